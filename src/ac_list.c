@@ -27,6 +27,7 @@
 #include "remote.h"
 #include "resolve.h"
 #include "build.h"
+#include "watch.h"
 
 
 /** \file
@@ -64,6 +65,7 @@ static const char
 			*acl_diff[]   = { "diff", NULL },
 			*acl_help[]   = { "help", "?", NULL },
 			*acl_info[]   = { "info", NULL },
+			*acl_watch[]  = { "watch", NULL },
 			/** \todo: remove initialize */
 			*acl_urls[]   = { "urls", "initialize", NULL };
 
@@ -92,13 +94,15 @@ static const char
 #define DIR_UPD .do_update_dir=1
 /** Action doesn't write into WAA, may be used by unprivileged user */
 #define RO .is_readonly=1
+/** Only the given paths get looked at, so their subtrees are enough */
+#define PARTIAL .partial_load=1
 
 
 /** -. */
 struct actionlist_t action_list[]=
 {
 	/* The first action is the default. */
-	ACT(status,   st__work,   st__action, FILTER, STS_WRITE, DIR_UPD, RO),
+	ACT(status,   st__work,   st__action, FILTER, STS_WRITE, DIR_UPD, RO, PARTIAL),
 	ACT(commit,   ci__work,   ci__action, UNINIT, FILTER, DIR_UPD),
 	ACT(update,   up__work, st__progress, UNINIT, DECODER),
 	ACT(export,  exp__work,         NULL, .is_import_export=1, DECODER),
@@ -120,10 +124,11 @@ struct actionlist_t action_list[]=
 	ACT(checko,   co__work,         NULL, DECODER, .repos_feedback=st__rm_status),
 	ACT( build,  bld__work,   st__status, DIR_UPD),
 	ACT( delay,delay__work,   st__status, RO),
+	ACT( watch, wch__work,         NULL, DIR_UPD),
 	/* For help we set import_export, to avoid needing a WAA 
 	 * (default /var/spool/fsvs) to exist. */
 	ACT(  help,  ac__Usage,         NULL, .is_import_export=1, RO),
-	ACT(  info, info__work, info__action, RO),
+	ACT(  info, info__work, info__action, RO, PARTIAL),
 	ACT(prop_g,prp__g_work,         NULL, RO),
 	ACT(prop_s,prp__s_work,         NULL, .i_val=FS_NEW),
 	ACT(prop_d,prp__s_work,         NULL, .i_val=FS_REMOVED),
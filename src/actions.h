@@ -128,6 +128,9 @@ struct actionlist_t
 	int do_update_dir:1;
 	/** Says that this is a read-only operation (like "status"). */
 	int is_readonly:1;
+	/** Whether only the subtrees of the given paths need to be loaded; 
+	 * see waa__input_tree(). */
+	int partial_load:1;
 };
 
 
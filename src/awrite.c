@@ -0,0 +1,559 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <apr_pools.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "global.h"
+#include "helper.h"
+#include "options.h"
+#include "awrite.h"
+
+
+/** \file
+ * Asynchronous file writer.
+ *
+ * On \ref checkout, \ref export and \ref update the file data arrives in
+ * delta windows from the repository; writing each window synchronously
+ * means that we alternate between waiting for the network and waiting for
+ * the disk.
+ *
+ * So the (already decoded) data is collected into chunks here, and these
+ * get written by a small pool of writer threads (see \ref
+ * o_write_threads); as every chunk knows its file offset, the threads
+ * can use \c pwrite(), and need not care about ordering.
+ *
+ * The number of queued chunks is bounded, so that a slow disk stops the
+ * network side instead of using up all memory.
+ *
+ * If \c fallocate() is available the file space is reserved in growing
+ * extents, to keep big files unfragmented. The subversion editor
+ * interface doesn't tell us the file size in advance, so the reservation 
+ * may go beyond the end of the data; as we write to a temporary file, it 
+ * doesn't matter that this changes the file size, and on close the file 
+ * is truncated to the real length, which gives the rest back.
+ *
+ * Blocks that contain only zeroes are not written, so that sparse files 
+ * stay sparse (see \ref o_sparse_files); if space has already been 
+ * reserved there, it's given back with \c FALLOC_FL_PUNCH_HOLE.
+ * The reservation is done in the main thread, before the chunk is 
+ * queued; so the writers know whether they need to punch a hole.
+ *
+ * The writer threads never call into APR or subversion; they only do
+ * \c pwrite(), and touch the fields documented as protected by the
+ * mutex.
+ * */
+
+
+/** How many bytes are collected before a chunk gets queued. */
+#define AW___CHUNK_SIZE (256*1024)
+/** How many chunks may be queued per writer thread. */
+#define AW___QUEUE_PER_THREAD (4)
+/** Granularity for zero block detection, ie. the smallest hole that gets 
+ * created. */
+#define AW___HOLE_BLOCK (4096)
+/** Upper limit for the number of writer threads. */
+#define AW___MAX_THREADS (16)
+/** The first preallocation extent; it gets doubled each time, up to \ref
+ * AW___PREALLOC_MAX. */
+#define AW___PREALLOC_MIN (1024*1024)
+/** Maximum preallocation extent. */
+#define AW___PREALLOC_MAX (64*1024*1024)
+
+
+struct aw___file_t;
+
+/** A block of data, to be written at a specific file offset. */
+struct aw___chunk_t {
+	/** Next chunk in the queue, or in the free list. */
+	struct aw___chunk_t *next;
+	/** The file this goes to. */
+	struct aw___file_t *file;
+	/** Where in the file. */
+	off_t offset;
+	/** Number of valid bytes in \c data. */
+	size_t len;
+	/** Whether space is reserved for (parts of) this chunk. */
+	int reserved;
+	/** The data. */
+	char data[AW___CHUNK_SIZE];
+};
+
+
+/** Per-file data. */
+struct aw___file_t {
+	/** Name of the file, for error messages. */
+	char *filename;
+	/** The file descriptor, or \c -1 if already closed. */
+	int fd;
+	/** How many chunks are queued or being written. Protected by the
+	 * mutex. */
+	int pending;
+	/** The first error that happened on writing. Protected by the mutex. */
+	int error;
+	/** How many bytes have been given to the writers. */
+	off_t queued;
+	/** Up to where space has been reserved. */
+	off_t allocated;
+	/** The chunk that is currently being filled. */
+	struct aw___chunk_t *chunk;
+};
+
+
+/** Number of writer threads; \c 0 means synchronous writes, \c -1 that
+ * they haven't been started yet. */
+static int aw___threads=-1;
+/** Whether zero blocks should become holes. */
+static int aw___sparse;
+/** Unused chunks. */
+static struct aw___chunk_t *aw___free;
+
+#ifdef HAVE_PTHREAD
+/** The mutex for the queue, the free list, and the shared file fields. */
+static pthread_mutex_t aw___mutex=PTHREAD_MUTEX_INITIALIZER;
+/** Signalled when a chunk gets queued. */
+static pthread_cond_t aw___work=PTHREAD_COND_INITIALIZER;
+/** Signalled when a chunk is finished. */
+static pthread_cond_t aw___done=PTHREAD_COND_INITIALIZER;
+/** The queue. */
+static struct aw___chunk_t *aw___head, **aw___tail=&aw___head;
+/** Number of chunks in the queue or being written. */
+static int aw___queued;
+
+#define AW___LOCK() pthread_mutex_lock(&aw___mutex)
+#define AW___UNLOCK() pthread_mutex_unlock(&aw___mutex)
+#else
+#define AW___LOCK() do { } while (0)
+#define AW___UNLOCK() do { } while (0)
+#endif
+
+
+/** Returns whether the \a len bytes at \a data are all zero. */
+static inline int aw___is_zero(const char *data, size_t len)
+{
+	return !data[0] && memcmp(data, data+1, len-1) == 0;
+}
+
+
+/** Reserves file space for \a chunk, in growing extents.
+ * Chunks that will become a hole get no reservation. */
+static void aw___reserve(struct aw___chunk_t *chunk)
+{
+	struct aw___file_t *file=chunk->file;
+#if defined(HAVE_FALLOCATE)
+	off_t start, len, end;
+
+	end=chunk->offset + chunk->len;
+	if (end > file->allocated &&
+			!(aw___sparse && aw___is_zero(chunk->data, chunk->len)))
+	{
+		start=file->allocated;
+		if (start < chunk->offset)
+			start=chunk->offset;
+
+		len=start ? start : AW___PREALLOC_MIN;
+		if (len > AW___PREALLOC_MAX)
+			len=AW___PREALLOC_MAX;
+		if (start + len < end)
+			len=end - start;
+
+		/* Not supported by every filesystem; that's no reason to stop. */
+		if (fallocate(file->fd, 0, start, len) == 0)
+			file->allocated=start + len;
+	}
+#endif
+
+	chunk->reserved= chunk->offset < file->allocated;
+}
+
+
+/** Writes the data of \a chunk; zero blocks are skipped, or punched out 
+ * of the reserved space.
+ * Returns an \c errno value. */
+static int aw___write_chunk(struct aw___chunk_t *chunk)
+{
+	struct aw___file_t *file=chunk->file;
+	char *cp;
+	size_t len, run, n;
+	off_t pos;
+	ssize_t done;
+	int zero;
+
+	cp=chunk->data;
+	len=chunk->len;
+	pos=chunk->offset;
+	while (len)
+	{
+		/* Find a run of blocks that are all zero, or all not zero. */
+		run=AW___HOLE_BLOCK - (pos % AW___HOLE_BLOCK);
+		if (run > len) run=len;
+		zero=aw___sparse && aw___is_zero(cp, run);
+		while (run < len)
+		{
+			n=len-run;
+			if (n > AW___HOLE_BLOCK) n=AW___HOLE_BLOCK;
+			if ((aw___sparse && aw___is_zero(cp+run, n)) != zero) break;
+			run+=n;
+		}
+
+		if (zero)
+		{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+			/* The file is new, so unwritten space reads as zeroes anyway; 
+			 * this only gives back reserved blocks. */
+			if (chunk->reserved)
+				fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+						pos, run);
+#endif
+		}
+		else
+		{
+			for(n=0; n<run; )
+			{
+				done=pwrite(file->fd, cp+n, run-n, pos+n);
+				if (done == -1)
+				{
+					if (errno == EINTR) continue;
+					return errno;
+				}
+				n+=done;
+			}
+		}
+
+		cp+=run;
+		pos+=run;
+		len-=run;
+	}
+
+	return 0;
+}
+
+
+#ifdef HAVE_PTHREAD
+/** The writer thread.
+ * Takes chunks from the queue, writes them, and puts them into the free
+ * list. */
+static void *aw___thread(void *arg UNUSED)
+{
+	struct aw___chunk_t *chunk;
+	struct aw___file_t *file;
+	int status;
+
+	AW___LOCK();
+	while (1)
+	{
+		while (!aw___head)
+			pthread_cond_wait(&aw___work, &aw___mutex);
+
+		chunk=aw___head;
+		aw___head=chunk->next;
+		if (!aw___head) aw___tail=&aw___head;
+		file=chunk->file;
+
+		/* After an error the rest of the file is not needed anymore. */
+		status=file->error;
+		AW___UNLOCK();
+
+		if (!status)
+			status=aw___write_chunk(chunk);
+
+		AW___LOCK();
+		if (status && !file->error)
+			file->error=status;
+		file->pending--;
+		aw___queued--;
+
+		chunk->next=aw___free;
+		aw___free=chunk;
+
+		pthread_cond_broadcast(&aw___done);
+	}
+
+	return NULL;
+}
+#endif
+
+
+/** Starts the writer threads, as configured.
+ * If they can't be started, the files are written synchronously. */
+static void aw___start(void)
+{
+#ifdef HAVE_PTHREAD
+	int count;
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t all, old;
+#endif
+
+	aw___threads=0;
+	aw___sparse=opt__get_int(OPT__SPARSE_FILES);
+#ifdef HAVE_PTHREAD
+	count=opt__get_int(OPT__WRITE_THREADS);
+	if (count > AW___MAX_THREADS) count=AW___MAX_THREADS;
+	if (count <= 0 || pthread_attr_init(&attr)) goto ex;
+
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* Signals should be handled in the main thread only; the threads
+	 * inherit the blocked mask. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	while (aw___threads < count &&
+			pthread_create(&thread, &attr, aw___thread, NULL) == 0)
+		aw___threads++;
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+
+ex:
+#endif
+	DEBUGP("%d writer threads", aw___threads);
+}
+
+
+/** Gets an empty chunk. */
+static int aw___get_chunk(struct aw___chunk_t **chunk)
+{
+	int status;
+	struct aw___chunk_t *ch;
+
+	status=0;
+	AW___LOCK();
+	ch=aw___free;
+	if (ch) aw___free=ch->next;
+	AW___UNLOCK();
+
+	if (!ch)
+		STOPIF( hlp__alloc( &ch, sizeof(*ch)), NULL);
+
+	ch->len=0;
+	*chunk=ch;
+
+ex:
+	return status;
+}
+
+
+/** Puts \a chunk back into the free list. */
+static void aw___put_chunk(struct aw___chunk_t *chunk)
+{
+	AW___LOCK();
+	chunk->next=aw___free;
+	aw___free=chunk;
+	AW___UNLOCK();
+}
+
+
+/** Hands the current chunk of \a file to the writers, or writes it
+ * directly.
+ * Returns an earlier error of this file, if there was one. */
+static int aw___submit(struct aw___file_t *file)
+{
+	int status;
+	struct aw___chunk_t *chunk;
+
+	chunk=file->chunk;
+	file->chunk=NULL;
+
+	chunk->file=file;
+	chunk->offset=file->queued;
+	file->queued += chunk->len;
+	aw___reserve(chunk);
+
+	if (aw___threads == 0)
+	{
+		status=aw___write_chunk(chunk);
+		if (status && !file->error)
+			file->error=status;
+		aw___put_chunk(chunk);
+		return file->error;
+	}
+
+#ifdef HAVE_PTHREAD
+	AW___LOCK();
+	while (aw___queued >= aw___threads*AW___QUEUE_PER_THREAD)
+		pthread_cond_wait(&aw___done, &aw___mutex);
+
+	status=file->error;
+	if (status)
+	{
+		chunk->next=aw___free;
+		aw___free=chunk;
+	}
+	else
+	{
+		chunk->next=NULL;
+		*aw___tail=chunk;
+		aw___tail=&chunk->next;
+
+		file->pending++;
+		aw___queued++;
+		pthread_cond_signal(&aw___work);
+	}
+	AW___UNLOCK();
+#endif
+
+	return status;
+}
+
+
+/** Writes the remaining data of \a file, waits for the writers, and
+ * closes the file. */
+static int aw___close_file(struct aw___file_t *file)
+{
+	int status;
+
+	status=0;
+	if (file->fd == -1) goto ex;
+
+	if (file->chunk)
+	{
+		if (file->chunk->len)
+			aw___submit(file);
+		else
+		{
+			aw___put_chunk(file->chunk);
+			file->chunk=NULL;
+		}
+	}
+
+	AW___LOCK();
+#ifdef HAVE_PTHREAD
+	while (file->pending)
+		pthread_cond_wait(&aw___done, &aw___mutex);
+#endif
+	status=file->error;
+
+	/* Set the file size, in case it ends in a hole, and give back the 
+	 * space that was reserved but not used. */
+	if (!status)
+		if (ftruncate(file->fd, file->queued) == -1)
+			status=errno;
+	AW___UNLOCK();
+
+	if (close(file->fd) == -1 && !status)
+		status=errno;
+	file->fd=-1;
+
+	STOPIF( status, "Writing to \"%s\"", file->filename);
+
+ex:
+	return status;
+}
+
+
+/** The \c svn_stream_t write handler. */
+static svn_error_t *aw___write(void *baton,
+		const char *data, apr_size_t *len)
+{
+	struct aw___file_t *file=baton;
+	int status;
+	apr_size_t left, n;
+
+	status=0;
+	left=*len;
+	while (left)
+	{
+		if (!file->chunk)
+			STOPIF( aw___get_chunk(&file->chunk), NULL);
+
+		n=AW___CHUNK_SIZE - file->chunk->len;
+		if (n > left) n=left;
+
+		memcpy(file->chunk->data + file->chunk->len, data, n);
+		file->chunk->len += n;
+		data += n;
+		left -= n;
+
+		if (file->chunk->len == AW___CHUNK_SIZE)
+			STOPIF( aw___submit(file),
+					"Writing to \"%s\"", file->filename);
+	}
+
+ex:
+	RETURN_SVNERR(status);
+}
+
+
+/** The \c svn_stream_t close handler. */
+static svn_error_t *aw___close(void *baton)
+{
+	int status;
+
+	STOPIF( aw___close_file(baton), NULL);
+
+ex:
+	RETURN_SVNERR(status);
+}
+
+
+/** Pool cleanup; for streams that don't get closed, eg. because of an
+ * error. */
+static apr_status_t aw___cleanup(void *baton)
+{
+	struct aw___file_t *file=baton;
+
+	if (file->fd != -1)
+		aw___close_file(file);
+
+	IF_FREE(file->filename);
+	free(file);
+	return APR_SUCCESS;
+}
+
+
+/** -.
+ * The file is created with mode \c 0600; the real meta-data gets set
+ * later. */
+int aw__open(const char *filename, apr_pool_t *pool,
+		svn_stream_t **stream)
+{
+	int status;
+	struct aw___file_t *file;
+	svn_stream_t *new_str;
+
+	file=NULL;
+	if (aw___threads == -1)
+		aw___start();
+
+	STOPIF( hlp__calloc( &file, 1, sizeof(*file)), NULL);
+	file->fd=-1;
+	file->filename=strdup(filename);
+	STOPIF_ENOMEM( !file->filename );
+
+	file->fd=open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	STOPIF_CODE_ERR( file->fd == -1, errno,
+			"Cannot open \"%s\" for writing", filename);
+
+	new_str=svn_stream_create(file, pool);
+	STOPIF_ENOMEM( !new_str );
+
+	svn_stream_set_write(new_str, aw___write);
+	svn_stream_set_close(new_str, aw___close);
+
+	apr_pool_cleanup_register(pool, file,
+			aw___cleanup, apr_pool_cleanup_null);
+	file=NULL;
+
+	*stream=new_str;
+
+ex:
+	if (file)
+	{
+		if (file->fd != -1) close(file->fd);
+		IF_FREE(file->filename);
+		free(file);
+	}
+	return status;
+}
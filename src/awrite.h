@@ -0,0 +1,26 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __AWRITE_H__
+#define __AWRITE_H__
+
+#include <subversion-1/svn_io.h>
+
+/** \file
+ * Asynchronous file writer header file. */
+
+
+/** Opens \a filename for writing, and returns a stream in \a stream that
+ * hands the data to the writer threads.
+ *
+ * Closing the stream waits until all data has been written, and closes
+ * the file; if it isn't closed, that's done when \a pool gets cleared. */
+int aw__open(const char *filename, apr_pool_t *pool,
+		svn_stream_t **stream);
+
+#endif
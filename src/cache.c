@@ -26,11 +26,10 @@
  * from some function and using it, knowing that it's valid for a few more 
  * calls of the same function, eases life tremendously.
  *
- * \todo Convert the other caches. 
+ * For key/value lookups (like user and group names) there's a hashed 
+ * cache, see \ref hcache_t.
  *
- * \todo Let the \c apr_uid_get() calls from \c update.c go into that -
- * but they need a hash or something like that. Maybe reverse the test and 
- * look whether the number (eg. uid) matches the string (username)?
+ * \todo Convert the other caches. 
  * */
 
 
@@ -205,83 +204,220 @@ void cch__set_active(struct cache_t *cache, int i)
 	}
 }
 
-/** A simple hash.
- * Copies the significant bits ' ' .. 'Z' (or, really, \\x20 ..  \\x60) of 
- * at most 6 bytes of \a stg into a packed bitfield, so that 30bits are 
- * used.  */
-cache_value_t cch___string_to_cv(const char *stg)
+/** Hash function for the keys (FNV-1a). */
+static uint32_t cch___hash(const void *key, int len)
 {
-  union {
-	  cache_value_t cv;
-		struct {
-			unsigned int c0:5;
-			unsigned int c1:5;
-			unsigned int c2:5;
-			unsigned int c3:5;
-			unsigned int c4:5;
-			unsigned int c5:5;
-			unsigned int ignore_me:2;
-		};
-	} __attribute__((packed)) result;
-
-	result.cv=0;
-	if (*stg) 
-	{ result.c0 = *(stg++) - 0x20;
-		if (*stg) 
-		{ result.c1 = *(stg++) - 0x20;
-			if (*stg) 
-			{ result.c2 = *(stg++) - 0x20;
-				if (*stg) 
-				{ result.c3 = *(stg++) - 0x20;
-					if (*stg) 
-					{ result.c4 = *(stg++) - 0x20;
-						if (*stg) 
-						{ result.c5 = *(stg++) - 0x20;
-						} } } } } }
-
-	return result.cv;
+	const unsigned char *cp=key;
+	uint32_t hash;
+
+	hash=2166136261u;
+	while (len--)
+	{
+		hash ^= *(cp++);
+		hash *= 16777619u;
+	}
+
+	return hash;
 }
 
 
-/** -.
- * */
-int cch__hash_find(struct cache_t *cache, const char *key, cache_value_t *data)
+/** Returns the table slot of \a key, or \c -1.  */
+static int cch___hash_slot(struct hcache_t *cache,
+		const void *key, int key_len, uint32_t hash)
 {
-	int status;
-	cache_value_t id;
-	int i;
+	unsigned slot;
+	struct hcache_entry_t *e;
+
+	for(slot=hash & cache->mask; 
+			cache->table[slot] != -1;
+			slot=(slot+1) & cache->mask)
+	{
+		e=cache->entries + cache->table[slot];
+		if (e->hash == hash && e->key_len == key_len &&
+				memcmp(e->key, key, key_len) == 0)
+			return slot;
+	}
+
+	return -1;
+}
 
-	id=cch___string_to_cv(key);
 
-	DEBUGP("looking for %lX = %s", id, key);
-	if (cch__find(cache, id, &i, NULL, NULL) == 0 && 
-			strcmp(key, cache->entries[i]->data) == 0)
+/** Removes the entry in \a slot from the table.
+ *
+ * Following entries of the same probe sequence are shifted back, so that 
+ * no tombstones are needed. */
+static void cch___hash_remove(struct hcache_t *cache, unsigned slot)
+{
+	unsigned i, j, home;
+
+	i=j=slot;
+	while (1)
 	{
-		*data = cache->entries[i]->hash_data;
-		DEBUGP("found %s=%ld", key, *data);
-		status=0;
+		j=(j+1) & cache->mask;
+		if (cache->table[j] == -1) break;
+
+		home=cache->entries[ cache->table[j] ].hash & cache->mask;
+		/* The entry at j may only be moved to i if its home slot is not 
+		 * (cyclically) in <tt>(i, j]</tt>. */
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+		{
+			cache->table[i]=cache->table[j];
+			i=j;
+		}
 	}
-	else
-		status=ENOENT;
 
-	return status;
+	cache->table[i]=-1;
+}
+
+
+/** Takes the entry \a i out of the LRU list. */
+static void cch___lru_unlink(struct hcache_t *cache, int i)
+{
+	struct hcache_entry_t *e=cache->entries+i;
+
+	if (e->newer == -1) cache->newest=e->older;
+	else cache->entries[e->newer].older=e->older;
+
+	if (e->older == -1) cache->oldest=e->newer;
+	else cache->entries[e->older].newer=e->newer;
+}
+
+
+/** Puts the entry \a i at the head of the LRU list. */
+static void cch___lru_push(struct hcache_t *cache, int i)
+{
+	struct hcache_entry_t *e=cache->entries+i;
+
+	e->newer=-1;
+	e->older=cache->newest;
+	if (cache->newest != -1)
+		cache->entries[cache->newest].newer=i;
+	cache->newest=i;
+	if (cache->oldest == -1)
+		cache->oldest=i;
 }
 
 
 /** -.
- * */
-int cch__hash_add(struct cache_t *cache, const char *key, cache_value_t value)
+ * The table has at least twice as many slots as there may be entries, so 
+ * that the probe sequences stay short. */
+int cch__hash_new(struct hcache_t **cache, int max)
 {
 	int status;
-	cache_value_t id;
+	unsigned size;
+	struct hcache_t *c;
+
+	status=0;
+	if (*cache) goto ex;
+
+	for(size=4; size < 2*(unsigned)max; size<<=1) ;
 
+	STOPIF( hlp__calloc( &c, 1, sizeof(*c)), NULL);
+	STOPIF( hlp__calloc( &c->entries, max, sizeof(*c->entries)), NULL);
+	STOPIF( hlp__alloc( &c->table, size * sizeof(*c->table)), NULL);
+	memset(c->table, -1, size * sizeof(*c->table));
 
-	id=cch___string_to_cv(key);
-	STOPIF( cch__add(cache, id, key, strlen(key), NULL), NULL);
-	cache->entries[ cache->lru ]->hash_data = value;
+	c->max=max;
+	c->mask=size-1;
+	c->newest=c->oldest=-1;
+	*cache=c;
 
 ex:
 	return status;
 }
 
 
+/** -.
+ * For \a key_len \c ==-1 \c strlen() is used.
+ *
+ * A found entry becomes the most recently used one. */
+int cch__hash_find(struct hcache_t *cache, 
+		const void *key, int key_len,
+		cache_value_t *value, char **data)
+{
+	int slot, i;
+	struct hcache_entry_t *e;
+
+	if (key_len == -1) key_len=strlen(key);
+
+	slot=cch___hash_slot(cache, key, key_len, cch___hash(key, key_len));
+	if (slot == -1) return ENOENT;
+
+	i=cache->table[slot];
+	e=cache->entries+i;
+	if (cache->newest != i)
+	{
+		cch___lru_unlink(cache, i);
+		cch___lru_push(cache, i);
+	}
+
+	if (value) *value=e->value;
+	if (data) *data=e->data;
+	return 0;
+}
+
+
+/** -.
+ * For \a key_len \c ==-1 \c strlen() is used; \a data may be \c NULL, 
+ * then an empty string is stored.
+ *
+ * An existing entry for \a key is overwritten; if the cache is full, the 
+ * least recently used entry is discarded. */
+int cch__hash_add(struct hcache_t *cache, 
+		const void *key, int key_len,
+		cache_value_t value, const char *data, 
+		char **copy)
+{
+	int status, slot, i, data_len;
+	uint32_t hash;
+	struct hcache_entry_t *e;
+
+	status=0;
+	if (key_len == -1) key_len=strlen(key);
+	if (!data) data="";
+	data_len=strlen(data);
+
+	hash=cch___hash(key, key_len);
+	slot=cch___hash_slot(cache, key, key_len, hash);
+	if (slot != -1)
+	{
+		i=cache->table[slot];
+		cch___lru_unlink(cache, i);
+	}
+	else
+	{
+		if (cache->used < cache->max)
+			i=cache->used++;
+		else
+		{
+			i=cache->oldest;
+			cch___lru_unlink(cache, i);
+			e=cache->entries+i;
+			cch___hash_remove(cache, 
+					cch___hash_slot(cache, e->key, e->key_len, e->hash));
+		}
+
+		for(slot=hash & cache->mask; 
+				cache->table[slot] != -1;
+				slot=(slot+1) & cache->mask) ;
+		cache->table[slot]=i;
+	}
+
+	e=cache->entries+i;
+	cch___lru_push(cache, i);
+
+	STOPIF( hlp__realloc( &e->key, key_len + 1 + data_len + 1), NULL);
+	memcpy(e->key, key, key_len);
+	e->key[key_len]=0;
+	e->data=e->key + key_len + 1;
+	memcpy(e->data, data, data_len+1);
+
+	e->hash=hash;
+	e->key_len=key_len;
+	e->value=value;
+
+	if (copy) *copy=e->data;
+
+ex:
+	return status;
+}
@@ -26,8 +26,6 @@ typedef long cache_value_t;
 struct cache_entry_t {
 	/** ID of entry */
 	cache_value_t id;
-	/** User-data for hashes */
-	cache_value_t hash_data;
 	/** Length of data */
 	int len;
 #if 0
@@ -157,14 +155,58 @@ ex:
 }
 
 
-/** Interpret the \a cache as a hash, look for the \a key, returning the 
- * \ref cache_entry_t::hash_data or \c ENOENT. */
-int cch__hash_find(struct cache_t *cache, 
-		const char *key, cache_value_t *data);
-/** Interpret the \a cache as a hash and store the given \a value to the \a 
- * key. */
-int cch__hash_add(struct cache_t *cache, 
-		const char *key, cache_value_t value);
+/** \name Hashed caches
+ *
+ * A size-bounded key/value cache, using open addressing on a full hash of 
+ * the key; when it's full, the least recently used entry gets replaced.
+ * @{ */
+/** An entry of a \ref hcache_t. */
+struct hcache_entry_t {
+	/** Hash value of the key. */
+	uint32_t hash;
+	/** Length of the key. */
+	int key_len;
+	/** Neighbours in the LRU list (entry indizes); \c -1 at the ends. */
+	int newer, older;
+	/** Numeric value. */
+	cache_value_t value;
+	/** Key, followed by the string data; one allocation. */
+	char *key;
+	/** String value, points behind the key. */
+	char *data;
+};
+
+/** A hashed cache. */
+struct hcache_t {
+	/** How many entries may be stored. */
+	int max;
+	/** How many entries are used. */
+	int used;
+	/** Size of \c table minus 1; the size is a power of 2. */
+	unsigned mask;
+	/** Most and least recently used entry; \c -1 if empty. */
+	int newest, oldest;
+	/** The hash table, giving indizes into \c entries, or \c -1 for an 
+	 * empty slot. */
+	int *table;
+	/** The entries. */
+	struct hcache_entry_t *entries;
+};
+
+/** Allocates a hashed \a cache for \a max entries, if \c *cache is \c 
+ * NULL. */
+int cch__hash_new(struct hcache_t **cache, int max);
+/** Looks for \a key in the \a cache; returns the stored \a value and \a 
+ * data, or \c ENOENT. */
+int cch__hash_find(struct hcache_t *cache, 
+		const void *key, int key_len,
+		cache_value_t *value, char **data);
+/** Stores \a value and a copy of \a data for the \a key. */
+int cch__hash_add(struct hcache_t *cache, 
+		const void *key, int key_len,
+		cache_value_t value, const char *data, 
+		char **copy);
+/** @} */
 
 #endif
 
@@ -14,6 +14,7 @@
 
 #include "url.h"
 #include "waa.h"
+#include "est_ops.h"
 #include "helper.h"
 #include "commit.h"
 #include "export.h"
@@ -109,7 +110,8 @@ int co__work(struct estat *root, int argc, char *argv[])
 				"!Cannot use the directory \"%s\";\nmaybe you meant to give an URL?", path);
 
 
-	root->arg=path ? path : ".";
+	STOPIF( ops__make_cold(root), NULL);
+	root->cold->arg=path ? path : ".";
 
 	STOPIF( waa__save_cwd( &path, NULL, 0), NULL);
 	STOPIF( waa__create_working_copy(path), NULL);
@@ -17,6 +17,10 @@
 #include "global.h"
 #include "est_ops.h"
 #include "waa.h"
+#include "perf.h"
+#include "options.h"
+#include "chunks.h"
+#include "fprint.h"
 
 
 /** \file
@@ -24,6 +28,10 @@
 
 #define MAPSIZE (32*1024*1024)
 
+/** Holes in sparse files are hashed from a buffer of zeroes of this size, 
+ * instead of mapping them. */
+#define ZEROSIZE (1024*1024)
+
 
 
 /** CRC table.
@@ -58,6 +66,13 @@ struct t_manber_data
 
 	/** The file descriptor where the manber-block-MD5s will be written to. */
 	int manber_fd;
+	/** The key of the file in the \ref chnk index. */
+	uint32_t chunk_file;
+
+	/** Whether a \ref fprt fingerprint is calculated. */
+	int do_fprint;
+	/** The fingerprint state. */
+	struct fp__state_t fprint;
 
 
 	/** The internal manber-state. */
@@ -311,6 +326,12 @@ int cs__compare_file(struct estat *sts, char *fullpath, int *result)
 	struct sstat_t actual;
 	md5_digest_t old_md5 = { 0 };
 	static struct t_manber_data mb_dat;
+	/* Not const, so that it's in the BSS and costs no disk space. */
+	static unsigned char zeroes[ZEROSIZE];
+	off_t next;
+	long pagesize;
+	struct timespec started;
+	int fp_changed;
 
 
 	/* Default is "don't know". */
@@ -328,6 +349,7 @@ int cs__compare_file(struct estat *sts, char *fullpath, int *result)
 	}
 
 	status=0;
+	PRF__SPAN_START(started);
 
 	if (!fullpath)
 		STOPIF( ops__build_path(&fullpath, sts), NULL);
@@ -344,6 +366,23 @@ int cs__compare_file(struct estat *sts, char *fullpath, int *result)
 
 	if (S_ISREG(actual.mode))
 	{
+		/* A big file with a fingerprint needn't be MD5ed. 
+		 * The MD5 is left alone; we don't know the new one, and the old one 
+		 * is still that of the repository. */
+		if (opt__get_int(OPT__FINGERPRINT) != FINGERPRINT_NO &&
+				actual.size >= CS__MIN_FILE_SIZE)
+		{
+			status=fp__compare(sts, fullpath, actual.size, &fp_changed);
+			if (!status)
+			{
+				PRF__COUNT(PRF__C_FINGERPRINTS, 1);
+				sts->change_flag = fp_changed ? CF_CHANGED : CF_NOTCHANGED;
+				goto flag_set;
+			}
+			if (status != ENOENT) STOPIF(status, NULL);
+			status=0;
+		}
+
 		do_manber=1;
 		/* Open the file and read the stream from there, comparing the blocks
 		 * as necessary.
@@ -363,6 +402,15 @@ int cs__compare_file(struct estat *sts, char *fullpath, int *result)
 
 		hash_pos=0;
 		STOPIF( cs___manber_data_init(&mb_dat, sts), NULL );
+		/* If there was no usable fingerprint, and we may write to the WAA, 
+		 * we make one now; it's stored if the file is unchanged. */
+		if (opt__get_int(OPT__FINGERPRINT) != FINGERPRINT_NO &&
+				actual.size >= CS__MIN_FILE_SIZE &&
+				!action->is_readonly)
+		{
+			mb_dat.do_fprint=1;
+			fp__init(&mb_dat.fprint);
+		}
 
 		/* We map windows of the file into main memory. Never more than 256MB. */
 		current_pos=0;
@@ -388,22 +436,67 @@ int cs__compare_file(struct estat *sts, char *fullpath, int *result)
 		}
 
 		status=0;
+		pagesize=sysconf(_SC_PAGESIZE);
 		while (current_pos < actual.size)
 		{
 			if (actual.size-current_pos < MAPSIZE)
 				length_mapped=actual.size-current_pos;
 			else
 				length_mapped=MAPSIZE;
-			DEBUGP("mapping %u bytes from %llu", 
-					length_mapped, (t_ull)current_pos); 
 
-			filedata=mmap(NULL, length_mapped, 
-					PROT_READ, MAP_SHARED, 
-					fh, current_pos);
-			STOPIF_CODE_ERR( filedata == MAP_FAILED, errno,
-					"comparing the file %s failed (mmap)",
-					fullpath);
+			filedata=NULL;
+#ifdef SEEK_DATA
+			/* Holes in sparse files needn't be read; they're zeroes. 
+			 * The boundaries are rounded to pages, so that current_pos stays 
+			 * usable as mmap() offset.
+			 * If the filesystem doesn't know about holes, we simply get 
+			 * current_pos back. */
+			next=lseek(fh, current_pos, SEEK_DATA);
+			if (next == -1 && errno == ENXIO)
+				next=actual.size;
+			else if (next != -1)
+				next -= next % pagesize;
+
+			if (next > current_pos)
+			{
+				if (next-current_pos < length_mapped)
+					length_mapped=next-current_pos;
+				if (length_mapped > ZEROSIZE)
+					length_mapped=ZEROSIZE;
+
+				DEBUGP("hole of %u bytes at %llu", 
+						length_mapped, (t_ull)current_pos); 
+				filedata=zeroes;
+			}
+			else
+			{
+				next=lseek(fh, current_pos, SEEK_HOLE);
+				if (next != -1)
+				{
+					next += pagesize-1;
+					next -= next % pagesize;
+					if (next > current_pos && next-current_pos < length_mapped)
+						length_mapped=next-current_pos;
+				}
+			}
+#endif
+
+			if (!filedata)
+			{
+				DEBUGP("mapping %u bytes from %llu", 
+						length_mapped, (t_ull)current_pos); 
+
+				filedata=mmap(NULL, length_mapped, 
+						PROT_READ, MAP_SHARED, 
+						fh, current_pos);
+				STOPIF_CODE_ERR( filedata == MAP_FAILED, errno,
+						"comparing the file %s failed (mmap)",
+						fullpath);
+			}
 
+			PRF__COUNT(PRF__C_HASHED_BYTES, length_mapped);
+			if (mb_dat.do_fprint)
+				fp__update(&mb_dat.fprint, filedata, length_mapped);
 			map_pos=0;
 			while (map_pos<length_mapped)
 			{
@@ -456,14 +549,20 @@ changed:
 				map_pos+=i;
 			}
 
-			STOPIF_CODE_ERR( munmap((void*)filedata, length_mapped) == -1,
-					errno, "unmapping of file failed");
+			if (filedata != zeroes)
+				STOPIF_CODE_ERR( munmap((void*)filedata, length_mapped) == -1,
+						errno, "unmapping of file failed");
 			current_pos+=length_mapped;
 
 			if (i==-2) break;
 		}
 
 		STOPIF( cs___finish_manber( &mb_dat), NULL);
+
+		if (mb_dat.do_fprint && 
+				memcmp(old_md5, sts->md5, sizeof(sts->md5)) == 0)
+			STOPIF( fp__store(sts, &mb_dat.fprint, sts->md5, actual.size), 
+					NULL);
 	}
 	else if (S_ISLNK(sts->st.mode))
 	{
@@ -478,7 +577,9 @@ changed:
 
 	sts->change_flag = memcmp(old_md5, sts->md5, sizeof(sts->md5)) == 0 ?
 		CF_NOTCHANGED : CF_CHANGED;
+flag_set:
 	DEBUGP("change flag for %s set to %d", fullpath, sts->change_flag);
+	PRF__SPAN_END(started, "hash", fullpath);
 
 
 ret_result:
@@ -496,6 +597,122 @@ ex:
 }
 
 
+/** -.
+ * The borders are found just like in cs__compare_file(); the block MD5s
+ * are calculated, but not stored anywhere.
+ * A trailing partial block is counted, too. */
+int cs__manber_blocks(const unsigned char *data, size_t len,
+		unsigned *blocks)
+{
+	int status, i;
+	size_t pos, last_border;
+	unsigned length;
+	struct t_manber_data mb_dat;
+
+
+	STOPIF( cs___manber_data_init(&mb_dat, NULL), NULL );
+
+	*blocks=0;
+	pos=last_border=0;
+	while (pos<len)
+	{
+		length = len-pos < MAPSIZE ? len-pos : MAPSIZE;
+
+		STOPIF( cs___end_of_block(data+pos, length, &i, &mb_dat), NULL);
+
+		if (i == -1)
+		{
+			pos+=length;
+			continue;
+		}
+
+		(*blocks)++;
+		pos+=i;
+		last_border=pos;
+		STOPIF( cs___end_of_block(NULL, 0, NULL, &mb_dat), NULL );
+	}
+
+	if (last_border < len)
+		(*blocks)++;
+
+	STOPIF( cs___finish_manber( &mb_dat), NULL);
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * The borders are found just like in cs__compare_file(); as in the \ref 
+ * md5s files, a trailing partial block is not returned.
+ * \a data is filled like by cs__read_manber_hashes(), without the index. 
+ * */
+int cs__manber_hashes_of_file(char *fullpath, 
+		struct cs__manber_hashes *data)
+{
+	int status, i, fh;
+	ssize_t got, pos;
+	unsigned max;
+	struct t_manber_data mb_dat;
+	static unsigned char buffer[64*1024];
+
+
+	status=0;
+	memset(data, 0, sizeof(*data));
+	max=0;
+	fh=open(fullpath, O_RDONLY);
+	STOPIF_CODE_ERR( fh == -1, errno, "Cannot open %s", fullpath);
+
+	STOPIF( cs___manber_data_init(&mb_dat, NULL), NULL );
+
+	while (1)
+	{
+		got=read(fh, buffer, sizeof(buffer));
+		if (got == -1 && errno == EINTR) continue;
+		STOPIF_CODE_ERR( got == -1, errno, "Cannot read %s", fullpath);
+		if (!got) break;
+
+		pos=0;
+		while (pos < got)
+		{
+			STOPIF( cs___end_of_block(buffer+pos, got-pos, &i, &mb_dat), NULL);
+			if (i == -1) break;
+
+			if (data->count >= max)
+			{
+				max = max ? max*2 : 64;
+				STOPIF( hlp__realloc( &data->hash, max*sizeof(*data->hash)), NULL);
+				STOPIF( hlp__realloc( & data->md5, max*sizeof(* data->md5)), NULL);
+				STOPIF( hlp__realloc( & data->end, max*sizeof(* data->end)), NULL);
+			}
+
+			data->hash[data->count]=mb_dat.last_state;
+			data->end[data->count]=mb_dat.fpos;
+			memcpy(data->md5[data->count], mb_dat.block_md5, 
+					sizeof(data->md5[0]));
+			data->count++;
+
+			STOPIF( cs___end_of_block(NULL, 0, NULL, &mb_dat), NULL );
+			pos+=i;
+		}
+	}
+
+	STOPIF( cs___finish_manber( &mb_dat), NULL);
+	DEBUGP("%u blocks in %s", data->count, fullpath);
+
+ex:
+	if (status)
+	{
+		IF_FREE(data->hash);
+		IF_FREE(data->md5);
+		IF_FREE(data->end);
+	}
+
+	if (fh != -1) close(fh);
+	return status;
+}
+
+
 /** -.
  * If a file has been committed, this is where various checksum-related
  * uninitializations can happen. */
@@ -579,7 +796,7 @@ int cs___end_of_block(const unsigned char *data, int maxlen,
 	status=0;
 	if (!data)
 	{
-		DEBUGP("manber reinit");
+		DEBUGP_HOT("manber reinit");
 		mb_f->state=0;
 		mb_f->last_state=0;
 		mb_f->bktrk_bytes=0;
@@ -628,7 +845,7 @@ int cs___end_of_block(const unsigned char *data, int maxlen,
 		if (i < maxlen)
 		{
 			*eob=i;
-			DEBUGP("zero block border at %d", i);
+			DEBUGP_HOT("zero block border at %d", i);
 		}
 	}
 	else
@@ -659,7 +876,7 @@ int cs___end_of_block(const unsigned char *data, int maxlen,
 				*eob=i;
 				apr_md5_update(& mb_f->block_md5_ctx, data, i);
 				apr_md5_final( mb_f->block_md5, & mb_f->block_md5_ctx);
-				DEBUGP("manber found a border: %u %08X %08X %s", 
+				DEBUGP_HOT("manber found a border: %u %08X %08X %s", 
 						i, mb_f->last_state, mb_f->state, cs__md5tohex_buffered(mb_f->block_md5));
 				break;
 			}
@@ -675,7 +892,7 @@ int cs___end_of_block(const unsigned char *data, int maxlen,
 	mb_f->fpos += (*eob == -1) ? maxlen : *eob;
 
 ex:
-	DEBUGP("on return at fpos=%llu: %08X (databits=%2x)", 
+	DEBUGP_HOT("on return at fpos=%llu: %08X (databits=%2x)", 
 			(t_ull)mb_f->fpos, mb_f->state, mb_f->data_bits);
 	return status;
 }
@@ -694,6 +911,9 @@ int cs___update_manber(struct t_manber_data *mb_f,
 	char *filename;
 
 	status=0;
+	if (mb_f->do_fprint)
+		fp__update(&mb_f->fprint, data, len);
+
 	/* We tried to avoid doing this calculation for small files.
 	 *
 	 * But: this does not work.
@@ -753,11 +973,13 @@ int cs___update_manber(struct t_manber_data *mb_f,
 			STOPIF( ops__build_path(&filename, mb_f->sts), NULL);
 			STOPIF( waa__open_byext(filename, WAA__FILE_MD5s_EXT, WAA__WRITE,
 						&	cs___manber.manber_fd), NULL );
+			mb_f->chunk_file=ck__file_key(filename);
 			DEBUGP("now doing manber-hashing for %s...", filename);
 		}
 
 		STOPIF_CODE_ERR( write( mb_f->manber_fd, buffer, i) != i,
 				errno, "writing to manber hash file");
+		STOPIF( ck__add(mb_f->chunk_file, mb_f->block_md5), NULL);
 
 		/* re-init manber state */
 		STOPIF( cs___end_of_block(NULL, 0, NULL, mb_f), NULL );
@@ -820,6 +1042,7 @@ svn_error_t *cs___mnbs_close(void *baton)
 	int status;
 	svn_error_t *status_svn;
 	struct t_manber_data *mb_f=baton;
+	struct estat *sts;
 
 	status=0;
 
@@ -840,8 +1063,15 @@ svn_error_t *cs___mnbs_close(void *baton)
 		mb_f->input=NULL;
 	}
 
+	sts=mb_f->sts;
 	STOPIF( cs___finish_manber(mb_f), NULL);
 
+	/* The fingerprint is kept for the same files as the md5s. */
+	if (mb_f->do_fprint && sts && mb_f->fpos >= CS__MIN_FILE_SIZE)
+		STOPIF( fp__store(sts, &mb_f->fprint, mb_f->full_md5, mb_f->fpos), 
+				NULL);
+	mb_f->do_fprint=0;
+
 ex:
 	RETURN_SVNERR(status);
 }
@@ -874,6 +1104,11 @@ int cs__new_manber_filter(struct estat *sts,
 			"manber-data-init failed");
 
 	cs___manber.input=stream_input;
+	if (opt__get_int(OPT__FINGERPRINT) != FINGERPRINT_NO)
+	{
+		cs___manber.do_fprint=1;
+		fp__init(&cs___manber.fprint);
+	}
 
 	new_str=svn_stream_create(&cs___manber, pool);
 	STOPIF_ENOMEM( !new_str );
@@ -38,6 +38,10 @@ struct cs__manber_hashes
 
 /** Checks whether a file has changed. */
 int cs__compare_file(struct estat *sts, char *fullpath, int *result);
+/** Splits \a len bytes at \a data into manber blocks, and returns their
+ * number in \a blocks. For the micro-benchmarks. */
+int cs__manber_blocks(const unsigned char *data, size_t len,
+		unsigned *blocks);
 /** Puts the hex string of \a md5 into \a dest, and returns \a dest. */
 char* cs__md5tohex(const md5_digest_t md5, char *dest);
 /** Converts an MD5 digest to an ASCII string in a self-managed buffer. */
@@ -55,6 +59,10 @@ int cs__new_manber_filter(struct estat *sts,
 		svn_stream_t **filter_stream,
 		apr_pool_t *pool);
 
+/** Calculates the manber-hashes of the file at \a fullpath. */
+int cs__manber_hashes_of_file(char *fullpath, 
+		struct cs__manber_hashes *data);
+
 /** Reads the \ref md5s file into memory. */
 int cs__read_manber_hashes(struct estat *sts, 
 		struct cs__manber_hashes *data);
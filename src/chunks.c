@@ -0,0 +1,440 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <apr_md5.h>
+
+#include "global.h"
+#include "helper.h"
+#include "waa.h"
+#include "chunks.h"
+
+
+/** \file
+ * Index of the manber blocks of all files, see \ref chnk.
+ *
+ * The \ref md5s files only say which blocks a file had at its last
+ * commit or update; to find a block in \b another file we'd have to read
+ * all of them. So whenever a block MD5 is written to a \ref md5s file, it
+ * is put into this index, too, together with a 32bit key for the path of
+ * the file (see ck__file_key()).
+ *
+ * The index is a hash table with open addressing in a single file, which
+ * is \c mmap()ed; the MD5 is the key, and a block found in several files
+ * has several slots. Nothing is ever removed, so the index only gives
+ * hints: the caller has to verify them against the \ref md5s file of the
+ * entry.
+ *
+ * When the table gets full it's doubled; at \ref CK___MAX_SLOTS it's
+ * started anew instead, so that old data doesn't accumulate without
+ * limit.
+ *
+ * Several processes may use the index at the same time; queries take a
+ * shared \c flock(), changes an exclusive one, and the mapping is
+ * checked against the file size after locking. */
+
+
+/** Magic string at the start of the file, with the format version. */
+#define CK___MAGIC "FSVSchk1"
+/** Number of slots in a new index file; must be a power of 2. */
+#define CK___START_SLOTS (16*1024)
+/** With this many slots the index is started anew. */
+#define CK___MAX_SLOTS (16*1024*1024)
+/** A block found in that many files is too common to be a hint, and is not
+ * stored any more. */
+#define CK___MAX_SAME (16)
+
+
+/** Header of the index file. */
+struct ck___header_t {
+	/** \c CK___MAGIC, without the \c \\0. */
+	char magic[8];
+	/** Number of slots; a power of 2. \c 0 while the table is being
+	 * resized. */
+	uint32_t slots;
+	/** Number of used slots. */
+	uint32_t used;
+};
+
+/** A slot. */
+struct ck___slot_t {
+	/** The block MD5. */
+	md5_digest_t md5;
+	/** The file key; \c 0 for an empty slot. */
+	uint32_t file;
+};
+
+
+/** The mapped index, or \c NULL. */
+static struct ck___header_t *ck___map;
+/** The slots, just after the header. */
+static struct ck___slot_t *ck___slots;
+/** The mapped length. */
+static size_t ck___map_len;
+/** The file handle, or \c -1. */
+static int ck___fh=-1;
+/** Whether the index is opened for writing. */
+static int ck___writable;
+/** Set if there's no index; so that it's not looked for again on each
+ * query. */
+static int ck___missing;
+
+
+/** Returns the number of bytes needed for \a slots slots. */
+static size_t ck___size(uint32_t slots)
+{
+	return sizeof(struct ck___header_t) +
+		(size_t)slots * sizeof(struct ck___slot_t);
+}
+
+
+/** Returns the first slot to look at for \a md5. */
+static uint32_t ck___start(const md5_digest_t md5)
+{
+	uint32_t v;
+
+	/* The MD5 is evenly distributed, so any 4 bytes are fine. */
+	memcpy(&v, md5, sizeof(v));
+	return v & (ck___map->slots-1);
+}
+
+
+/** Maps \a len bytes of the index file. */
+static int ck___mmap(size_t len)
+{
+	int status;
+	void *map;
+
+	status=0;
+	map=mmap(NULL, len,
+			ck___writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, ck___fh, 0);
+	STOPIF_CODE_ERR( map == MAP_FAILED, errno, "mmap of the chunk index");
+
+	ck___map=map;
+	ck___map_len=len;
+	ck___slots=(struct ck___slot_t*)(ck___map+1);
+
+ex:
+	return status;
+}
+
+
+/** Makes the file an empty index with \a slots slots. */
+static int ck___init(uint32_t slots)
+{
+	int status;
+
+	status=0;
+	if (ck___map)
+	{
+		munmap(ck___map, ck___map_len);
+		ck___map=NULL;
+	}
+
+	/* Truncating first clears all the old slots. */
+	STOPIF_CODE_ERR( ftruncate(ck___fh, 0) == -1 ||
+			ftruncate(ck___fh, ck___size(slots)) == -1, errno,
+			"resizing the chunk index");
+
+	STOPIF( ck___mmap(ck___size(slots)), NULL);
+	memcpy(ck___map->magic, CK___MAGIC, sizeof(ck___map->magic));
+	ck___map->slots=slots;
+	ck___map->used=0;
+
+ex:
+	return status;
+}
+
+
+/** Puts \a md5 with \a file into a free slot.
+ * A block that's already stored for this \a file, or for too many files,
+ * is not stored again. */
+static void ck___insert(const md5_digest_t md5, uint32_t file)
+{
+	uint32_t i, mask;
+	int same;
+	struct ck___slot_t *slot;
+
+	mask=ck___map->slots-1;
+	same=0;
+	for(i=ck___start(md5); ; i=(i+1) & mask)
+	{
+		slot=ck___slots+i;
+		if (!slot->file) break;
+
+		if (memcmp(slot->md5, md5, sizeof(slot->md5)) == 0)
+		{
+			if (slot->file == file || ++same >= CK___MAX_SAME)
+				return;
+		}
+	}
+
+	memcpy(slot->md5, md5, sizeof(slot->md5));
+	slot->file=file;
+	ck___map->used++;
+}
+
+
+/** Doubles the number of slots; the old slots are put into the new
+ * table. */
+static int ck___grow(void)
+{
+	int status;
+	uint32_t i, old_slots;
+	struct ck___slot_t *copy;
+
+
+	status=0;
+	copy=NULL;
+	old_slots=ck___map->slots;
+	if (old_slots*2 > CK___MAX_SLOTS)
+	{
+		DEBUGP("chunk index full, starting anew");
+		STOPIF( ck___init(CK___START_SLOTS), NULL);
+		goto ex;
+	}
+
+	STOPIF( hlp__alloc( &copy, old_slots*sizeof(*copy)), NULL);
+	memcpy(copy, ck___slots, old_slots*sizeof(*copy));
+
+	STOPIF( ck___init(old_slots*2), NULL);
+	for(i=0; i<old_slots; i++)
+		if (copy[i].file)
+			ck___insert(copy[i].md5, copy[i].file);
+
+	DEBUGP("chunk index now has %u of %u slots used",
+			ck___map->used, ck___map->slots);
+
+ex:
+	IF_FREE(copy);
+	return status;
+}
+
+
+/** Returns whether the mapping of \a len bytes is a valid index. */
+static int ck___valid(off_t len)
+{
+	return memcmp(ck___map->magic, CK___MAGIC, sizeof(ck___map->magic)) == 0 &&
+		ck___map->slots &&
+		!(ck___map->slots & (ck___map->slots-1)) &&
+		ck___size(ck___map->slots) == (size_t)len;
+}
+
+
+/** Takes the lock \a op (\c LOCK_SH or \c LOCK_EX) on the index, and 
+ * makes the mapping match the file.
+ *
+ * Another process may have resized the index since we mapped it; 
+ * touching the mapping beyond the new end would give a \c SIGBUS. As 
+ * the file is only resized with the exclusive lock held, it's stable 
+ * while we hold the lock.
+ *
+ * If the index isn't valid, it's started anew if we may write; else \c 
+ * ENOENT is returned. On errors the lock is released again. */
+static int ck___lock(int op)
+{
+	int status;
+	off_t len;
+
+
+	status=0;
+	while (flock(ck___fh, op) == -1)
+		STOPIF_CODE_ERR( errno != EINTR, errno, "locking the chunk index");
+
+	len=lseek(ck___fh, 0, SEEK_END);
+	STOPIF_CODE_ERR( len == -1, errno, "getting the size of the chunk index");
+
+	if (ck___map && (size_t)len == ck___map_len && ck___valid(len)) 
+		goto ex;
+
+	if (ck___map)
+	{
+		munmap(ck___map, ck___map_len);
+		ck___map=NULL;
+	}
+
+	if (len >= (off_t)ck___size(0))
+	{
+		STOPIF( ck___mmap(len), NULL);
+		if (ck___valid(len)) goto ex;
+	}
+
+	DEBUGP("chunk index not valid");
+	if (!ck___writable)
+	{
+		status=ENOENT;
+		goto ex;
+	}
+
+	STOPIF( ck___init(CK___START_SLOTS), NULL);
+
+ex:
+	if (status) 
+		flock(ck___fh, LOCK_UN);
+	return status;
+}
+
+
+/** Releases the lock taken by ck___lock(). */
+static void ck___unlock(void)
+{
+	flock(ck___fh, LOCK_UN);
+}
+
+
+/** Opens the index, if not already done; it gets mapped by ck___lock().
+ * Returns \c ENOENT if there's none and \a writable is not set. */
+static int ck___open(int writable)
+{
+	int status;
+	char *cp, *eos;
+
+
+	status=0;
+	if (ck___fh != -1 && (ck___writable || !writable)) goto ex;
+	if (ck___missing && !writable) 
+	{
+		status=ENOENT;
+		goto ex;
+	}
+
+	STOPIF( ck__close(), NULL);
+
+	STOPIF( waa__get_waa_directory(wc_path, &cp, &eos, NULL,
+				GWD_WAA | (writable ? GWD_MKDIR : 0)), NULL);
+	strcpy(eos, WAA__CHUNK_INDEX_EXT);
+
+	ck___writable=writable;
+	ck___fh=open(cp, writable ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+	if (ck___fh == -1)
+	{
+		status=errno;
+		if (status == ENOENT && !writable) 
+		{
+			ck___missing=1;
+			goto ex;
+		}
+		STOPIF(status, "opening the chunk index %s", cp);
+	}
+	if (writable)
+		ck___missing=0;
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * The first 4 bytes of the MD5 of the path are taken; \c 0 is never
+ * returned, as it marks empty slots. */
+uint32_t ck__file_key(const char *path)
+{
+	md5_digest_t md5;
+	uint32_t v;
+
+	apr_md5(md5, path, strlen(path));
+	memcpy(&v, md5, sizeof(v));
+	return v ? v : 1;
+}
+
+
+/** -.
+ * Blocks with only zeroes (and so a MD5 of \c 0) are not stored; they're
+ * in nearly every sparse file. */
+int ck__add(uint32_t file, const md5_digest_t md5)
+{
+	int status;
+	static const md5_digest_t zero_md5 = { 0 };
+
+
+	status=0;
+	if (memcmp(md5, zero_md5, sizeof(zero_md5)) == 0) goto ex;
+
+	STOPIF( ck___open(1), NULL);
+	STOPIF( ck___lock(LOCK_EX), NULL);
+
+	/* At most 3/4 filled, to keep the probe chains short. */
+	if (ck___map->used >= ck___map->slots/4*3)
+		status=ck___grow();
+	if (!status)
+		ck___insert(md5, file);
+
+	ck___unlock();
+	STOPIF( status, NULL);
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * Returns \c ENOENT if there's no index.
+ * At most \a max keys are returned; \a found is set to the number of
+ * keys. */
+int ck__find(const md5_digest_t md5, uint32_t *files, int max, int *found)
+{
+	int status;
+	uint32_t i, mask;
+	struct ck___slot_t *slot;
+
+
+	*found=0;
+	status=ck___open(0);
+	if (status == ENOENT) goto ex;
+	STOPIF(status, NULL);
+
+	status=ck___lock(LOCK_SH);
+	if (status == ENOENT) goto ex;
+	STOPIF(status, NULL);
+
+	mask=ck___map->slots-1;
+	for(i=ck___start(md5); *found < max; i=(i+1) & mask)
+	{
+		slot=ck___slots+i;
+		if (!slot->file) break;
+
+		if (memcmp(slot->md5, md5, sizeof(slot->md5)) == 0)
+			files[(*found)++]=slot->file;
+	}
+
+	ck___unlock();
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * Can be called any number of times. */
+int ck__close(void)
+{
+	int status;
+
+	status=0;
+	if (ck___map)
+	{
+		STOPIF_CODE_ERR( munmap(ck___map, ck___map_len) == -1, errno,
+				"unmapping the chunk index");
+		ck___map=NULL;
+	}
+
+	if (ck___fh != -1)
+	{
+		STOPIF_CODE_ERR( close(ck___fh) == -1, errno,
+				"closing the chunk index");
+		ck___fh=-1;
+	}
+
+ex:
+	return status;
+}
+
@@ -0,0 +1,28 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __CHUNKS_H__
+#define __CHUNKS_H__
+
+#include "global.h"
+
+/** \file
+ * Index of the manber blocks of all files header file. */
+
+
+/** Returns the key for the file at \a path, as stored in the index. */
+uint32_t ck__file_key(const char *path);
+/** Remembers that the file with the key \a file has a block with \a md5.
+ * */
+int ck__add(uint32_t file, const md5_digest_t md5);
+/** Returns the keys of the files that had a block with \a md5. */
+int ck__find(const md5_digest_t md5, uint32_t *files, int max, int *found);
+/** Unmaps and closes the index. */
+int ck__close(void);
+
+#endif
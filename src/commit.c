@@ -69,6 +69,7 @@
 #include <apr_pools.h>
 #include <apr_user.h>
 #include <apr_file_io.h>
+#include <apr_allocator.h>
 #include <subversion-1/svn_delta.h>
 #include <subversion-1/svn_ra.h>
 #include <subversion-1/svn_error.h>
@@ -94,9 +95,34 @@
 #include "racallback.h"
 #include "url.h"
 #include "helper.h"
+#include "perf.h"
+#include "prefetch.h"
 
 
 
+/** How much freed pool memory APR may keep for re-use during the commit; 
+ * the rest is given back. */
+#define CI___POOL_MAX_FREE (4*1024*1024)
+
+
+/** \name Splitting a commit into several revisions.
+ * See \ref o_commit_split.
+ * @{ */
+/** How many entries may go into a single revision; \c 0 for no limit. */
+static unsigned ci___split_entries;
+/** How many bytes of file data may be sent in a single revision; \c 0 
+ * for no limit. */
+static t_ull ci___split_bytes;
+/** How many bytes have been sent in the current revision. */
+static t_ull ci___sent_bytes;
+/** Set if some entries were left for the next revision. */
+static int ci___split_more;
+
+/** Whether the commit may be split. */
+#define CI___SPLITTING() (ci___split_entries || ci___split_bytes)
+/** @} */
+
+
 /** Typedef needed for \a ci___send_user_props(). See there.  */
 typedef svn_error_t *(*change_any_prop_t) (void *baton,
 		const char *name,
@@ -255,9 +281,12 @@ int send_a_prop(void *baton, int store_encoder,
 	if (store_encoder && strcmp(key, propval_commitpipe) == 0)
 	{
 		if (value)
-			STOPIF( hlp__strdup( &sts->decoder, value->data), NULL);
-		else 
-			sts->decoder=NULL;
+		{
+			STOPIF( ops__make_cold(sts), NULL);
+			STOPIF( hlp__strdup( &sts->cold->decoder, value->data), NULL);
+		}
+		else if (sts->cold)
+			sts->cold->decoder=NULL;
 	}
 
 	status_svn=function(baton, key, value, pool);
@@ -276,7 +305,7 @@ ex:
  * ordered by the user have been done -- no properties with \c 
  * prp__prop_will_be_removed() will be here.
  *
- * If \a store_encoder is set, \c sts->decoder gets set from the value of 
+ * If \a store_encoder is set, \c sts->cold->decoder gets set from the value of 
  * the commit-pipe.
  *
  * \c auto-props from groupings are sent, too.
@@ -341,6 +370,9 @@ int ci___send_user_props(void *baton,
 	/* A hsh__close() does the garbage collection. */
 	STOPIF( hsh__close(db, status), NULL);
 
+	/* Everything is sent now. */
+	ops__free_user_prop(sts);
+
 ex:
 	return status;
 }
@@ -406,6 +438,102 @@ error:
 }
 
 
+/** Returns whether the current revision is full, so that \a sts has to 
+ * wait for the next one.
+ *
+ * A revision is only ended before a subdirectory, so that it always has 
+ * complete directories (without the subdirectories that are left out); 
+ * all other entries of a directory are sent with it.
+ *
+ * Every revision gets at least one entry; and copies are always sent as 
+ * a whole, as their children can't be committed without their base. */
+static int ci___split_is_full(struct estat *sts)
+{
+	if (!CI___SPLITTING()) return 0;
+	if (!committed_entries) return 0;
+	if (!S_ISDIR(sts->st.mode)) return 0;
+	if (sts->flags & RF_COPY_SUB) return 0;
+
+	return (ci___split_entries && committed_entries >= ci___split_entries) ||
+		(ci___split_bytes && ci___sent_bytes >= ci___split_bytes);
+}
+
+
+/** Sets the revision of the entries committed in this part of a split 
+ * commit, as the next part changes current_url->current_rev.
+ *
+ * waa__output_tree() does that for \c SET_REVNUM as well, but only in the 
+ * file. */
+static void ci___set_revisions(struct estat *sts)
+{
+	uint32_t i;
+
+	if (sts->repos_rev == SET_REVNUM && sts->url)
+		sts->repos_rev=sts->url->current_rev;
+
+	if (S_ISDIR(sts->st.mode))
+		for(i=0; i<sts->entry_count; i++)
+			ci___set_revisions(sts->by_inode[i]);
+}
+
+
+/** Keeps the new entries that are left for the next part of a split 
+ * commit out of the entry list.
+ *
+ * They have no URL and no revision yet, and their state isn't stored; 
+ * after an interrupted commit they'd be loaded as known, unchanged 
+ * entries, and never be committed. So they're marked \c RF_DONT_WRITE, 
+ * and their parent gets \c RF_CHECK, so that they're found as new again.  
+ * Entries that have \c RF_ADD or are copied keep these flags in the 
+ * entry list, so they're written.
+ *
+ * With \a hide unset the marks are removed again, for the next part. */
+static void ci___hide_uncommitted(struct estat *dir, int hide)
+{
+	uint32_t i;
+	struct estat *sts;
+
+	for(i=0; i<dir->entry_count; i++)
+	{
+		sts=dir->by_inode[i];
+		if (!hide)
+			sts->flags &= ~RF_DONT_WRITE;
+		else if ((sts->entry_status & FS_REPLACED) == FS_NEW &&
+				!(sts->flags & (RF_ADD | RF___IS_COPY)))
+		{
+			DEBUGP("%s is left out of the entry list", sts->name);
+			sts->flags |= RF_DONT_WRITE;
+			dir->flags |= RF_CHECK;
+			continue;
+		}
+
+		if (S_ISDIR(sts->st.mode))
+			ci___hide_uncommitted(sts, hide);
+	}
+}
+
+
+/** Returns whether ci__directory() has to look at \a sts; 
+ * ci___prefetch_tree() has to select the same entries.
+ *
+ * The flags are stored persistently; we have to check whether this entry 
+ * shall be committed. The entry_status is set depending on the 
+ * do_this_entry already; if it's not 0, it's got to be committed, or 
+ * maybe a child needs attention (with FS_CHILD_CHANGED). */
+static inline int ci___is_wanted(struct estat *sts)
+{
+	return ( (sts->flags & RF___COMMIT_MASK) && sts->do_this_entry) ||
+		sts->entry_status;
+}
+
+
+/** Returns whether the data of \a sts gets sent by ci__nondir(). */
+static inline int ci___transfers_text(struct estat *sts)
+{
+	return (sts->entry_status & (FS_CHANGED | FS_NEW | FS_REMOVED)) != 0;
+}
+
+
 /** Commit function for non-directory entries.
  *
  * Here we handle devices, symlinks and files.
@@ -432,8 +560,11 @@ svn_error_t *ci__nondir(const svn_delta_editor_t *editor,
 	struct encoder_t *encoder;
 	int transfer_text, has_manber;
 	hash_t db;
+	struct timespec started;
 
 
+	PRF__SPAN_START(started);
+	filename=NULL;
 	str=NULL;
 	a_stream=NULL;
 	s_stream=NULL;
@@ -469,7 +600,7 @@ svn_error_t *ci__nondir(const svn_delta_editor_t *editor,
 			st__flags_string_fromint(sts->flags));
 
 
-	transfer_text= sts->entry_status & (FS_CHANGED | FS_NEW | FS_REMOVED);
+	transfer_text= ci___transfers_text(sts);
 	/* In case the file is identical to the original copy source, we need 
 	 * not send the data to the server.
 	 * BUT we have to store the correct MD5 locally; as the source file may 
@@ -513,6 +644,7 @@ svn_error_t *ci__nondir(const svn_delta_editor_t *editor,
 						ops__dev_to_filedata(sts), pool);
 				break;
 			case S_IFREG:
+				pf__reached(sts);
 				STOPIF( apr_file_open(&a_stream, filename, APR_READ, 0, pool),
 						"open file \"%s\" for reading", filename);
 
@@ -526,16 +658,16 @@ svn_error_t *ci__nondir(const svn_delta_editor_t *editor,
 
 				/* That's needed only for actually putting the data in the 
 				 * repository - for local re-calculating it isn't. */
-				if (transfer_text && sts->decoder)
+				if (transfer_text && COLD(sts, decoder))
 				{
 					/* The user-defined properties have already been sent, so the 
 					 * propval_commitpipe would already be cleared; we don't need to 
 					 * check for prp__prop_will_be_removed().  */
-					STOPIF( hlp__encode_filter(s_stream, sts->decoder, 0,
+					STOPIF( hlp__encode_filter(s_stream, sts->cold->decoder, 0,
 								filename, &s_stream, &encoder, pool), NULL );
 					encoder->output_md5= &(sts->md5);
 
-					IF_FREE(sts->decoder);
+					IF_FREE(sts->cold->decoder);
 				}
 				break;
 			default:
@@ -617,6 +749,7 @@ ex:
 		apr_file_close(a_stream);
 	}
 
+	PRF__SPAN_END(started, "ci__nondir", filename);
 	RETURN_SVNERR(status);
 }
 
@@ -641,42 +774,40 @@ svn_error_t *ci__directory(const svn_delta_editor_t *editor,
 	struct sstat_t stat;
 	struct cache_entry_t *utf8fn_plus_missing;
 	int utf8fn_len;
+	int left_out;
 
 
 	status=0;
+	left_out=0;
 	utf8fn_plus_missing=NULL;
 	subpool=NULL;
 	DEBUGP("commit_dir with baton %p", dir_baton);
+	/* A single pool per directory, that gets cleared for each entry; 
+	 * creating and destroying a pool per entry costs time, and the freed 
+	 * memory isn't necessarily reused. */
+	STOPIF( apr_pool_create_ex(&subpool, pool, NULL, NULL), 
+			"no pool");
 	for(i=0; i<dir->entry_count; i++)
 	{
 		sts=dir->by_inode[i];
 
-		/* The flags are stored persistently; we have to check whether this 
-		 * entry shall be committed. */
-		if ( (sts->flags & RF___COMMIT_MASK) && sts->do_this_entry)
-		{
-			/* Did we change properties since last commit? Then we have something 
-			 * to do. */
-			if (sts->flags & RF_PUSHPROPS)
-				sts->entry_status |= FS_PROPERTIES;
-		}
-		else if (sts->entry_status)
-		{
-			/* The entry_status is set depending on the do_this_entry already;
-			 * if it's not 0, it's got to be committed. */
-			/* Maybe a child needs attention (with FS_CHILD_CHANGED), so we have 
-			 * to recurse.  */
-		}
-		else
-			/* Completely ignore item if nothing to be done. */
+		/* Completely ignore item if nothing to be done. */
+		if (!ci___is_wanted(sts))
 			continue;
 
+		/* Did we change properties since last commit? Then we have something 
+		 * to do. */
+		if ( (sts->flags & RF_PUSHPROPS) && sts->do_this_entry)
+			sts->entry_status |= FS_PROPERTIES;
 
-		/* clear an old pool */
-		if (subpool) apr_pool_destroy(subpool);
-		/* get a fresh pool */
-		STOPIF( apr_pool_create_ex(&subpool, pool, NULL, NULL), 
-				"no pool");
+		if (ci___split_is_full(sts))
+		{
+			DEBUGP("%s is left for the next revision", sts->name);
+			left_out=ci___split_more=1;
+			continue;
+		}
+
+		apr_pool_clear(subpool);
 
 		STOPIF( ops__build_path(&filename, sts), NULL);
 		/* As the path needs to be canonical we strip the ./ in front, and 
@@ -719,12 +850,13 @@ svn_error_t *ci__directory(const svn_delta_editor_t *editor,
 			if (!exists_now)
 			{
 				DEBUGP("%s=%d doesn't exist anymore", sts->name, i);
-				/* remove from data structures */
-
-				STOPIF( ops__delete_entry(dir, NULL, i, UNKNOWN_INDEX),
-						NULL);
+				/* remove from data structures; the filename is the entry's path, 
+				 * so it has to be used before. */
 				STOPIF( waa__delete_byext(filename, WAA__FILE_MD5s_EXT, 1), NULL);
+				STOPIF( waa__delete_byext(filename, WAA__FILE_FPRINT_EXT, 1), NULL);
 				STOPIF( waa__delete_byext(filename, WAA__PROP_EXT, 1), NULL);
+				STOPIF( ops__delete_entry(dir, NULL, i, UNKNOWN_INDEX),
+						NULL);
 				i--;
 				continue;
 			}
@@ -867,9 +999,16 @@ svn_error_t *ci__directory(const svn_delta_editor_t *editor,
 		{
 			STOPIF_SVNERR( ci__directory, (editor, sts, baton, subpool) );
 			STOPIF_SVNERR( editor->close_directory, (baton, subpool) );
+
+			if (CI___SPLITTING() && (sts->entry_status & FS_CHILD_CHANGED))
+				left_out=1;
 		}
 		else
 		{
+			if (S_ISREG(sts->st.mode) && 
+					(sts->entry_status & (FS_NEW | FS_CHANGED)))
+				ci___sent_bytes += sts->st.size;
+
 			STOPIF_SVNERR( ci__nondir, (editor, sts, baton, subpool) );
 			STOPIF_SVNERR( editor->close_file, (baton, NULL, subpool) );
 		}
@@ -890,6 +1029,14 @@ svn_error_t *ci__directory(const svn_delta_editor_t *editor,
 			sts->url=current_url;
 			sts->repos_rev = SET_REVNUM;
 		}
+
+		/* Only the data needed for the entry list is kept. */
+		STOPIF( ops__drop_scratch(sts), NULL);
+
+		/* If the commit gets split, the next revision must only see what's 
+		 * left; directories do that for themselves, below. */
+		if (CI___SPLITTING() && !S_ISDIR(sts->st.mode))
+			sts->entry_status=0;
 	}
 
 
@@ -942,6 +1089,15 @@ svn_error_t *ci__directory(const svn_delta_editor_t *editor,
 					editor->change_dir_prop, 0, pool), NULL);
 	}
 
+	/* The directory exists now, and its properties have been sent; if 
+	 * children were left for the next revision, they have to be found 
+	 * again. */
+	if (CI___SPLITTING())
+	{
+		dir->entry_status= left_out ? FS_CHILD_CHANGED : 0;
+		dir->flags &= ~RF_PUSHPROPS;
+	}
+
 
 ex:
 	if (subpool) 
@@ -1049,6 +1205,46 @@ ex:
 }
 
 
+/** Queues the files below \a dir that will have their data sent, for
+ * read-ahead.
+ *
+ * This has to give them in the same order as ci__directory() will, so it 
+ * uses the same tests; pf__reached() copes with a file too much or too 
+ * few, though. */
+static int ci___prefetch_tree(struct estat *dir)
+{
+	int status;
+	uint32_t i;
+	struct estat *sts;
+	char *filename;
+
+
+	status=0;
+	for(i=0; i<dir->entry_count; i++)
+	{
+		sts=dir->by_inode[i];
+
+		if (!ci___is_wanted(sts))
+			continue;
+		if (sts->flags & RF_UNVERSION)
+			continue;
+
+		if (S_ISDIR(sts->st.mode))
+			STOPIF( ci___prefetch_tree(sts), NULL);
+		else if (S_ISREG(sts->st.mode) && 
+				( ci___transfers_text(sts) ||
+					(sts->flags & (RF_ADD | RF___IS_COPY)) ))
+		{
+			STOPIF( ops__build_path(&filename, sts), NULL);
+			STOPIF( pf__add(sts, filename), NULL);
+		}
+	}
+
+ex:
+	return status;
+}
+
+
 
 
 /** The main commit function.
@@ -1075,6 +1271,7 @@ int ci__work(struct estat *root, int argc, char *argv[])
 	const char *url_name;
 	time_t delay_start;
 	char *missing_dirs;
+	int part;
 
 
 	status=0;
@@ -1191,39 +1388,24 @@ int ci__work(struct estat *root, int argc, char *argv[])
 	STOPIF( hlp__local2utf8(opt_commitmsg, &utf8_commit_msg, -1),
 			"Conversion of the commit message to utf8 failed");
 
+	/* The message file is gone after the first revision; and the utf8 
+	 * conversion may return a cached buffer. */
+	STOPIF( hlp__strdup( &utf8_commit_msg, utf8_commit_msg), NULL);
+
 	if (opt__verbosity() > VERBOSITY_VERYQUIET)
 		printf("Committing to %s\n", current_url->url);
 
 
-	STOPIF_SVNERR( svn_ra_get_commit_editor,
-			(current_url->session,
-			 &editor,
-			 &edit_baton,
-			 utf8_commit_msg,
-			 ci__callback,
-			 root,
-			 NULL, // apr_hash_t *lock_tokens,
-			 FALSE, // svn_boolean_t keep_locks,
-			 global_pool) );
-
-	if (opt_commitmsgfile && st.st_size != 0)
-		STOPIF_CODE_ERR( munmap(opt_commitmsg, st.st_size) == -1, errno,
-				"munmap()");
-	if (commitmsg_is_temp)
-		STOPIF_CODE_ERR( unlink(opt_commitmsgfile) == -1, errno,
-				"Cannot remove temporary message file %s", opt_commitmsgfile);
+	ci___split_entries=opt__get_int(OPT__COMMIT_SPLIT_ENTRIES);
+	ci___split_bytes=opt__get_int(OPT__COMMIT_SPLIT_MB);
+	ci___split_bytes *= 1024*1024;
 
+	/* The per-directory pools get cleared again and again; without a limit 
+	 * APR keeps all the freed memory for itself, so the process would 
+	 * stay at its peak size. */
+	apr_allocator_max_free_set( apr_pool_allocator_get(global_pool),
+			CI___POOL_MAX_FREE);
 
-	/* The whole URL is at the same revision - per definition. */
-	STOPIF_SVNERR( editor->open_root,
-			(edit_baton, current_url->current_rev, global_pool, &root_baton) );
-
-	/* Only children are updated, not the root. Do that here. */
-	if (ops__allowed_by_filter(root))
-		STOPIF( hlp__lstat( root->name, &root->st), NULL);
-
-
-	committed_entries=0;
 	if (missing_dirs)
 	{
 		STOPIF( hlp__local2utf8( missing_dirs, &missing_dirs, -1), NULL);
@@ -1235,16 +1417,67 @@ int ci__work(struct estat *root, int argc, char *argv[])
 	}
 
 
-	/* This is the second step that takes time. */
-	STOPIF_SVNERR( ci___base_dirs,
-			(missing_path_utf8, editor, root, root_baton));
+	/* Normally this is done once; if the commit gets split, once per 
+	 * revision. */
+	for(part=1; ; part++)
+	{
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
+		STOPIF_SVNERR( svn_ra_get_commit_editor,
+				(current_url->session,
+				 &editor,
+				 &edit_baton,
+				 utf8_commit_msg,
+				 ci__callback,
+				 root,
+				 NULL, // apr_hash_t *lock_tokens,
+				 FALSE, // svn_boolean_t keep_locks,
+				 global_pool) );
+
+		if (part == 1)
+		{
+			if (opt_commitmsgfile && st.st_size != 0)
+				STOPIF_CODE_ERR( munmap(opt_commitmsg, st.st_size) == -1, errno,
+						"munmap()");
+			if (commitmsg_is_temp)
+				STOPIF_CODE_ERR( unlink(opt_commitmsgfile) == -1, errno,
+						"Cannot remove temporary message file %s", opt_commitmsgfile);
+		}
 
 
-	/* If an error occurred, abort the commit. */
-	if (!status)
-	{
-		if (opt__get_int(OPT__EMPTY_COMMIT)==OPT__NO && 
-				committed_entries==0)
+		/* The whole URL is at the same revision - per definition. */
+		STOPIF_SVNERR( editor->open_root,
+				(edit_baton, current_url->current_rev, global_pool, &root_baton) );
+
+		/* Only children are updated, not the root. Do that here. */
+		if (ops__allowed_by_filter(root))
+			STOPIF( hlp__lstat( root->name, &root->st), NULL);
+
+
+		committed_entries=0;
+		ci___sent_bytes=0;
+		ci___split_more=0;
+
+		/* Let the disk work ahead of the editor. */
+		if (pf__start())
+			STOPIF( ci___prefetch_tree(root), NULL);
+
+		/* This is the second step that takes time. */
+		STOPIF_SVNERR( ci___base_dirs,
+				(missing_path_utf8, editor, root, root_baton));
+		pf__stop();
+
+
+		/* A split commit may end with an empty pass; that mustn't give an 
+		 * empty revision. The previous part still needs its delay. */
+		if (committed_entries==0 && part > 1)
+		{
+			editor->abort_edit(edit_baton, global_pool);
+			edit_baton=NULL;
+			break;
+		}
+
+		if (committed_entries==0 &&
+				opt__get_int(OPT__EMPTY_COMMIT)==OPT__NO)
 		{
 			if (opt__verbosity() > VERBOSITY_VERYQUIET)
 				printf("Avoiding empty commit as requested.\n");
@@ -1260,29 +1493,44 @@ int ci__work(struct estat *root, int argc, char *argv[])
 
 		delay_start=time(NULL);
 
-		/* Has to write new file, if commit succeeded. */
-		if (!status)
-		{
-			/* We possibly have to use some generation counter:
-			 * - write the URLs to a temporary file,
-			 * - write the entries,
-			 * - rename the temporary file.
-			 * Although, if we're cut off anywhere, we're not consistent with the
-			 * data.
-			 * Just use unionfs - that's easier. */
-			STOPIF( waa__output_tree(root), NULL);
-			STOPIF( url__output_list(), NULL);
-		}
-
-		/* We do the delay here ... here we've got a chance that the second 
-		 * wrap has already happened because of the IO above. */
-		STOPIF( hlp__delay(delay_start, DELAY_COMMIT), NULL);
+		/* Has to write new file, if commit succeeded.
+		 * We possibly have to use some generation counter:
+		 * - write the URLs to a temporary file,
+		 * - write the entries,
+		 * - rename the temporary file.
+		 * Although, if we're cut off anywhere, we're not consistent with the
+		 * data.
+		 * Just use unionfs - that's easier.
+		 *
+		 * For a split commit this is the checkpoint; if we're interrupted 
+		 * later, the next commit only has to send the rest. */
+		if (ci___split_more)
+			ci___hide_uncommitted(root, 1);
+		STOPIF( waa__output_tree(root), NULL);
+		STOPIF( url__output_list(), NULL);
+
+		if (!ci___split_more) break;
+
+		ci___hide_uncommitted(root, 0);
+
+		ci___set_revisions(root);
+
+		if (opt__verbosity() > VERBOSITY_QUIET)
+			printf("Committed part %d (%u entries); continuing.\n",
+					part, committed_entries);
+		/* The base directories exist now. */
+		missing_path_utf8=NULL;
 	}
 
+	/* We do the delay here ... here we've got a chance that the second 
+	 * wrap has already happened because of the IO above. */
+	STOPIF( hlp__delay(delay_start, DELAY_COMMIT), NULL);
+
 ex:
 	STOP_HANDLE_SVNERR(status_svn);
 
 ex2:
+	pf__stop();
 	if (status && edit_baton)
 	{
 abort_commit:
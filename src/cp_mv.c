@@ -20,6 +20,7 @@
 #include "cache.h"
 #include "helper.h"
 #include "waa.h"
+#include "chunks.h"
 
 
 /** \file
@@ -191,7 +192,12 @@
  *
  * </table>
  *
- * \note \b manber matching is not implemented yet.
+ * For \e manber the blocks of the new file are looked up in an index of 
+ * the blocks of all files, which is kept up-to-date on commit and update; 
+ * so files that were renamed and changed (or got data appended, like 
+ * rotated logfiles) can be found, too. The percentage is 
+ * (common_blocks)/(blocks_in_file1 + blocks_in_file2 - common_blocks), 
+ * like for \e dirlist.
  *
  * \note If too many possible matches for an entry are found, not all are 
  * printed; only an indicator <tt>...</tt> is shown at the end.
@@ -331,6 +337,7 @@ typedef datum (cm___to_datum_t)(const struct estat *sts);
 cm___to_datum_t cm___md5_datum;
 cm___to_datum_t cm___inode_datum;
 cm___to_datum_t cm___name_datum;
+cm___to_datum_t cm___chunk_key_datum;
 /** @} */
 
 
@@ -360,6 +367,8 @@ cm___register_fn cm___hash_register;
 cm___get_list_fn cm___hash_list;
 /** Match directories by their children. */
 cm___get_list_fn cm___match_children;
+/** Match files by their manber blocks. */
+cm___get_list_fn cm___manber_list;
 /** Outputs percent of match. */
 cm___format_fn cm___output_pct;
 
@@ -425,6 +434,11 @@ struct cm___match_t cm___match_array[]=
 		.insert=cm___hash_register, .get_list=cm___hash_list,
 		.entry_type=S_IFREG, .filename=WAA__FILE_MD5s_EXT},
 
+	{ .name="manber", .to_key=cm___chunk_key_datum, .is_expensive=1,
+		.insert=cm___hash_register, .get_list=cm___manber_list,
+		.format=cm___output_pct,
+		.entry_type=S_IFREG, .filename=WAA__FILE_CHUNK_KEY_EXT},
+
 	{ .name="inode", .to_key=cm___inode_datum, 
 		.insert=cm___hash_register, .get_list=cm___hash_list,
 		.entry_type=S_IFDIR, .filename=WAA__FILE_INODE_EXT},
@@ -473,6 +487,24 @@ datum cm___inode_datum(const struct estat *sts)
 }
 
 
+/** Gets a \a datum from the key of the file in the \ref chnk index. */
+datum cm___chunk_key_datum(const struct estat *sts)
+{
+	static uint32_t key;
+	datum d;
+	char *path;
+
+	/* The path is always there for known entries; on ENOMEM we've got other 
+	 * problems. */
+	key=0;
+	if (ops__build_path(&path, (struct estat*)sts) == 0)
+		key=ck__file_key(path);
+	d.dptr=(char*)&key;
+	d.dsize=sizeof(key);
+	return d;
+}
+
+
 /** Compare function for cm___candidate_t. */
 static int cm___cand_compare(const void *_a, const void *_b)
 {
@@ -491,6 +523,22 @@ static int cm___cand_comp_count(const void *_a, const void *_b)
 }
 
 
+/** Compare function for cm___candidate_t; the best match first. */
+static int cm___cand_comp_best(const void *_a, const void *_b)
+{
+	const struct cm___candidate_t *a=_a;
+	const struct cm___candidate_t *b=_b;
+	return b->match_count - a->match_count;
+}
+
+
+/** Compare function for MD5s. */
+static int cm___md5_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(md5_digest_t));
+}
+
+
 /** -. */
 int cm___hash_register(struct estat *sts, struct cm___match_t *match)
 {
@@ -642,6 +690,112 @@ int cm___hash_list(struct estat *sts, struct cm___match_t *match,
 }
 
 
+/** -.
+ *
+ * The index gives the files that had some block of \a sts at their last 
+ * commit or update; but as it's never cleaned, each of these is checked 
+ * against its \ref md5s file. */
+int cm___manber_list(struct estat *sts, struct cm___match_t *match,
+		struct cm___candidate_t **output, int *found)
+{
+	int status;
+	static struct cm___candidate_t arr[MAX_DUPL_ENTRIES*4];
+	struct cm___candidate_t *cur, tmp_cand={0};
+	struct cs__manber_hashes new_blocks, old_blocks;
+	uint32_t files[MAX_DUPL_ENTRIES];
+	struct estat **list;
+	size_t arr_count;
+	int i, j, file_count, list_count;
+	unsigned b, common;
+	datum key;
+	char *path;
+
+
+	memset(&new_blocks, 0, sizeof(new_blocks));
+	memset(&old_blocks, 0, sizeof(old_blocks));
+	arr_count=0;
+	*found=0;
+
+	/* The index is filled on commit and update, not by the registration 
+	 * of this matcher; so if it's not wanted, don't read the file. */
+	status=ENOENT;
+	if (!match->is_enabled) goto ex;
+
+	STOPIF( ops__build_path(&path, sts), NULL);
+	STOPIF( cs__manber_hashes_of_file(path, &new_blocks), NULL);
+
+	for(b=0; b<new_blocks.count; b++)
+	{
+		status=ck__find(new_blocks.md5[b], files, MAX_DUPL_ENTRIES, &file_count);
+		/* No index means nothing to find. */
+		if (status == ENOENT) goto ex;
+		STOPIF(status, NULL);
+
+		for(i=0; i<file_count; i++)
+		{
+			key.dptr=(char*)(files+i);
+			key.dsize=sizeof(files[i]);
+			status=hsh__list_get(match->db, key, NULL, &list, &list_count);
+			if (status == ENOENT) continue;
+			STOPIF(status, NULL);
+
+			for(j=0; j<list_count; j++)
+			{
+				tmp_cand.sts=list[j];
+				cur=lfind(&tmp_cand, arr, &arr_count, 
+						sizeof(arr[0]), cm___cand_compare);
+				if (!cur && arr_count < sizeof(arr)/sizeof(arr[0]))
+					lsearch(&tmp_cand, arr, &arr_count, 
+							sizeof(arr[0]), cm___cand_compare);
+			}
+		}
+	}
+	DEBUGP("%llu files share blocks with %s", (t_ull)arr_count, path);
+
+
+	/* Now count the common blocks. */
+	qsort(new_blocks.md5, new_blocks.count, sizeof(new_blocks.md5[0]), 
+			cm___md5_compare);
+	for(i=0; i<arr_count; i++)
+	{
+		status=cs__read_manber_hashes(arr[i].sts, &old_blocks);
+		if (status == ENOENT) continue;
+		STOPIF(status, NULL);
+
+		common=0;
+		for(b=0; b<old_blocks.count; b++)
+			if (bsearch(old_blocks.md5[b], new_blocks.md5, new_blocks.count,
+						sizeof(new_blocks.md5[0]), cm___md5_compare))
+				common++;
+
+		/* Repeated blocks could be counted more than once. */
+		if (common > new_blocks.count) common=new_blocks.count;
+
+		if (common)
+		{
+			arr[*found]=arr[i];
+			arr[*found].match_count = (t_ull)common*1000/
+				(new_blocks.count + old_blocks.count - common);
+			(*found)++;
+		}
+
+		IF_FREE(old_blocks.hash);
+		IF_FREE(old_blocks.md5);
+		IF_FREE(old_blocks.end);
+	}
+
+	qsort(arr, *found, sizeof(arr[0]), cm___cand_comp_best);
+	*output=arr;
+	status = *found ? 0 : ENOENT;
+
+ex:
+	IF_FREE(new_blocks.hash);
+	IF_FREE(new_blocks.md5);
+	IF_FREE(new_blocks.end);
+	return status;
+}
+
+
 /** Puts cm___candidate_t::match_count formatted into \a buffer. */
 char* cm___output_pct(struct cm___match_t *match, 
 		struct cm___candidate_t *cand)
@@ -759,8 +913,8 @@ static int cm___match(struct estat *entry)
 
 			cur->matches_where |= 1 << i;
 
-			/* Copy dirlist value */
-			if (i == CM___DIRLIST)
+			/* Copy dirlist or manber value */
+			if (match->format)
 				cur->match_count=list[j].match_count;
 
 			DEBUGP("got %s for %s => 0x%X",
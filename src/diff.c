@@ -27,6 +27,7 @@
 #include "racallback.h"
 #include "cp_mv.h"
 #include "warnings.h"
+#include "udiff.h"
 #include "diff.h"
 
 
@@ -61,8 +62,9 @@
  * file. With both revisions given, the difference between these repository 
  * versions is calculated.
  * 
- * You'll need the \c diff program, as the files are simply passed as 
- * parameters to it.
+ * By default the differences are calculated internally; if you 
+ * configure another \c diff program, the files are simply passed as 
+ * parameters to it. See \ref o_diff_engine.
  * 
  * The default is to do non-recursive diffs; so <tt>fsvs diff .</tt> will 
  * output the changes in all files <b>in the current directory</b> and 
@@ -86,6 +88,11 @@
 
 int cdiff_pipe=STDOUT_FILENO;
 pid_t cdiff_pid=0;
+/** Whether the internal diff engine is used, see \ref o_diff_engine. */
+static int df___internal=0;
+/** Where the internal diff engine writes to; either \c STDOUT, or the 
+ * pipe to colordiff. */
+static FILE *df___output=NULL;
 
 
 /** A number that cannot be a valid pointer. */
@@ -105,7 +112,7 @@ pid_t cdiff_pid=0;
  * that could even be done here, by using two \c va_list variables and 
  * comparing. But it's not a performance problem.
  */
-int df___print_meta(char *format, ... )
+int df___print_meta(FILE *output, char *format, ... )
 {
 	int status;
 	va_list va;
@@ -136,7 +143,7 @@ int df___print_meta(char *format, ... )
 
 		/* Different */
 	STOPIF_CODE_EPIPE( 
-			printf( 
+			fprintf(output, 
 				(l1 != l2 || strcmp(buf_new, buf_old) !=0) ? 
 				"-%s\n+%s\n" : " %s\n", 
 				buf_old, buf_new), NULL);
@@ -158,6 +165,10 @@ ex:
  *
  * \a rev2_file is meaningful only if \a rev2 is 0; this file gets removed 
  * after printing the difference!
+ *
+ * With the internal diff engine the difference is printed before 
+ * returning; else a child process is started, which is waited for on the 
+ * next call.
  * */
 int df__do_diff(struct estat *sts, 
 		svn_revnum_t rev1, 
@@ -179,9 +190,12 @@ int df__do_diff(struct estat *sts,
 	int is_copy;
 	int fdflags;
 	apr_hash_t *props_r1, *props_r2;
+	FILE *output;
 
 
 	status=0;
+	b1=b2=NULL;
+	new_mtime_string=other_mtime_string=NULL;
 
 	/* Check whether we have an active child; wait for it. */
 	if (last_child)
@@ -288,121 +302,149 @@ int df__do_diff(struct estat *sts,
 				NULL, sts, &props_r1, 
 				current_url->pool), NULL);
 
-	/* If we didn't flush the stdio buffers here, we'd risk getting them 
-	 * printed a second time from the child. */
-	fflush(NULL);
-
-
-	last_child=fork();
-	STOPIF_CODE_ERR( last_child == -1, errno,
-			"Cannot fork diff program");
-
-	if (!last_child)
+	if (df___internal)
+	{
+		/* Keep the order of our output and the diff. */
+		if (df___output != stdout)
+			STOPIF_CODE_EPIPE( fflush(stdout), NULL);
+		output=df___output;
+	}
+	else
 	{
-		STOPIF( hlp__format_path(sts, path, &disp_dest), NULL);
+		/* If we didn't flush the stdio buffers here, we'd risk getting them 
+		 * printed a second time from the child. */
+		fflush(NULL);
 
-		/* Remove the ./ at the front */
-		setenv(FSVS_EXP_CURR_ENTRY, path+2, 1);
+		last_child=fork();
+		STOPIF_CODE_ERR( last_child == -1, errno,
+				"Cannot fork diff program");
+		/* The parent continues with the next entry. */
+		if (last_child) goto ex;
+		output=stdout;
+	}
 
-		disp_source= is_copy ? url_to_fetch : disp_dest;
+	STOPIF( hlp__format_path(sts, path, &disp_dest), NULL);
 
-		len_d=strlen(disp_dest);
-		len_s=strlen(disp_source);
+	/* Remove the ./ at the front */
+	setenv(FSVS_EXP_CURR_ENTRY, path+2, 1);
 
+	disp_source= is_copy ? url_to_fetch : disp_dest;
 
-		if (cdiff_pipe != STDOUT_FILENO)
-		{
-			STOPIF_CODE_ERR( dup2(cdiff_pipe, STDOUT_FILENO) == -1, errno,
-					"Redirect output");
-
-			/* Problem with svn+ssh - see comment below. */
-			fdflags=fcntl(STDOUT_FILENO, F_GETFD);
-			fdflags &= ~FD_CLOEXEC;
-			/* Does this return errors? */
-			fcntl(STDOUT_FILENO, F_SETFD, fdflags);
-		}
+	len_d=strlen(disp_dest);
+	len_s=strlen(disp_source);
 
 
-		/* We need not be nice with memory usage - we'll be replaced soon. */
+	if (!df___internal && cdiff_pipe != STDOUT_FILENO)
+	{
+		STOPIF_CODE_ERR( dup2(cdiff_pipe, STDOUT_FILENO) == -1, errno,
+				"Redirect output");
+
+		/* Problem with svn+ssh - see comment below. */
+		fdflags=fcntl(STDOUT_FILENO, F_GETFD);
+		fdflags &= ~FD_CLOEXEC;
+		/* Does this return errors? */
+		fcntl(STDOUT_FILENO, F_SETFD, fdflags);
+	}
 
-		/* 30 chars should be enough for everyone */
-		b1=malloc(len_s + 60 + 30);
-		b2=malloc(len_d + 60 + 30);
 
-		STOPIF( hlp__strdup( &new_mtime_string, 
-					ctime(& sts_r2.st.mtim.tv_sec)), NULL);
-		STOPIF( hlp__strdup( &other_mtime_string, 
-					ctime(&sts->st.mtim.tv_sec)), NULL);
+	/* 30 chars should be enough for everyone */
+	STOPIF( hlp__alloc( &b1, len_s + 60 + 30), NULL);
+	STOPIF( hlp__alloc( &b2, len_d + 60 + 30), NULL);
 
-		sprintf(b1, "%s  \tRev. %llu  \t(%-24.24s)", 
-				disp_source, (t_ull) rev1, other_mtime_string);
+	STOPIF( hlp__strdup( &new_mtime_string, 
+				ctime(& sts_r2.st.mtim.tv_sec)), NULL);
+	STOPIF( hlp__strdup( &other_mtime_string, 
+				ctime(&sts->st.mtim.tv_sec)), NULL);
 
-		if (rev2 == 0)
-		{
-			sprintf(b2, "%s  \tLocal version  \t(%-24.24s)", 
-					disp_dest, new_mtime_string);
-			strcpy(short_desc, "local");
-		}
-		else
-		{
-			sprintf(b2, "%s  \tRev. %llu  \t(%-24.24s)", 
-					disp_dest, (t_ull) rev2, new_mtime_string);
-			sprintf(short_desc, "r%llu", (t_ull) rev2);
-		}
+	sprintf(b1, "%s  \tRev. %llu  \t(%-24.24s)", 
+			disp_source, (t_ull) rev1, other_mtime_string);
 
+	if (rev2 == 0)
+	{
+		sprintf(b2, "%s  \tLocal version  \t(%-24.24s)", 
+				disp_dest, new_mtime_string);
+		strcpy(short_desc, "local");
+	}
+	else
+	{
+		sprintf(b2, "%s  \tRev. %llu  \t(%-24.24s)", 
+				disp_dest, (t_ull) rev2, new_mtime_string);
+		sprintf(short_desc, "r%llu", (t_ull) rev2);
+	}
 
-		/* Print header line, just like a recursive diff does. */
-		STOPIF_CODE_EPIPE( printf("diff -u %s.r%llu %s.%s\n", 
-					disp_source, (t_ull)rev1, 
-					disp_dest, short_desc),
-				"Diff header");
 
+	/* Print header line, just like a recursive diff does. */
+	STOPIF_CODE_EPIPE( fprintf(output, "diff -u %s.r%llu %s.%s\n", 
+				disp_source, (t_ull)rev1, 
+				disp_dest, short_desc),
+			"Diff header");
 
-		if (opt__is_verbose() > 0) // TODO: && !symlink ...)
-		{
-			STOPIF(	df___print_meta( "Mode: 0%03o",
-						sts->st.mode & 07777,
-						META_DIFF_DELIMITER,
-						sts_r2.st.mode & 07777), 
-					NULL);
-			STOPIF(	df___print_meta( "MTime: %.24s", 
-						other_mtime_string,
-						META_DIFF_DELIMITER,
-						new_mtime_string),
-					NULL);
-			STOPIF(	df___print_meta( "Owner: %d (%s)",
-						sts->st.uid, hlp__get_uname(sts->st.uid, "undefined"),
-						META_DIFF_DELIMITER,
-						sts_r2.st.uid, hlp__get_uname(sts_r2.st.uid, "undefined") ),
-					NULL);
-			STOPIF(	df___print_meta( "Group: %d (%s)", 
-						sts->st.gid, hlp__get_grname(sts->st.gid, "undefined"),
-						META_DIFF_DELIMITER,
-						sts_r2.st.gid, hlp__get_grname(sts_r2.st.gid, "undefined") ),
-					NULL);
-		}
-		fflush(NULL);
 
-		// TODO: if special_dev ...
+	if (opt__is_verbose() > 0) // TODO: && !symlink ...)
+	{
+		STOPIF(	df___print_meta(output, "Mode: 0%03o",
+					sts->st.mode & 07777,
+					META_DIFF_DELIMITER,
+					sts_r2.st.mode & 07777), 
+				NULL);
+		STOPIF(	df___print_meta(output, "MTime: %.24s", 
+					other_mtime_string,
+					META_DIFF_DELIMITER,
+					new_mtime_string),
+				NULL);
+		STOPIF(	df___print_meta(output, "Owner: %d (%s)",
+					sts->st.uid, hlp__get_uname(sts->st.uid, "undefined"),
+					META_DIFF_DELIMITER,
+					sts_r2.st.uid, hlp__get_uname(sts_r2.st.uid, "undefined") ),
+				NULL);
+		STOPIF(	df___print_meta(output, "Group: %d (%s)", 
+					sts->st.gid, hlp__get_grname(sts->st.gid, "undefined"),
+					META_DIFF_DELIMITER,
+					sts_r2.st.gid, hlp__get_grname(sts_r2.st.gid, "undefined") ),
+				NULL);
+	}
+	// TODO: if special_dev ...
 
-		/* Checking \b which return value we get is unnecessary ...  On \b 
-		 * every error we get \c -1 .*/
-		execlp( opt__get_string(OPT__DIFF_PRG),
-				opt__get_string(OPT__DIFF_PRG),
-				opt__get_string(OPT__DIFF_OPT),
-				last_tmp_file, 
-				"--label", b1,
+	if (df___internal)
+	{
+		status=ud__diff_files(output, last_tmp_file, b1,
 				(rev2 != 0 ? last_tmp_file2 : 
 				 rev2_file ? rev2_file : path),
-				"--label", b2,
-				opt__get_string(OPT__DIFF_EXTRA),
-				NULL);
-		STOPIF_CODE_ERR( 1, errno, 
-				"Starting the diff program \"%s\" failed",
-				opt__get_string(OPT__DIFF_PRG));
+				b2, UD__DEFAULT_CONTEXT, NULL);
+		if (!status && fflush(output) == EOF)
+			status= errno == EPIPE ? -EPIPE : errno;
+
+		/* An \c EPIPE on \c STDOUT is the user's choice (like <tt>| 
+		 * head</tt>); but if colordiff stops reading, that's an error.  */
+		STOPIF_CODE_ERR( status == -EPIPE && output != stdout, EPIPE,
+				"!The colordiff program stopped accepting data");
+		STOPIF( status, NULL);
+		goto ex;
 	}
 
+	fflush(NULL);
+
+	/* Checking \b which return value we get is unnecessary ...  On \b 
+	 * every error we get \c -1 .*/
+	execlp( opt__get_string(OPT__DIFF_PRG),
+			opt__get_string(OPT__DIFF_PRG),
+			opt__get_string(OPT__DIFF_OPT),
+			last_tmp_file, 
+			"--label", b1,
+			(rev2 != 0 ? last_tmp_file2 : 
+			 rev2_file ? rev2_file : path),
+			"--label", b2,
+			opt__get_string(OPT__DIFF_EXTRA),
+			NULL);
+	STOPIF_CODE_ERR( 1, errno, 
+			"Starting the diff program \"%s\" failed",
+			opt__get_string(OPT__DIFF_PRG));
+
 ex:
+	IF_FREE(b1);
+	IF_FREE(b2);
+	IF_FREE(new_mtime_string);
+	IF_FREE(other_mtime_string);
 	return status;
 }
 
@@ -414,6 +456,15 @@ int df___cleanup(void)
 	int ret;
 
 
+	if (df___output && df___output != stdout)
+	{
+		/* That closes the pipe, too. */
+		STOPIF_CODE_ERR( fclose(df___output) == EOF, errno,
+				"Cannot close colordiff pipe");
+		df___output=NULL;
+		cdiff_pipe=STDOUT_FILENO;
+	}
+
 	if (cdiff_pipe != STDOUT_FILENO)
 		STOPIF_CODE_ERR( close(cdiff_pipe) == -1, errno,
 				"Cannot close colordiff pipe");
@@ -876,8 +927,8 @@ ex:
 
 /** -.
  *
- * We get the WC status, fetch the named changed entries, and call
- * an external diff program for each.
+ * We get the WC status, fetch the named changed entries, and print 
+ * the differences (or call an external diff program) for each.
  *
  * As a small performance optimization we do that kind of parallel - 
  * while we're fetching a file, we run the diff. */
@@ -904,6 +955,26 @@ int df__work(struct estat *root, int argc, char *argv[])
 	signal(SIGCHLD, SIG_DFL);
 
 
+	/* Use the internal diff engine if wanted, or in auto mode if the 
+	 * external program isn't configured. */
+	switch (opt__get_int(OPT__DIFF_ENGINE))
+	{
+		case DIFF_ENGINE_INTERNAL:
+			df___internal=1;
+			break;
+		case DIFF_ENGINE_EXTERNAL:
+			df___internal=0;
+			break;
+		case DIFF_ENGINE_AUTO:
+			df___internal= 
+				opt__get_prio(OPT__DIFF_PRG) == PRIO_DEFAULT &&
+				opt__get_prio(OPT__DIFF_OPT) == PRIO_DEFAULT &&
+				opt__get_prio(OPT__DIFF_EXTRA) == PRIO_DEFAULT;
+			break;
+	}
+	DEBUGP("internal diff engine: %d", df___internal);
+
+
 	/* check for colordiff */
 	if (( opt__get_int(OPT__COLORDIFF)==0 ||
 				opt__doesnt_say_off(opt__get_string(OPT__COLORDIFF)) ) &&
@@ -914,6 +985,14 @@ int df__work(struct estat *root, int argc, char *argv[])
 		STOPIF( df___colordiff(&cdiff_pipe, &cdiff_pid), NULL);
 	}
 
+	df___output=stdout;
+	if (df___internal && cdiff_pipe != STDOUT_FILENO)
+	{
+		df___output=fdopen(cdiff_pipe, "w");
+		STOPIF_CODE_ERR( !df___output, errno,
+				"Cannot open stream for colordiff pipe");
+	}
+
 	/* TODO: If we get "-u X@4 Y@4:3 Z" we'd have to do different kinds of 
 	 * diff for the URLs.
 	 * What about filenames? */
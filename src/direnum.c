@@ -21,6 +21,7 @@
 #include "warnings.h"
 #include "global.h"
 #include "helper.h"
+#include "perf.h"
 
 
 /** \file
@@ -101,6 +102,7 @@ ex:
  * \return The number of bytes used in \a dirp. */
 int dir__enum(dir__handle dh, fsvs_dirent *dirp, unsigned int count)
 {
+	PRF__COUNT(PRF__C_GETDENTS, 1);
 	return syscall(__NR_getdents64, dh, dirp, count);
 }
 
@@ -167,6 +169,7 @@ int dir__enum(dir__handle dh, fsvs_dirent *dirp, unsigned int count)
 {
 	struct dirent *de;
 
+	PRF__COUNT(PRF__C_GETDENTS, 1);
 	de=readdir(dh);
 	/* EOD ? */
 	if (!de) return 0; 
@@ -522,7 +525,8 @@ int dir__enumerator(struct estat *this,
 	/* If a _down_-sizing ever gives an error, we're really botched.
 	 * But if it's an empty directory, a NULL pointer will be returned. */
 	BUG_ON(mark && !strings);
-	this->strings=strings;
+	STOPIF( ops__make_cold(this), NULL);
+	this->cold->strings=strings;
 	/* Now this space is used - don't free. */
 	strings=NULL;
 
@@ -552,7 +556,7 @@ int dir__enumerator(struct estat *this,
 
 		/* The names-array has only the offsets stored.
 		 * So put correct values there. */
-		sts->name=this->strings + names[i];
+		sts->name=this->cold->strings + names[i];
 		sts->st.ino=inode_numbers[i];
 
 		/* now the data is copied, we store the pointer. */
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 
 
@@ -25,6 +26,7 @@
 #include "helper.h"
 #include "checksum.h"
 #include "url.h"
+#include "watch.h"
 
 /** \file
  * Handling of single struct \a estat s.
@@ -488,10 +490,14 @@ int ops___entries_to_write(struct estat *dir)
  * 
  * Any other characters that are allowed in a filename can be written - 
  * even control characters like \c \\n, \c \\r, \c \\f and so on.
+ *
+ * If \a line_len is not \c NULL, the number of bytes written is returned 
+ * there.
  * */
 int ops__save_1entry(struct estat *sts,
 		ino_t parent_ino,
-		int filehandle)
+		int filehandle,
+		unsigned *line_len)
 {
 	int len;
 	static char buffer[WAA_MAX_DIR_INFO_CHARS+2] = 
@@ -522,7 +528,7 @@ int ops__save_1entry(struct estat *sts,
 	is_dev = S_ISBLK(sts->st.mode) || S_ISCHR(sts->st.mode);
 
 
-	if (sts->match_pattern)
+	if (COLD(sts, match_pattern))
 		STOPIF( ops__apply_group(sts, NULL, NULL), NULL);
 
 
@@ -570,6 +576,7 @@ int ops__save_1entry(struct estat *sts,
 	is_dir=write(filehandle, buffer, len);
 	STOPIF_CODE_ERR(is_dir != len, errno, 
 			"write entry");
+	if (line_len) *line_len=len;
 
 	status=0;
 
@@ -678,72 +685,214 @@ int ops__calc_path_len(struct estat *sts)
 }
 
 
-/** -.
- * This function uses a rotating array of \c cache_entry_t.
- * This means that a few paths will be usable at once;
- * if some path has to be stored for a (possibly indefinite) time it should 
- * be \c strdup()ed, or re-built upon need. 
+/** \name Path arena
  *
- * A LRU eviction scheme is used - with last one marked. 
+ * The full paths of entries are stored in big chunks of memory; an entry 
+ * keeps its path in \ref estat::path, so looking it up again is a single 
+ * pointer read.
  *
- * If some function modifies that memory, it should set the first
- * char to \c \\0, to signal that it's no longer valid for other users.
+ * Each chunk counts how many of its paths are in use. When an entry is 
+ * freed its path is given back; the space is reused at once if it's the 
+ * last one in the chunk (as is the case for temporary entries), and a 
+ * chunk without used paths is freed. So a long running process doesn't 
+ * accumulate paths of entries that are long gone.
  *
- * \todo A further optimization would be to check if a parent is already 
- * present, and append to that path. Similar for a neighbour entry.
+ * The chunks are aligned to their size, so the chunk of a path is found by 
+ * masking its address.
  *
- * The \c cache_entry_t::id member is used as a pointer to the struct \ref estat.
- * */
-int ops__build_path(char **value, struct estat *sts)
+ * A path is built from the parent's path, so every level of the tree is 
+ * copied once, instead of walking up to the root for every entry.
+ *
+ * Building a path is serialized by a mutex, so that (eg.) writer threads 
+ * may ask for paths, too; the pointer is published atomically, so that 
+ * readers don't need to lock.
+ * @{ */
+/** How big the arena chunks are; must be a power of 2. */
+#define OPS___ARENA_CHUNK (64*1024)
+
+/** Header of an arena chunk. */
+struct ops___chunk_t {
+	/** How many paths in this chunk are in use. */
+	unsigned long users;
+};
+
+/** Returns the chunk that holds \a path. */
+#define OPS___CHUNK_OF(path) ((struct ops___chunk_t*) \
+		((uintptr_t)(path) & ~(uintptr_t)(OPS___ARENA_CHUNK-1)))
+
+/** The chunk new paths are put into. */
+static struct ops___chunk_t *ops___arena_current=NULL;
+/** Where the next path can be put, and how many bytes are left there. */
+static char *ops___arena_next=NULL;
+static size_t ops___arena_left=0;
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+static pthread_mutex_t ops___arena_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+#define OPS___ARENA_LOCK() pthread_mutex_lock(&ops___arena_mutex)
+#define OPS___ARENA_UNLOCK() pthread_mutex_unlock(&ops___arena_mutex)
+#define OPS___PATH_GET(sts) __atomic_load_n(&(sts)->path, __ATOMIC_ACQUIRE)
+#define OPS___PATH_SET(sts, p) __atomic_store_n(&(sts)->path, (p), __ATOMIC_RELEASE)
+#else
+#define OPS___ARENA_LOCK() do { } while (0)
+#define OPS___ARENA_UNLOCK() do { } while (0)
+#define OPS___PATH_GET(sts) ((sts)->path)
+#define OPS___PATH_SET(sts, p) ((sts)->path=(p))
+#endif
+
+
+/** Returns \a len bytes of arena space.
+ * Must be called with the arena locked. */
+static int ops___arena_alloc(size_t len, char **dest)
 {
-	static struct cache_t *cache=NULL;
-	int status, i;
-	unsigned needed_space;
-	char *data;
-
-	/* Please note that in struct \ref estat there's a bitfield, and its member 
-	 * \ref cache_index must take the full range plus an additional "out of 
-	 * range" value! */
-	STOPIF( cch__new_cache(&cache, 48), NULL);
-
-	/* Look if it's cached. */
-	if (sts->cache_index>0 &&
-			sts->cache_index<=cache->max && 
-			cache->entries[sts->cache_index-1]->id == (cache_value_t)sts &&
-			cache->entries[sts->cache_index-1]->data[0])
+	int status;
+	struct ops___chunk_t *chunk;
+	size_t size;
+	void *mem;
+
+	status=0;
+	if (len > ops___arena_left)
 	{
-		/* the found entry has index i; we'd like that to be the LRU. */
-		i=sts->cache_index-1;
-		DEBUGP("%p found in cache index %d; lru %d",
-				sts, i, cache->lru);
-		cch__set_active(cache, i);
-		goto ex;
+		/* Very long paths get their own memory, so that the rest of the 
+		 * current chunk isn't wasted. */
+		size = len > OPS___ARENA_CHUNK/4 ? 
+			len + sizeof(*chunk) : OPS___ARENA_CHUNK;
+		status=posix_memalign(&mem, OPS___ARENA_CHUNK, size);
+		STOPIF(status, "allocating %llu bytes for paths", (t_ull)size);
+		chunk=mem;
+		chunk->users=1;
+
+		if (size != OPS___ARENA_CHUNK)
+		{
+			*dest=(char*)(chunk+1);
+			goto ex;
+		}
+
+		/* The paths in the old chunk are all gone. */
+		if (ops___arena_current && !ops___arena_current->users)
+			free(ops___arena_current);
+
+		ops___arena_current=chunk;
+		ops___arena_next=(char*)(chunk+1);
+		ops___arena_left=OPS___ARENA_CHUNK - sizeof(*chunk);
+	}
+	else
+		ops___arena_current->users++;
+
+	*dest=ops___arena_next;
+	ops___arena_next+=len;
+	ops___arena_left-=len;
+
+ex:
+	return status;
+}
+
+
+/** Puts the path of \a sts (and its parents, as needed) into the arena.
+ * Must be called with the arena locked.
+ *
+ * We don't use (or set) \ref estat::path_len here, as that is a bitfield 
+ * that shares its storage with data other threads might change. */
+static int ops___arena_path(struct estat *sts, char **path)
+{
+	int status;
+	char *parent_path, *cp;
+	size_t plen, nlen;
+
+	status=0;
+	/* Another thread might have been faster. */
+	cp=sts->path;
+	if (cp) goto ex;
+
+	nlen=strlen(sts->name);
+	if (sts->parent)
+	{
+		STOPIF( ops___arena_path(sts->parent, &parent_path), NULL);
+		plen=strlen(parent_path);
+
+		STOPIF( ops___arena_alloc(plen + 1 + nlen + 1, &cp), NULL);
+		memcpy(cp, parent_path, plen);
+		cp[plen]=PATH_SEPARATOR;
+		memcpy(cp+plen+1, sts->name, nlen+1);
 	}
+	else
+	{
+		STOPIF( ops___arena_alloc(nlen + 1, &cp), NULL);
+		memcpy(cp, sts->name, nlen+1);
+	}
+
+	OPS___PATH_SET(sts, cp);
+
+ex:
+	if (!status) *path=cp;
+	return status;
+}
+
 
-	if (!sts->path_len)
-		ops__calc_path_len(sts);
+/** Gives the path of \a sts back to the arena.
+ * Called when \a sts gets freed. */
+static void ops___arena_release(struct estat *sts)
+{
+	char *path;
+	size_t len;
+	struct ops___chunk_t *chunk;
 
-	needed_space=sts->path_len+1;
 
-	STOPIF( cch__add(cache, (cache_value_t)sts, NULL, 
-				needed_space, &data), NULL);
+	if (!sts->path) return;
 
-	/* Now we have an index, and enough space. */
-	status=ops__build_path2(data, needed_space, sts);
-	if (status == 0)
+	OPS___ARENA_LOCK();
+	path=sts->path;
+	sts->path=NULL;
+
+	len=strlen(path)+1;
+	if (path + len == ops___arena_next)
 	{
-		/* Something happened with our path length counting -
-		 * it's really a bug. */
-		BUG("path len counting went wrong");
+		ops___arena_next=path;
+		ops___arena_left+=len;
+	}
+
+	chunk=OPS___CHUNK_OF(path);
+	BUG_ON(!chunk->users);
+	if (--chunk->users == 0)
+	{
+		if (chunk != ops___arena_current)
+			free(chunk);
+		else
+		{
+			ops___arena_next=(char*)(chunk+1);
+			ops___arena_left=OPS___ARENA_CHUNK - sizeof(*chunk);
+		}
 	}
+	OPS___ARENA_UNLOCK();
+}
+/** @} */
+
+
+/** -.
+ * The returned string is valid as long as the entry is, and must not be 
+ * changed; if some path has to be modified, it must be copied first.
+ *
+ * This is safe to call from multiple threads at once. */
+int ops__build_path(char **value, struct estat *sts)
+{
+	int status;
+	char *path;
 
-	data[status-1]=0;
-	sts->cache_index=cache->lru+1;
 	status=0;
+	path=OPS___PATH_GET(sts);
+	if (!path)
+	{
+		OPS___ARENA_LOCK();
+		status=ops___arena_path(sts, &path);
+		OPS___ARENA_UNLOCK();
+		STOPIF(status, NULL);
+	}
+
+	*value=path;
 
 ex:
-	//	DEBUGP("status=%d; path=%s", status, cache->entries[cache->lru]->data);
-	if (!status) *value=cache->entries[cache->lru]->data;
 	return status;
 }
 
@@ -945,7 +1094,7 @@ int ops__allocate(int needed,
 	if (count)
 		*count=returned;
 
-	/* The memory is cleared; cache_index == 0 means uninitialized, which is 
+	/* The memory is cleared; path == NULL means "not built yet", which is 
 	 * exactly what we want. */
 
 	VALGRIND_MAKE_MEM_DEFINED(*where, sizeof(**where) * returned);
@@ -955,6 +1104,65 @@ ex:
 }
 
 
+/** -.
+ * The structure is zeroed. */
+int ops__make_cold(struct estat *sts)
+{
+	int status;
+
+	status=0;
+	if (!sts->cold)
+		STOPIF( hlp__calloc( &sts->cold, 1, sizeof(*sts->cold)), NULL);
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * The properties live in their own pool, which is stored with the key 
+ * "". */
+void ops__free_user_prop(struct estat *sts)
+{
+	if (!COLD(sts, user_prop)) return;
+
+	apr_pool_destroy(apr_hash_get(sts->cold->user_prop, "", 0));
+	sts->cold->user_prop=NULL;
+}
+
+
+/** -.
+ * Used after an entry has been committed: the old version, the stored 
+ * properties, and the name ordered list of a directory can go; if the 
+ * cold data is empty afterwards, it is freed as well.
+ *
+ * The entry itself, and the data that ops__save_1entry() needs, stay; 
+ * so this only lowers the memory per entry, it doesn't bound the total. */
+int ops__drop_scratch(struct estat *sts)
+{
+	int status;
+	struct estat_cold *cold;
+
+	status=0;
+	if (S_ISDIR(sts->st.mode))
+		IF_FREE(sts->by_name);
+
+	cold=sts->cold;
+	if (!cold) goto ex;
+
+	if (cold->old)
+		STOPIF( ops__free_entry(& cold->old), NULL);
+	ops__free_user_prop(sts);
+
+	if (!cold->arg && !cold->match_pattern && 
+			!cold->decoder && !cold->strings)
+		IF_FREE(sts->cold);
+
+ex:
+	return status;
+}
+
+
 /** -.
  * The pointer to the entry is set to \c NULL, to avoid re-using. */
 int ops__free_entry(struct estat **sts_p)
@@ -967,8 +1175,8 @@ int ops__free_entry(struct estat **sts_p)
 
 
 	status=0;
-	if (sts->old)
-		STOPIF( ops__free_entry(& sts->old), NULL);
+	if (COLD(sts, old))
+		STOPIF( ops__free_entry(& sts->cold->old), NULL);
 	if (S_ISDIR(sts->st.mode))
 	{
 		BUG_ON(sts->entry_count && !sts->by_inode);
@@ -978,9 +1186,13 @@ int ops__free_entry(struct estat **sts_p)
 
 		IF_FREE(sts->by_inode);
 		IF_FREE(sts->by_name);
-		IF_FREE(sts->strings);
+		if (sts->cold)
+			IF_FREE(sts->cold->strings);
 		sts->st.mode=0;
 	}
+	ops__free_user_prop(sts);
+	IF_FREE(sts->cold);
+	ops___arena_release(sts);
 
 	/* Clearing the memory here serves no real purpose;
 	 * the free list written here overwrites parts.
@@ -1352,8 +1564,15 @@ int ops__update_single_entry(struct estat *sts, struct sstat_t *output)
 			goto removed_memset;
 		}
 
-	/* Check for current status */
-	status=hlp__lstat(fullpath, &st);
+	/* Check for current status; if the watch daemon knows that nothing 
+	 * happened to this entry, the stored values are current. */
+	if (sts->st.mode && !(sts->flags & RF_ISNEW) && wch__is_clean(fullpath))
+	{
+		st=sts->st;
+		status=0;
+	}
+	else
+		status=hlp__lstat(fullpath, &st);
 
 	if (status)
 	{
@@ -1412,7 +1631,7 @@ removed_memset:
 	else
 		if (action->overwrite_sts_st) sts->st=st;
 
-	DEBUGP("known %s: action=%X, flags=%X, mode=0%o, status=%d",
+	DEBUGP_HOT("known %s: action=%X, flags=%X, mode=0%o, status=%d",
 			fullpath, sts->entry_status, sts->flags, sts->st.mode, status);
 
 	sts->local_mode_packed = MODE_T_to_PACKED(st.mode);
@@ -1488,7 +1707,7 @@ int ops__update_filter_set_bits(struct estat *sts)
 		}
 	}
 
-	DEBUGP("filter says %d", sts->do_filter_allows);
+	DEBUGP_HOT("filter says %d", sts->do_filter_allows);
 
 ex:
 	return status;
@@ -1546,18 +1765,20 @@ void ops__copy_single_entry(struct estat *src, struct estat *dest)
 
 	/* Gets recalculated on next using */
 	dest->path_len=0;
+	dest->path=NULL;
 
 	/* The entry is not marked as to-be-ignored ... that would change the 
 	 * entry type, and we have to save it anyway. */
 	dest->entry_status=FS_NEW;
 	dest->remote_status=FS_NEW;
 
-	dest->cache_index=0;
 	dest->decoder_is_correct=src->decoder_is_correct;
 
 	dest->was_output=0;
+	dest->subtree_done=0;
 	dest->do_userselected = dest->do_child_wanted = dest->do_this_entry = 0;
-	dest->arg=NULL;
+	if (dest->cold)
+		dest->cold->arg=NULL;
 }
 
 
@@ -1750,7 +1971,9 @@ int ops__are_children_interesting(struct estat *dir)
  *
  * This means applying the target URL, and storing the auto-properties.
  *
- * Optionally the property database can be returned in \a props.
+ * Optionally the property database can be returned in \a props; 
+ * that is \c NULL if the entry has no properties, as creating (and 
+ * removing) an empty database for each new entry costs a \c fsync().
  * */
 int ops__apply_group(struct estat *sts, hash_t *props, 
 		apr_pool_t *pool)
@@ -1764,12 +1987,13 @@ int ops__apply_group(struct estat *sts, hash_t *props,
 	own_pool=0;
 	if (props) *props=NULL;
 
-	if (!sts->match_pattern) goto return_prop;
+	if (!COLD(sts, match_pattern)) goto return_prop;
 
-	group= sts->match_pattern->group_def;
+	group= sts->cold->match_pattern->group_def;
 	BUG_ON(!group);
 
-	DEBUGP("applying %s to %s", sts->match_pattern->group_name, sts->name);
+	DEBUGP("applying %s to %s", sts->cold->match_pattern->group_name, 
+			sts->name);
 
 	if (group->auto_props)
 	{
@@ -1788,12 +2012,20 @@ int ops__apply_group(struct estat *sts, hash_t *props,
 		sts->url=group->url;
 	sts->to_be_ignored=group->is_ignore;
 
-	sts->match_pattern=NULL;
+	sts->cold->match_pattern=NULL;
 
 return_prop:
 	if (props && !*props)
-		STOPIF( prp__open_byestat( sts, 
-					GDBM_WRCREAT | HASH_REMEMBER_FILENAME, props), NULL);
+	{
+		status=prp__open_byestat( sts, 
+				GDBM_WRITER | HASH_REMEMBER_FILENAME, props);
+		if (status == ENOENT)
+		{
+			*props=NULL;
+			status=0;
+		}
+		STOPIF(status, NULL);
+	}
 
 ex:
 	if (own_pool)
@@ -1810,10 +2042,19 @@ int ops__make_shadow_entry(struct estat *sts, int flags)
 	struct estat *copy;
 
 
-	BUG_ON(sts->old);
+	BUG_ON(COLD(sts, old));
 
 	STOPIF( ops__allocate(1, &copy, NULL), NULL);
 	memcpy(copy, sts, sizeof(*copy));
+	/* The path belongs to sts; the copy builds its own, if needed. */
+	copy->path=NULL;
+	/* The copy gets its own cold data, so that setting the old pointer 
+	 * below doesn't change it. */
+	if (sts->cold)
+	{
+		STOPIF( hlp__alloc( &copy->cold, sizeof(*copy->cold)), NULL);
+		*copy->cold = *sts->cold;
+	}
 
 	if (flags == SHADOWED_BY_REMOTE)
 	{
@@ -1829,8 +2070,8 @@ int ops__make_shadow_entry(struct estat *sts, int flags)
 	/* The by_inode and by_name arrays of the parent might point to the old 
 	 * location; rather than searching and changing them, we simply copy the 
 	 * old data, and clean the references in sts. */
-	copy->cache_index=0;
-	sts->old=copy;
+	STOPIF( ops__make_cold(sts), NULL);
+	sts->cold->old=copy;
 
 ex:
 	return status;
@@ -1853,7 +2094,7 @@ void DEBUGP_dump_estat(struct estat *sts)
 	 *   char path[sts->path_len+2];
 	 *   ops__build_path2(...)
 	 * which cannot return an ENOMEM, but would always recompute the path 
-	 * (and not use the cache). */
+	 * (and not use the path arena). */
 	if (ops__build_path(&path, sts))
 		DEBUGP("*** Dump of ... %s/%s",
 				sts->parent ? sts->parent->name : "/",
@@ -1874,7 +2115,7 @@ void DEBUGP_dump_estat(struct estat *sts)
 	if (S_ISDIR(sts->st.mode))
 		DEBUGP("directory: %d children", sts->entry_count);
 	else
-		DEBUGP("non-dir: decoder=%s, md5=%s", sts->decoder,
+		DEBUGP("non-dir: decoder=%s, md5=%s", COLD(sts, decoder),
 				cs__md5tohex_buffered(sts->md5));
 
 	/* Devices are not seen that often; so we accept a bogus size output. */
@@ -1884,7 +2125,7 @@ void DEBUGP_dump_estat(struct estat *sts)
 			(t_ull)sts->st.ino);
 
 	DEBUGP("others:%s%s%s%s%s%s%s%s%s",
-			sts->old ? " old" : "",
+			COLD(sts, old) ? " old" : "",
 			sts->was_output ? " was_output" : "",
 			sts->decoder_is_correct ? " decoder_ok" : "",
 			sts->do_userselected ? " do_usersel" : "",
@@ -51,8 +51,14 @@ int ops__delete_entry(struct estat *dir,
 /** This function returns blocks of (struct estat), possibly smaller than 
  * wanted by the caller. */
 int ops__allocate(int needed, struct estat **where, int *count);
+/** Allocates the \ref estat_cold "cold data" of \a sts, if not done yet. */
+int ops__make_cold(struct estat *sts);
 /** Frees the memory associated with this entry and all its children. */
 int ops__free_entry(struct estat **sts_p);
+/** Frees data of \a sts that isn't needed for writing the entry list. */
+int ops__drop_scratch(struct estat *sts);
+/** Frees the stored user-defined properties of \a sts, if any. */
+void ops__free_user_prop(struct estat *sts);
 /** Frees all "marked" entries in the given directory at once. */
 int ops__free_marked(struct estat *dir, int fast_mode);
 /** Appends the array of \a count \a new_entries as children to \a dir. */
@@ -64,7 +70,8 @@ int ops__new_entries(struct estat *dir,
  * */
 int ops__save_1entry(struct estat *sts,
 		ino_t parent_ino,
-		int filehandle);
+		int filehandle,
+		unsigned *line_len);
 /** Fills \a sts from a buffer \a where. */
 int ops__load_1entry(char **where, struct estat *sts, char **filename,
 		ino_t *parent_i);
@@ -115,7 +122,7 @@ int ops__are_children_interesting(struct estat *dir);
 int ops__apply_group(struct estat *sts, hash_t *props, 
 		apr_pool_t *pool);
 
-/** Creates a copy of \a sts, and keeps it referenced by \c sts->old.
+/** Creates a copy of \a sts, and keeps it referenced by \c sts->cold->old.
  * */
 int ops__make_shadow_entry(struct estat *sts, int flags);
 #define SHADOWED_BY_REMOTE (1)
@@ -22,6 +22,7 @@
 #include "helper.h"
 #include "url.h"
 #include "racallback.h"
+#include "perf.h"
 
 
 /**
@@ -156,6 +157,7 @@ int exp__do(struct estat *root, struct url_t *url)
 	STOPIF( url__canonical_rev(current_url, &rev), NULL);
 
 	/* export files */
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_do_update,
 			(current_url->session,
 			 &reporter,
@@ -0,0 +1,528 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "global.h"
+#include "helper.h"
+#include "est_ops.h"
+#include "checksum.h"
+#include "options.h"
+#include "perf.h"
+#include "waa.h"
+#include "fprint.h"
+
+
+/** \file
+ * Local fingerprints of big files, see \ref fprt and \ref o_fingerprint.
+ *
+ * Finding out whether a big file has changed means reading and hashing
+ * it in full (if it hasn't changed); with MD5 that is limited by the CPU,
+ * not by the disks.
+ *
+ * So, when enabled, a second hash is stored for the files that get a \ref
+ * md5s file; it is never sent to the repository, and is only used to say
+ * "unchanged" quickly.
+ *
+ * The file is cut into segments of \ref FP___SEGMENT bytes; each segment
+ * gets a XXH64 hash, and the fingerprint is the XXH64 of these hashes and
+ * the file size. That gives the same value whether the file is hashed as
+ * a stream (in the \ref md5s filter on commit, update and revert) or in
+ * pieces; so the segments can be hashed by several threads at once.
+ *
+ * The threads only \c mmap() and hash; they never call APR or anything
+ * else of FSVS.
+ *
+ * The MD5 is still calculated wherever the repository needs it; the
+ * fingerprint is bound to the MD5 of the file it was calculated with, so
+ * a stale fingerprint is simply ignored. */
+
+
+/** Size of the segments that are hashed separately. */
+#define FP___SEGMENT (4*1024*1024)
+/** Maximum number of threads. */
+#define FP___MAX_THREADS (16)
+/** Name of the algorithm in the \ref fprt file. */
+#define FP___XXH64_NAME "xxh64"
+/** Format of the \ref fprt file: algorithm, MD5, size, fingerprint. */
+#define FP___FORMAT "%s %s %llu %016llx\n"
+
+
+/** \name XXH64 constants
+ * @{ */
+#define FP___P1 0x9E3779B185EBCA87ULL
+#define FP___P2 0xC2B2AE3D27D4EB4FULL
+#define FP___P3 0x165667B19E3779F9ULL
+#define FP___P4 0x85EBCA77C2B2AE63ULL
+#define FP___P5 0x27D4EB2F165667C5ULL
+/** @} */
+
+
+static inline uint64_t fp___rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64-r));
+}
+
+
+/** Reads a little-endian value; the compiler makes a single load out of
+ * that where possible. */
+static inline uint64_t fp___read64(const unsigned char *p)
+{
+	return (uint64_t)p[0]       | (uint64_t)p[1] << 8 |
+		(uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+		(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+		(uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+
+static inline uint32_t fp___read32(const unsigned char *p)
+{
+	return (uint32_t)p[0]       | (uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static inline uint64_t fp___round(uint64_t acc, uint64_t input)
+{
+	acc += input * FP___P2;
+	acc = fp___rotl(acc, 31);
+	return acc * FP___P1;
+}
+
+
+static inline uint64_t fp___merge(uint64_t acc, uint64_t val)
+{
+	acc ^= fp___round(0, val);
+	return acc * FP___P1 + FP___P4;
+}
+
+
+static void fp___xxh64_init(struct fp__xxh64_t *x, uint64_t seed)
+{
+	memset(x, 0, sizeof(*x));
+	x->seed=seed;
+	x->v[0]=seed + FP___P1 + FP___P2;
+	x->v[1]=seed + FP___P2;
+	x->v[2]=seed;
+	x->v[3]=seed - FP___P1;
+}
+
+
+static void fp___xxh64_update(struct fp__xxh64_t *x,
+		const unsigned char *p, size_t len)
+{
+	const unsigned char *end;
+	unsigned fill;
+
+	x->total += len;
+
+	/* Complete a partial stripe first. */
+	if (x->memsize)
+	{
+		fill=sizeof(x->mem) - x->memsize;
+		if (len < fill)
+		{
+			memcpy(x->mem + x->memsize, p, len);
+			x->memsize += len;
+			return;
+		}
+
+		memcpy(x->mem + x->memsize, p, fill);
+		x->v[0]=fp___round(x->v[0], fp___read64(x->mem+ 0));
+		x->v[1]=fp___round(x->v[1], fp___read64(x->mem+ 8));
+		x->v[2]=fp___round(x->v[2], fp___read64(x->mem+16));
+		x->v[3]=fp___round(x->v[3], fp___read64(x->mem+24));
+		p += fill;
+		len -= fill;
+		x->memsize=0;
+	}
+
+	end=p+len;
+	while (end-p >= 32)
+	{
+		x->v[0]=fp___round(x->v[0], fp___read64(p+ 0));
+		x->v[1]=fp___round(x->v[1], fp___read64(p+ 8));
+		x->v[2]=fp___round(x->v[2], fp___read64(p+16));
+		x->v[3]=fp___round(x->v[3], fp___read64(p+24));
+		p+=32;
+	}
+
+	if (p < end)
+	{
+		memcpy(x->mem, p, end-p);
+		x->memsize=end-p;
+	}
+}
+
+
+static uint64_t fp___xxh64_digest(const struct fp__xxh64_t *x)
+{
+	uint64_t h;
+	const unsigned char *p, *end;
+
+	if (x->total >= 32)
+	{
+		h=fp___rotl(x->v[0], 1) + fp___rotl(x->v[1], 7) +
+			fp___rotl(x->v[2], 12) + fp___rotl(x->v[3], 18);
+		h=fp___merge(h, x->v[0]);
+		h=fp___merge(h, x->v[1]);
+		h=fp___merge(h, x->v[2]);
+		h=fp___merge(h, x->v[3]);
+	}
+	else
+		h=x->seed + FP___P5;
+
+	h += x->total;
+
+	p=x->mem;
+	end=p + x->memsize;
+	for(; p+8 <= end; p+=8)
+	{
+		h ^= fp___round(0, fp___read64(p));
+		h = fp___rotl(h, 27) * FP___P1 + FP___P4;
+	}
+	if (p+4 <= end)
+	{
+		h ^= (uint64_t)fp___read32(p) * FP___P1;
+		h = fp___rotl(h, 23) * FP___P2 + FP___P3;
+		p+=4;
+	}
+	for(; p < end; p++)
+	{
+		h ^= *p * FP___P5;
+		h = fp___rotl(h, 11) * FP___P1;
+	}
+
+	h ^= h >> 33;
+	h *= FP___P2;
+	h ^= h >> 29;
+	h *= FP___P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+
+/** Puts \a value into the outer hash; the byte order is fixed, so that
+ * the fingerprints stay valid if the WAA is moved to another machine. */
+static void fp___outer_add(struct fp__state_t *st, uint64_t value)
+{
+	unsigned char buffer[8];
+	int i;
+
+	for(i=0; i<8; i++)
+		buffer[i]=value >> (8*i);
+	fp___xxh64_update(&st->outer, buffer, sizeof(buffer));
+}
+
+
+/** Finishes the current segment. */
+static void fp___end_segment(struct fp__state_t *st)
+{
+	fp___outer_add(st, fp___xxh64_digest(&st->segment));
+	fp___xxh64_init(&st->segment, 0);
+	st->segment_fill=0;
+}
+
+
+/** Returns the fingerprint of a file with \a size bytes. */
+static uint64_t fp___final(struct fp__state_t *st, off_t size)
+{
+	if (st->segment_fill)
+		fp___end_segment(st);
+	fp___outer_add(st, size);
+	return fp___xxh64_digest(&st->outer);
+}
+
+
+/** -. */
+void fp__init(struct fp__state_t *st)
+{
+	fp___xxh64_init(&st->segment, 0);
+	fp___xxh64_init(&st->outer, 0);
+	st->segment_fill=0;
+}
+
+
+/** -.
+ * The data may come in pieces of any size. */
+void fp__update(struct fp__state_t *st, const void *data, size_t len)
+{
+	const unsigned char *p=data;
+	size_t now;
+
+	while (len)
+	{
+		now=FP___SEGMENT - st->segment_fill;
+		if (now > len) now=len;
+
+		fp___xxh64_update(&st->segment, p, now);
+		st->segment_fill += now;
+		p += now;
+		len -= now;
+
+		if (st->segment_fill == FP___SEGMENT)
+			fp___end_segment(st);
+	}
+}
+
+
+/** Data for hashing the segments of a file. */
+static struct {
+	/** The file. */
+	int fh;
+	/** Its size. */
+	off_t size;
+	/** The segment hashes. */
+	uint64_t *hashes;
+	/** Number of segments. */
+	unsigned count;
+	/** The next segment to be hashed. */
+	unsigned next;
+	/** The first error, as \c errno value. */
+	int error;
+} fp___file;
+
+#ifdef HAVE_PTHREAD
+/** The mutex for \ref fp___file. */
+static pthread_mutex_t fp___mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/** Hashes segments of \ref fp___file, until all are taken.
+ * Runs in the main thread and in the helper threads. */
+static void *fp___hash_segments(void *arg UNUSED)
+{
+	unsigned i;
+	off_t start;
+	size_t len;
+	void *map;
+	struct fp__xxh64_t x;
+
+	while (1)
+	{
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&fp___mutex);
+#endif
+		i = fp___file.error ? fp___file.count : fp___file.next;
+		if (i < fp___file.count) fp___file.next++;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&fp___mutex);
+#endif
+		if (i >= fp___file.count) break;
+
+		start=(off_t)i * FP___SEGMENT;
+		len=fp___file.size - start;
+		if (len > FP___SEGMENT) len=FP___SEGMENT;
+
+		map=mmap(NULL, len, PROT_READ, MAP_SHARED, fp___file.fh, start);
+		if (map == MAP_FAILED)
+		{
+#ifdef HAVE_PTHREAD
+			pthread_mutex_lock(&fp___mutex);
+#endif
+			if (!fp___file.error) fp___file.error=errno ? errno : EIO;
+#ifdef HAVE_PTHREAD
+			pthread_mutex_unlock(&fp___mutex);
+#endif
+			break;
+		}
+
+#ifdef MADV_SEQUENTIAL
+		madvise(map, len, MADV_SEQUENTIAL);
+#endif
+		fp___xxh64_init(&x, 0);
+		fp___xxh64_update(&x, map, len);
+		fp___file.hashes[i]=fp___xxh64_digest(&x);
+
+		munmap(map, len);
+	}
+
+	return NULL;
+}
+
+
+/** Calculates the fingerprint of the file \a fh with \a size bytes.
+ * If there's more than one segment, they're hashed by a few threads. */
+static int fp___of_file(int fh, off_t size, uint64_t *fp)
+{
+	int status;
+	unsigned i;
+	struct fp__state_t st;
+#ifdef HAVE_PTHREAD
+	pthread_t ids[FP___MAX_THREADS];
+	int threads;
+	long cpus;
+	sigset_t all, old;
+#endif
+
+
+	status=0;
+	memset(&fp___file, 0, sizeof(fp___file));
+	fp___file.fh=fh;
+	fp___file.size=size;
+	fp___file.count=(size + FP___SEGMENT-1) / FP___SEGMENT;
+	STOPIF( hlp__calloc( &fp___file.hashes, fp___file.count+1,
+				sizeof(*fp___file.hashes)), NULL);
+
+#ifdef HAVE_PTHREAD
+	threads=0;
+	cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > fp___file.count) cpus=fp___file.count;
+	if (cpus > FP___MAX_THREADS) cpus=FP___MAX_THREADS;
+
+	if (cpus > 1)
+	{
+		/* Signals should be handled in the main thread only. */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+
+		/* The main thread hashes, too. */
+		while (threads < cpus-1 &&
+				pthread_create(ids+threads, NULL, fp___hash_segments, NULL) == 0)
+			threads++;
+
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	DEBUGP("hashing %u segments with %d threads",
+			fp___file.count, threads+1);
+#endif
+
+	fp___hash_segments(NULL);
+
+#ifdef HAVE_PTHREAD
+	while (threads)
+		pthread_join(ids[--threads], NULL);
+#endif
+
+	STOPIF( fp___file.error, "hashing the file for the fingerprint");
+
+	fp__init(&st);
+	for(i=0; i<fp___file.count; i++)
+		fp___outer_add(&st, fp___file.hashes[i]);
+	*fp=fp___final(&st, size);
+
+	PRF__COUNT(PRF__C_HASHED_BYTES, size);
+
+ex:
+	IF_FREE(fp___file.hashes);
+	return status;
+}
+
+
+/** -.
+ * The state \a st is finished by this call. */
+int fp__store(struct estat *sts, struct fp__state_t *st,
+		const md5_digest_t md5, off_t size)
+{
+	int status, fh, i;
+	char *filename;
+	char buffer[128];
+	uint64_t fp;
+
+
+	status=0;
+	fh=-1;
+	fp=fp___final(st, size);
+
+	i=snprintf(buffer, sizeof(buffer), FP___FORMAT, FP___XXH64_NAME,
+			cs__md5tohex_buffered(md5), (t_ull)size, (t_ull)fp);
+	BUG_ON(i >= sizeof(buffer));
+
+	STOPIF( ops__build_path(&filename, sts), NULL);
+	DEBUGP("fingerprint of %s is %s", filename, buffer);
+
+	STOPIF( waa__open_byext(filename, WAA__FILE_FPRINT_EXT, WAA__WRITE,
+				&fh), NULL);
+	STOPIF_CODE_ERR( write(fh, buffer, i) != i, errno,
+			"writing the fingerprint of %s", filename);
+
+ex:
+	if (fh != -1)
+	{
+		i=waa__close(fh, status);
+		fh=-1;
+		STOPIF(i, "closing the fingerprint of %s", filename);
+	}
+	return status;
+}
+
+
+/** -.
+ * Returns \c ENOENT if there's no usable fingerprint; ie. none was
+ * stored, it's for another MD5 than that of \a sts, or the file can't be
+ * opened. The caller then has to hash the file in the normal way.
+ *
+ * Else \a changed is set to \c 0 if the file at \a fullpath has the
+ * stored fingerprint, and to \c 1 if not. */
+int fp__compare(struct estat *sts, char *fullpath, off_t size,
+		int *changed)
+{
+	int status, fh, i;
+	char *filename;
+	char buffer[128], name[16], md5_hex[APR_MD5_DIGESTSIZE*2+1];
+	t_ull old_size, old_fp;
+	uint64_t fp;
+
+
+	status=0;
+	fh=-1;
+	STOPIF( ops__build_path(&filename, sts), NULL);
+	status=waa__open_byext(filename, WAA__FILE_FPRINT_EXT, WAA__READ, &fh);
+	if (status == ENOENT) goto ex;
+	STOPIF(status, "reading the fingerprint of %s", filename);
+
+	i=read(fh, buffer, sizeof(buffer)-1);
+	STOPIF_CODE_ERR( i == -1, errno,
+			"reading the fingerprint of %s", filename);
+	buffer[i]=0;
+	close(fh);
+	fh=-1;
+
+	if (sscanf(buffer, "%15s %32s %llu %llx",
+				name, md5_hex, &old_size, &old_fp) != 4 ||
+			strcmp(name, FP___XXH64_NAME) != 0 ||
+			strcmp(md5_hex, cs__md5tohex_buffered(sts->md5)) != 0)
+	{
+		DEBUGP("fingerprint of %s not usable", filename);
+		status=ENOENT;
+		goto ex;
+	}
+
+	if (old_size != size)
+	{
+		DEBUGP("size of %s changed", filename);
+		*changed=1;
+		goto ex;
+	}
+
+	fh=open(fullpath, O_RDONLY);
+	if (fh == -1)
+	{
+		DEBUGP("can't open %s: %d", fullpath, errno);
+		status=ENOENT;
+		goto ex;
+	}
+
+	STOPIF( fp___of_file(fh, size, &fp), "fingerprinting %s", fullpath);
+
+	*changed= fp != old_fp;
+	DEBUGP("fingerprint of %s: %016llx, was %016llx",
+			filename, (t_ull)fp, old_fp);
+
+ex:
+	if (fh != -1) close(fh);
+	return status;
+}
@@ -0,0 +1,56 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __FPRINT_H__
+#define __FPRINT_H__
+
+#include "global.h"
+
+/** \file
+ * Local file fingerprints header file. */
+
+
+/** State of a XXH64 calculation. */
+struct fp__xxh64_t {
+	/** The four accumulators. */
+	uint64_t v[4];
+	/** Number of bytes hashed so far. */
+	uint64_t total;
+	/** The seed. */
+	uint64_t seed;
+	/** Bytes not yet processed, as less than a stripe was given. */
+	unsigned char mem[32];
+	/** Number of bytes in \c mem. */
+	unsigned memsize;
+};
+
+/** State of a fingerprint calculation over a stream. */
+struct fp__state_t {
+	/** Hash of the current segment. */
+	struct fp__xxh64_t segment;
+	/** Hash over the segment hashes. */
+	struct fp__xxh64_t outer;
+	/** Bytes in the current segment. */
+	uint32_t segment_fill;
+};
+
+
+/** Starts a fingerprint calculation. */
+void fp__init(struct fp__state_t *st);
+/** Hashes the next \a len bytes of a file. */
+void fp__update(struct fp__state_t *st, const void *data, size_t len);
+/** Writes the fingerprint of \a sts, as calculated in \a st, with the full
+ * file \a md5. */
+int fp__store(struct estat *sts, struct fp__state_t *st,
+		const md5_digest_t md5, off_t size);
+/** Checks the file \a fullpath against the stored fingerprint of \a sts.
+ * */
+int fp__compare(struct estat *sts, char *fullpath, off_t size,
+		int *changed);
+
+#endif
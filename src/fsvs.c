@@ -33,6 +33,8 @@
 #include "options.h"
 #include "actions.h"
 #include "racallback.h"
+#include "perf.h"
+#include "chunks.h"
 
 /** \file
  * The central parts of fsvs (main).
@@ -81,6 +83,8 @@
  *   remote)</tt>
  *   <dt>\ref cpfd "copyfrom-detect"<dd><tt>Ask FSVS about probably 
  *   copied/moved/renamed entries; see \ref cp</tt>
+ *   <dt>\ref watch <dd><tt>Track changes, so that \ref status etc. 
+ *   needn't check every entry</tt>
  * </dl>
  *
  * \section cmds_au Defining which entries to take:
@@ -1063,9 +1067,13 @@ int main(int argc, char *args[], char *env[])
 	svn_error_t *status_svn;
 	int eo_args, i;
 	void *mem_start, *mem_end;
+	struct timespec started;
+	/* 0 before the action, 1 while it runs, 2 when reported. */
+	int perf_state;
 
 
 	help=0;
+	perf_state=0;
 	eo_args=1;
 	environ=env;
 	program_name=args[0];
@@ -1147,7 +1155,7 @@ int main(int argc, char *args[], char *env[])
 	/* direct initialization doesn't work because
 	 * of the anonymous structures */
 	root.repos_rev=0;
-	root.name=root.strings=".";
+	root.name=".";
 	root.st.size=0;
 	root.st.mode=S_IFDIR | 0700;
 	root.entry_count=0;
@@ -1406,12 +1414,17 @@ int main(int argc, char *args[], char *env[])
 	STOPIF_SVNERR( cb__init, (global_pool));
 
 
+	STOPIF( prf__init(), NULL);
+	PRF__START(started);
+	perf_state=1;
 	STOPIF( action->work(&root, argc-optind, args+optind), 
 			"action %s failed", action->name[0]);
+	STOPIF( st__flush_records(), NULL);
 
 	/* Remove copyfrom records in the database, if any to do. */
 	STOPIF( cm__get_source(NULL, NULL, NULL, NULL, status), 
 			NULL);
+	STOPIF( ck__close(), NULL);
 
 	/* Maybe we should try that even if we failed? 
 	 * Would make sense in that the warnings might be helpful in determining
@@ -1421,7 +1434,22 @@ int main(int argc, char *args[], char *env[])
 
 	STOPIF( url__close_sessions(), NULL);
 
+	PRF__STOP(PRF__T_TOTAL, started);
+	perf_state=2;
+	STOPIF( prf__report(), NULL);
+
 ex:
+	/* Records found before an error should still be written. */
+	if (status && status != -EPIPE)
+		st__flush_records();
+
+	/* The numbers of a failed run are interesting, too. */
+	if (status && perf_state == 1)
+	{
+		PRF__STOP(PRF__T_TOTAL, started);
+		prf__report();
+	}
+
 	mem_end=sbrk(0);
 	DEBUGP("memory stats: %p to %p, %llu KB", 
 			mem_start, mem_end, (t_ull)(mem_end-mem_start)/1024);
@@ -99,6 +99,13 @@ struct ignore_t {
 	 * is converted to PCRE. */
 	char *compare_string;
 
+	/** The literal start of a shell pattern, up to the first wildcard, like 
+	 * \c "./dir/" for \c "./dir/ *.o"; \c NULL for the other types.
+	 * Only entries below directories that fit this prefix can match. */
+	char *prefix;
+	/** Length of \c prefix. */
+	int prefix_len;
+
 	/** How many times this pattern was visited. */
 	unsigned stats_tested;
 	/** How many times this pattern matched.
@@ -286,6 +293,55 @@ struct sstat_t {
 
 
 
+/** Seldom needed data of an entry.
+ *
+ * These members are \c NULL for nearly all entries of a big working copy, 
+ * so they are kept out of struct \ref estat; the structure is allocated 
+ * by ops__make_cold() on the first write, and read via \ref COLD.
+ *
+ * On x86_64 this takes struct \ref estat from 208 to 176 bytes (184 with 
+ * estat::path); an entry with cold data needs 48 bytes more.
+ * A layout with dense per-field arrays and 32bit indices instead of 
+ * pointers would save more, but every module walks the tree via 
+ * estat::parent and estat::by_inode, so that isn't done. */
+struct estat_cold {
+	/** If an entry gets removed, the old version is remembered (if needed) 
+	 * via the \c old pointer (eg to know which children were known and may 
+	 * be safely removed).  */
+	struct estat *old;
+
+	/** Which argument causes this path to be done. */
+	char *arg;
+
+	/** Which pattern matched this entry.
+	 * Only set for new entries, and \c NULL if none. */
+	struct ignore_t *match_pattern;
+
+	/** Stored user-defined properties as \c name=>svn_string_t, if \c 
+	 * action->keep_user_prop is set.
+	 * Allocated in a subpool of \c estat::url->pool, so that it's still 
+	 * available after cb__record_changes() returns.
+	 * The subpool is available from a hash lookup with key "" (len=0). */
+  apr_hash_t *user_prop;
+
+	/** For files: the en/decoder string.
+	 *  Only gets set if \c action->needs_decoder!=0 from 
+	 *  <tt>fsvs:update-pipe</tt>, or in commit from 
+	 *  <tt>fsvs:commit-pipe</tt>. */
+	char *decoder;
+
+	/** For directories: name storage space for sub- (and sub-sub- etc.) 
+	 * entries.
+	 * Mainly used in the root inode, but is used in newly found directories
+	 * too. \c NULL for most directory entries. */
+	char *strings;
+};
+
+/** Reads the member \a field of the \ref estat_cold "cold data" of \a 
+ * sts; \c NULL if there's none. */
+#define COLD(sts, field) ((sts)->cold ? (sts)->cold->field : NULL)
+
+
 /** The central structure for data storage.
  *
  * The name comes from <em>extended struct stat</em>.
@@ -300,6 +356,9 @@ struct estat {
 	struct estat *parent;
 	/** Name of this entry. */
 	char *name;
+	/** Full path of this entry, \c NULL until ops__build_path() puts it 
+	 * into the path arena. */
+	char *path;
 
 	/** Meta-data of this entry.
 	 * Most important: the entry type that is used for the shared members 
@@ -316,20 +375,14 @@ struct estat {
 	 * Will be used for multi-url updates. */
 	struct url_t *url;
 
-	/** If an entry gets removed, the old version is remembered (if needed) 
-	 * via the \c old pointer (eg to know which children were known and may 
-	 * be safely removed).  */
-	struct estat *old;
+	/** Seldom needed data; \c NULL until ops__make_cold() is called.
+	 * Use \ref COLD to read members. */
+	struct estat_cold *cold;
 
 	/** Data about this entry. */
 	union {
 		/** For files */
 		struct {
-			/** The en/decoder string.
-			 *  Only gets set if \c action->needs_decoder!=0 from 
-			 *  <tt>fsvs:update-pipe</tt>, or in commit from 
-			 *  <tt>fsvs:commit-pipe</tt>. */
-			char *decoder;
 			/** MD5-hash of the repository version.  While committing it is set 
 			 * to the \e new MD5, and saved with \a waa__output_tree(). */
 			md5_digest_t md5;
@@ -341,16 +394,8 @@ struct estat {
 			 * See \ref ChgFlag "Change detection flags". */
 			unsigned int change_flag:2;
 		};
-		/** For directories.
-		 * The by_inode and by_name members are positioned so that they collide 
-		 * with the \c md5 file member above - in case of incorrect file types 
-		 * that's safer, as they'll contain invalid pointers instead of (the 
-		 * valid) \c decoder.  */
+		/** For directories. */
 		struct {
-			/** Name storage space for sub- (and sub-sub- etc.) entries.
-			 * Mainly used in the root inode, but is used in newly found directories
-			 * too. \c NULL for most directory entries. */
-			char *strings;
 			/** List of child entries.
 			 * Sorted by inode number, NULL-terminated.
 			 * Always valid. */
@@ -371,8 +416,9 @@ struct estat {
 			 * conserves memory to keep it here. */
 			uint32_t unfinished;
 
-			/** This flag is set if any child is *not* at the same revision,
-			 * so this directory has to be descended on reporting. */
+			/** This flag is set if any child is *not* at the same revision 
+			 * (or URL), so this directory has to be descended on reporting.  
+			 * See \ref pathrevs. */
 			unsigned int other_revs:1;
 			/** If this bit is set, the directory has to be re-sorted before
 			 * being written out -- it may have new entries, which are not in
@@ -417,20 +463,6 @@ struct estat {
 
 
 	/** \name Common variables for all types of entries. */
-	/** Which argument causes this path to be done. */
-	char *arg;
-
-	/** Which pattern matched this entry.
-	 * Only set for new entries, and \c NULL if none. */
-	struct ignore_t *match_pattern;
-
-	/** Stored user-defined properties as \c name=>svn_string_t, if \c 
-	 * action->keep_user_prop is set.
-	 * Allocated in a subpool of \c estat::url->pool, so that it's still 
-	 * available after cb__record_changes() returns.
-	 * The subpool is available from a hash lookup with key "" (len=0). */
-  apr_hash_t *user_prop;
-
 	/** Flags for this entry. See \ref EntFlags "Various flags for entries" for constant definitions. */
 	uint32_t flags;
 
@@ -461,13 +493,6 @@ struct estat {
 	unsigned int remote_status:10;
 
 
-	/** Cache index number +1 of this entries' path.
-	 * \c 0 (and \c >MAX_CACHED_PATHS) is used as \e uninitialized; so the 
-	 * value here has range of <tt>[1 .. MAX_CACHED_PATHS]</tt> instead of 
-	 * the usual <tt>[0 .. MAX_CACHED_PATHS-1]</tt>. */
-	unsigned int cache_index:6;
-
-
 	/** Length of path up to here. Does not include the \c \\0. See \ref 
 	 * ops__calc_path_len. */
 	unsigned short path_len:16;
@@ -503,6 +528,11 @@ struct estat {
 	/** Whether this entry should not be written into the
 	 * \ref dir "entry list", and/or ignored otherwise. */
 	unsigned int to_be_ignored:1;
+
+	/** Set when this entry (and, for a directory, everything below it) has 
+	 * been checked; used for the incremental \ref o_dir_sort "sorted" 
+	 * output. */
+	unsigned int subtree_done:1;
 };
 
 
@@ -643,14 +673,29 @@ struct estat {
 #ifdef ENABLE_RELEASE
 #define DEBUGP(...) do { } while (0)
 #else
-/** Declaration of the debug function. */
+/** Declaration of the debug function.
+ * Marked as \c cold, so that the calls get moved out of the normal code 
+ * path. */
 extern void _DEBUGP(const char file[], int line, const char func[], const char format[], ...)
-	__attribute__ ((format (printf, 4, 5) ));
+	__attribute__ ((format (printf, 4, 5), cold ));
 	/** The macro used for printing debug messages.
 	 * Includes time, file, line number and function name. 
 	 * Allows filtering via opt_debugprefix.
 	 * \note Check for \ref PrintfTypes "argument sizes". */
-#define DEBUGP(...) do { if (debuglevel) _DEBUGP(__FILE__, __LINE__, __PRETTY_FUNCTION__, __VA_ARGS__); } while (0)
+#define DEBUGP(...) do { if (__builtin_expect(debuglevel, 0)) _DEBUGP(__FILE__, __LINE__, __PRETTY_FUNCTION__, __VA_ARGS__); } while (0)
+#endif
+
+/** Debug messages in the inner loops - per data block, per entry, per 
+ * ignore pattern.
+ * Even the check of \c debuglevel costs measurable time there, and the 
+ * arguments (like cs__md5tohex_buffered()) have to be kept around; so 
+ * these are only compiled in with \c --enable-debug.
+ *
+ * Variables that are only used for such messages need \c UNUSED. */
+#ifdef ENABLE_DEBUG
+#define DEBUGP_HOT(...) DEBUGP(__VA_ARGS__)
+#else
+#define DEBUGP_HOT(...) do { } while (0)
 #endif
 
 
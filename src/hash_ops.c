@@ -14,6 +14,7 @@
 #include "waa.h"
 #include "helper.h"
 #include "hash_ops.h"
+#include "perf.h"
 
 
 /** \file
@@ -207,7 +208,10 @@ int hsh___new_bare(char *wcfile, char *name, int gdbm_mode,
 	}
 	else
 		STOPIF( waa__get_waa_directory(wcfile, &cp, &eos, NULL,
-					( (gdbm_mode == GDBM_READER) ? 0 : GWD_MKDIR)  
+					/* GDBM_WRITER needs an existing file, so there's no need to 
+					 * create the directory for it. */
+					( (gdbm_mode == GDBM_READER || gdbm_mode == GDBM_WRITER) ? 
+						0 : GWD_MKDIR)  
 					| waa__get_gwd_flag(name)), NULL);
 	strcpy(eos, name);
 
@@ -223,6 +227,7 @@ int hsh___new_bare(char *wcfile, char *name, int gdbm_mode,
 		status=0;
 	}
 
+	PRF__COUNT(PRF__C_GDBM_OPENS, 1);
 	db = gdbm_open(cp, 0, gdbm_mode, 0777, NULL);
 	if (!db)
 	{
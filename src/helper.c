@@ -28,6 +28,7 @@
 #include "checksum.h"
 #include "helper.h"
 #include "cache.h"
+#include "perf.h"
 
 
 /** \file
@@ -341,8 +342,12 @@ int hlp__lstat(const char *fn, struct sstat_t *st)
 {
 	int status;
 	struct stat st64;
+	struct timespec started;
 
+	PRF__COUNT(PRF__C_LSTAT, 1);
+	PRF__SPAN_START(started);
 	status=lstat(fn, &st64);
+	PRF__SPAN_END(started, "lstat", fn);
 	if (status == 0) 
 	{
 		DEBUGP("%s: uid=%llu gid=%llu mode=0%llo dev=0x%llx "
@@ -622,35 +627,40 @@ ex:
 }
 
 
+/** How many user and group names are cached. */
+#define HLP___ID_CACHE (256)
+
 /** -.
- * Has a few buffers for these operations.
- *
- * The cache is statically allocated, as we cannot return \c ENOMEM.
+ * The names are kept in a hashed cache.
  *
  * If we cannot store a cache during querying, we'll return the value, but 
- * forget that we already know it.
- *
- * \todo Keep most-used? */
+ * forget that we already know it. */
 const char *hlp__get_grname(gid_t gid, char *not_found)
 {
 	struct group *gr;
-	static struct cache_t cache = { .max=CACHE_DEFAULT };
+	static struct hcache_t *cache=NULL;
 	char *str;
+	cache_value_t id;
 
 
-	if (cch__find(&cache, gid, NULL, &str, NULL) == 0)
+	id=gid;
+	if (cch__hash_new(&cache, HLP___ID_CACHE))
+		cache=NULL;
+	else if (cch__hash_find(cache, &id, sizeof(id), NULL, &str) == 0)
 		return *str ? str : not_found;
 
 	gr=getgrgid(gid);
 
-	cch__add(&cache, gid, gr ? gr->gr_name : "", -1, &str);
+	/* Unknown IDs are remembered as empty strings. */
+	str=gr ? gr->gr_name : "";
+	if (cache)
+		cch__hash_add(cache, &id, sizeof(id), 0, str, &str);
 	return *str ? str : not_found;
 }
 
 
 /** -.
- * Has a few buffers for these operations; the cache is statically 
- * allocated, as we cannot return \c ENOMEM.
+ * The names are kept in a hashed cache.
  *
  * If we cannot store a cache during querying, we'll return the value, but 
  * forget that we already know it.
@@ -658,33 +668,41 @@ const char *hlp__get_grname(gid_t gid, char *not_found)
 const char *hlp__get_uname(uid_t uid, char *not_found)
 {
 	struct passwd *pw;
-	static struct cache_t cache = { .max=CACHE_DEFAULT };
+	static struct hcache_t *cache=NULL;
 	char *str;
+	cache_value_t id;
 
-	if (cch__find(&cache, uid, NULL, &str, NULL) == 0)
+
+	id=uid;
+	if (cch__hash_new(&cache, HLP___ID_CACHE))
+		cache=NULL;
+	else if (cch__hash_find(cache, &id, sizeof(id), NULL, &str) == 0)
 		return *str ? str : not_found;
 
 	pw=getpwuid(uid);
 
-	cch__add(&cache, uid, pw ? pw->pw_name : "", -1, &str);
+	/* Unknown IDs are remembered as empty strings. */
+	str=pw ? pw->pw_name : "";
+	if (cache)
+		cch__hash_add(cache, &id, sizeof(id), 0, str, &str);
 	return *str ? str : not_found;
 }
 
 
 /** -.
- * Uses a simple hash function. */
+ * Uses a hashed cache on the full name. */
 int hlp__get_uid(char *user, uid_t *uid, apr_pool_t *pool)
 {
-	static struct cache_t *cache=NULL;
+	static struct hcache_t *cache=NULL;
 	int status;
 	apr_gid_t a_gid;
 	/* Needed for 64bit type-conversions. */
 	cache_value_t cv;
 
 
-	STOPIF( cch__new_cache(&cache, 64), NULL);
+	STOPIF( cch__hash_new(&cache, HLP___ID_CACHE), NULL);
 
-	if (cch__hash_find(cache, user, &cv) == ENOENT)
+	if (cch__hash_find(cache, user, -1, &cv, NULL) == ENOENT)
 	{
 		status=apr_uid_get(uid, &a_gid, user, pool);
 		if (status)
@@ -692,7 +710,7 @@ int hlp__get_uid(char *user, uid_t *uid, apr_pool_t *pool)
 		else
 		{
 			cv=*uid;
-			STOPIF( cch__hash_add(cache, user, cv), NULL);
+			STOPIF( cch__hash_add(cache, user, -1, cv, NULL, NULL), NULL);
 		}
 	}
 	else
@@ -704,17 +722,17 @@ ex:
 
 
 /** -.
- * Uses a simple hash function. */
+ * Uses a hashed cache on the full name. */
 int hlp__get_gid(char *group, gid_t *gid, apr_pool_t *pool)
 {
-	static struct cache_t *cache=NULL;
+	static struct hcache_t *cache=NULL;
 	int status;
 	/* Needed for 64bit type-conversions. */
 	cache_value_t cv;
 
 
-	STOPIF( cch__new_cache(&cache, 64), NULL);
-	if (cch__hash_find(cache, group, &cv) == ENOENT)
+	STOPIF( cch__hash_new(&cache, HLP___ID_CACHE), NULL);
+	if (cch__hash_find(cache, group, -1, &cv, NULL) == ENOENT)
 	{
 		status=apr_gid_get(gid, group, pool);
 		if (status)
@@ -722,7 +740,7 @@ int hlp__get_gid(char *group, gid_t *gid, apr_pool_t *pool)
 		else
 		{
 			cv=*gid;
-			STOPIF( cch__hash_add(cache, group, cv), NULL);
+			STOPIF( cch__hash_add(cache, group, -1, cv, NULL, NULL), NULL);
 		}
 	}
 	else
@@ -892,6 +910,7 @@ int hlp___encoder_waiter(struct encoder_t *encoder)
 	/* The names look reversed, because the pipe_* name is how the child sees 
 	 * it.  */
 	struct pollfd poll_data;
+	struct timespec started;
 
 	if (encoder->is_writer)
 	{
@@ -907,8 +926,10 @@ int hlp___encoder_waiter(struct encoder_t *encoder)
 	status=0;
 	/* We cannot wait indefinitely, because we don't get any close event yet.  
 	 * */
+	PRF__SPAN_START(started);
 	STOPIF_CODE_ERR( poll(&poll_data, 1, 100) == -1, errno,
 			"Error polling for data");
+	PRF__SPAN_END(started, "encoder_wait", NULL);
 
 ex:
 	return status;
@@ -1160,6 +1181,7 @@ svn_error_t *hlp___encode_close(void *baton)
 	svn_error_t *status_svn;
 	int retval;
 	struct encoder_t *encoder=baton;
+	struct timespec started;
 	md5_digest_t md5;
 
 
@@ -1177,7 +1199,9 @@ svn_error_t *hlp___encode_close(void *baton)
 		STOPIF_SVNERR( svn_stream_close, (encoder->orig) );
 	}
 
+	PRF__SPAN_START(started);
 	status=waitpid(encoder->child, &retval, 0);
+	PRF__SPAN_END(started, "encoder_wait", NULL);
 	DEBUGP("child %d gave %d - %X", encoder->child, status, retval);
 	STOPIF_CODE_ERR(status == -1, errno,
 			"Waiting for child process failed");
@@ -1549,14 +1573,15 @@ int hlp__match_path_envs(struct estat *root)
 			 * from *env-1, which *should* be save, as that is normally allocated 
 			 * on the top of the (mostly downgrowing) stack.
 			 * Be conservative. */
-			STOPIF( hlp__alloc( &sts->arg, 1+len+1+3), NULL);
+			STOPIF( ops__make_cold(sts), NULL);
+			STOPIF( hlp__alloc( &sts->cold->arg, 1+len+1+3), NULL);
 
 			/* \todo DOS-compatible as %env% ? */
-			sts->arg[0]=ENVIRONMENT_START;
-			memcpy(sts->arg+1, *env, len);
-			sts->arg[1+len]=0;
+			sts->cold->arg[0]=ENVIRONMENT_START;
+			memcpy(sts->cold->arg+1, *env, len);
+			sts->cold->arg[1+len]=0;
 
-			DEBUGP("match: %s gets %s", sts->name, sts->arg);
+			DEBUGP("match: %s gets %s", sts->name, sts->cold->arg);
 		}
 	}
 
@@ -1584,6 +1609,10 @@ int hlp__format_path(struct estat *sts, char *wc_relative_path,
 
 	status=0;
 	path=NULL;
+	/* ops__build_path() doesn't set the path lengths. */
+	if (!sts->path_len)
+		ops__calc_path_len(sts);
+
 	switch (opt__get_int(OPT__PATH))
 	{
 		case PATH_WCRELATIVE:
@@ -1593,7 +1622,7 @@ int hlp__format_path(struct estat *sts, char *wc_relative_path,
 		case PATH_CACHEDENVIRON:
 		case PATH_PARMRELATIVE:
 			parent_with_arg=sts;
-			while (parent_with_arg->parent && !parent_with_arg->arg) 
+			while (parent_with_arg->parent && !COLD(parent_with_arg, arg)) 
 			{
 				//				DEBUGP("no arg: %s", parent_with_arg->name);
 				parent_with_arg=parent_with_arg->parent;
@@ -1604,10 +1633,16 @@ int hlp__format_path(struct estat *sts, char *wc_relative_path,
 			 * The root is always the wc_path, so set it as default ... */
 			/** \todo We should set it beginning from a command line parameter, 
 			 * if we have one. Preferably the nearest one ... */
-			if (!parent_with_arg->arg) parent_with_arg->arg=wc_path;
+			if (!COLD(parent_with_arg, arg)) 
+			{
+				STOPIF( ops__make_cold(parent_with_arg), NULL);
+				parent_with_arg->cold->arg=wc_path;
+			}
 
 
-			len=strlen(parent_with_arg->arg);
+			len=strlen(parent_with_arg->cold->arg);
+			if (!parent_with_arg->path_len)
+				ops__calc_path_len(parent_with_arg);
 			sts_rel_len=sts->path_len - parent_with_arg->path_len;
 
 			/* If there was no parameter, and we're standing at the WC root, we 
@@ -1623,7 +1658,7 @@ int hlp__format_path(struct estat *sts, char *wc_relative_path,
 
 
 			DEBUGP("parent=%s, has %s; len=%d, rel_len=%d", 
-					parent_with_arg->name, parent_with_arg->arg, len, sts_rel_len);
+					parent_with_arg->name, parent_with_arg->cold->arg, len, sts_rel_len);
 			/* Maybe we should cache the last \c parent_with_arg and \c pwa_len. */
 			STOPIF( cch__entry_set(&cache, 0, NULL, 
 						len + 1 + sts_rel_len + 3,
@@ -1633,7 +1668,7 @@ int hlp__format_path(struct estat *sts, char *wc_relative_path,
 			 * ./.././, which the user possibly wants.
 			 * Use the parameter as given; only avoid putting a superfluous / at 
 			 * the end.  */
-			memcpy(path, parent_with_arg->arg, len);
+			memcpy(path, parent_with_arg->cold->arg, len);
 
 			/* If we had an parameter (so the PATH_SEPARATOR won't be the first 
 			 * character), and the last character of the parameter isn't already a 
@@ -21,6 +21,7 @@
 #include "direnum.h"
 #include "ignore.h"
 #include "url.h"
+#include "perf.h"
 
 
 /** \file
@@ -652,6 +653,21 @@ static struct ignore_t *ignore_list=NULL;
 /** Place where the patterns are mmap()ed. */
 static char *memory;
 
+/** \anchor ign_dir The patterns for one directory.
+ * New entries are classified one directory after the other; so the 
+ * patterns that can match anything in a directory are found once, and for 
+ * its entries only these are tested, in the same order.
+ * @{ */
+/** The directory path, including the trailing \c PATH_SEPARATOR. */
+static char *ign___dir_path;
+/** Length of \c ign___dir_path; \c 0 if the list is invalid. */
+static int ign___dir_len;
+/** Indizes into \c ignore_list. */
+static int *ign___dir_patterns;
+/** Number of used, and allocated, indizes. */
+static int ign___dir_count, ign___dir_max;
+/** @} */
+
 
 /** The various strings that define the pattern types.
  * @{ */
@@ -806,6 +822,16 @@ int ign__compile_pattern(struct ignore_t *ignore)
 			dest+=strlen(norm_prefix);
 		}
 
+		/* Remember the literal start, including an eventual norm_prefix; 
+		 * see ign__is_ignore(). */
+		ignore->prefix_len=strcspn(src, "*?[\\");
+		STOPIF( hlp__alloc( &ignore->prefix, 
+					(dest-buffer) + ignore->prefix_len + 1), NULL);
+		memcpy(ignore->prefix, buffer, dest-buffer);
+		memcpy(ignore->prefix + (dest-buffer), src, ignore->prefix_len);
+		ignore->prefix_len += dest-buffer;
+		ignore->prefix[ignore->prefix_len]=0;
+
 		backslashed = 0;
 		do
 		{
@@ -1375,8 +1401,57 @@ int ign__load_list(char *dir)
 ex:
 	/* to make sure no bad things happen */
 	if (status)
+	{
 		used_ignore_entries=0;
+		ign___dir_len=0;
+	}
+
+	return status;
+}
+
+
+/** Finds the patterns that may match in the directory \a path.
+ * \a dir_len is the length of the directory part of \a path, including 
+ * the \c PATH_SEPARATOR.
+ *
+ * A shell pattern is only skipped if its literal start differs from the 
+ * directory path; everything else (PCRE, devices, inodes, 
+ * case-insensitive patterns) is always taken.  */
+static int ign___find_dir_patterns(const char *path, int dir_len)
+{
+	int status;
+	int i, len;
+	struct ignore_t *ign;
 
+
+	status=0;
+	if (used_ignore_entries > ign___dir_max)
+	{
+		ign___dir_max=used_ignore_entries;
+		STOPIF( hlp__realloc( &ign___dir_patterns, 
+					ign___dir_max * sizeof(*ign___dir_patterns)), NULL);
+	}
+
+	STOPIF( hlp__realloc( &ign___dir_path, dir_len+1), NULL);
+	memcpy(ign___dir_path, path, dir_len);
+	ign___dir_path[dir_len]=0;
+
+	ign___dir_count=0;
+	for(i=0; i<used_ignore_entries; i++)
+	{
+		ign=ignore_list+i;
+
+		len = ign->prefix_len < dir_len ? ign->prefix_len : dir_len;
+		if (!ign->prefix || ign->is_icase ||
+				strncmp(ign->prefix, path, len) == 0)
+			ign___dir_patterns[ign___dir_count++]=i;
+	}
+
+	ign___dir_len=dir_len;
+	DEBUGP("%d of %d patterns for %s", 
+			ign___dir_count, used_ignore_entries, ign___dir_path);
+
+ex:
 	return status;
 }
 
@@ -1623,7 +1698,8 @@ ex:
  * a path level value is given.
  *
  * As we need to preserve the _order_ of the ignore/take statements,
- * we cannot easily optimize.
+ * we cannot easily optimize; but patterns that can't match in the 
+ * directory of \a sts are skipped, see \ref ign_dir.
  * is_ignored is set to +1 if ignored, 0 if unknown, and -1 if 
  * on a take-list (overriding later ignore list).
  *
@@ -1633,8 +1709,8 @@ int ign__is_ignore(struct estat *sts,
 		int *is_ignored)
 {
 	struct estat *dir;
-	int status, namelen UNUSED, len, i, path_len UNUSED;
-	char *path UNUSED, *cp;
+	int status, namelen UNUSED, len, i, j, path_len;
+	char *path UNUSED, *cp, *sep;
 	struct ignore_t **ign_list UNUSED;
 	struct ignore_t *ign;
 	struct sstat_t *st;
@@ -1660,26 +1736,33 @@ int ign__is_ignore(struct estat *sts,
 		STOPIF_ENOMEM(!match_data);
 	}
 
-	/* TODO - see ign__set_ignorelist() */ 
-	/* currently all entries are checked against the full ignore list -
-	 * not good performance-wise! */
 	STOPIF( ops__build_path(&cp, sts), NULL);
-	DEBUGP("testing %s for being ignored", cp);
+	DEBUGP_HOT("testing %s for being ignored", cp);
 
 	len=strlen(cp);
-	for(i=0; i<used_ignore_entries; i++)
+	/* The entries of a directory come one after the other; the list of 
+	 * patterns is only done again when the directory changes. */
+	sep=strrchr(cp, PATH_SEPARATOR);
+	path_len= sep ? sep-cp+1 : len;
+	if (path_len != ign___dir_len || 
+			strncmp(cp, ign___dir_path, path_len) != 0)
+		STOPIF( ign___find_dir_patterns(cp, path_len), NULL);
+
+	for(j=0; j<ign___dir_count; j++)
 	{
+		i=ign___dir_patterns[j];
 		ign=ignore_list+i;
 
 		if (!ign->group_def)
 			STOPIF( ign___load_group(ign), NULL);
 
 		ign->stats_tested++;
+		PRF__COUNT(PRF__C_IGNORE_TESTS, 1);
 
 		if (ign->type == PT_SHELL || ign->type == PT_PCRE ||
 				ign->type == PT_SHELL_ABS)
 		{
-			DEBUGP("matching %s(0%o) against \"%s\" "
+			DEBUGP_HOT("matching %s(0%o) against \"%s\" "
 					"(dir_only=%d; and=0%o, cmp=0%o)",
 					cp, sts->st.mode, ign->pattern, ign->dir_only,
 					ign->mode_match_and, ign->mode_match_cmp);
@@ -1699,7 +1782,7 @@ int ign__is_ignore(struct estat *sts,
 							(unsigned char*)cp, len,
 							0, 0,
 							match_data, 0);
-					DEBUGP("match %s against %s: %d", cp, ign->pattern, status);
+					DEBUGP_HOT("match %s against %s: %d", cp, ign->pattern, status);
 
 					if (status > 0) {
 						/* Matched. */
@@ -1751,14 +1834,14 @@ int ign__is_ignore(struct estat *sts,
 
 			/* status = 0 if *matches* ! */
 			status = !status;
-			DEBUGP("device compare pattern status=%d", status);
+			DEBUGP_HOT("device compare pattern status=%d", status);
 		}
 		else if (ign->type == PT_INODE)
 		{
 			sts_cmp.st.dev=ign->dev;
 			sts_cmp.st.ino=ign->inode;
 			status = dir___f_sort_by_inodePP(&sts_cmp, sts) != 0;
-			DEBUGP("inode compare %llX:%llu status=%d", 
+			DEBUGP_HOT("inode compare %llX:%llu status=%d", 
 					(t_ull)ign->dev, (t_ull)ign->inode, status);
 		}
 		else
@@ -1769,8 +1852,9 @@ int ign__is_ignore(struct estat *sts,
 		{
 			ign->stats_matches++;
 			*is_ignored = ign->group_def->is_ignore ? +1 : -1;
-			sts->match_pattern=ign;
-			DEBUGP("pattern found -  result %d", *is_ignored);
+			STOPIF( ops__make_cold(sts), NULL);
+			sts->cold->match_pattern=ign;
+			DEBUGP_HOT("pattern found -  result %d", *is_ignored);
 			goto ex;
 		}
 	}
@@ -1864,6 +1948,8 @@ int ign__new_pattern(unsigned count, char *pattern[],
 
 
 	status=0;
+	/* The indizes change. */
+	ign___dir_len=0;
 	DEBUGP("getting %d new entries - max is %d, used are %d", 
 			count, max_ignore_entries, used_ignore_entries);
 	if (used_ignore_entries+count >= max_ignore_entries)
@@ -1989,7 +2075,7 @@ int ign___test_single_pattern(struct estat *sts)
 	status=0;
 	BUG_ON(!(sts->entry_status & FS_NEW));
 
-	if (sts->match_pattern)
+	if (COLD(sts, match_pattern))
 	{
 		STOPIF( ops__build_path(&path, sts), NULL);
 		if (opt__is_verbose() >= 0)
@@ -2012,7 +2098,7 @@ int ign___test_all_patterns(struct estat *sts)
 	BUG_ON(!(sts->entry_status & FS_NEW));
 
 	STOPIF( ops__build_path(&path, sts), NULL);
-	ign=sts->match_pattern;
+	ign=COLD(sts, match_pattern);
 
 	if (opt__is_verbose() >= 0)
 		STOPIF_CODE_EPIPE( 
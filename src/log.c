@@ -37,6 +37,9 @@
  * Optionally the name of an URL can be given after \c -u; then the log of 
  * this URL, instead of the topmost one, is shown.
  *
+ * The log data is cached in the WAA, so that only new revisions have to 
+ * be fetched from the repository; see \ref o_log_cache.
+ *
  * TODOs: 
  * - \c --stop-on-copy
  * - Show revision for \b all URLs associated with a working copy?
@@ -54,6 +57,8 @@
 #include <ctype.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 
 
 #include "global.h"
@@ -65,6 +70,7 @@
 #include "update.h"
 #include "racallback.h"
 #include "helper.h"
+#include "perf.h"
 
 
 #define MAX_LOG_OUTPUT_LINE (1024)
@@ -272,6 +278,639 @@ ex:
 
 
 
+/** \name Log cache
+ *
+ * The log cache is an append-only file per URL in the WAA (see \ref 
+ * logc); it stores the revision data and the changed paths of all 
+ * revisions below the URL, up to some cached \c HEAD.
+ *
+ * On each \c log invocation only the revisions newer than that are 
+ * fetched, and appended; then the query is answered locally.
+ *
+ * The file format is
+ * \code
+ *   FSVS log cache 1\n
+ *   URL\0\n
+ * \endcode
+ * followed by revision blocks
+ * \code
+ *   r<revision> <number of paths>\n
+ *   author\0date\0message\0\n
+ * \endcode
+ * each followed by the given number of changed paths
+ * \code
+ *   <action> <copyfrom revision> path\0copyfrom path\0\n
+ * \endcode
+ * After each successful fetch an \c "h<HEAD>\n" line is written; 
+ * everything after the last such line is incomplete, and gets discarded.
+ * @{ */
+#define LOG___CACHE_HEADER "FSVS log cache 1\n"
+
+/** One cached revision. */
+struct log___cache_entry_t {
+	/** Revision number. */
+	svn_revnum_t rev;
+	/** Strings, pointing into the mapped file. */
+	const char *author, *date, *message;
+	/** Start of the changed paths list. */
+	const char *paths;
+	/** Number of changed paths. */
+	int path_count;
+};
+
+/** The cache of the current URL. */
+struct log___cache_t {
+	/** Name of the cache file. */
+	char *filename;
+	/** Mapped data. */
+	char *data;
+	/** Mapped length. */
+	size_t length;
+	/** The file handle, with a shared lock held as long as the file is 
+	 * mapped; a writer may truncate the file only with an exclusive lock.
+	 * \c -1 if not open. */
+	int fh;
+	/** Bytes that contain complete data. */
+	size_t valid_length;
+	/** The revisions, ascending. */
+	struct log___cache_entry_t *entries;
+	/** How many entries are stored. */
+	int count;
+	/** Up to which revision the cache is complete. */
+	svn_revnum_t head;
+};
+/** @} */
+
+
+/** Reads an unsigned number at \a *pos, not going past \a end. */
+static int log___cache_number(const char **pos, const char *end, 
+		long long *value)
+{
+	const char *cp;
+	int negative;
+
+
+	cp=*pos;
+	negative=0;
+	if (cp < end && *cp == '-')
+	{
+		negative=1;
+		cp++;
+	}
+
+	*value=0;
+	while (cp < end && isdigit(*cp))
+		*value = *value*10 + *(cp++) - '0';
+
+	if (cp == *pos || cp >= end) return EOF;
+
+	if (negative) *value = -*value;
+	*pos=cp;
+	return 0;
+}
+
+
+/** Skips a \c NUL -terminated string at \a *pos; returns \c EOF if it 
+ * doesn't end before \a end. */
+static int log___cache_string(const char **pos, const char *end,
+		const char **string)
+{
+	const char *cp;
+
+
+	cp=memchr(*pos, 0, end - *pos);
+	if (!cp) return EOF;
+
+	if (string) *string=*pos;
+	*pos=cp+1;
+	return 0;
+}
+
+
+/** Skips the given character. */
+static int log___cache_char(const char **pos, const char *end, char c)
+{
+	if (*pos >= end || **pos != c) return EOF;
+	(*pos)++;
+	return 0;
+}
+
+
+/** Skips a changed path entry, and returns its fields. */
+static int log___cache_path(const char **pos, const char *end,
+		char *action, long long *copyfrom_rev, 
+		const char **path, const char **copyfrom_path)
+{
+	if (*pos >= end) return EOF;
+	*action = *((*pos)++);
+
+	if (log___cache_char(pos, end, ' ') ||
+			log___cache_number(pos, end, copyfrom_rev) ||
+			log___cache_char(pos, end, ' ') ||
+			log___cache_string(pos, end, path) ||
+			log___cache_string(pos, end, copyfrom_path) ||
+			log___cache_char(pos, end, '\n'))
+		return EOF;
+	return 0;
+}
+
+
+/** Forgets the data of the cache. */
+static void log___cache_unmap(struct log___cache_t *cache)
+{
+	if (cache->data)
+		munmap(cache->data, cache->length);
+	cache->data=NULL;
+	cache->length=cache->valid_length=0;
+	IF_FREE(cache->entries);
+	cache->count=0;
+	cache->head=0;
+}
+
+
+/** Frees the data of the cache, and closes the file. */
+static void log___cache_free(struct log___cache_t *cache)
+{
+	log___cache_unmap(cache);
+	/* Releases the lock, too. */
+	if (cache->fh != -1)
+		close(cache->fh);
+	cache->fh=-1;
+}
+
+
+/** Maps and parses the cache file open as \a fh, which must be locked by 
+ * the caller.
+ * A file for another URL, or a broken file result in an empty cache. */
+static int log___cache_map(struct log___cache_t *cache, struct url_t *url,
+		int fh)
+{
+	int status;
+	int max, i;
+	struct sstat_t st;
+	const char *pos, *end, *cp, *url_in_file;
+	long long value;
+	struct log___cache_entry_t entry;
+	char action;
+
+
+	status=0;
+	STOPIF( hlp__fstat(fh, &st), NULL);
+	if (st.size == 0) goto ex;
+
+	cache->length=st.size;
+	cache->data=mmap(NULL, cache->length, PROT_READ, MAP_SHARED, fh, 0);
+	STOPIF_CODE_ERR( cache->data == MAP_FAILED, errno,
+			"Cannot map log cache \"%s\"", cache->filename);
+
+	pos=cache->data;
+	end=cache->data + cache->length;
+
+	if (cache->length < strlen(LOG___CACHE_HEADER) ||
+			memcmp(pos, LOG___CACHE_HEADER, strlen(LOG___CACHE_HEADER)) != 0)
+		goto invalid;
+	pos+=strlen(LOG___CACHE_HEADER);
+
+	if (log___cache_string(&pos, end, &url_in_file) ||
+			log___cache_char(&pos, end, '\n') ||
+			strcmp(url_in_file, url->url) != 0)
+		goto invalid;
+
+	max=0;
+	while (pos < end)
+	{
+		switch (*(pos++))
+		{
+			case 'h':
+				if (log___cache_number(&pos, end, &value) ||
+						log___cache_char(&pos, end, '\n'))
+					goto done;
+
+				/* Only now are the entries before valid. */
+				cache->head=value;
+				cache->valid_length=pos - cache->data;
+				break;
+
+			case 'r':
+				if (log___cache_number(&pos, end, &value) ||
+						log___cache_char(&pos, end, ' '))
+					goto done;
+				entry.rev=value;
+
+				if (log___cache_number(&pos, end, &value) ||
+						log___cache_char(&pos, end, '\n') ||
+						log___cache_string(&pos, end, &entry.author) ||
+						log___cache_string(&pos, end, &entry.date) ||
+						log___cache_string(&pos, end, &entry.message) ||
+						log___cache_char(&pos, end, '\n'))
+					goto done;
+
+				entry.path_count=value;
+				entry.paths=pos;
+				for(i=0; i<entry.path_count; i++)
+					if (log___cache_path(&pos, end, &action, &value, &cp, &cp))
+						goto done;
+
+				if (cache->count >= max)
+				{
+					max = max*2 + 256;
+					STOPIF( hlp__realloc( &cache->entries, 
+								sizeof(*cache->entries) * max), NULL);
+				}
+				cache->entries[cache->count++]=entry;
+				break;
+
+			default:
+				goto done;
+		}
+	}
+
+done:
+	/* Drop the entries after the last head marker. */
+	while (cache->count && 
+			cache->entries[cache->count-1].rev > cache->head)
+		cache->count--;
+
+	DEBUGP("log cache has %d entries up to r%llu, %llu of %llu bytes valid", 
+			cache->count, (t_ull)cache->head, 
+			(t_ull)cache->valid_length, (t_ull)cache->length);
+
+ex:
+	return status;
+
+invalid:
+	DEBUGP("log cache %s invalid, or for another URL", cache->filename);
+	log___cache_unmap(cache);
+	goto ex;
+}
+
+
+/** Loads the cache file for the \a url.
+ * A missing file results in an empty cache.
+ *
+ * The file stays open with a shared lock, so that it isn't truncated 
+ * while we use the mapping; that would give a \c SIGBUS. */
+static int log___cache_load(struct log___cache_t *cache, struct url_t *url)
+{
+	int status;
+
+
+	status=0;
+	log___cache_free(cache);
+
+	cache->fh=open(cache->filename, O_RDONLY);
+	if (cache->fh == -1)
+	{
+		STOPIF_CODE_ERR( errno != ENOENT, errno,
+				"Cannot open log cache \"%s\"", cache->filename);
+		DEBUGP("no log cache yet");
+		goto ex;
+	}
+
+	STOPIF_CODE_ERR( flock(cache->fh, LOCK_SH) == -1, errno,
+			"Cannot lock log cache \"%s\"", cache->filename);
+	STOPIF( log___cache_map(cache, url, cache->fh), NULL);
+
+ex:
+	return status;
+}
+
+
+/** Callback for \c svn_ra_get_log(); appends the revision to the cache 
+ * file given as \a baton. */
+static svn_error_t *log___cache_receiver(void *baton, 
+		apr_hash_t *changed_paths,
+		svn_revnum_t revision,
+		const char *author,
+		const char *date,
+		const char *message,
+		apr_pool_t *pool)
+{
+	int status;
+	FILE *output=baton;
+	apr_hash_index_t *hi;
+	const void *name;
+	void *value;
+	svn_log_changed_path_t *change;
+
+
+	status=0;
+	DEBUGP("caching r%llu", (t_ull)revision);
+
+	STOPIF_CODE_EPIPE( fprintf(output, "r%llu %u\n%s%c%s%c%s%c\n",
+				(t_ull)revision, 
+				changed_paths ? apr_hash_count(changed_paths) : 0,
+				author ? author : "", 0,
+				date ? date : "", 0,
+				message ? message : "", 0), NULL);
+
+	if (changed_paths)
+		for(hi=apr_hash_first(pool, changed_paths); hi; hi=apr_hash_next(hi))
+		{
+			apr_hash_this(hi, &name, NULL, &value);
+			change=value;
+			STOPIF_CODE_EPIPE( fprintf(output, "%c %lld %s%c%s%c\n",
+						change->action, 
+						(long long)(change->copyfrom_path ? change->copyfrom_rev : -1),
+						(const char*)name, 0,
+						change->copyfrom_path ? change->copyfrom_path : "", 0), NULL);
+		}
+
+ex:
+	RETURN_SVNERR(status);
+}
+
+
+/** Brings the cache up to \a head, by fetching the newer revisions.
+ *
+ * If the cache file is not writeable (eg. because we're running as an 
+ * unprivileged user), or another process has it in use, \a cache->head 
+ * stays below \a head. */
+static int log___cache_update(struct log___cache_t *cache, 
+		struct url_t *url, svn_revnum_t head)
+{
+	int status;
+	svn_error_t *status_svn;
+	int fh;
+	FILE *output;
+
+
+	status=0;
+	status_svn=NULL;
+	output=NULL;
+
+	if (cache->head >= head) goto ex2;
+
+	fh=open(cache->filename, O_RDWR | O_CREAT, 0666);
+	if (fh == -1)
+	{
+		STOPIF_CODE_ERR( errno != EACCES && errno != EROFS && errno != EPERM,
+				errno, "Cannot open log cache \"%s\"", cache->filename);
+		DEBUGP("log cache not writeable");
+		goto ex2;
+	}
+
+	output=fdopen(fh, "r+");
+	if (!output) close(fh);
+	STOPIF_CODE_ERR( !output, ENOMEM, "Cannot fdopen log cache");
+
+	/* Our own shared lock would block the exclusive one. */
+	log___cache_free(cache);
+
+	/* Other processes might be reading the file (perhaps for a long time, 
+	 * with the output going to a pager), or doing the same right now; 
+	 * then the cache stays as it is. */
+	if (flock(fh, LOCK_EX | LOCK_NB) == -1)
+	{
+		STOPIF_CODE_ERR( errno != EWOULDBLOCK, errno,
+				"Cannot lock log cache \"%s\"", cache->filename);
+		DEBUGP("log cache in use");
+		goto ex;
+	}
+
+	/* What we loaded before might be outdated by now; only with the lock 
+	 * held we know how much of the file is valid. */
+	STOPIF( log___cache_map(cache, url, fh), NULL);
+	if (cache->head >= head) 
+	{
+		DEBUGP("log cache got updated meanwhile");
+		goto ex;
+	}
+
+	/* Remove incomplete data at the end; and restart, if the file is for 
+	 * another URL. */
+	STOPIF_CODE_ERR( ftruncate(fh, cache->valid_length) == -1, errno,
+			"Cannot truncate log cache \"%s\"", cache->filename);
+	STOPIF_CODE_ERR( fseek(output, 0, SEEK_END) == -1, errno, NULL);
+
+	if (!cache->valid_length)
+		STOPIF_CODE_EPIPE( fprintf(output, LOG___CACHE_HEADER "%s%c\n", 
+					url->url, 0), NULL);
+
+	DEBUGP("fetching r%llu to r%llu", 
+			(t_ull)cache->head+1, (t_ull)head);
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
+	STOPIF_SVNERR( svn_ra_get_log,
+			(url->session, NULL, cache->head+1, head, 0, 1, 0,
+			 log___cache_receiver, output, global_pool));
+
+	STOPIF_CODE_EPIPE( fprintf(output, "h%llu\n", (t_ull)head), NULL);
+	STOPIF_CODE_EPIPE( fflush(output), NULL);
+
+ex:
+	STOP_HANDLE_SVNERR(status_svn);
+ex2:
+	if (output)
+	{
+		/* Releases the lock, too. */
+		fh=fclose(output);
+		output=NULL;
+		STOPIF_CODE_ERR( !status && fh == EOF, errno,
+				"Cannot close log cache \"%s\"", cache->filename);
+
+		/* Map it again, with a shared lock. */
+		if (!status)
+			STOPIF( log___cache_load(cache, url), NULL);
+	}
+	return status;
+}
+
+
+/** Checks whether the revision \a entry touches \a *path; if the path 
+ * (or one of its parents) was copied in this revision, \a *path is 
+ * changed to the copy source.
+ *
+ * \a *matches is set if the revision is part of the history of \a 
+ * *path; \a *history_start is set if \a *path was created (without 
+ * history) in this revision. */
+static int log___cache_follow(struct log___cache_entry_t *entry, 
+		const char *end, char **path, int *matches, int *history_start)
+{
+	int status;
+	int j, len, path_len, best_len;
+	const char *pos, *changed, *copyfrom, *best_copyfrom;
+	char action;
+	long long copyfrom_rev;
+	char *new_path;
+
+
+	status=0;
+	path_len=strlen(*path);
+	/* The root matches everything. */
+	*matches= path_len <= 1;
+	*history_start=0;
+	best_len=-1;
+	best_copyfrom=NULL;
+
+	pos=entry->paths;
+	for(j=0; j<entry->path_count; j++)
+	{
+		BUG_ON( log___cache_path(&pos, end, &action, &copyfrom_rev,
+					&changed, &copyfrom));
+
+		len=strlen(changed);
+		/* Changes at or below the path. */
+		if (strncmp(changed, *path, path_len) == 0 &&
+				(changed[path_len] == 0 || changed[path_len] == PATH_SEPARATOR))
+			*matches=1;
+
+		/* The path, or one of its parents, got created; the nearest one 
+		 * wins. */
+		if ((action == 'A' || action == 'R') && len > best_len &&
+				strncmp(*path, changed, len) == 0 &&
+				((*path)[len] == 0 || (*path)[len] == PATH_SEPARATOR))
+		{
+			*matches=1;
+			best_len=len;
+			best_copyfrom=copyfrom;
+		}
+	}
+
+	if (best_len >= 0)
+	{
+		if (*best_copyfrom)
+		{
+			STOPIF( hlp__strmnalloc( strlen(best_copyfrom) + 
+						path_len - best_len + 1, &new_path,
+						best_copyfrom, *path + best_len, NULL), NULL);
+			DEBUGP("at r%llu %s was copied from %s", 
+					(t_ull)entry->rev, *path, new_path);
+			IF_FREE(*path);
+			*path=new_path;
+		}
+		else
+			*history_start=1;
+	}
+
+ex:
+	return status;
+}
+
+
+/** Prints the log from the cache.
+ *
+ * The revisions are filtered on \a repos_path, which is the repository 
+ * path (starting with \c /) of the entry; like subversion we follow 
+ * the history across copies.
+ *
+ * The cache has the history of the URL itself; if the history of the 
+ * entry leaves that, the cache can't answer the query. Then \a *answered 
+ * is set to \c 0, and nothing is printed. */
+static int log___cache_query(struct log___cache_t *cache, 
+		const char *url_path, const char *repos_path,
+		svn_revnum_t from, svn_revnum_t to, int limit, 
+		int *answered)
+{
+	int status;
+	svn_error_t *status_svn;
+	struct log___cache_entry_t **list, *entry;
+	int list_count, i, j, matches, url_matches, len;
+	int history_start, url_history_start;
+	svn_revnum_t low, high;
+	const char *pos, *end, *path, *copyfrom;
+	char action;
+	long long copyfrom_rev;
+	char *filter, *url_filter;
+	apr_pool_t *subpool;
+	apr_hash_t *changed_paths;
+	svn_log_changed_path_t *change;
+
+
+	status=0;
+	status_svn=NULL;
+	list=NULL;
+	filter=url_filter=NULL;
+	subpool=NULL;
+	*answered=0;
+
+	low = from < to ? from : to;
+	high = from < to ? to : from;
+	end=cache->data + cache->valid_length;
+
+	STOPIF( hlp__strdup( &filter, repos_path), NULL);
+	STOPIF( hlp__strdup( &url_filter, url_path), NULL);
+	STOPIF( hlp__alloc( &list, sizeof(*list) * (cache->count+1)), NULL);
+
+	/* Walk downwards from the newest revision, to get the renames right.  
+	 * */
+	list_count=0;
+	for(i=cache->count-1; i>=0; i--)
+	{
+		entry=cache->entries+i;
+		if (entry->rev < low) break;
+
+		STOPIF( log___cache_follow(entry, end, &filter, 
+					&matches, &history_start), NULL);
+		STOPIF( log___cache_follow(entry, end, &url_filter, 
+					&url_matches, &url_history_start), NULL);
+
+		if (matches && entry->rev <= high)
+			list[list_count++]=entry;
+
+		if (history_start)
+		{
+			DEBUGP("history starts at r%llu", (t_ull)entry->rev);
+			break;
+		}
+
+		/* For descending output we can stop early. */
+		if (from >= to && limit > 0 && list_count >= limit)
+			break;
+
+		len=strlen(url_filter);
+		if (strncmp(filter, url_filter, len) != 0 ||
+				(filter[len] != 0 && filter[len] != PATH_SEPARATOR))
+		{
+			DEBUGP("history of %s leaves %s, can't answer from cache",
+					filter, url_filter);
+			goto ex;
+		}
+	}
+
+	/* Now print in the wanted order. */
+	if (limit <= 0 || limit > list_count) limit=list_count;
+
+	STOPIF( apr_pool_create(&subpool, global_pool), NULL);
+	for(i=0; i<limit; i++)
+	{
+		apr_pool_clear(subpool);
+		entry= from < to ? list[list_count-1-i] : list[i];
+
+		changed_paths=NULL;
+		if (opt__is_verbose() > 0)
+		{
+			changed_paths=apr_hash_make(subpool);
+			pos=entry->paths;
+			for(j=0; j<entry->path_count; j++)
+			{
+				BUG_ON( log___cache_path(&pos, end, &action, &copyfrom_rev,
+							&path, &copyfrom));
+				change=apr_pcalloc(subpool, sizeof(*change));
+				change->action=action;
+				change->copyfrom_path= *copyfrom ? copyfrom : NULL;
+				change->copyfrom_rev=copyfrom_rev;
+				apr_hash_set(changed_paths, path, APR_HASH_KEY_STRING, change);
+			}
+		}
+
+		STOPIF_SVNERR( log__receiver,
+				(NULL, changed_paths, entry->rev, 
+				 entry->author, entry->date, entry->message, subpool));
+	}
+
+	*answered=1;
+
+ex:
+	STOP_HANDLE_SVNERR(status_svn);
+ex2:
+	if (subpool) apr_pool_destroy(subpool);
+	IF_FREE(list);
+	IF_FREE(filter);
+	IF_FREE(url_filter);
+	return status;
+}
+
+
 /** -.
  *
  * */
@@ -285,9 +924,16 @@ int log__work(struct estat *root, int argc, char *argv[])
 	int limit;
 	char **normalized;
 	const char *base_url;
+	char *waa_dir, *eos;
+	struct log___cache_t cache;
+	svn_revnum_t head;
+	int answered;
 
 
 	status_svn=NULL;
+	answered=0;
+	memset(&cache, 0, sizeof(cache));
+	cache.fh=-1;
 	STOPIF_CODE_ERR(argc>1, EINVAL,
 			"!This command takes (currently) at most a single path.");
 
@@ -360,6 +1006,7 @@ int log__work(struct estat *root, int argc, char *argv[])
 	}
 
 	/* Calculate the comparison string. */
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_get_repos_root2,
 			(current_url->session, &base_url, global_pool));
 		/* |- current_url->url -|
@@ -413,19 +1060,45 @@ int log__work(struct estat *root, int argc, char *argv[])
 	DEBUGP("log limit at %d", limit);
 
 
-	status_svn=svn_ra_get_log(current_url->session, paths,
-			opt_target_revision, opt_target_revision2,
-			limit,
-			opt__is_verbose() > 0,
-			0, // TODO: stop-on-copy,
-			log__receiver, 
-			NULL, global_pool);
+	if (opt__get_int(OPT__LOG_CACHE))
+	{
+		STOPIF( waa__get_waa_directory(wc_path, &waa_dir, &eos, NULL, 
+					GWD_WAA), NULL);
+		sprintf(eos, "%s%d", WAA__LOG_CACHE_EXT, current_url->internal_number);
+		STOPIF( hlp__strdup( &cache.filename, waa_dir), NULL);
+
+		STOPIF( log___cache_load(&cache, current_url), NULL);
+
+		head=SVN_INVALID_REVNUM;
+		STOPIF( url__canonical_rev(current_url, &head), NULL);
+		STOPIF( log___cache_update(&cache, current_url, head), NULL);
+
+		if (cache.head >= opt_target_revision &&
+				cache.head >= opt_target_revision2)
+			STOPIF( log___cache_query(&cache, 
+						current_url->url + strlen(base_url),
+						log___path_prefix,
+						opt_target_revision, opt_target_revision2, limit, 
+						&answered), NULL);
+	}
 
-	if (status_svn)
+	if (!answered)
 	{
-		if (status_svn->apr_err == -EPIPE)
-			goto ex;
-		STOPIF_SVNERR( status_svn, );
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
+		status_svn=svn_ra_get_log(current_url->session, paths,
+				opt_target_revision, opt_target_revision2,
+				limit,
+				opt__is_verbose() > 0,
+				0, // TODO: stop-on-copy,
+				log__receiver, 
+				NULL, global_pool);
+
+		if (status_svn)
+		{
+			if (status_svn->apr_err == -EPIPE)
+				goto ex;
+			STOPIF_SVNERR( status_svn, );
+		}
 	}
 
 
@@ -434,6 +1107,8 @@ int log__work(struct estat *root, int argc, char *argv[])
 ex:
 	STOP_HANDLE_SVNERR(status_svn);
 ex2:
+	log___cache_free(&cache);
+	IF_FREE(cache.filename);
 	return status;
 }
 
@@ -157,6 +157,47 @@ const struct opt___val_str_t opt___delay_strings[]= {
 };
 
 
+/** Diff engine selection.
+ * See \ref o_diff_engine. */
+const struct opt___val_str_t opt___diff_engine_strings[]= {
+	{ .val=DIFF_ENGINE_AUTO,				.string="auto" },
+	{ .val=DIFF_ENGINE_INTERNAL,		.string="internal" },
+	{ .val=DIFF_ENGINE_EXTERNAL,		.string="external" }, 
+	{ .string=NULL, }
+};
+
+
+/** Status output format.
+ * See \ref o_status_format. */
+const struct opt___val_str_t opt___status_format_strings[]= {
+	{ .val=STATUS_FORMAT_TEXT,		.string="text" },
+	{ .val=STATUS_FORMAT_NUL,			.string="nul" },
+	{ .val=STATUS_FORMAT_JSONL,		.string="jsonl" }, 
+	{ .string=NULL, }
+};
+
+
+/** Performance report format.
+ * See \ref o_perf_report. */
+const struct opt___val_str_t opt___perf_report_strings[]= {
+	{ .val=PERF_REPORT_NO,				.string="no" },
+	{ .val=PERF_REPORT_TEXT,			.string="text" },
+	{ .val=PERF_REPORT_TEXT,			.string="yes" },
+	{ .val=PERF_REPORT_JSON,			.string="json" }, 
+	{ .string=NULL, }
+};
+
+
+/** Local fingerprint algorithms.
+ * See \ref o_fingerprint. */
+const struct opt___val_str_t opt___fingerprint_strings[]= {
+	{ .val=FINGERPRINT_NO,				.string="no" },
+	{ .val=FINGERPRINT_XXH64,			.string="xxh64" },
+	{ .val=FINGERPRINT_XXH64,			.string="yes" },
+	{ .string=NULL, }
+};
+
+
 /** Conflict resolution options.
  * See \ref o_conflict. */
 const struct opt___val_str_t opt___conflict_strings[]= {
@@ -202,6 +243,14 @@ struct opt__list_t opt__list[OPT__COUNT]=
 		.name="log_output", .i_val=LOG__OPT_DEFAULT,
 		.parse=opt___strings2empty_bm, .parm=opt___log_output_strings,
 	},
+	[OPT__LOG_CACHE] = {
+		.name="log_cache", .i_val=OPT__YES,
+		.parse=opt___string2val, .parm=opt___yes_no,
+	},
+	[OPT__REMOTE_CACHE] = {
+		.name="remote_cache", .i_val=OPT__YES,
+		.parse=opt___string2val, .parm=opt___yes_no,
+	},
 	[OPT__COLORDIFF] = {
 		.name="colordiff", .cp_val=NULL, .parse=opt___store_string,
 	},
@@ -213,6 +262,14 @@ struct opt__list_t opt__list[OPT__COUNT]=
 		.name="stat_color", .i_val=OPT__NO, 
 		.parse=opt___string2val, .parm=opt___yes_no,
 	},
+	[OPT__STATUS_FORMAT] = {
+		.name="status_format", .i_val=STATUS_FORMAT_TEXT,
+		.parse=opt___string2val, .parm=opt___status_format_strings,
+	},
+	[OPT__STATUS_STREAM] = {
+		.name="status_stream", .i_val=OPT__NO,
+		.parse=opt___string2val, .parm=opt___yes_no,
+	},
 	[OPT__STOP_ON_CHANGE] = {
 		.name="stop_change", .i_val=OPT__NO, 
 		.parse=opt___string2val, .parm=opt___yes_no,
@@ -268,6 +325,10 @@ struct opt__list_t opt__list[OPT__COUNT]=
 	[OPT__DIFF_EXTRA] = {
 		.name="diff_extra", .cp_val=NULL, .parse=opt___store_string,
 	},
+	[OPT__DIFF_ENGINE] = {
+		.name="diff_engine", .i_val=DIFF_ENGINE_AUTO,
+		.parse=opt___string2val, .parm=opt___diff_engine_strings,
+	},
 
 	[OPT__WARNINGS] = {
 		.name="warning", .parse=opt___parse_warnings,
@@ -326,6 +387,46 @@ struct opt__list_t opt__list[OPT__COUNT]=
 		.name="copyfrom_exp", .i_val=OPT__YES,
 		.parse=opt___string2val, .parm=opt___yes_no,
 	},
+	[OPT__WRITE_THREADS] = {
+		.name="write_threads", .i_val=2, .parse=opt___atoi,
+	},
+	[OPT__COMMIT_PREFETCH] = {
+		.name="commit_prefetch", .i_val=0, .parse=opt___atoi,
+	},
+	[OPT__COMMIT_SPLIT_ENTRIES] = {
+		.name="commit_split_entries", .i_val=0, .parse=opt___atoi,
+	},
+	[OPT__COMMIT_SPLIT_MB] = {
+		.name="commit_split_mb", .i_val=0, .parse=opt___atoi,
+	},
+	[OPT__FETCH_THREADS] = {
+		.name="fetch_threads", .i_val=0, .parse=opt___atoi,
+	},
+	[OPT__SPARSE_FILES] = {
+		.name="sparse_files", .i_val=OPT__YES,
+		.parse=opt___string2val, .parm=opt___yes_no,
+	},
+	[OPT__FINGERPRINT] = {
+		.name="fingerprint", .i_val=FINGERPRINT_NO,
+		.parse=opt___string2val, .parm=opt___fingerprint_strings,
+	},
+	[OPT__WATCH] = {
+		.name="watch", .i_val=OPT__YES,
+		.parse=opt___string2val, .parm=opt___yes_no,
+	},
+	[OPT__PERF_REPORT] = {
+		.name="perf_report", .i_val=PERF_REPORT_NO,
+		.parse=opt___string2val, .parm=opt___perf_report_strings,
+	},
+	[OPT__PERF_OUTPUT] = {
+		.name="perf_output", .cp_val=NULL, .parse=opt___store_string,
+	},
+	[OPT__TRACE_OUTPUT] = {
+		.name="trace_output", .cp_val=NULL, .parse=opt___store_string,
+	},
+	[OPT__TRACE_THRESHOLD] = {
+		.name="trace_threshold", .i_val=100, .parse=opt___atoi,
+	},
 };
 
 
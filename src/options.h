@@ -32,6 +32,12 @@ enum opt__settings_e {
 	/** The option bits for log output.
 	 * See \ref o_logoutput. */
 	OPT__LOG_OUTPUT,
+	/** Whether the log should be cached locally.
+	 * See \ref o_log_cache. */
+	OPT__LOG_CACHE,
+	/** Whether the remote-status result should be cached locally.
+	 * See \ref o_remote_cache. */
+	OPT__REMOTE_CACHE,
 	/** Whether to pipe to colordiff.
 	 * Currently yes/no/auto; possibly path/"auto"/"no"?
 	 * See \ref o_colordiff. */
@@ -42,6 +48,12 @@ enum opt__settings_e {
 	/** Should the status output be colored?
 	 * See \ref o_colordiff*/
 	OPT__STATUS_COLOR,
+	/** Human-readable or machine-readable status output.
+	 * See \ref o_status_format. */
+	OPT__STATUS_FORMAT,
+	/** Whether status records are written out one by one.
+	 * See \ref o_status_format. */
+	OPT__STATUS_STREAM,
 	/** Stop on change.
 	 * See \ref o_stop_change*/
 	OPT__STOP_ON_CHANGE,
@@ -87,6 +99,9 @@ enum opt__settings_e {
 	/** Extra options for the diff program.
 	 * See \ref o_diff. */
 	OPT__DIFF_EXTRA,
+	/** Whether the internal diff engine should be used.
+	 * See \ref o_diff_engine. */
+	OPT__DIFF_ENGINE,
 
 	/** Set warning levels.
 	 * See \ref o_warnings */
@@ -119,6 +134,42 @@ enum opt__settings_e {
 	/** Do expensive copyfrom checks?
 	 * See \ref o_copyfrom_exp */
 	OPT__COPYFROM_EXP,
+	/** Number of threads for writing files.
+	 * See \ref o_write_threads. */
+	OPT__WRITE_THREADS,
+	/** How many files are read ahead on commit.
+	 * See \ref o_commit_prefetch. */
+	OPT__COMMIT_PREFETCH,
+	/** Maximum number of entries per revision on commit.
+	 * See \ref o_commit_split. */
+	OPT__COMMIT_SPLIT_ENTRIES,
+	/** Maximum MB of file data per revision on commit.
+	 * See \ref o_commit_split. */
+	OPT__COMMIT_SPLIT_MB,
+	/** Number of threads fetching files on revert and update.
+	 * See \ref o_fetch_threads. */
+	OPT__FETCH_THREADS,
+	/** Whether zero blocks should be written as holes.
+	 * See \ref o_sparse_files. */
+	OPT__SPARSE_FILES,
+	/** Which local fingerprint is kept for big files.
+	 * See \ref o_fingerprint. */
+	OPT__FINGERPRINT,
+	/** Whether a \ref watch daemon should be asked for changes.
+	 * See \ref o_watch. */
+	OPT__WATCH,
+	/** Whether to print performance counters.
+	 * See \ref o_perf_report. */
+	OPT__PERF_REPORT,
+	/** Where the performance report goes.
+	 * See \ref o_perf_report. */
+	OPT__PERF_OUTPUT,
+	/** Where a trace gets written to.
+	 * See \ref o_trace. */
+	OPT__TRACE_OUTPUT,
+	/** Minimum duration of traced operations, in microseconds.
+	 * See \ref o_trace. */
+	OPT__TRACE_THRESHOLD,
 
 	/** Set a global password, for anonymous co/ci.
 	 * See \ref o_passwd. */
@@ -363,6 +414,45 @@ static inline int opt__is_verbose(void) {
 
 
 
+/** \name List of constants for \ref o_diff_engine option.
+ * @{ */
+enum opt__diff_engine_e {
+	DIFF_ENGINE_AUTO=0,
+	DIFF_ENGINE_INTERNAL,
+	DIFF_ENGINE_EXTERNAL,
+};
+/** @} */
+
+
+/** \name List of constants for \ref o_status_format option.
+ * @{ */
+enum opt__status_format_e {
+	STATUS_FORMAT_TEXT=0,
+	STATUS_FORMAT_NUL,
+	STATUS_FORMAT_JSONL,
+};
+/** @} */
+
+
+/** \name List of constants for \ref o_perf_report option.
+ * @{ */
+enum opt__perf_report_e {
+	PERF_REPORT_NO=0,
+	PERF_REPORT_TEXT,
+	PERF_REPORT_JSON,
+};
+/** @} */
+
+
+/** \name List of constants for \ref o_fingerprint option.
+ * @{ */
+enum opt__fingerprint_e {
+	FINGERPRINT_NO=0,
+	FINGERPRINT_XXH64,
+};
+/** @} */
+
+
 /** \name List of constants for \ref o_conflict option.
  * @{ */
 enum opt__conflict_e {
@@ -0,0 +1,325 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "global.h"
+#include "options.h"
+#include "helper.h"
+#include "perf.h"
+
+
+/** \file
+ * Performance counters, timers and tracing.
+ *
+ * The counters are simply incremented; the phases are timed with the 
+ * monotonic clock, but only if \ref o_perf_report "a report" or \ref 
+ * o_trace "a trace" is wanted.
+ *
+ * For a trace the spans are kept in a ring buffer, so that a long run 
+ * keeps the most recent ones; at the end they're written in the Chrome 
+ * trace-event format, which can be loaded into \c chrome://tracing or 
+ * Perfetto.
+ * */
+
+
+t_ull prf__counter[PRF__C_COUNT];
+struct prf__timer_t prf__timer[PRF__T_COUNT];
+
+
+/** Names of the counters, as used in the report. */
+static const char *prf___counter_names[PRF__C_COUNT]= {
+	[PRF__C_LSTAT] = "lstat",
+	[PRF__C_GETDENTS] = "getdents",
+	[PRF__C_HASHED_BYTES] = "hashed_bytes",
+	[PRF__C_IGNORE_TESTS] = "ignore_tests",
+	[PRF__C_GDBM_OPENS] = "gdbm_opens",
+	[PRF__C_RA_CALLS] = "ra_calls",
+	[PRF__C_RA_BYTES] = "ra_bytes",
+	[PRF__C_FINGERPRINTS] = "fingerprints",
+};
+
+/** Names of the phases, as used in the report. */
+static const char *prf___timer_names[PRF__T_COUNT]= {
+	[PRF__T_TOTAL] = "total",
+	[PRF__T_DIR_LOAD] = "dir_load",
+	[PRF__T_SCAN] = "scan",
+	[PRF__T_DIR_SAVE] = "dir_save",
+};
+
+
+/** How many spans are kept. */
+#define PRF___TRACE_EVENTS (64*1024)
+/** How much of the detail string is kept. */
+#define PRF___DETAIL_LEN (96)
+
+/** A recorded span. */
+struct prf___event_t {
+	/** Name of the span; a constant string. */
+	const char *name;
+	/** Start and duration, in nanoseconds. */
+	t_ull start, duration;
+	/** The recording thread. */
+	int tid;
+	/** Eg. the path; if it's too long, only the end is kept. */
+	char detail[PRF___DETAIL_LEN];
+};
+
+/** The ring buffer; allocated in prf__init(), before any thread is 
+ * started. */
+static struct prf___event_t *prf___events=NULL;
+/** How many spans were recorded; modulo \c PRF___TRACE_EVENTS that's the 
+ * next position in the ring. */
+static unsigned long prf___event_count=0;
+
+
+/** Returns the time of \a ts in nanoseconds. */
+static inline t_ull prf___ns(struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+
+/** Returns the id of the calling thread, for the trace. */
+static inline int prf___tid(void)
+{
+#ifdef SYS_gettid
+	return syscall(SYS_gettid);
+#else
+	return getpid();
+#endif
+}
+
+
+/** -.
+ * Must be called after the options are known, and before any threads 
+ * get started. */
+int prf__init(void)
+{
+	int status;
+
+	status=0;
+	if (PRF__TRACING() && !prf___events)
+		STOPIF( hlp__calloc( &prf___events, 
+					PRF___TRACE_EVENTS, sizeof(*prf___events)), NULL);
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * Taking the ring position is atomic, so that threads can record spans, 
+ * too. */
+void prf__span(struct timespec *start, const char *name, 
+		const char *detail, int always)
+{
+	struct timespec now;
+	struct prf___event_t *ev;
+	t_ull duration;
+	unsigned long pos;
+	int len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	duration=prf___ns(&now) - prf___ns(start);
+	if (!always && 
+			duration < opt__get_int(OPT__TRACE_THRESHOLD) * 1000ULL)
+		return;
+
+	if (!prf___events) return;
+
+	pos=__atomic_fetch_add(&prf___event_count, 1, __ATOMIC_RELAXED);
+	ev=prf___events + pos % PRF___TRACE_EVENTS;
+
+	ev->name=name;
+	ev->start=prf___ns(start);
+	ev->duration=duration;
+	ev->tid=prf___tid();
+	ev->detail[0]=0;
+	if (detail)
+	{
+		len=strlen(detail);
+		if (len >= PRF___DETAIL_LEN)
+			detail += len - (PRF___DETAIL_LEN-1);
+		strncpy(ev->detail, detail, PRF___DETAIL_LEN-1);
+		ev->detail[PRF___DETAIL_LEN-1]=0;
+	}
+}
+
+
+/** -. */
+void prf__add_time(enum prf__timer_e which, struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	prf__timer[which].ns += prf___ns(&now) - prf___ns(start);
+	prf__timer[which].calls++;
+
+	if (PRF__TRACING())
+		prf__span(start, prf___timer_names[which], NULL, 1);
+}
+
+
+/** Writes the report as text. */
+static int prf___text(FILE *output)
+{
+	int i;
+
+	fprintf(output, "Performance report:\n");
+	for(i=0; i<PRF__T_COUNT; i++)
+		fprintf(output, "  %-14s %10.6f s  (%u calls)\n",
+				prf___timer_names[i], prf__timer[i].ns / 1e9, 
+				prf__timer[i].calls);
+	for(i=0; i<PRF__C_COUNT; i++)
+		fprintf(output, "  %-14s %12llu\n",
+				prf___counter_names[i], prf__counter[i]);
+
+	return ferror(output) ? errno : 0;
+}
+
+
+/** Writes the report as a single JSON object. */
+static int prf___json(FILE *output)
+{
+	int i;
+
+	fprintf(output, "{\"timers\":{");
+	for(i=0; i<PRF__T_COUNT; i++)
+		fprintf(output, "%s\"%s\":{\"seconds\":%.6f,\"calls\":%u}",
+				i ? "," : "",
+				prf___timer_names[i], prf__timer[i].ns / 1e9, 
+				prf__timer[i].calls);
+	fprintf(output, "},\"counters\":{");
+	for(i=0; i<PRF__C_COUNT; i++)
+		fprintf(output, "%s\"%s\":%llu",
+				i ? "," : "",
+				prf___counter_names[i], prf__counter[i]);
+	fprintf(output, "}}\n");
+
+	return ferror(output) ? errno : 0;
+}
+
+
+/** Writes \a string as JSON string. */
+static void prf___json_string(FILE *output, const char *string)
+{
+	const unsigned char *cp;
+
+	fputc('"', output);
+	for(cp=(const unsigned char*)string; *cp; cp++)
+	{
+		if (*cp == '"' || *cp == '\\')
+			fprintf(output, "\\%c", *cp);
+		else if (*cp < 0x20)
+			fprintf(output, "\\u%04x", *cp);
+		else
+			fputc(*cp, output);
+	}
+	fputc('"', output);
+}
+
+
+/** Writes the recorded spans to the file given in \ref o_trace 
+ * "trace_output". */
+static int prf___trace_write(void)
+{
+	int status;
+	FILE *output;
+	unsigned long i, first;
+	struct prf___event_t *ev;
+	int pid;
+
+
+	status=0;
+	output=fopen(opt__get_string(OPT__TRACE_OUTPUT), "w");
+	STOPIF_CODE_ERR( !output, errno, 
+			"Cannot open the trace file \"%s\"", 
+			opt__get_string(OPT__TRACE_OUTPUT));
+
+	/* If the ring has wrapped, start with the oldest span. */
+	first= prf___event_count > PRF___TRACE_EVENTS ? 
+		prf___event_count - PRF___TRACE_EVENTS : 0;
+	pid=getpid();
+
+	fprintf(output, "{\"traceEvents\":[\n");
+	for(i=first; prf___events && i<prf___event_count; i++)
+	{
+		ev=prf___events + i % PRF___TRACE_EVENTS;
+		fprintf(output, "%s{\"name\":\"%s\",\"cat\":\"fsvs\",\"ph\":\"X\","
+				"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+				i == first ? "" : ",\n",
+				ev->name, ev->start/1e3, ev->duration/1e3, pid, ev->tid);
+		if (ev->detail[0])
+		{
+			fprintf(output, ",\"args\":{\"detail\":");
+			prf___json_string(output, ev->detail);
+			fputc('}', output);
+		}
+		fputc('}', output);
+	}
+	fprintf(output, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	status=ferror(output) ? errno : 0;
+	if (fclose(output) && !status)
+		status=errno;
+	STOPIF( status, "Writing the trace file \"%s\"",
+			opt__get_string(OPT__TRACE_OUTPUT));
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * The report goes to \c STDERR, or to the file given with \ref 
+ * o_perf_report "perf_output". */
+int prf__report(void)
+{
+	int status;
+	const char *fn;
+	FILE *output;
+
+
+	status=0;
+	output=NULL;
+	if (PRF__TRACING())
+		STOPIF( prf___trace_write(), NULL);
+
+	if (!opt__get_int(OPT__PERF_REPORT)) goto ex;
+
+	fn=opt__get_string(OPT__PERF_OUTPUT);
+	if (!fn || !*fn || strcmp(fn, "-") == 0)
+		output=stderr;
+	else
+	{
+		output=fopen(fn, "w");
+		STOPIF_CODE_ERR( !output, errno, 
+				"Cannot open the performance report file \"%s\"", fn);
+	}
+
+	if (opt__get_int(OPT__PERF_REPORT) == PERF_REPORT_JSON)
+		status=prf___json(output);
+	else
+		status=prf___text(output);
+	STOPIF( status, "Writing the performance report");
+
+ex:
+	if (output && output != stderr)
+	{
+		if (fclose(output) && !status)
+			status=errno;
+	}
+	return status;
+}
+
@@ -0,0 +1,122 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <time.h>
+
+#include "global.h"
+#include "options.h"
+
+/** \file
+ * Performance counters, timers and tracing header file.
+ *
+ * See \ref o_perf_report and \ref o_trace. */
+
+
+/** The counters. */
+enum prf__counter_e {
+	/** \c lstat() calls. */
+	PRF__C_LSTAT=0,
+	/** Directory reads (\c getdents64() or \c readdir()). */
+	PRF__C_GETDENTS,
+	/** Bytes read in cs__compare_file(). */
+	PRF__C_HASHED_BYTES,
+	/** Ignore patterns tested. */
+	PRF__C_IGNORE_TESTS,
+	/** GDBM databases opened. */
+	PRF__C_GDBM_OPENS,
+	/** Requests to the repository. */
+	PRF__C_RA_CALLS,
+	/** Bytes sent to and received from the repository. */
+	PRF__C_RA_BYTES,
+	/** Files compared via their fingerprint, instead of the MD5. */
+	PRF__C_FINGERPRINTS,
+	PRF__C_COUNT
+};
+
+/** The timed phases. */
+enum prf__timer_e {
+	/** The whole run. */
+	PRF__T_TOTAL=0,
+	/** Loading the entry list, waa__input_tree(). */
+	PRF__T_DIR_LOAD,
+	/** Looking for changes, waa__update_tree(). */
+	PRF__T_SCAN,
+	/** Writing the entry list, waa__output_tree(). */
+	PRF__T_DIR_SAVE,
+	PRF__T_COUNT
+};
+
+/** Accumulated time of a phase. */
+struct prf__timer_t {
+	/** Nanoseconds spent. */
+	t_ull ns;
+	/** How often it was run. */
+	unsigned calls;
+};
+
+extern t_ull prf__counter[PRF__C_COUNT];
+extern struct prf__timer_t prf__timer[PRF__T_COUNT];
+
+
+/** Adds \a n to the counter \a which.
+ * That's always done; it's cheaper than asking whether it's needed. */
+#define PRF__COUNT(which, n) do { prf__counter[which] += (n); } while (0)
+
+/** Whether spans get recorded; for string options \c i_val is the 
+ * length. */
+#define PRF__TRACING() (opt__get_int(OPT__TRACE_OUTPUT) > 0)
+
+/** Whether phases are timed. */
+#define PRF__TIMING() (opt__get_int(OPT__PERF_REPORT) || PRF__TRACING())
+
+/** Remembers the start time in \a stamp (a <tt>struct timespec</tt>), if 
+ * a report or trace is wanted. */
+#define PRF__START(stamp) do { 																\
+	if (PRF__TIMING())																							\
+		clock_gettime(CLOCK_MONOTONIC, &(stamp));										\
+} while (0)
+
+/** Adds the time since \a stamp to the phase \a which; when tracing, 
+ * that's recorded as a span, too. */
+#define PRF__STOP(which, stamp) do { 													\
+	if (PRF__TIMING())																							\
+		prf__add_time(which, &(stamp));															\
+} while (0)
+
+/** Adds the time since \a start to the phase \a which. */
+void prf__add_time(enum prf__timer_e which, struct timespec *start);
+
+
+/** Remembers the start time of a span in \a stamp, if tracing. */
+#define PRF__SPAN_START(stamp) do { 													\
+	if (PRF__TRACING())																							\
+		clock_gettime(CLOCK_MONOTONIC, &(stamp));										\
+} while (0)
+
+/** Records the span \a name since \a stamp, with \a detail (eg. a path, 
+ * may be \c NULL), if it took at least \ref o_trace "trace_threshold". */
+#define PRF__SPAN_END(stamp, name, detail) do { 							\
+	if (PRF__TRACING())																							\
+		prf__span(&(stamp), name, detail, 0);												\
+} while (0)
+
+/** Records a span; spans shorter than the threshold are dropped, unless 
+ * \a always is set. */
+void prf__span(struct timespec *start, const char *name, 
+		const char *detail, int always);
+
+/** Allocates the trace buffer, if tracing. */
+int prf__init(void);
+
+/** Prints the report and writes the trace, if requested. */
+int prf__report(void);
+
+#endif
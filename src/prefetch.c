@@ -0,0 +1,300 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "global.h"
+#include "helper.h"
+#include "options.h"
+#include "prefetch.h"
+
+
+/** \file
+ * Read-ahead for \ref commit.
+ *
+ * The commit editor gets the file data strictly one file after the other;
+ * reading, hashing and sending each file synchronously means that the
+ * disk sits idle while we're hashing or waiting for the network, and the
+ * network is idle while we're waiting for the disk.
+ *
+ * So, before the editor drive starts, the files that will have their
+ * data sent are queued here, in the order in which the editor will want
+ * them; a few reader threads then open the next few files (see \ref
+ * o_commit_prefetch) ahead of the editor, and ask the kernel to read their
+ * data into the page cache. When the editor thread gets to a file, its
+ * data should already be in memory, and the only thing left to wait for
+ * is the network.
+ *
+ * The hashing and the delta windows are still done in the editor thread:
+ * the manber filter keeps per-file state in the \ref md5s writer, the
+ * encoders run external processes, and the subversion streams and pools
+ * must not be shared between threads; and the svndiff encoding happens
+ * inside the RA layer's window handler anyway.
+ *
+ * The reader threads never call into APR or subversion; they only
+ * \c open(), \c posix_fadvise() or \c read(), and \c close().
+ *
+ * The queue is not strict: if the editor thread skips some queued files, 
+ * pf__reached() moves the readers past them; a file that wasn't queued is 
+ * simply read by the editor thread. */
+
+
+/** Number of reader threads. These mostly wait for \c open(), so there's
+ * no need to have more. */
+#define PF___THREADS (2)
+/** Only that many bytes per file get read ahead, so that a few big files
+ * don't throw everything else out of the page cache. */
+#define PF___MAX_BYTES (32*1024*1024)
+/** Buffer size for reading, if \c posix_fadvise() isn't available. */
+#define PF___READ_BUFFER (64*1024)
+
+
+/** One queued file. */
+struct pf___file_t {
+	/** The entry, to recognize it in pf__reached(). */
+	struct estat *sts;
+	/** A copy of the path, as the reader threads can't build it. */
+	char *path;
+	/** How many bytes to read ahead. */
+	off_t len;
+};
+
+
+#ifdef HAVE_PTHREAD
+/** The mutex for all the variables below. */
+static pthread_mutex_t pf___mutex=PTHREAD_MUTEX_INITIALIZER;
+/** Signalled when a file gets queued, when the editor thread progresses,
+ * and on stopping. */
+static pthread_cond_t pf___work=PTHREAD_COND_INITIALIZER;
+/** The threads, for joining them. */
+static pthread_t pf___thread_ids[PF___THREADS];
+#endif
+
+/** Number of running reader threads. */
+static int pf___threads=0;
+/** How many files may be read ahead of the editor thread. */
+static int pf___ahead;
+/** Whether the threads should finish. */
+static int pf___stopping;
+/** The queue, in editor order. */
+static struct pf___file_t *pf___files;
+/** Number of queued files, and allocated slots. */
+static unsigned pf___count, pf___max;
+/** The next file to be read ahead. */
+static unsigned pf___next;
+/** The first file the editor thread hasn't got to yet. */
+static unsigned pf___reached;
+
+
+#ifdef HAVE_PTHREAD
+/** Gets the data of \a path into the page cache.
+ * Errors are ignored; the editor thread will see them as well. */
+static void pf___read_ahead(const char *path, off_t len)
+{
+	int fd;
+#ifndef HAVE_POSIX_FADVISE
+	char buffer[PF___READ_BUFFER];
+	ssize_t got;
+#endif
+
+	fd=open(path, O_RDONLY | O_NOCTTY);
+	if (fd == -1) return;
+
+#ifdef HAVE_POSIX_FADVISE
+	/* The kernel starts reading now, without us having to wait. */
+	posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+#else
+	while (len > 0)
+	{
+		got=read(fd, buffer, sizeof(buffer));
+		if (got == -1 && errno == EINTR) continue;
+		if (got <= 0) break;
+		len-=got;
+	}
+#endif
+
+	close(fd);
+}
+
+
+/** The reader thread.
+ * Takes the next file, as long as that is not too far ahead of the editor
+ * thread. */
+static void *pf___thread(void *arg UNUSED)
+{
+	char *path;
+	off_t len;
+
+	pthread_mutex_lock(&pf___mutex);
+	while (!pf___stopping)
+	{
+		if (pf___next < pf___count &&
+				pf___next < pf___reached + pf___ahead)
+		{
+			/* The array may get reallocated while we're reading; so take what
+			 * we need now. The path itself isn't freed before we're joined. */
+			path=pf___files[pf___next].path;
+			len=pf___files[pf___next].len;
+			pf___next++;
+			pthread_mutex_unlock(&pf___mutex);
+
+			pf___read_ahead(path, len);
+
+			pthread_mutex_lock(&pf___mutex);
+		}
+		else
+			pthread_cond_wait(&pf___work, &pf___mutex);
+	}
+	pthread_mutex_unlock(&pf___mutex);
+
+	return NULL;
+}
+#endif
+
+
+/** -.
+ * Returns whether read-ahead is done; if not, the caller needn't queue
+ * anything. */
+int pf__start(void)
+{
+#ifdef HAVE_PTHREAD
+	sigset_t all, old;
+
+	BUG_ON(pf___threads, "read-ahead already running");
+	pf___ahead=opt__get_int(OPT__COMMIT_PREFETCH);
+	if (pf___ahead <= 0) goto ex;
+
+	pf___stopping=0;
+	pf___count=pf___next=pf___reached=0;
+
+	/* Signals should be handled in the main thread only; the threads
+	 * inherit the blocked mask. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	while (pf___threads < PF___THREADS &&
+			pthread_create(pf___thread_ids+pf___threads, NULL,
+				pf___thread, NULL) == 0)
+		pf___threads++;
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+ex:
+#endif
+	DEBUGP("%d reader threads, %d files ahead", pf___threads, pf___ahead);
+	return pf___threads > 0;
+}
+
+
+/** -.
+ * \a path is copied. */
+int pf__add(struct estat *sts, const char *path)
+{
+	int status;
+#ifdef HAVE_PTHREAD
+	struct pf___file_t *file;
+	char *copy;
+#endif
+
+	status=0;
+	if (!pf___threads) goto ex;
+
+#ifdef HAVE_PTHREAD
+	STOPIF( hlp__strdup( &copy, path), NULL);
+
+	pthread_mutex_lock(&pf___mutex);
+	if (pf___count >= pf___max)
+	{
+		pf___max = pf___max ? pf___max*2 : 1024;
+		file=realloc(pf___files, pf___max * sizeof(*pf___files));
+		if (!file)
+		{
+			pthread_mutex_unlock(&pf___mutex);
+			IF_FREE(copy);
+			STOPIF(ENOMEM, NULL);
+		}
+		pf___files=file;
+	}
+
+	file=pf___files + pf___count;
+	file->sts=sts;
+	file->path=copy;
+	file->len= sts->st.size < PF___MAX_BYTES ? sts->st.size : PF___MAX_BYTES;
+	pf___count++;
+
+	pthread_cond_signal(&pf___work);
+	pthread_mutex_unlock(&pf___mutex);
+#endif
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * Normally \a sts is one of the next few queued files; if it isn't, the 
+ * rest of the queue is searched, so that the readers get in front of the 
+ * editor thread again.
+ * Files that were skipped over needn't be read any more. */
+void pf__reached(struct estat *sts)
+{
+#ifdef HAVE_PTHREAD
+	unsigned i;
+
+	if (!pf___threads) return;
+
+	pthread_mutex_lock(&pf___mutex);
+	for(i=pf___reached; i<pf___count; i++)
+		if (pf___files[i].sts == sts) break;
+
+	if (i < pf___count)
+	{
+		if (i >= pf___reached + pf___ahead)
+			DEBUGP("editor skipped %u queued files", i - pf___reached);
+
+		pf___reached=i+1;
+		if (pf___next < pf___reached)
+			pf___next=pf___reached;
+		pthread_cond_broadcast(&pf___work);
+	}
+	else
+		DEBUGP("%s wasn't queued", sts->name);
+	pthread_mutex_unlock(&pf___mutex);
+#endif
+}
+
+
+/** -.
+ * Can be called any number of times. */
+void pf__stop(void)
+{
+#ifdef HAVE_PTHREAD
+	unsigned i;
+
+	if (!pf___threads) return;
+
+	pthread_mutex_lock(&pf___mutex);
+	pf___stopping=1;
+	pthread_cond_broadcast(&pf___work);
+	pthread_mutex_unlock(&pf___mutex);
+
+	while (pf___threads)
+		pthread_join(pf___thread_ids[--pf___threads], NULL);
+
+	DEBUGP("%u of %u files read ahead", pf___next, pf___count);
+	for(i=0; i<pf___count; i++)
+		IF_FREE(pf___files[i].path);
+	IF_FREE(pf___files);
+	pf___count=pf___max=0;
+#endif
+}
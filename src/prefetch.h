@@ -0,0 +1,28 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "global.h"
+
+/** \file
+ * Read-ahead for commit header file. */
+
+
+/** Starts the reader threads, as configured by \ref o_commit_prefetch. */
+int pf__start(void);
+/** Queues the file \a sts at \a path for read-ahead; the files have to be
+ * given in the order in which they'll be sent. */
+int pf__add(struct estat *sts, const char *path);
+/** Tells the reader threads that the editor has got to \a sts. */
+void pf__reached(struct estat *sts);
+/** Stops the reader threads, and forgets the queue. */
+void pf__stop(void);
+
+#endif
@@ -453,7 +453,7 @@ int prp__get(hash_t db, const char * const keycp, datum *value)
  * The meta-data of the entry is overwritten with the data coming from the 
  * repository; its \ref estat::remote_status is set.
  * If \a props_db is not NULL, the still opened property database is 
- * returned.
+ * returned; if no property had to be stored, that's \c NULL.
  * */
 int prp__set_from_aprhash(struct estat *sts, 
 		apr_hash_t *props, 
@@ -485,6 +485,10 @@ int prp__set_from_aprhash(struct estat *sts,
 	 *
 	 * Debian bug #514704.
 	 *
+	 * So the database is only created when the first property has to be 
+	 * stored; the auto-props of a group, for example, often have only 
+	 * meta-data. If nothing gets stored, the old file is just removed.
+	 *
 	 * (Removing of old properties is needed because we'd only know in 
 	 * cb__record_changes() that properties get removed; in revert we only 
 	 * have the new list.
@@ -494,21 +498,6 @@ int prp__set_from_aprhash(struct estat *sts,
 	db=NULL;
 	hi=apr_hash_first(pool, props);
 
-	if (flags & STORE_IN_FS)
-	{
-		/* If we want to write the data to disk, but there is nothing to write 
-		 * (and the caller doesn't need the DB), just remove the file. See 
-		 * above.  */
-		if (!hi && !props_db)
-		{
-			STOPIF( prp__unlink_db_for_estat(sts), NULL);
-			goto ex;
-		}
-
-		STOPIF( prp__open_byestat(sts, 
-					GDBM_NEWDB | HASH_REMEMBER_FILENAME, &db), NULL);
-	}
-
 	for (; hi; hi = apr_hash_next(hi)) 
 	{
 		/* As the name/key is a (char*), we don't need its length. */
@@ -525,6 +514,10 @@ int prp__set_from_aprhash(struct estat *sts,
 
 		if (to_store)
 		{
+			if (!db && (flags & STORE_IN_FS))
+				STOPIF( prp__open_byestat(sts, 
+							GDBM_NEWDB | HASH_REMEMBER_FILENAME, &db), NULL);
+
 			if (db)
 			{
 				/** \todo - store in utf-8? local encoding?
@@ -543,6 +536,9 @@ int prp__set_from_aprhash(struct estat *sts,
 	}
 
 	DEBUGP("%d properties stored", count);
+	if (!db && (flags & STORE_IN_FS))
+		STOPIF( prp__unlink_db_for_estat(sts), NULL);
+
 	if (props_db)
 		*props_db=db;
 	else
@@ -680,6 +676,9 @@ int prp__s_work(struct estat *root, int argc, char *argv[])
 			/* Get group. */
 			STOPIF( ign__is_ignore(sts, &change), NULL);
 			STOPIF( ops__apply_group(sts, &db, NULL), NULL);
+			/* Only entries with properties get a database from that. */
+			if (!db)
+				STOPIF( prp__open_byestat(sts, GDBM_WRCREAT, &db), NULL);
 
 			if (!sts->url)
 				sts->url=current_url;
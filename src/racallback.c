@@ -13,6 +13,9 @@
 
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <subversion-1/svn_ra.h>
 #include <subversion-1/svn_auth.h>
@@ -29,36 +32,38 @@
 #include "status.h"
 #include "cache.h"
 #include "url.h"
+#include "waa.h"
+#include "options.h"
 #include "racallback.h"
+#include "perf.h"
 
 
-svn_error_t *cb__init(apr_pool_t *pool)
+/** -.
+ * The providers (and the credentials they cache) belong to the baton, so 
+ * eg. fetch threads need their own; these shouldn't ask on the terminal, 
+ * so \a non_interactive should be set for them. */
+svn_error_t *cb__new_auth_baton(svn_auth_baton_t **baton, 
+		int non_interactive, apr_pool_t *pool)
 {
 	int status;
 	svn_error_t *status_svn;
 	apr_hash_t *cfg_hash;
 	svn_config_t *cfg;
-	char *cfg_usr_path;
 
 
-	cfg_usr_path = NULL;
 	STOPIF( hlp__get_svn_config(&cfg_hash), NULL);
 
 	cfg = apr_hash_get(cfg_hash, SVN_CONFIG_CATEGORY_CONFIG,
 			APR_HASH_KEY_STRING);
 
-	 /* make sure that folders for storing authentications credentials are created */
-	STOPIF_SVNERR( svn_config_ensure, (cfg_usr_path, pool));
-
-	/* Set up Authentication stuff. */
 	STOPIF_SVNERR( svn_cmdline_setup_auth_baton,
-			(&cb__cb_table.auth_baton,
-			 !(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)),
+			(baton,
+			 non_interactive,
 			 opt__get_int(OPT__AUTHOR) ?
 			 opt__get_string(OPT__AUTHOR) : NULL,
 			 opt__get_int(OPT__PASSWD) ?
 			 opt__get_string(OPT__PASSWD) : NULL,
-			 cfg_usr_path,
+			 NULL, /* config dir */
 			 0, /* no_auth_cache */
 			 cfg,
 			 NULL, /* cancel function */
@@ -66,7 +71,30 @@ svn_error_t *cb__init(apr_pool_t *pool)
 			 pool)
 			);
 
-	BUG_ON(!cb__cb_table.auth_baton);
+	BUG_ON(!*baton);
+
+ex:
+	RETURN_SVNERR(status);
+}
+
+
+svn_error_t *cb__init(apr_pool_t *pool)
+{
+	int status;
+	svn_error_t *status_svn;
+	char *cfg_usr_path;
+
+
+	cfg_usr_path = NULL;
+
+	 /* make sure that folders for storing authentications credentials are created */
+	STOPIF_SVNERR( svn_config_ensure, (cfg_usr_path, pool));
+
+	/* Set up Authentication stuff. */
+	STOPIF_SVNERR( cb__new_auth_baton, 
+			(&cb__cb_table.auth_baton,
+			 !(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)),
+			 pool));
 
 ex:
 	RETURN_SVNERR(status);
@@ -93,7 +121,21 @@ ex:
 }
 
 
-struct svn_ra_callbacks_t cb__cb_table=
+/** Counts the bytes transferred, for \ref o_perf_report.
+ *
+ * \a progress is the total of the current session; when a new session 
+ * starts, it begins at \c 0 again. */
+static void cb___progress(apr_off_t progress, apr_off_t total UNUSED,
+		void *baton UNUSED, apr_pool_t *pool UNUSED)
+{
+	static apr_off_t last=0;
+
+	PRF__COUNT(PRF__C_RA_BYTES, progress >= last ? progress-last : progress);
+	last=progress;
+}
+
+
+struct svn_ra_callbacks2_t cb__cb_table=
 {
 	.open_tmp_file = cb__open_tmp,
 	.auth_baton = NULL,
@@ -102,6 +144,9 @@ struct svn_ra_callbacks_t cb__cb_table=
 	.set_wc_prop=NULL,
 	.push_wc_prop=NULL,
 	.invalidate_wc_props=NULL,
+
+	.progress_func=cb___progress,
+	.progress_baton=NULL,
 };
 
 
@@ -222,9 +267,9 @@ int cb__add_entry(struct estat *dir,
     sts->entry_count=0;
     sts->by_inode=NULL;
     sts->by_name=NULL;
-    sts->strings=NULL;
+    if (sts->cold)
+      sts->cold->strings = sts->cold->decoder = NULL;
 
-    sts->decoder=NULL;
     sts->has_orig_md5=0;
 		memset(& sts->md5, 0, sizeof(sts->md5));
 
@@ -320,18 +365,19 @@ int cb___store_prop(struct estat *sts,
 
 	if (action->keep_user_prop && user_prop)
 	{
-		if (!sts->user_prop)
+		if (!COLD(sts, user_prop))
 		{
 			/* The root entry has no associated URL, so it has no pool.
 			 * Normally there shouldn'd be any user-properties, though. */
 			STOPIF( apr_pool_create(&u_p_pool, sts->url ? 
 						sts->url->pool : global_pool), NULL);
 
-			sts->user_prop=apr_hash_make(u_p_pool);
-			apr_hash_set(sts->user_prop, "", 0, u_p_pool);
+			STOPIF( ops__make_cold(sts), NULL);
+			sts->cold->user_prop=apr_hash_make(u_p_pool);
+			apr_hash_set(sts->cold->user_prop, "", 0, u_p_pool);
 		}
 		else
-			u_p_pool=apr_hash_get(sts->user_prop, "", 0);
+			u_p_pool=apr_hash_get(sts->cold->user_prop, "", 0);
 
 
 		/* apr_hash_set() only stores an address; we have to take care to not 
@@ -339,7 +385,7 @@ int cb___store_prop(struct estat *sts,
 		 * invalid after closing this entry. */
 		copy=apr_palloc(u_p_pool, strlen(utf8_name)+1);
 		strcpy(copy, utf8_name);
-		apr_hash_set(sts->user_prop, copy, APR_HASH_KEY_STRING, 
+		apr_hash_set(sts->cold->user_prop, copy, APR_HASH_KEY_STRING, 
 				svn_string_dup(value, u_p_pool) );
 
 #ifdef ENABLE_DEBUG
@@ -439,7 +485,8 @@ svn_error_t *cb___add_directory(const char *utf8_path,
 		 * shared storage space. */
 		sts->entry_count=0;
 		sts->by_inode = sts->by_name = NULL;
-		sts->strings = NULL;
+		if (sts->cold)
+			sts->cold->strings = NULL;
 		sts->other_revs=sts->to_be_sorted=0;
 	}
 
@@ -629,7 +676,7 @@ svn_error_t *cb___close_file(void *file_baton,
 
 	if (!S_ISDIR(sts->st.mode))
 	{ 
-		if (sts->has_orig_md5 || sts->decoder)
+		if (sts->has_orig_md5 || COLD(sts, decoder))
 			DEBUGP("Has an original MD5, %s not used", text_checksum);
 		else
 			if (text_checksum)
@@ -706,14 +753,619 @@ const svn_delta_editor_t cb___change_recorder =
 /** @} */
 
 
-int cb___report_path_rev(struct estat *dir, 
-		const svn_ra_reporter2_t *reporter,
-		void *report_baton, 
+/** ----------------------------------------------------------------------------
+ * \defgroup rscache Remote-status cache
+ * The last result of \ref remote-status, per URL.
+ * @{
+ *
+ * The status drive from the repository only depends on the revisions the 
+ * working copy is at (see \ref pathrevs) and on the target revision; so, 
+ * while these don't change, asking again gives the same editor calls.
+ *
+ * These calls are recorded in the \ref rstc "rstc" file, and replayed into 
+ * cb___change_recorder() the next time; the changes are then found 
+ * without another network drive. Everything local (eg. the entry types, 
+ * and the output) is done by the change recorder, so that's as current as 
+ * on a real drive.
+ *
+ * The file format is
+ * \code
+ *   FSVS remote-status cache 1\n
+ *   U<URL>\0\n
+ *   <base revision> <target revision> <summary>\n
+ * \endcode
+ * where the summary is a digest of the \c set_path() calls, or \c - if 
+ * there are none.
+ * followed by one line per editor call; the first character is the call,
+ * paths and names are \c \\0 terminated:
+ * \code
+ *   r<revision>\n           set_target_revision
+ *   R\n                     open_root
+ *   x<path>\0\n             delete_entry
+ *   a<path>\0\n             add_directory
+ *   o<path>\0\n             open_directory
+ *   c\n                     close_directory
+ *   A<path>\0\n             add_file
+ *   O<path>\0\n             open_file
+ *   t\n                     apply_textdelta
+ *   p<len> <name>\0<data>\n change_*_prop; \c - as length for removal
+ *   C<checksum>\0\n         close_file
+ *   e\n                     close_edit
+ * \endcode
+ * A file that doesn't end with the \c e line is incomplete, and ignored.
+ *
+ * If \c HEAD has moved, a full drive is done, and the file is replaced;  
+ * combining the cached result with a newer drive would report entries 
+ * twice.
+ * */
+#define CB___RSC_HEADER "FSVS remote-status cache 1\n"
+
+/** Where the editor calls are written to, or \c NULL. */
+static FILE *cb___rsc_out;
+/** The temporary file that is written; it's renamed to the cache file 
+ * when the drive is complete, so that another process never sees a 
+ * half-written cache. */
+static char *cb___rsc_tmp;
+
+
+/** Writes a record \a code with the optional string \a str. */
+static void cb___rsc_put(char code, const char *str)
+{
+	putc(code, cb___rsc_out);
+	if (str)
+		fwrite(str, strlen(str)+1, 1, cb___rsc_out);
+	putc('\n', cb___rsc_out);
+}
+
+
+static svn_error_t *cb___rsc_set_target_revision(void *edit_baton,
+		svn_revnum_t rev,
 		apr_pool_t *pool)
 {
-	int status, i;
-	struct estat *sts;
+	fprintf(cb___rsc_out, "r%ld\n", (long)rev);
+	return cb___set_target_revision(edit_baton, rev, pool);
+}
+
+static svn_error_t *cb___rsc_open_root(void *edit_baton,
+		svn_revnum_t base_revision,
+		apr_pool_t *dir_pool,
+		void **root_baton)
+{
+	cb___rsc_put('R', NULL);
+	return cb___open_root(edit_baton, base_revision, dir_pool, root_baton);
+}
+
+static svn_error_t *cb___rsc_delete_entry(const char *utf8_path,
+		svn_revnum_t revision,
+		void *parent_baton,
+		apr_pool_t *pool)
+{
+	cb___rsc_put('x', utf8_path);
+	return cb___delete_entry(utf8_path, revision, parent_baton, pool);
+}
+
+static svn_error_t *cb___rsc_add_directory(const char *utf8_path,
+		void *parent_baton,
+		const char *utf8_copy_path,
+		svn_revnum_t copy_rev,
+		apr_pool_t *dir_pool,
+		void **child_baton)
+{
+	cb___rsc_put('a', utf8_path);
+	return cb___add_directory(utf8_path, parent_baton, 
+			utf8_copy_path, copy_rev, dir_pool, child_baton);
+}
+
+static svn_error_t *cb___rsc_open_directory(const char *utf8_path,
+		void *parent_baton,
+		svn_revnum_t base_revision,
+		apr_pool_t *dir_pool,
+		void **child_baton)
+{
+	cb___rsc_put('o', utf8_path);
+	return cb___open_directory(utf8_path, parent_baton, 
+			base_revision, dir_pool, child_baton);
+}
+
+/** Writes a property record. */
+static void cb___rsc_prop(const char *utf8_name, const svn_string_t *value)
+{
+	if (value)
+		fprintf(cb___rsc_out, "p%lu ", (unsigned long)value->len);
+	else
+		fputs("p- ", cb___rsc_out);
+
+	fwrite(utf8_name, strlen(utf8_name)+1, 1, cb___rsc_out);
+	if (value)
+		fwrite(value->data, value->len, 1, cb___rsc_out);
+	putc('\n', cb___rsc_out);
+}
+
+static svn_error_t *cb___rsc_change_dir_prop(void *dir_baton,
+		const char *utf8_name,
+		const svn_string_t *value,
+		apr_pool_t *pool)
+{
+	cb___rsc_prop(utf8_name, value);
+	return cb___change_dir_prop(dir_baton, utf8_name, value, pool);
+}
+
+static svn_error_t *cb___rsc_close_directory(void *dir_baton,
+		apr_pool_t *pool)
+{
+	cb___rsc_put('c', NULL);
+	return cb___close_directory(dir_baton, pool);
+}
+
+static svn_error_t *cb___rsc_add_file(const char *utf8_path,
+		void *parent_baton,
+		const char *utf8_copy_path,
+		svn_revnum_t copy_rev,
+		apr_pool_t *file_pool,
+		void **file_baton)
+{
+	cb___rsc_put('A', utf8_path);
+	return cb___add_file(utf8_path, parent_baton, 
+			utf8_copy_path, copy_rev, file_pool, file_baton);
+}
+
+static svn_error_t *cb___rsc_open_file(const char *utf8_path,
+		void *parent_baton,
+		svn_revnum_t base_revision,
+		apr_pool_t *file_pool,
+		void **file_baton)
+{
+	cb___rsc_put('O', utf8_path);
+	return cb___open_file(utf8_path, parent_baton, 
+			base_revision, file_pool, file_baton);
+}
+
+static svn_error_t *cb___rsc_apply_textdelta(void *file_baton,
+		const char *base_checksum,
+		apr_pool_t *pool,
+		svn_txdelta_window_handler_t *handler,
+		void **handler_baton)
+{
+	cb___rsc_put('t', NULL);
+	return cb___apply_textdelta(file_baton, base_checksum, pool, 
+			handler, handler_baton);
+}
+
+static svn_error_t *cb___rsc_change_file_prop(void *file_baton,
+		const char *utf8_name,
+		const svn_string_t *value,
+		apr_pool_t *pool)
+{
+	cb___rsc_prop(utf8_name, value);
+	return cb___change_file_prop(file_baton, utf8_name, value, pool);
+}
+
+static svn_error_t *cb___rsc_close_file(void *file_baton,
+		const char *text_checksum,
+		apr_pool_t *pool)
+{
+	cb___rsc_put('C', text_checksum ? text_checksum : "");
+	return cb___close_file(file_baton, text_checksum, pool);
+}
+
+static svn_error_t *cb___rsc_close_edit(void *edit_baton, 
+		apr_pool_t *pool)
+{
+	cb___rsc_put('e', NULL);
+	return cb___close_edit(edit_baton, pool);
+}
+
+
+/** The change recorder, with each call written to the cache first. */
+const svn_delta_editor_t cb___rsc_recorder = 
+{
+	.set_target_revision 	= cb___rsc_set_target_revision,
+
+	.open_root 						= cb___rsc_open_root,
+
+	.delete_entry				 	= cb___rsc_delete_entry,
+	.add_directory 				= cb___rsc_add_directory,
+	.open_directory 			= cb___rsc_open_directory,
+	.change_dir_prop 			= cb___rsc_change_dir_prop,
+	.close_directory 			= cb___rsc_close_directory,
+	.absent_directory 		= cb___absent_directory,
+
+	.add_file 						= cb___rsc_add_file,
+	.open_file 						= cb___rsc_open_file,
+	.apply_textdelta 			= cb___rsc_apply_textdelta,
+	.change_file_prop 		= cb___rsc_change_file_prop,
+	.close_file 					= cb___rsc_close_file,
+	.absent_file 					= cb___absent_file,
+
+	.close_edit 					= cb___rsc_close_edit,
+	.abort_edit 					= cb___abort_edit,
+};
+
+
+/** Returns the name of the cache file for \c current_url in \a filename.  
+ * */
+static int cb___rsc_filename(char **filename)
+{
+	int status;
+	char *waa_dir, *eos;
+
+	STOPIF( waa__get_waa_directory(wc_path, &waa_dir, &eos, NULL, 
+				GWD_WAA), NULL);
+	sprintf(eos, "%s%d", WAA__RS_CACHE_EXT, current_url->internal_number);
+	*filename=waa_dir;
+
+ex:
+	return status;
+}
+
+
+/** Starts recording for \a filename, for the drive from \c 
+ * current_url->current_rev (and the paths in \a summary) to \a target.
+ * If the file can't be written, nothing gets recorded. */
+static int cb___rsc_start(const char *filename, svn_revnum_t target,
+		const char *summary)
+{
+	int status, fh;
+
+	status=0;
+	STOPIF( hlp__strmnalloc( strlen(filename) + 8, &cb___rsc_tmp,
+				filename, ".XXXXXX", NULL), NULL);
+	fh=mkstemp(cb___rsc_tmp);
+	if (fh != -1)
+	{
+		cb___rsc_out=fdopen(fh, "w");
+		if (!cb___rsc_out)
+		{
+			close(fh);
+			unlink(cb___rsc_tmp);
+		}
+	}
+
+	if (!cb___rsc_out)
+	{
+		DEBUGP("can't write %s: %d", cb___rsc_tmp, errno);
+		IF_FREE(cb___rsc_tmp);
+		goto ex;
+	}
+
+	fputs(CB___RSC_HEADER, cb___rsc_out);
+	cb___rsc_put('U', current_url->url);
+	fprintf(cb___rsc_out, "%ld %ld %s\n", 
+			(long)current_url->current_rev, (long)target, summary);
+
+ex:
+	return status;
+}
+
+
+/** Finishes recording; a complete file replaces \a filename, an 
+ * incomplete one is removed. */
+static void cb___rsc_stop(const char *filename, int ok)
+{
+	if (!cb___rsc_out) return;
+
+	if (ferror(cb___rsc_out)) ok=0;
+	if (fclose(cb___rsc_out)) ok=0;
+	cb___rsc_out=NULL;
+
+	if (ok && rename(cb___rsc_tmp, filename) == -1)
+	{
+		DEBUGP("can't rename to %s: %d", filename, errno);
+		ok=0;
+	}
+	if (!ok)
+		unlink(cb___rsc_tmp);
+	IF_FREE(cb___rsc_tmp);
+}
+
+
+/** Parses the record at \a *pos, and advances \a *pos.
+ * Returns the record type in \a code, its string argument in \a str, and 
+ * (for properties) the value length in \a len; \c 0 is returned for an 
+ * invalid record. */
+static int cb___rsc_next(char **pos, char *end, 
+		char *code, char **str, long *len)
+{
+	char *cp;
+
+	cp=*pos;
+	*code=*cp++;
+	*str=cp;
+	*len=-1;
+	switch (*code)
+	{
+		case 'R': case 'c': case 't': case 'e':
+			break;
+		case 'r':
+			strtol(cp, &cp, 10);
+			break;
+		case 'p':
+			if (cp < end && *cp == '-')
+				cp++;
+			else
+				*len=strtol(cp, &cp, 10);
+			if (cp >= end || *cp != ' ') return 0;
+			*str=++cp;
+			/* Fall through for the name. */
+		case 'U': case 'x': case 'a': case 'o': case 'A': case 'O': case 'C':
+			cp=memchr(cp, 0, end-cp);
+			if (!cp) return 0;
+			cp++;
+			if (*len > 0)
+			{
+				if (*len > end-cp) return 0;
+				cp+=*len;
+			}
+			break;
+		default:
+			return 0;
+	}
+
+	if (cp >= end || *cp != '\n') return 0;
+	*pos=cp+1;
+	return 1;
+}
+
+
+/** Replays a cached drive from \a filename into the change recorder, if 
+ * it's for \c current_url, its current revision, and \a target.
+ * \a done is set if that was possible.
+ *
+ * The whole file is checked before the first call is made, so that a 
+ * broken file doesn't leave half-recorded changes behind; then a normal 
+ * drive is done. */
+static int cb___rsc_replay(struct estat *root, const char *filename, 
+		svn_revnum_t target, const char *summary, int *done, 
+		apr_pool_t *pool)
+{
+	int status;
 	svn_error_t *status_svn;
+	int fh, depth, max_depth, in_file;
+	struct sstat_t st;
+	char *data, *pos, *start, *end, *str, *cp, code;
+	long base, tgt, len;
+	void **batons, *file_baton, *baton;
+	svn_string_t value;
+	svn_txdelta_window_handler_t handler;
+	void *handler_baton;
+
+
+	status=0;
+	*done=0;
+	data=MAP_FAILED;
+	batons=NULL;
+	st.size=0;
+
+	fh=open(filename, O_RDONLY);
+	if (fh == -1) goto ex;
+
+	STOPIF( hlp__fstat(fh, &st), NULL);
+	if (st.size <= (off_t)strlen(CB___RSC_HEADER)) goto ex;
+
+	data=mmap(NULL, st.size, PROT_READ, MAP_SHARED, fh, 0);
+	STOPIF_CODE_ERR( data == MAP_FAILED, errno,
+			"Cannot map remote-status cache \"%s\"", filename);
+
+	pos=data;
+	end=data + st.size;
+
+	/* The last byte must be a newline, so that the numbers can be parsed 
+	 * without looking at the length. */
+	if (memcmp(pos, CB___RSC_HEADER, strlen(CB___RSC_HEADER)) != 0 ||
+			end[-1] != '\n')
+		goto invalid;
+	pos+=strlen(CB___RSC_HEADER);
+
+	/* URL, and revisions. */
+	if (!cb___rsc_next(&pos, end, &code, &str, &len) ||
+			code != 'U' || strcmp(str, current_url->url) != 0)
+		goto invalid;
+
+	base=strtol(pos, &cp, 10);
+	if (cp >= end || *cp != ' ') goto invalid;
+	tgt=strtol(cp+1, &cp, 10);
+	if (cp >= end || *cp != ' ') goto invalid;
+	str=cp+1;
+	cp=memchr(str, '\n', end-str);
+	if (!cp) goto invalid;
+	pos=cp+1;
+
+	if (base != current_url->current_rev || tgt != target ||
+			cp-str != (long)strlen(summary) || 
+			memcmp(str, summary, cp-str) != 0)
+	{
+		DEBUGP("cache is for %ld to %ld", base, tgt);
+		goto ex;
+	}
+
+
+	/* Check everything first; the drive must be complete, and properly 
+	 * nested. Text and close records need an open file; directory records 
+	 * mustn't come while a file is open. */
+	start=pos;
+	depth=max_depth=-1;
+	in_file=0;
+	code=0;
+	while (pos < end)
+	{
+		if (code == 'e') goto invalid;
+		if (!cb___rsc_next(&pos, end, &code, &str, &len)) goto invalid;
+
+		switch (code)
+		{
+			case 'r':
+				if (depth != -1) goto invalid;
+				break;
+			case 'R': case 'a': case 'o':
+				if ((code == 'R') != (depth == -1) || in_file) goto invalid;
+				depth++;
+				if (depth > max_depth) max_depth=depth;
+				break;
+			case 'c': case 'x':
+				if (depth < 0 || in_file) goto invalid;
+				if (code == 'c') depth--;
+				break;
+			case 'A': case 'O':
+				if (depth < 0 || in_file) goto invalid;
+				in_file=1;
+				break;
+			case 't':
+				if (!in_file) goto invalid;
+				break;
+			case 'C':
+				if (!in_file) goto invalid;
+				in_file=0;
+				break;
+			case 'p':
+				if (depth < 0) goto invalid;
+				break;
+			case 'e':
+				if (depth != -1 || in_file) goto invalid;
+				break;
+		}
+	}
+	if (code != 'e') goto invalid;
+
+
+	STOPIF( hlp__alloc( &batons, sizeof(*batons) * (max_depth+1)), NULL);
+	DEBUGP("replaying %s", filename);
+
+	pos=start;
+	depth=-1;
+	file_baton=NULL;
+	while (pos < end)
+	{
+		cb___rsc_next(&pos, end, &code, &str, &len);
+		baton= depth >= 0 ? batons[depth] : NULL;
+
+		switch (code)
+		{
+			case 'r':
+				STOPIF_SVNERR( cb___set_target_revision,
+						(root, strtol(str, NULL, 10), pool));
+				break;
+			case 'R':
+				depth++;
+				STOPIF_SVNERR( cb___open_root, 
+						(root, current_url->current_rev, pool, batons+depth));
+				break;
+			case 'x':
+				STOPIF_SVNERR( cb___delete_entry,
+						(str, SVN_INVALID_REVNUM, baton, pool));
+				break;
+			case 'a':
+				depth++;
+				STOPIF_SVNERR( cb___add_directory,
+						(str, baton, NULL, SVN_INVALID_REVNUM, pool, 
+						 batons+depth));
+				break;
+			case 'o':
+				depth++;
+				STOPIF_SVNERR( cb___open_directory,
+						(str, baton, SVN_INVALID_REVNUM, pool, batons+depth));
+				break;
+			case 'c':
+				STOPIF_SVNERR( cb___close_directory, (baton, pool));
+				depth--;
+				break;
+			case 'A':
+				STOPIF_SVNERR( cb___add_file,
+						(str, baton, NULL, SVN_INVALID_REVNUM, pool, &file_baton));
+				break;
+			case 'O':
+				STOPIF_SVNERR( cb___open_file,
+						(str, baton, SVN_INVALID_REVNUM, pool, &file_baton));
+				break;
+			case 't':
+				BUG_ON(!file_baton);
+				STOPIF_SVNERR( cb___apply_textdelta,
+						(file_baton, NULL, pool, &handler, &handler_baton));
+				break;
+			case 'p':
+				value.data=str + strlen(str) + 1;
+				value.len= len<0 ? 0 : len;
+				STOPIF( cb___store_prop(file_baton ? file_baton : baton, str, 
+							len<0 ? NULL : &value, pool), NULL);
+				break;
+			case 'C':
+				BUG_ON(!file_baton);
+				STOPIF_SVNERR( cb___close_file, 
+						(file_baton, *str ? str : NULL, pool));
+				file_baton=NULL;
+				break;
+			case 'e':
+				STOPIF_SVNERR( cb___close_edit, (root, pool));
+				break;
+		}
+	}
+
+	*done=1;
+
+ex:
+	IF_FREE(batons);
+	if (data != MAP_FAILED)
+		munmap(data, st.size);
+	if (fh != -1) close(fh);
+	return status;
+
+invalid:
+	DEBUGP("cache file %s is invalid", filename);
+	goto ex;
+}
+/** @} */
+
+
+/** ----------------------------------------------------------------------------
+ * \defgroup pathrevs Reporting mixed revisions
+ * Which subtrees are at another revision than their parent.
+ * @{
+ *
+ * After a commit only the committed entries are at the new revision; the 
+ * others are still at their older revisions. If only the working copy 
+ * root were reported, the repository would assume that everything is at 
+ * the root's revision; changes on the older entries would be missed, and 
+ * the committed entries would be sent again.
+ *
+ * So every entry of \c current_url that has another revision than its 
+ * parent is reported via \c set_path(); the subtree below it is at that 
+ * revision, too, unless it gets reported itself.
+ *
+ * To find these entries without walking the whole tree the \ref 
+ * estat::other_revs bit is used; it's set while loading the entry list 
+ * (see waa__input_tree()) for all directories that have some entry below 
+ * them with another revision or URL than its parent. Directories without 
+ * that bit are uniform, and needn't be looked into.
+ *
+ * The list is collected before the drive, so that the \ref rscache 
+ * "remote-status cache" can tell whether it's for the same report.
+ * */
+
+/** Length of the summary string of the collected calls. */
+#define CB___SUMMARY_LEN (APR_MD5_DIGESTSIZE*2+1)
+
+/** One \c set_path() call. */
+struct cb___path_rev_t {
+	/** The path, without the \c "./" in front. */
+	char *path;
+	/** The revision it's at. */
+	svn_revnum_t rev;
+};
+
+/** The collected \c set_path() calls, in tree order (parents first, as 
+ * the repository wants them). */
+static struct cb___path_rev_t *cb___path_revs;
+/** Number of collected calls, and allocated slots. */
+static unsigned cb___path_rev_count, cb___path_rev_max;
+
+
+/** Collects the entries below \a dir that are not at \a dir_rev, which is 
+ * the revision that \a dir was reported at (or is assumed to be at). */
+static int cb___collect_path_revs(struct estat *dir, svn_revnum_t dir_rev)
+{
+	int status;
+	uint32_t i;
+	struct estat *sts;
+	svn_revnum_t rev;
 	char *fn;
 
 
@@ -721,31 +1373,110 @@ int cb___report_path_rev(struct estat *dir,
 	for(i=0; i<dir->entry_count; i++)
 	{
 		sts=dir->by_inode[i];
-
-		STOPIF( ops__build_path(&fn, sts), NULL );
-		/* We have to cut the "./" in front. */
-		/* We report the directories' revision too. */
-		/* As we're doing the children of a directory, there must always
-		 * be a parent. */
-		/* \todo: the parent might be from another URL. What should we do? */
-		if ( sts->repos_rev != sts->parent->repos_rev)
+		rev=dir_rev;
+
+		/* Entries of other URLs, and not yet committed ones, don't exist 
+		 * (or not like that) for this URL; their parent's revision is 
+		 * passed down. */
+		if (sts->url == current_url && 
+				!(sts->flags & (RF_ADD | RF___IS_COPY)) &&
+				!sts->to_be_ignored)
 		{
-			DEBUGP("reporting %s at %llu", fn, (t_ull)sts->repos_rev);
-			STOPIF_SVNERR( reporter->set_path,
-					(report_baton, fn+2, sts->repos_rev, 0, "", pool));
+			rev = sts->repos_rev == SET_REVNUM ? 
+				current_url->current_rev : sts->repos_rev;
+
+			if (rev <= 0)
+				rev=dir_rev;
+			else if (rev != dir_rev)
+			{
+				if (cb___path_rev_count >= cb___path_rev_max)
+				{
+					cb___path_rev_max = cb___path_rev_max ? 
+						cb___path_rev_max*2 : 64;
+					STOPIF( hlp__realloc( &cb___path_revs, 
+								cb___path_rev_max * sizeof(*cb___path_revs)), NULL);
+				}
+
+				STOPIF( ops__build_path(&fn, sts), NULL );
+				/* The paths are kept, so we can just point to them. */
+				cb___path_revs[cb___path_rev_count].path=fn+2;
+				cb___path_revs[cb___path_rev_count].rev=rev;
+				cb___path_rev_count++;
+			}
 		}
 
 		if (S_ISDIR(sts->st.mode) && sts->other_revs)
-		{
-			STOPIF( cb___report_path_rev(sts, reporter, report_baton, pool),
-					NULL);
-		}	
+			STOPIF( cb___collect_path_revs(sts, rev), NULL);
+	}
+
+ex:
+	return status;
+}
+
+
+/** Collects the \c set_path() calls for the working copy \a root, which 
+ * gets reported at \c current_url->current_rev, and writes a digest of 
+ * them as hex string into \a summary.
+ *
+ * The root's children are always looked at, as the root itself might be 
+ * at another revision than the URL. */
+static int cb___path_revs_collect(struct estat *root, 
+		char summary[CB___SUMMARY_LEN])
+{
+	int status;
+	unsigned i;
+	apr_md5_ctx_t md5_ctx;
+	md5_digest_t md5;
+	char buffer[32];
+
+
+	STOPIF( cb___collect_path_revs(root, current_url->current_rev), NULL);
+
+	apr_md5_init(&md5_ctx);
+	for(i=0; i<cb___path_rev_count; i++)
+	{
+		apr_md5_update(&md5_ctx, cb___path_revs[i].path, 
+				strlen(cb___path_revs[i].path)+1);
+		sprintf(buffer, "%ld\n", (long)cb___path_revs[i].rev);
+		apr_md5_update(&md5_ctx, buffer, strlen(buffer));
 	}
+	apr_md5_final(md5, &md5_ctx);
+	cs__md5tohex(md5, summary);
+
+	DEBUGP("%u paths at other revisions, summary %s", 
+			cb___path_rev_count, summary);
 
 ex:
 	return status;
 }
 
+
+/** Reports the collected paths. */
+static int cb___report_path_revs(const svn_ra_reporter2_t *reporter,
+		void *report_baton, 
+		apr_pool_t *pool)
+{
+	int status;
+	unsigned i;
+	svn_error_t *status_svn;
+
+
+	status=0;
+	for(i=0; i<cb___path_rev_count; i++)
+	{
+		DEBUGP("reporting %s at %llu", 
+				cb___path_revs[i].path, (t_ull)cb___path_revs[i].rev);
+		STOPIF_SVNERR( reporter->set_path,
+				(report_baton, cb___path_revs[i].path, cb___path_revs[i].rev, 
+				 FALSE, NULL, pool));
+	}
+
+ex:
+	return status;
+}
+/** @} */
+
+
 /** Helper function for cb__remove_from_url(). 
  *
  * Returns the highest-priority URL that's used by an entry below \a sts 
@@ -906,6 +1637,12 @@ ex:
  * If \a other_paths is \c NULL, or doesn't include an <tt>"."</tt> entry, 
  * the WC root is reported to be at \c current_url->current_rev or, if this 
  * is \c 0, to be at \a target, but empty.
+ *
+ * Without \a other_paths, and if the root isn't reported empty, the 
+ * entries at other revisions get reported as well; see \ref pathrevs.
+ *
+ * For \ref remote-status the result may come from the \ref rscache 
+ * "remote-status cache" instead.
  * */
 int cb__record_changes_mixed(struct estat *root,
 		svn_revnum_t target,
@@ -916,11 +1653,49 @@ int cb__record_changes_mixed(struct estat *root,
 	svn_error_t *status_svn;
 	void *report_baton;
 	const svn_ra_reporter2_t *reporter;
+	const svn_delta_editor_t *editor;
 	char *cur, **op;
+	char *cache_fn;
+	int replayed, by_path;
+	char summary[CB___SUMMARY_LEN];
 
 
 	status=0;
+	cache_fn=NULL;
 	cb___dest_rev=target;
+	editor=&cb___change_recorder;
+
+	/* If the root is reported as it is, the entries at other revisions are 
+	 * reported too; with other_paths, or when starting empty, the given 
+	 * revisions are wanted. */
+	by_path= !other_paths && current_url->current_rev != 0;
+	strcpy(summary, "-");
+	cb___path_rev_count=0;
+	if (by_path)
+		STOPIF( cb___path_revs_collect(root, summary), NULL);
+
+	/* Only the plain case is cached; the mixed reports are for diff. */
+	if (action->is_compare && !other_paths &&
+			opt__get_int(OPT__REMOTE_CACHE))
+	{
+		STOPIF( cb___rsc_filename(&cur), NULL);
+		STOPIF( hlp__strdup( &cache_fn, cur), NULL);
+
+		STOPIF( cb___rsc_replay(root, cache_fn, target, summary, 
+					&replayed, pool), NULL);
+		if (replayed)
+		{
+			DEBUGP("changes from %llu to %llu taken from the cache",
+					(t_ull)current_url->current_rev, (t_ull)target);
+			goto done;
+		}
+
+		STOPIF( cb___rsc_start(cache_fn, target, summary), NULL);
+		if (cb___rsc_out)
+			editor=&cb___rsc_recorder;
+	}
+
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_do_status,
 			(current_url->session,
 			 &reporter,
@@ -928,7 +1703,7 @@ int cb__record_changes_mixed(struct estat *root,
 			 "",
 			 target,
 			 TRUE,
-			 &cb___change_recorder,
+			 editor,
 			 root,
 			 pool) );
 
@@ -993,16 +1768,20 @@ int cb__record_changes_mixed(struct estat *root,
 	DEBUGP("Getting changes from %llu to %llu", 
 			(t_ull)current_url->current_rev,
 			(t_ull)target);
-#if 0
-	STOPIF( cb___report_path_rev( root, reporter, report_baton, pool), NULL);
-#endif
+	STOPIF( cb___report_path_revs(reporter, report_baton, pool), NULL);
 
 	STOPIF_SVNERR( reporter->finish_report, 
 			(report_baton, global_pool));
 
+	cb___rsc_stop(cache_fn, 1);
+
+done:
 	current_url->current_rev=cb___dest_rev;
 
 ex:
+	/* After an error the recorded data is incomplete. */
+	cb___rsc_stop(cache_fn, 0);
+	IF_FREE(cache_fn);
 	return status;
 }
 
@@ -1022,6 +1801,7 @@ int cb__does_path_exist(svn_ra_session_t *session,
 
 	status=0;
 
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_stat,
 			(session, path, rev, &dirent, pool));
 	*exists = dirent != NULL;
@@ -15,11 +15,14 @@
  * The cb__record_changes() and other callback functions header file.  */
 
 /** The callback table for cb__record_changes(). */
-extern struct svn_ra_callbacks_t cb__cb_table;
+extern struct svn_ra_callbacks2_t cb__cb_table;
 
 /** Initialize the callback functions.
  * \todo Authentication providers. */
 svn_error_t *cb__init(apr_pool_t *pool);
+/** Creates a new authentication baton in \a pool. */
+svn_error_t *cb__new_auth_baton(svn_auth_baton_t **baton, 
+		int non_interactive, apr_pool_t *pool);
 
 /** A change-recording editor. */
 int cb__record_changes(struct estat *root,
@@ -25,6 +25,8 @@
 #include "update.h"
 #include "cp_mv.h"
 #include "status.h"
+#include "perf.h"
+#include "rfetch.h"
 
 
 /** \file
@@ -271,6 +273,7 @@ int rev__get_text_to_stream( char *loc_url, svn_revnum_t revision,
 	/* Fetch decoder from repository. */
 	if (decoder == DECODER_UNKNOWN)
 	{
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
 		STOPIF_SVNERR_TEXT( svn_ra_get_file,
 				(current_url->session,
 				 utf8_url, revision,
@@ -292,6 +295,9 @@ int rev__get_text_to_stream( char *loc_url, svn_revnum_t revision,
 	 * have to do that after the manber-filter. */
 	if (decoder)
 	{
+		/* setenv() and fork() mustn't race with the fetch threads. */
+		rf__stop();
+
 		snprintf(target_rev, sizeof(target_rev), 
 				"%llu", (t_ull)revision);
 		setenv(FSVS_EXP_TARGET_REVISION, target_rev, 1);
@@ -303,6 +309,7 @@ int rev__get_text_to_stream( char *loc_url, svn_revnum_t revision,
 	}
 
 
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR_TEXT( svn_ra_get_file,
 			(current_url->session,
 			 utf8_url, revision,
@@ -403,6 +410,28 @@ ex:
 }
 
 
+/** Calculates the MD5 (and the manber hashes) of \a sts from the data in 
+ * \a file, which was fetched by a thread of \ref rfetch.c.
+ * The data is still in the page cache, so that's cheap. */
+static int rev___hash_fetched(struct estat *sts, apr_file_t *file,
+		apr_pool_t *pool)
+{
+	int status;
+	svn_error_t *status_svn;
+	svn_stream_t *input, *filter;
+
+
+	STOPIF( cs__new_manber_filter(sts, svn_stream_empty(pool), 
+				&filter, pool), NULL);
+	/* Closing the input must not close the file. */
+	input=svn_stream_from_aprfile2(file, TRUE, pool);
+	STOPIF_SVNERR( svn_stream_copy3, (input, filter, NULL, NULL, pool));
+
+ex:
+	return status;
+}
+
+
 /** -.
  *
  * Meta-data is set; an existing local entry gets atomically removed by \c 
@@ -413,6 +442,8 @@ ex:
  *
  * If \a revision is 0, the \c BASE revision is and \a decoder is used; 
  * this is the copy base for copied entries.
+ *
+ * If the file was fetched ahead (see \ref rfetch.c), that data is taken.
  */
 int rev__install_file(struct estat *sts, svn_revnum_t revision,
 		char *decoder,
@@ -428,6 +459,7 @@ int rev__install_file(struct estat *sts, svn_revnum_t revision,
 	char *special_data;
 	char *url;
 	svn_revnum_t rev_to_take;
+	svn_string_t *prop_val;
 
 
 	BUG_ON(!pool);
@@ -454,28 +486,7 @@ int rev__install_file(struct estat *sts, svn_revnum_t revision,
 	 * So remove them; if the file is big enough, we'll recreate it with 
 	 * correct data. */
 	STOPIF( waa__delete_byext(filename, WAA__FILE_MD5s_EXT, 1), NULL);
-
-
-	/* Files get written in files; we use the temporarily generated name for  
-	 * special entries, too. */
-	/* We could use a completely different mechanism for temp-file-names;
-	 * but keeping it close to the target lets us see if we're out of
-	 * disk space in this filesystem. (At least if it's not a binding mount
-	 * or something similar - but then rename() should fail).
-	 * If we wrote the data somewhere else, we'd risk moving it again, across 
-	 * filesystem boundaries. */
-	STOPIF( waa__get_tmp_name( filename, &filename_tmp, &a_stream, subpool), 
-			NULL);
-
-
-	/* It's a bit easier to just take the (small) performance hit, and always 
-	 * (temporarily) write the data in a file.
-	 * If it's a special entry, that will just get read immediately back and 
-	 * changed to the correct type.
-	 *
-	 * It doesn't really make much difference, as the file is always created 
-	 * to get a distinct name. */
-	stream=svn_stream_from_aprfile(a_stream, subpool);
+	STOPIF( waa__delete_byext(filename, WAA__FILE_FPRINT_EXT, 1), NULL);
 
 
 	if (sts->url)
@@ -496,7 +507,7 @@ int rev__install_file(struct estat *sts, svn_revnum_t revision,
 	{
 		/* BASE wanted; get decoder. */
 		STOPIF( up__fetch_decoder(sts), NULL);
-		decoder=sts->decoder;
+		decoder=COLD(sts, decoder);
 	}
 	else
 	{
@@ -506,12 +517,58 @@ int rev__install_file(struct estat *sts, svn_revnum_t revision,
 	}
 
 
-	STOPIF( url__open_session(NULL, NULL), NULL);
+	/* Maybe a fetch thread has got the data already; but it's raw, so it 
+	 * can only be taken if there's no decoder. */
+	STOPIF( rf__take(sts, rev_to_take, &filename_tmp, &props, subpool), NULL);
+	if (filename_tmp)
+	{
+		prop_val=apr_hash_get(props, propval_updatepipe, APR_HASH_KEY_STRING);
+		if (decoder == DECODER_UNKNOWN ? prop_val != NULL : decoder != NULL)
+		{
+			DEBUGP("%s needs decoding, fetching again", filename);
+			unlink(filename_tmp);
+			filename_tmp=NULL;
+		}
+	}
+
+
+	if (filename_tmp)
+	{
+		STOPIF( apr_file_open(&a_stream, filename_tmp, APR_READ, 0, subpool),
+				"Cannot open \"%s\"", filename_tmp);
+		STOPIF( rev___hash_fetched(sts, a_stream, subpool), NULL);
+	}
+	else
+	{
+		/* Files get written in files; we use the temporarily generated name 
+		 * for special entries, too. */
+		/* We could use a completely different mechanism for temp-file-names;
+		 * but keeping it close to the target lets us see if we're out of
+		 * disk space in this filesystem. (At least if it's not a binding mount
+		 * or something similar - but then rename() should fail).
+		 * If we wrote the data somewhere else, we'd risk moving it again, 
+		 * across filesystem boundaries. */
+		STOPIF( waa__get_tmp_name( filename, &filename_tmp, &a_stream, subpool), 
+				NULL);
+
+
+		/* It's a bit easier to just take the (small) performance hit, and 
+		 * always (temporarily) write the data in a file.
+		 * If it's a special entry, that will just get read immediately back 
+		 * and changed to the correct type.
+		 *
+		 * It doesn't really make much difference, as the file is always 
+		 * created to get a distinct name. */
+		stream=svn_stream_from_aprfile(a_stream, subpool);
 
-	/* We don't give an estat for meta-data parsing, because we have to loop 
-	 * through the property list anyway - for storing locally. */
-	STOPIF( rev__get_text_to_stream( url, rev_to_take, decoder, 
-				stream, sts, NULL, &props, pool), NULL);
+
+		STOPIF( url__open_session(NULL, NULL), NULL);
+
+		/* We don't give an estat for meta-data parsing, because we have to 
+		 * loop through the property list anyway - for storing locally. */
+		STOPIF( rev__get_text_to_stream( url, rev_to_take, decoder, 
+					stream, sts, NULL, &props, pool), NULL);
+	}
 
 
 	if (apr_hash_get(props, propname_special, APR_HASH_KEY_STRING))
@@ -602,6 +659,8 @@ int rev__merge(struct estat *sts,
 	STOPIF( hlp__lstat(file2, &stat), NULL);
 
 
+	/* The child mustn't inherit locks held by the fetch threads. */
+	rf__stop();
 	pid=fork();
 	STOPIF_CODE_ERR( pid == -1, errno, "Cannot fork()" );
 	if (pid == 0)
@@ -703,6 +762,7 @@ int rev__get_props(struct estat *sts,
 		STOPIF( hlp__local2utf8(filename+2, &utf8_path, -1), NULL);
 	}
 
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_get_file,
 			(current_url->session,
 			 utf8_path,
@@ -869,7 +929,7 @@ int rev___revert_to_base(struct estat *sts,
 		DEBUGP("l_st=%s, r_st=%s, old=%p", 
 				st__status_string_fromint(sts->entry_status), 
 				st__status_string_fromint(sts->remote_status), 
-				sts->old);
+				COLD(sts, old));
 
 		/* Parent directories might just have been created. */
 		if (!S_ISDIR(sts->st.mode))
@@ -883,7 +943,7 @@ int rev___revert_to_base(struct estat *sts,
 			 * data, reset rights.
 			 * */
 			/* TODO - opt_target_revision ? */
-			STOPIF( rev__install_file(sts, wanted, sts->decoder, pool),
+			STOPIF( rev__install_file(sts, wanted, COLD(sts, decoder), pool),
 					"Unable to revert entry '%s'", path);
 			*dir_change_flag |= REVERT_MTIME;
 		}
@@ -899,7 +959,7 @@ int rev___revert_to_base(struct estat *sts,
 				status = (mkdir(path, sts->st.mode & 07777) == -1) ? errno : 0;
 				if (status == EEXIST)
 				{
-				DEBUGP("old=%p", sts->old);
+				DEBUGP("old=%p", COLD(sts, old));
 				}
 				DEBUGP("mkdir(%s) says %d", path, status);
 				STOPIF(status, "Cannot create directory '%s'", path);
@@ -943,6 +1003,38 @@ int rev___no_local_change(struct estat *sts)
 }
 
 
+/** Queues the files that rev___local_revert() will install, for \ref 
+ * rfetch.c; the same conditions, in the same order. */
+static int rev___queue_local(struct estat *dir)
+{
+	int status;
+	uint32_t i;
+	struct estat *sts;
+
+
+	status=0;
+	for(i=0; i<dir->entry_count; i++)
+	{
+		sts=dir->by_inode[i];
+
+		if (sts->do_this_entry && 
+				(sts->entry_status & FS__CHANGE_MASK) &&
+				!(sts->flags & (RF_UNVERSION | RF_ADD)) &&
+				!S_ISDIR(sts->st.mode) &&
+				ops__allowed_by_filter(sts))
+			STOPIF( rf__add(sts, opt_target_revisions_given ? 
+						opt_target_revision : sts->repos_rev), NULL);
+
+		if (S_ISDIR(sts->st.mode) && 
+				(sts->entry_status & FS_CHILD_CHANGED))
+			STOPIF( rev___queue_local(sts), NULL);
+	}
+
+ex:
+	return status;
+}
+
+
 /** -.
  * Recurses for rev___revert_to_base.
  *
@@ -1093,7 +1185,10 @@ int rev__work(struct estat *root, int argc, char *argv[])
 		 * waa__do_sorted_tree() can't be used, either, because it does the 
 		 * directory *before* the children - which makes the directories' mtime 
 		 * wrong if children get created or deleted. */
+		STOPIF( rev___queue_local(root), NULL);
+		STOPIF( rf__start(), NULL);
 		STOPIF( rev___local_revert(root, global_pool), NULL);
+		rf__stop();
 	}
 
 	
@@ -1118,6 +1213,8 @@ int rev__work(struct estat *root, int argc, char *argv[])
 	}
 
 ex:
+	/* Remove the temporary files after an error. */
+	rf__stop();
 	return status;
 }
 
@@ -1187,9 +1284,9 @@ int rev___undo_change(struct estat *sts,
 	/* An entry can be given as removed, and in the same step be created
 	 * again - possibly as another type. */
 
-	/* If the entry wasn't replaced, but only removed, there's no sts->old. 
+	/* If the entry wasn't replaced, but only removed, there's no sts->cold->old. 
 	 * */
-	removed=sts->old ? sts->old : sts;
+	removed=COLD(sts, old) ? sts->cold->old : sts;
 	if (removed->remote_status & FS_REMOVED)
 	{
 		/* Is the entry already removed? */
@@ -1245,7 +1342,7 @@ int rev___undo_change(struct estat *sts,
 	else if (sts->remote_status & (FS_CHANGED | FS_REPLACED))
 		/* Not a directory */
 	{
-		STOPIF( rev__install_file(sts, 0, sts->decoder, pool), NULL);
+		STOPIF( rev__install_file(sts, 0, COLD(sts, decoder), pool), NULL);
 		*dir_change_flag|=REVERT_MTIME;
 
 		/* We had a conflict; rename the file fetched from the 
@@ -1337,9 +1434,40 @@ ex:
 }
 
 
-/** -.
- * Used on update. */
-int rev__do_changed(struct estat *dir, 
+/** Queues the files that rev___do_changed() will install, for \ref 
+ * rfetch.c; the same conditions, in the same order.
+ * Files that get a decoder are not taken. */
+static int rev___queue_changed(struct estat *dir)
+{
+	int status;
+	uint32_t i;
+	struct estat *sts;
+
+
+	status=0;
+	if (!(dir->remote_status & FS_CHILD_CHANGED)) goto ex;
+
+	for(i=0; i<dir->entry_count; i++)
+	{
+		sts=dir->by_inode[i];
+
+		if ((sts->remote_status & FS_REPLACED) == FS_REMOVED)
+			continue;
+
+		if (S_ISDIR(sts->st.mode))
+			STOPIF( rev___queue_changed(sts), NULL);
+		else if ((sts->remote_status & (FS_CHANGED | FS_REPLACED)) &&
+				(!COLD(sts, decoder) || sts->cold->decoder == DECODER_UNKNOWN))
+			STOPIF( rf__add(sts, sts->repos_rev), NULL);
+	}
+
+ex:
+	return status;
+}
+
+
+/** Recurses for rev__do_changed(). */
+static int rev___do_changed(struct estat *dir, 
 		apr_pool_t *pool)
 {
 	int status;
@@ -1377,7 +1505,7 @@ int rev__do_changed(struct estat *dir,
 			subpool=NULL;
 			STOPIF( apr_pool_create(&subpool, pool), "subpool creation");
 
-			STOPIF( rev__do_changed(sts, subpool), NULL);
+			STOPIF( rev___do_changed(sts, subpool), NULL);
 		}	
 
 		STOPIF( st__rm_status(sts), NULL);
@@ -1410,4 +1538,22 @@ ex:
 }
 
 
+/** -.
+ * Used on update.
+ *
+ * The files to be installed are fetched ahead by the threads of \ref 
+ * rfetch.c. */
+int rev__do_changed(struct estat *dir, 
+		apr_pool_t *pool)
+{
+	int status;
 
+
+	STOPIF( rev___queue_changed(dir), NULL);
+	STOPIF( rf__start(), NULL);
+	STOPIF( rev___do_changed(dir, pool), NULL);
+
+ex:
+	rf__stop();
+	return status;
+}
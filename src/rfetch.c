@@ -0,0 +1,621 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <apr_pools.h>
+#include <apr_allocator.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <subversion-1/svn_ra.h>
+#include <subversion-1/svn_dirent_uri.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "global.h"
+#include "helper.h"
+#include "options.h"
+#include "racallback.h"
+#include "perf.h"
+#include "rfetch.h"
+
+
+/** \file
+ * Fetch-ahead for \ref revert and \ref update.
+ *
+ * The changed files are installed one after the other; for each of them
+ * the data is requested from the repository, and only then the next file
+ * is looked at. With many small files nearly all the time is spent
+ * waiting for these round-trips.
+ *
+ * So, before the tree is walked, the files that will be installed are
+ * queued here, in the same order; a few fetch threads, each with its own
+ * RA session per URL, then get the next few files into temporary files
+ * beside their targets (see \ref o_fetch_threads). When the walk gets to
+ * a file, rf__take() hands over the temporary file and the properties;
+ * the rest (hashing, decoding, meta-data, renaming, and the directory
+ * timestamps after all children) is done in the main thread as before.
+ *
+ * The threads only call \c svn_ra_get_file() on their own sessions,
+ * with their own pools; the sessions are opened in the main thread, each 
+ * thread with its own callback table and authentication baton (that 
+ * doesn't prompt), allocated in its own pool. If a thread's session can't 
+ * be opened (eg. because the credentials aren't cached), the fetching is 
+ * done with the threads that could be started.
+ *
+ * As the threads might hold locks (eg. in \c malloc()), they're stopped 
+ * before anything \c fork()s; see rf__stop().
+ *
+ * Data that's not usable as-is (eg. because of an \ref
+ * FSVS_PROP_UPDATE_PIPE "update-pipe") is thrown away by the caller, and
+ * fetched again the normal way; the queue is not strict, either: files
+ * that aren't asked for only waste a bit of bandwidth, and files that
+ * weren't queued are fetched by the main thread. */
+
+
+/** Upper limit for the number of fetch threads. */
+#define RF___MAX_THREADS (16)
+/** How many files each thread may fetch ahead of the main thread; this
+ * bounds the disk space used by temporary files. */
+#define RF___AHEAD_PER_THREAD (8)
+
+
+/** States of a queued file. */
+enum rf___state_e {
+	RF___QUEUED=0,
+	RF___RUNNING,
+	RF___DONE,
+	RF___FAILED,
+	RF___TAKEN,
+};
+
+
+/** One queued file. */
+struct rf___file_t {
+	/** The entry, to recognize it in rf__take(). */
+	struct estat *sts;
+	/** The path relative to the URL, in UTF-8. */
+	char *path;
+	/** The name of the temporary file; a \c mkstemp() template before the
+	 * file is fetched. */
+	char *tmp;
+	/** The serialized properties, see rf___props_to_hash(). */
+	char *props;
+	/** Length of \c props. */
+	size_t props_len;
+	/** The wanted revision. */
+	svn_revnum_t rev;
+	/** Index into \ref rf___urls. */
+	int url_nr;
+	/** State; protected by the mutex. */
+	enum rf___state_e state;
+};
+
+
+/** Per-thread data. */
+struct rf___worker_t {
+	/** The pool for the sessions, with its own allocator. */
+	apr_pool_t *pool;
+	/** Cleared for every file. */
+	apr_pool_t *file_pool;
+	/** One session per URL in \ref rf___urls. */
+	svn_ra_session_t **sessions;
+	/** The callbacks for the sessions, with this thread's authentication 
+	 * baton. */
+	struct svn_ra_callbacks2_t cb_table;
+#ifdef HAVE_PTHREAD
+	/** The thread, for joining it. */
+	pthread_t id;
+#endif
+};
+
+
+#ifdef HAVE_PTHREAD
+/** The mutex for all the variables below. */
+static pthread_mutex_t rf___mutex=PTHREAD_MUTEX_INITIALIZER;
+/** Signalled when the main thread progresses, and on stopping. */
+static pthread_cond_t rf___work=PTHREAD_COND_INITIALIZER;
+/** Signalled when a file is finished. */
+static pthread_cond_t rf___finished=PTHREAD_COND_INITIALIZER;
+#endif
+
+/** The fetch threads. */
+static struct rf___worker_t rf___workers[RF___MAX_THREADS];
+/** Number of running fetch threads. */
+static int rf___threads=0;
+/** How many files may be fetched ahead of the main thread. */
+static int rf___ahead;
+/** Whether the threads should finish. */
+static int rf___stopping;
+/** The queue, in installation order. */
+static struct rf___file_t *rf___files;
+/** Number of queued files, and allocated slots. */
+static unsigned rf___count, rf___max;
+/** The next file to be fetched. */
+static unsigned rf___next;
+/** The first file the main thread hasn't got to yet. */
+static unsigned rf___reached;
+/** The URLs of the queued files. */
+static struct url_t **rf___urls;
+/** Number of URLs in \ref rf___urls. */
+static int rf___url_count;
+/** The directory for the RA layers' temporary files. */
+static const char *rf___tmp_dir;
+
+
+#ifdef HAVE_PTHREAD
+/** Temporary files for the RA layer, without using the (not thread-safe)
+ * WAA functions. */
+static svn_error_t *rf___open_tmp(apr_file_t **fp,
+		void *callback_baton UNUSED, apr_pool_t *pool)
+{
+	char *template;
+	apr_status_t status;
+
+	template=apr_pstrcat(pool, rf___tmp_dir, "/fsvs.XXXXXX", NULL);
+	status=apr_file_mktemp(fp, template,
+			APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_DELONCLOSE,
+			pool);
+	return status ? svn_error_wrap_apr(status, NULL) : SVN_NO_ERROR;
+}
+
+
+/** The callbacks for the sessions of the fetch threads; each gets a copy 
+ * with its own \c auth_baton.
+ * The progress isn't counted, as \ref o_perf_report isn't thread-safe. */
+static const struct svn_ra_callbacks2_t rf___cb_table=
+{
+	.open_tmp_file = rf___open_tmp,
+};
+
+
+/** Writes the fetched data; \a baton points to the file descriptor. */
+static svn_error_t *rf___write(void *baton, const char *data, apr_size_t *len)
+{
+	int fd=*(int*)baton;
+	apr_size_t done;
+	ssize_t ret;
+
+	for(done=0; done < *len; done+=ret)
+	{
+		ret=write(fd, data+done, *len-done);
+		if (ret == -1)
+		{
+			if (errno == EINTR)
+			{
+				ret=0;
+				continue;
+			}
+			return svn_error_wrap_apr(errno, NULL);
+		}
+	}
+
+	return SVN_NO_ERROR;
+}
+
+
+/** Puts the properties in \a props into one \c malloc()ed block, which
+ * can be given to the main thread.
+ * The format is the name, \c \\0, the value length as \c uint32_t, and the
+ * value; repeated for every property. */
+static int rf___props_serialize(struct rf___file_t *file, apr_hash_t *props,
+		apr_pool_t *pool)
+{
+	apr_hash_index_t *hi;
+	const char *name;
+	const svn_string_t *value;
+	size_t len;
+	uint32_t vlen;
+	char *cp;
+
+	len=0;
+	for (hi = apr_hash_first(pool, props); hi; hi = apr_hash_next(hi))
+	{
+		apr_hash_this(hi, (const void**)&name, NULL, (void**)&value);
+		len += strlen(name)+1 + sizeof(vlen) + value->len;
+	}
+
+	file->props_len=len;
+	file->props=cp=malloc(len+1);
+	if (!cp) return 0;
+
+	for (hi = apr_hash_first(pool, props); hi; hi = apr_hash_next(hi))
+	{
+		apr_hash_this(hi, (const void**)&name, NULL, (void**)&value);
+		len=strlen(name)+1;
+		memcpy(cp, name, len);
+		cp+=len;
+		vlen=value->len;
+		memcpy(cp, &vlen, sizeof(vlen));
+		cp+=sizeof(vlen);
+		memcpy(cp, value->data, vlen);
+		cp+=vlen;
+	}
+
+	return 1;
+}
+
+
+/** Fetches \a file into its temporary file.
+ * Returns whether that was successful; on errors the main thread will
+ * try again, and report them. */
+static int rf___fetch(struct rf___worker_t *worker, struct rf___file_t *file)
+{
+	svn_error_t *err;
+	svn_stream_t *stream;
+	apr_hash_t *props;
+	int fd, ok;
+
+
+	apr_pool_clear(worker->file_pool);
+
+	/* The parent directory might not exist yet; then the main thread has
+	 * to do it. */
+	fd=mkstemp(file->tmp);
+	if (fd == -1) return 0;
+
+	stream=svn_stream_create(&fd, worker->file_pool);
+	svn_stream_set_write(stream, rf___write);
+
+	err=svn_ra_get_file(worker->sessions[file->url_nr],
+			file->path, file->rev,
+			stream, NULL, &props,
+			worker->file_pool);
+
+	ok= !err && rf___props_serialize(file, props, worker->file_pool);
+	svn_error_clear(err);
+
+	if (close(fd) == -1) ok=0;
+	if (!ok) unlink(file->tmp);
+
+	return ok;
+}
+
+
+/** The fetch thread.
+ * Takes the next file, as long as that is not too far ahead of the main
+ * thread. */
+static void *rf___thread(void *arg)
+{
+	struct rf___worker_t *worker=arg;
+	struct rf___file_t *file;
+	int ok;
+
+	pthread_mutex_lock(&rf___mutex);
+	while (!rf___stopping)
+	{
+		if (rf___next < rf___count &&
+				rf___next < rf___reached + rf___ahead)
+		{
+			/* The queue doesn't change while the threads run. */
+			file=rf___files + rf___next;
+			rf___next++;
+			file->state=RF___RUNNING;
+			pthread_mutex_unlock(&rf___mutex);
+
+			ok=rf___fetch(worker, file);
+
+			pthread_mutex_lock(&rf___mutex);
+			file->state= ok ? RF___DONE : RF___FAILED;
+			pthread_cond_broadcast(&rf___finished);
+		}
+		else
+			pthread_cond_wait(&rf___work, &rf___mutex);
+	}
+	pthread_mutex_unlock(&rf___mutex);
+
+	return NULL;
+}
+
+
+/** Opens one session per URL for \a worker, in the main thread. */
+static int rf___open_sessions(struct rf___worker_t *worker)
+{
+	int status;
+	svn_error_t *status_svn;
+	apr_allocator_t *allocator;
+	apr_hash_t *cfg;
+	const char *url;
+	int i;
+
+
+	/* The threads' pools must not share an allocator with anything else. */
+	STOPIF( apr_allocator_create(&allocator), NULL);
+	STOPIF( apr_pool_create_ex(&worker->pool, NULL, NULL, allocator), NULL);
+	apr_allocator_owner_set(allocator, worker->pool);
+	STOPIF( apr_pool_create(&worker->file_pool, worker->pool), NULL);
+
+	worker->sessions=apr_pcalloc(worker->pool,
+			rf___url_count * sizeof(*worker->sessions));
+
+	worker->cb_table=rf___cb_table;
+	STOPIF_SVNERR( cb__new_auth_baton,
+			(&worker->cb_table.auth_baton, 1, worker->pool));
+
+	STOPIF( hlp__get_svn_config(&cfg), NULL);
+	for(i=0; i<rf___url_count; i++)
+	{
+		url=svn_uri_canonicalize(rf___urls[i]->url, worker->pool);
+
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
+		STOPIF_SVNERR_TEXT( svn_ra_open2,
+				(worker->sessions+i, url,
+				 &worker->cb_table, NULL,
+				 cfg, worker->pool),
+				"svn_ra_open2(\"%s\")", rf___urls[i]->url);
+	}
+
+ex:
+	return status;
+}
+#endif
+
+
+/** -.
+ * Entries without an URL are not queued. */
+int rf__add(struct estat *sts, svn_revnum_t rev)
+{
+	int status;
+	struct rf___file_t *file;
+	char *path, *utf8;
+	int i;
+
+
+	status=0;
+	BUG_ON(rf___threads, "fetch threads already running");
+#ifndef HAVE_PTHREAD
+	goto ex;
+#endif
+	if (!sts->url || opt__get_int(OPT__FETCH_THREADS) <= 0) goto ex;
+
+	for(i=0; i<rf___url_count; i++)
+		if (rf___urls[i] == sts->url) break;
+	if (i == rf___url_count)
+	{
+		STOPIF( hlp__realloc( &rf___urls,
+					(rf___url_count+1) * sizeof(*rf___urls)), NULL);
+		rf___urls[rf___url_count++]=sts->url;
+	}
+
+	if (rf___count >= rf___max)
+	{
+		rf___max = rf___max ? rf___max*2 : 1024;
+		STOPIF( hlp__realloc( &rf___files,
+					rf___max * sizeof(*rf___files)), NULL);
+	}
+
+	STOPIF( ops__build_path(&path, sts), NULL);
+	/* The paths in the repository don't have the "./" in front. */
+	STOPIF( hlp__local2utf8(path+2, &utf8, -1), NULL);
+
+	file=rf___files + rf___count;
+	memset(file, 0, sizeof(*file));
+	file->sts=sts;
+	file->rev=rev;
+	file->url_nr=i;
+	STOPIF( hlp__strdup( &file->path, utf8), NULL);
+	/* The same name as waa__get_tmp_name() would give. */
+	STOPIF( hlp__strmnalloc(strlen(path) + 8, &file->tmp,
+				path, ".XXXXXX", NULL), NULL);
+	rf___count++;
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * If no files are queued, no threads are started. */
+int rf__start(void)
+{
+	int status;
+#ifdef HAVE_PTHREAD
+	sigset_t all, old;
+	int threads, opened, i;
+
+
+	status=0;
+	threads=opt__get_int(OPT__FETCH_THREADS);
+	if (threads > RF___MAX_THREADS) threads=RF___MAX_THREADS;
+	/* With only a single file there's nothing to overlap. */
+	if (threads <= 0 || rf___count < 2) goto ex;
+
+	rf___ahead=threads * RF___AHEAD_PER_THREAD;
+	rf___stopping=0;
+	rf___next=rf___reached=0;
+
+	STOPIF( apr_temp_dir_get(&rf___tmp_dir, global_pool), NULL);
+
+	/* Signals should be handled in the main thread only; the threads
+	 * inherit the blocked mask. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	/* All sessions are opened before the first thread runs; for svn+ssh 
+	 * this forks, which shouldn't happen while other threads are busy. */
+	for(opened=0; opened < threads; opened++)
+	{
+		rf___workers[opened].pool=NULL;
+		status=rf___open_sessions(rf___workers + opened);
+		if (status)
+		{
+			/* The main thread will fetch the files itself, and report the 
+			 * errors, if any. */
+			DEBUGP("can't open sessions for fetch thread %d: %d",
+					opened, status);
+			if (rf___workers[opened].pool)
+				apr_pool_destroy(rf___workers[opened].pool);
+			status=0;
+			break;
+		}
+	}
+
+	while (rf___threads < opened)
+	{
+		if (pthread_create(& rf___workers[rf___threads].id, NULL,
+					rf___thread, rf___workers + rf___threads) != 0)
+		{
+			DEBUGP("can't start fetch thread %d", rf___threads);
+			for(i=rf___threads; i<opened; i++)
+				apr_pool_destroy(rf___workers[i].pool);
+			break;
+		}
+		rf___threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+ex:
+	DEBUGP("%d fetch threads for %u files", rf___threads, rf___count);
+#else
+	status=0;
+#endif
+	return status;
+}
+
+
+#ifdef HAVE_PTHREAD
+/** Makes a hash out of the serialized properties of \a file. */
+static apr_hash_t *rf___props_to_hash(struct rf___file_t *file,
+		apr_pool_t *pool)
+{
+	apr_hash_t *props;
+	char *cp, *end, *name;
+	uint32_t vlen;
+
+	props=apr_hash_make(pool);
+	cp=file->props;
+	end=cp + file->props_len;
+	while (cp < end)
+	{
+		name=apr_pstrdup(pool, cp);
+		cp+=strlen(cp)+1;
+		memcpy(&vlen, cp, sizeof(vlen));
+		cp+=sizeof(vlen);
+		apr_hash_set(props, name, APR_HASH_KEY_STRING,
+				svn_string_ncreate(cp, vlen, pool));
+		cp+=vlen;
+	}
+
+	return props;
+}
+#endif
+
+
+/** -.
+ * Normally \a sts is one of the next few queued files; if it isn't, the 
+ * rest of the queue is searched, like in pf__reached(), and the files 
+ * that were skipped over aren't fetched any more.
+ * If \a sts isn't queued (or was fetched for another revision), \a 
+ * *filename is set to \c NULL, and the caller has to fetch the file 
+ * itself.
+ *
+ * The temporary file then belongs to the caller. */
+int rf__take(struct estat *sts, svn_revnum_t rev,
+		char **filename, apr_hash_t **props, apr_pool_t *pool)
+{
+	int status;
+#ifdef HAVE_PTHREAD
+	unsigned i;
+	struct rf___file_t *file;
+#endif
+
+	status=0;
+	*filename=NULL;
+	*props=NULL;
+#ifdef HAVE_PTHREAD
+	if (!rf___threads) goto ex;
+
+	pthread_mutex_lock(&rf___mutex);
+	for(i=rf___reached; i<rf___count; i++)
+		if (rf___files[i].sts == sts) break;
+
+	if (i >= rf___count)
+		DEBUGP("%s wasn't queued", sts->name);
+	else if (i >= rf___reached + rf___ahead)
+		DEBUGP("skipped %u queued files", i - rf___reached);
+
+	if (i < rf___count && rf___files[i].rev == rev)
+	{
+		file=rf___files+i;
+		/* Let the threads get to it, if they haven't yet; the files before 
+		 * it aren't needed anymore. */
+		rf___reached=i;
+		if (rf___next < rf___reached)
+			rf___next=rf___reached;
+		pthread_cond_broadcast(&rf___work);
+		while (file->state == RF___QUEUED || file->state == RF___RUNNING)
+			pthread_cond_wait(&rf___finished, &rf___mutex);
+
+		if (file->state == RF___DONE)
+		{
+			*filename=apr_pstrdup(pool, file->tmp);
+			*props=rf___props_to_hash(file, pool);
+			file->state=RF___TAKEN;
+		}
+	}
+
+	if (i < rf___count)
+	{
+		rf___reached=i+1;
+		if (rf___next < rf___reached)
+			rf___next=rf___reached;
+		pthread_cond_broadcast(&rf___work);
+	}
+	pthread_mutex_unlock(&rf___mutex);
+
+	if (*filename)
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
+	DEBUGP("%s fetched ahead: %s", sts->name, *filename ? "yes" : "no");
+
+ex:
+#endif
+	return status;
+}
+
+
+/** -.
+ * Can be called any number of times. */
+void rf__stop(void)
+{
+	unsigned i;
+
+#ifdef HAVE_PTHREAD
+	if (rf___threads)
+	{
+		pthread_mutex_lock(&rf___mutex);
+		rf___stopping=1;
+		pthread_cond_broadcast(&rf___work);
+		pthread_mutex_unlock(&rf___mutex);
+
+		while (rf___threads)
+		{
+			rf___threads--;
+			pthread_join(rf___workers[rf___threads].id, NULL);
+			apr_pool_destroy(rf___workers[rf___threads].pool);
+		}
+	}
+#endif
+
+	for(i=0; i<rf___count; i++)
+	{
+		/* Fetched, but not asked for. */
+		if (rf___files[i].state == RF___DONE)
+			unlink(rf___files[i].tmp);
+		IF_FREE(rf___files[i].path);
+		IF_FREE(rf___files[i].tmp);
+		IF_FREE(rf___files[i].props);
+	}
+	IF_FREE(rf___files);
+	IF_FREE(rf___urls);
+	rf___count=rf___max=0;
+	rf___url_count=0;
+}
@@ -0,0 +1,33 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __RFETCH_H__
+#define __RFETCH_H__
+
+#include "global.h"
+
+/** \file
+ * Fetch-ahead for revert and update header file. */
+
+
+/** Queues the file \a sts, to be fetched at revision \a rev; the files 
+ * have to be given in the order in which they'll be installed, and before 
+ * rf__start(). */
+int rf__add(struct estat *sts, svn_revnum_t rev);
+/** Opens the sessions and starts the fetch threads, as configured by \ref 
+ * o_fetch_threads. */
+int rf__start(void);
+/** Returns the data of \a sts at \a rev, if a thread has fetched it.
+ * The temporary file name is returned in \a filename (or \c NULL), the 
+ * properties in \a props. */
+int rf__take(struct estat *sts, svn_revnum_t rev, 
+		char **filename, apr_hash_t **props, apr_pool_t *pool);
+/** Stops the fetch threads, and removes the unused files. */
+void rf__stop(void);
+
+#endif
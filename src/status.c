@@ -7,6 +7,9 @@
  ************************************************************************/
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <time.h>
 #include <assert.h>
 
@@ -133,15 +136,16 @@ char * st___visible_file_size(struct estat *sts)
 }
 
 
-/** Meta-data status string. */
-char * st___meta_string(int status_bits, int flags)
+/** Meta-data status string; with \a detailed it's split into three 
+ * characters. */
+char * st___meta_string(int status_bits, int flags, int detailed)
 {
     static char buffer[4];
     int prop;
 
     prop=(status_bits & FS_PROPERTIES) | (flags & RF_PUSHPROPS);
 
-    if (opt__is_verbose() > 0)
+    if (detailed)
     {
         buffer[0] = status_bits & FS_META_MTIME ?  't' : '.';
         buffer[1] = status_bits & 
@@ -172,6 +176,194 @@ char *st___color(int status_bits)
 }
 
 
+/** Writes the status column (like \c "N...." or \c ".mC.") into \a 
+ * buffer, which needs space for 7 characters. */
+char *st___status_column(char *buffer, int status_bits, int flags, 
+		int detailed)
+{
+	sprintf(buffer, "%c%s%c%c",
+			flags & RF_ADD ? 'n' : 
+			flags & RF_UNVERSION ? 'd' : 
+			(status_bits & FS_REPLACED) == FS_REPLACED ? 'R' : 
+			status_bits & FS_NEW ? 'N' : 
+			status_bits & FS_REMOVED ? 'D' : '.',
+
+			st___meta_string(status_bits, flags, detailed),
+
+			flags & RF_CONFLICT ? 'x' : 
+			status_bits & FS_CHANGED ? 'C' : '.',
+
+			flags & RF___IS_COPY ? '+' : 
+			status_bits & FS_LIKELY ? '?' : 
+			/* An entry marked for unversioning or adding, 
+			 * which does not exist, gets a '!' */
+			( ( status_bits & FS_REMOVED ) &&
+				( flags & (RF_UNVERSION | RF_ADD) ) ) ? '!' : '.'
+			);
+
+	return buffer;
+}
+
+
+/** \name Machine-readable status records.
+ * See \ref o_status_format.
+ *
+ * The records are collected in a big buffer, and written with a single 
+ * \c write() call when it's full or at the end; so there's no per-line 
+ * \c stdio overhead.
+ * @{ */
+/** The initial size of the output buffer. */
+#define ST___RECORD_BUFFER (256*1024)
+static char *st___records;
+static unsigned st___records_len, st___records_size;
+
+
+/** -.
+ * \c stdout gets flushed first, so that earlier text output stays in 
+ * front. */
+int st__flush_records(void)
+{
+	int status;
+	unsigned pos;
+	ssize_t l;
+
+
+	status=0;
+	if (!st___records_len) goto ex;
+
+	STOPIF_CODE_EPIPE( fflush(stdout), NULL);
+
+	pos=0;
+	while (pos < st___records_len)
+	{
+		l=write(STDOUT_FILENO, st___records+pos, st___records_len-pos);
+		if (l == -1 && errno == EINTR) continue;
+		STOPIF_CODE_EPIPE(l, NULL);
+		pos+=l;
+	}
+
+	st___records_len=0;
+
+ex:
+	return status;
+}
+
+
+/** Makes sure that \a needed bytes are available in the output buffer. */
+static int st___records_reserve(unsigned needed)
+{
+	int status;
+
+
+	status=0;
+	if (st___records_len + needed <= st___records_size) goto ex;
+
+	STOPIF( st__flush_records(), NULL);
+
+	if (needed > st___records_size)
+	{
+		st___records_size= needed > ST___RECORD_BUFFER ? 
+			needed : ST___RECORD_BUFFER;
+		STOPIF( hlp__realloc( &st___records, st___records_size), NULL);
+	}
+
+ex:
+	return status;
+}
+
+
+/** Copies \a string as JSON string (including the quotes) to \a dest, 
+ * and returns the end.
+ * Needs at most 6 bytes per input byte plus 2. */
+static char *st___json_string(char *dest, const char *string)
+{
+	static const char hex[]="0123456789abcdef";
+	unsigned char c;
+
+	*(dest++)='"';
+	while ( (c=*(string++)) )
+	{
+		if (c == '"' || c == '\\')
+		{
+			*(dest++)='\\';
+			*(dest++)=c;
+		}
+		else if (c < 0x20)
+		{
+			memcpy(dest, "\\u00", 4);
+			dest[4]=hex[c >> 4];
+			dest[5]=hex[c & 0xf];
+			dest+=6;
+		}
+		else
+			*(dest++)=c;
+	}
+	*(dest++)='"';
+
+	return dest;
+}
+
+
+/** Puts a record for an entry into the output buffer. */
+static int st___print_record(char *path, int status_bits, int flags, 
+		char *size, struct estat *sts)
+{
+	int status;
+	char column[8];
+	char *url, *cp;
+	unsigned needed;
+
+
+	if (sts->url)
+		STOPIF( url__full_url(sts, &url), NULL);
+	else
+		url="";
+
+	st___status_column(column, status_bits, flags, 1);
+
+	needed=sizeof(column) + strlen(size) + 6*(strlen(path) + strlen(url)) +
+		64;
+	STOPIF( st___records_reserve(needed), NULL);
+
+	cp=st___records + st___records_len;
+	if (opt__get_int(OPT__STATUS_FORMAT) == STATUS_FORMAT_NUL)
+	{
+		cp=stpcpy(cp, column)+1;
+		cp=stpcpy(cp, size)+1;
+		cp=stpcpy(cp, path)+1;
+		cp=stpcpy(cp, url)+1;
+	}
+	else
+	{
+		cp+=sprintf(cp, "{\"status\":\"%s\",\"size\":", column);
+		/* Directories and devices have a string instead of a number. */
+		if (isdigit(size[0]))
+			cp=stpcpy(cp, size);
+		else
+			cp=st___json_string(cp, size);
+
+		cp=stpcpy(cp, ",\"path\":");
+		cp=st___json_string(cp, path);
+		cp=stpcpy(cp, ",\"url\":");
+		if (*url)
+			cp=st___json_string(cp, url);
+		else
+			cp=stpcpy(cp, "null");
+		cp=stpcpy(cp, "}\n");
+	}
+
+	st___records_len = cp - st___records;
+	BUG_ON(st___records_len > st___records_size);
+
+	if (opt__get_int(OPT__STATUS_STREAM))
+		STOPIF( st__flush_records(), NULL);
+
+ex:
+	return status;
+}
+/** @} */
+
+
 /** Prints the entry in readable form.
  * This function uses the \c OPT__VERBOSE settings.  */
 int st__print_status(char *path, int status_bits, int flags, char* size,
@@ -181,6 +373,7 @@ int st__print_status(char *path, int status_bits, int flags, char* size,
 	char *copyfrom, *url;
 	int copy_inherited;
 	FILE* output=stdout;
+	char column[8];
 
 
 	DEBUGP("VERBOSITY=%d", opt__get_int(OPT__VERBOSE));
@@ -203,6 +396,13 @@ int st__print_status(char *path, int status_bits, int flags, char* size,
       (status_bits & FS__CHANGE_MASK) ||
       (flags & ~RF_CHECK))
 	{
+		if (opt__get_int(OPT__STATUS_FORMAT) != STATUS_FORMAT_TEXT)
+		{
+			STOPIF( st___print_record(path, status_bits, flags, size, sts), 
+					NULL);
+			goto ex;
+		}
+
 		copyfrom=NULL;
 		copy_inherited=0;
 
@@ -240,25 +440,9 @@ int st__print_status(char *path, int status_bits, int flags, char* size,
 			STOPIF_CODE_EPIPE( fputs(st___color(status_bits), output), NULL);
 
 		if (opt__get_int(OPT__VERBOSE) & VERBOSITY_SHOWCHG)
-			STOPIF_CODE_EPIPE( fprintf(output, "%c%s%c%c  ",
-						flags & RF_ADD ? 'n' : 
-						flags & RF_UNVERSION ? 'd' : 
-						(status_bits & FS_REPLACED) == FS_REPLACED ? 'R' : 
-						status_bits & FS_NEW ? 'N' : 
-						status_bits & FS_REMOVED ? 'D' : '.',
-
-						st___meta_string(status_bits, flags),
-
-						flags & RF_CONFLICT ? 'x' : 
-						status_bits & FS_CHANGED ? 'C' : '.',
-
-						flags & RF___IS_COPY ? '+' : 
-						status_bits & FS_LIKELY ? '?' : 
-						/* An entry marked for unversioning or adding, 
-						 * which does not exist, gets a '!' */
-						( ( status_bits & FS_REMOVED ) &&
-							( flags & (RF_UNVERSION | RF_ADD) ) ) ? '!' : '.'
-						), NULL);
+			STOPIF_CODE_EPIPE( fprintf(output, "%s  ",
+						st___status_column(column, status_bits, flags,
+							opt__is_verbose() > 0)), NULL);
 
 
 		if (opt__get_int(OPT__VERBOSE) & VERBOSITY_SHOWSIZE)
@@ -267,7 +451,8 @@ int st__print_status(char *path, int status_bits, int flags, char* size,
 		if (opt__get_int(OPT__VERBOSE) & VERBOSITY_GROUP)
 			STOPIF_CODE_EPIPE( fprintf(output, "%-*s", 
 						ign__max_group_name_len+2,
-						sts->match_pattern ? sts->match_pattern->group_name :
+						COLD(sts, match_pattern) ? 
+						sts->cold->match_pattern->group_name :
 						"(none)"), NULL);
 
 		if (opt__get_int(OPT__VERBOSE) & VERBOSITY_SHOWNAME)
@@ -410,6 +595,8 @@ int st__work(struct estat *root, int argc, char *argv[])
 	{
 		action->local_callback=st__progress;
 		action->local_uninit=st__progress_uninit;
+		/* Print the sorted entries as soon as possible. */
+		STOPIF( waa__sorted_start(root, st__status), NULL);
 	}
 
 	STOPIF( waa__read_or_build_tree(root, argc, normalized, argv, NULL, 0), 
@@ -419,9 +606,14 @@ int st__work(struct estat *root, int argc, char *argv[])
 	if (opt__get_int(OPT__DIR_SORT))
 	{
 		action->local_callback=st__status;
-		STOPIF( waa__do_sorted_tree(root, ac__dispatch), NULL);
+		if (opt__get_int(OPT__STOP_ON_CHANGE))
+			STOPIF( waa__do_sorted_tree(root, ac__dispatch), NULL);
+		else
+			STOPIF( waa__sorted_finish(), NULL);
 	}
 
+	STOPIF( st__flush_records(), NULL);
+
 	if (opt__get_int(OPT__GROUP_STATS))
 		STOPIF( ign__print_group_stats(stdout), NULL);
 
@@ -30,6 +30,9 @@ action_t st__progress;
 /** Uninitializer for \ref st__progress. */
 action_uninit_t st__progress_uninit;
 
+/** Writes the buffered \ref o_status_format "status records". */
+int st__flush_records(void);
+
 /** Shows detailed information about the entry. */
 int st__print_entry_info(struct estat *sts);
 
@@ -91,6 +91,7 @@
 #include "update.h"
 #include "racallback.h"
 #include "helper.h"
+#include "perf.h"
 
 
 /** Get entries of directory, and fill tree.
@@ -129,6 +130,7 @@ int sync___recurse(struct estat *cur_dir,
 	DEBUGP("list of %s", path);
 	STOPIF( hlp__local2utf8(path, &path_utf8, -1), NULL);
 
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
 	STOPIF_SVNERR( svn_ra_get_dir2,
 			(current_url->session, 
 			 &dirents, NULL, NULL,
@@ -155,8 +157,8 @@ int sync___recurse(struct estat *cur_dir,
 			/* File or special entry. */
 			sts->st.size=val->size;
 
-			decoder= sts->user_prop ? 
-				apr_hash_get(sts->user_prop, 
+			decoder= COLD(sts, user_prop) ? 
+				apr_hash_get(sts->cold->user_prop, 
 						propval_updatepipe, APR_HASH_KEY_STRING) : 
 					NULL;
 
@@ -212,11 +214,7 @@ int sync___recurse(struct estat *cur_dir,
 			}
 
 			/* After this entry is done we can return a bit of memory. */
-			if (sts->user_prop)
-			{
-				apr_pool_destroy(apr_hash_get(sts->user_prop, "", 0));
-				sts->user_prop=NULL;
-			}
+			ops__free_user_prop(sts);
 
 			DEBUGP_dump_estat(sts);
 		}
@@ -251,6 +249,7 @@ int sync__progress(struct estat *sts)
 	STOPIF( ops__build_path(&path, sts), NULL);
 
 	STOPIF( waa__delete_byext( path, WAA__FILE_MD5s_EXT, 1), NULL);
+	STOPIF( waa__delete_byext( path, WAA__FILE_FPRINT_EXT, 1), NULL);
 	STOPIF( waa__delete_byext( path, WAA__PROP_EXT, 1), NULL);
 
 
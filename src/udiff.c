@@ -0,0 +1,592 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "global.h"
+#include "helper.h"
+#include "udiff.h"
+
+
+/** \file
+ * Internal unified diff engine.
+ *
+ * This is used by the \ref diff command instead of calling an external
+ * \c diff program for every changed file (see \ref o_diff_engine).
+ *
+ * Both files are \c mmap()ed, split into lines, and every distinct line
+ * gets mapped to a number; so that the comparison in the inner loop is
+ * only an integer compare.
+ *
+ * The difference itself is calculated with the linear-space variant of
+ * the algorithm in <i>E. Myers, "An O(ND) Difference Algorithm and Its
+ * Variations", Algorithmica 1, 1986</i>; for very big changes the
+ * search is cut short (like GNU diff does), so that the runtime stays
+ * bounded - the output is still a correct diff, just not necessarily the
+ * minimal one.
+ * */
+
+
+/** How many bytes are checked for \c NUL characters to decide whether a
+ * file is binary. */
+#define UD___BINARY_CHECK (8192)
+
+/** After how many edit steps the search for the middle snake is
+ * aborted, and an approximation used. */
+#define UD___MIN_EXPENSIVE (4096)
+
+
+/** Per-file data. */
+struct ud___file_t {
+	/** Filename, for error messages. */
+	const char *name;
+	/** The mapped file data, or \c NULL for empty files. */
+	char *data;
+	/** Length of the file. */
+	size_t size;
+	/** Start of each line; the entry after the last line points just
+	 * after the data. */
+	char **line;
+	/** The equivalence class number of each line. */
+	long *id;
+	/** Flag whether the line is part of a change. */
+	char *changed;
+	/** Number of lines. */
+	long count;
+};
+
+
+/** One equivalence class of lines. */
+struct ud___class_t {
+	/** Start of the first line seen with this content. */
+	char *start;
+	/** Length, including the newline character. */
+	size_t len;
+	/** Hash value. */
+	unsigned long hash;
+};
+
+
+/** A block of changed lines; \c [i0,i1) in the first, \c [j0,j1) in the
+ * second file. */
+struct ud___block_t {
+	long i0, i1, j0, j1;
+};
+
+
+/** Comparison state. */
+struct ud___ctx_t {
+	/** Line numbers of both files. */
+	long *xv, *yv;
+	/** Change flags of both files. */
+	char *xchg, *ychg;
+	/** Forward and backward diagonal vectors. */
+	long *fd, *bd;
+	/** Cost limit. */
+	long too_expensive;
+};
+
+
+/** Maps the file and finds the start of all lines. */
+static int ud___load(struct ud___file_t *file, const char *name)
+{
+	int status;
+	int fh;
+	struct sstat_t st;
+	char *cp, *end;
+	long i;
+
+
+	status=0;
+	fh=-1;
+	memset(file, 0, sizeof(*file));
+	file->name=name;
+
+	fh=open(name, O_RDONLY);
+	STOPIF_CODE_ERR( fh == -1, errno, "Cannot open %s", name);
+	STOPIF( hlp__fstat(fh, &st), NULL);
+
+	file->size=st.size;
+	if (file->size)
+	{
+		file->data=mmap(NULL, file->size, PROT_READ, MAP_SHARED, fh, 0);
+		STOPIF_CODE_ERR( file->data == MAP_FAILED, errno,
+				"Can't map %s", name);
+	}
+
+	/* Count lines; an incomplete last line counts, too. */
+	end=file->data+file->size;
+	file->count=0;
+	cp=file->data;
+	while (cp < end)
+	{
+		cp=memchr(cp, '\n', end-cp);
+		file->count++;
+		if (!cp) break;
+		cp++;
+	}
+
+	STOPIF( hlp__alloc( &file->line, sizeof(*file->line) * (file->count+1)),
+			NULL);
+	STOPIF( hlp__alloc( &file->id, sizeof(*file->id) * (file->count+1)),
+			NULL);
+	STOPIF( hlp__calloc( &file->changed, file->count+1, 1), NULL);
+
+	cp=file->data;
+	for(i=0; i<file->count; i++)
+	{
+		file->line[i]=cp;
+		cp=memchr(cp, '\n', end-cp);
+		cp= cp ? cp+1 : end;
+	}
+	file->line[file->count]=end;
+
+	DEBUGP("%s has %llu bytes in %ld lines",
+			name, (t_ull)file->size, file->count);
+
+ex:
+	if (fh != -1) close(fh);
+	return status;
+}
+
+
+/** Unmaps the file and frees the associated memory. */
+static void ud___unload(struct ud___file_t *file)
+{
+	if (file->data && file->data != MAP_FAILED)
+		munmap(file->data, file->size);
+	IF_FREE(file->line);
+	IF_FREE(file->id);
+	IF_FREE(file->changed);
+}
+
+
+/** Assigns equivalence classes to the lines of both files.
+ * Identical lines get the same number. */
+static int ud___classify(struct ud___file_t *files)
+{
+	int status;
+	struct ud___class_t *classes;
+	long *table;
+	long table_mask, class_count, i, c, idx;
+	int f;
+	char *cp;
+	size_t len;
+	unsigned long hash;
+
+
+	status=0;
+	classes=NULL;
+	table=NULL;
+
+	table_mask=1023;
+	while (table_mask < 2*(files[0].count + files[1].count))
+		table_mask=table_mask*2+1;
+
+	STOPIF( hlp__alloc( &classes, sizeof(*classes) *
+				(files[0].count + files[1].count + 1)), NULL);
+	STOPIF( hlp__alloc( &table, sizeof(*table) * (table_mask+1)), NULL);
+	memset(table, -1, sizeof(*table) * (table_mask+1));
+
+	class_count=0;
+	for(f=0; f<2; f++)
+		for(i=0; i<files[f].count; i++)
+		{
+			cp=files[f].line[i];
+			len=files[f].line[i+1] - cp;
+
+			/* FNV-1a */
+			hash=2166136261UL;
+			while (cp < files[f].line[i+1])
+				hash=(hash ^ *(cp++)) * 16777619UL;
+
+			idx=hash & table_mask;
+			while (1)
+			{
+				c=table[idx];
+				if (c == -1)
+				{
+					c=class_count++;
+					classes[c].start=files[f].line[i];
+					classes[c].len=len;
+					classes[c].hash=hash;
+					table[idx]=c;
+					break;
+				}
+
+				if (classes[c].hash == hash && classes[c].len == len &&
+						memcmp(classes[c].start, files[f].line[i], len) == 0)
+					break;
+
+				idx=(idx+1) & table_mask;
+			}
+
+			files[f].id[i]=c;
+		}
+
+	DEBUGP("%ld distinct lines", class_count);
+
+ex:
+	IF_FREE(classes);
+	IF_FREE(table);
+	return status;
+}
+
+
+/** Finds the midpoint of the shortest edit script for the given area.
+ *
+ * Returns the split point in \a xmid and \a ymid. */
+static void ud___split(struct ud___ctx_t *ctx,
+		long xoff, long xlim, long yoff, long ylim,
+		long *xmid, long *ymid)
+{
+	long *const xv=ctx->xv, *const yv=ctx->yv;
+	long *const fd=ctx->fd, *const bd=ctx->bd;
+	const long dmin=xoff-ylim, dmax=xlim-yoff;
+	const long fmid=xoff-yoff, bmid=xlim-ylim;
+	long fmin=fmid, fmax=fmid, bmin=bmid, bmax=bmid;
+	const int odd=(fmid-bmid) & 1;
+	long c, d, x, y, tlo, thi, best;
+
+
+	fd[fmid]=xoff;
+	bd[bmid]=xlim;
+
+	for(c=1; ; c++)
+	{
+		/* Extend the forward search by one diagonal on each side. */
+		if (fmin > dmin) fd[--fmin - 1] = -1;
+		else ++fmin;
+		if (fmax < dmax) fd[++fmax + 1] = -1;
+		else --fmax;
+
+		for(d=fmax; d>=fmin; d-=2)
+		{
+			tlo=fd[d-1];
+			thi=fd[d+1];
+			x= tlo >= thi ? tlo+1 : thi;
+			y=x-d;
+			while (x < xlim && y < ylim && xv[x] == yv[y])
+				x++, y++;
+			fd[d]=x;
+
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x)
+			{
+				*xmid=x;
+				*ymid=y;
+				return;
+			}
+		}
+
+		/* Same for the backward search. */
+		if (bmin > dmin) bd[--bmin - 1] = LONG_MAX;
+		else ++bmin;
+		if (bmax < dmax) bd[++bmax + 1] = LONG_MAX;
+		else --bmax;
+
+		for(d=bmax; d>=bmin; d-=2)
+		{
+			tlo=bd[d-1];
+			thi=bd[d+1];
+			x= tlo < thi ? tlo : thi-1;
+			y=x-d;
+			while (xoff < x && yoff < y && xv[x-1] == yv[y-1])
+				x--, y--;
+			bd[d]=x;
+
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d])
+			{
+				*xmid=x;
+				*ymid=y;
+				return;
+			}
+		}
+
+		if (c < ctx->too_expensive) continue;
+
+		/* Too expensive; take the forward diagonal that got furthest.  The
+		 * result is not minimal, but still a valid script. */
+		best=-1;
+		for(d=fmax; d>=fmin; d-=2)
+		{
+			x=fd[d];
+			if (x > xlim) x=xlim;
+			y=x-d;
+			if (y > ylim)
+			{
+				y=ylim;
+				x=y+d;
+			}
+
+			if (x < xoff || y < yoff) continue;
+			if (x == xoff && y == yoff) continue;
+			if (x == xlim && y == ylim) continue;
+
+			if (x+y > best)
+			{
+				best=x+y;
+				*xmid=x;
+				*ymid=y;
+			}
+		}
+
+		if (best != -1)
+		{
+			DEBUGP("cost limit reached at %ld,%ld", *xmid, *ymid);
+			return;
+		}
+	}
+}
+
+
+/** Marks the changed lines in the given area, recursively. */
+static void ud___compare(struct ud___ctx_t *ctx,
+		long xoff, long xlim, long yoff, long ylim)
+{
+	long xmid, ymid;
+
+
+	/* Skip identical lines at the start and end. */
+	while (xoff < xlim && yoff < ylim && ctx->xv[xoff] == ctx->yv[yoff])
+		xoff++, yoff++;
+	while (xoff < xlim && yoff < ylim &&
+			ctx->xv[xlim-1] == ctx->yv[ylim-1])
+		xlim--, ylim--;
+
+	if (xoff == xlim)
+		memset(ctx->ychg+yoff, 1, ylim-yoff);
+	else if (yoff == ylim)
+		memset(ctx->xchg+xoff, 1, xlim-xoff);
+	else
+	{
+		ud___split(ctx, xoff, xlim, yoff, ylim, &xmid, &ymid);
+		ud___compare(ctx, xoff, xmid, yoff, ymid);
+		ud___compare(ctx, xmid, xlim, ymid, ylim);
+	}
+}
+
+
+/** Prints a single line with the given prefix character. */
+static int ud___print_line(FILE *output, char prefix,
+		struct ud___file_t *file, long nr)
+{
+	int status;
+	size_t len;
+
+
+	status=0;
+	len=file->line[nr+1] - file->line[nr];
+
+	STOPIF_CODE_EPIPE( fputc(prefix, output), NULL);
+	STOPIF_CODE_EPIPE( fwrite(file->line[nr], len, 1, output) == 1 ? 0 : -1,
+			NULL);
+
+	if (file->line[nr][len-1] != '\n')
+		STOPIF_CODE_EPIPE(
+				fputs("\n\\ No newline at end of file\n", output), NULL);
+
+ex:
+	return status;
+}
+
+
+/** Prints a range for the hunk header, in the same way as GNU diff. */
+static int ud___print_range(FILE *output, char prefix,
+		long start, long count)
+{
+	int status;
+
+
+	status=0;
+	if (count == 1)
+		STOPIF_CODE_EPIPE( fprintf(output, "%c%ld", prefix, start+1), NULL);
+	else
+		STOPIF_CODE_EPIPE( fprintf(output, "%c%ld,%ld",
+					prefix, count ? start+1 : start, count), NULL);
+
+ex:
+	return status;
+}
+
+
+/** Prints the hunks for the given list of changed blocks. */
+static int ud___print_hunks(FILE *output, struct ud___file_t *files,
+		struct ud___block_t *blocks, long count, int context)
+{
+	int status;
+	long first, last, a0, a1, b0, b1, i, j;
+	struct ud___block_t *blk;
+
+
+	status=0;
+	first=0;
+	while (first < count)
+	{
+		/* Merge blocks whose context would overlap. */
+		last=first;
+		while (last+1 < count &&
+				blocks[last+1].i0 - blocks[last].i1 <= 2*context)
+			last++;
+
+		a0=blocks[first].i0 - context;
+		if (a0 < 0) a0=0;
+		b0=blocks[first].j0 - (blocks[first].i0 - a0);
+
+		a1=blocks[last].i1 + context;
+		if (a1 > files[0].count) a1=files[0].count;
+		b1=blocks[last].j1 + (a1 - blocks[last].i1);
+
+		STOPIF_CODE_EPIPE( fputs("@@ ", output), NULL);
+		STOPIF( ud___print_range(output, '-', a0, a1-a0), NULL);
+		STOPIF_CODE_EPIPE( fputs(" ", output), NULL);
+		STOPIF( ud___print_range(output, '+', b0, b1-b0), NULL);
+		STOPIF_CODE_EPIPE( fputs(" @@\n", output), NULL);
+
+		i=a0;
+		for(blk=blocks+first; blk<=blocks+last; blk++)
+		{
+			for(; i<blk->i0; i++)
+				STOPIF( ud___print_line(output, ' ', files+0, i), NULL);
+			for(; i<blk->i1; i++)
+				STOPIF( ud___print_line(output, '-', files+0, i), NULL);
+			for(j=blk->j0; j<blk->j1; j++)
+				STOPIF( ud___print_line(output, '+', files+1, j), NULL);
+		}
+		for(; i<a1; i++)
+			STOPIF( ud___print_line(output, ' ', files+0, i), NULL);
+
+		first=last+1;
+	}
+
+ex:
+	return status;
+}
+
+
+/** -.
+ * */
+int ud__diff_files(FILE *output,
+		const char *file1, const char *label1,
+		const char *file2, const char *label2,
+		int context, int *changed)
+{
+	int status;
+	struct ud___file_t files[2];
+	struct ud___ctx_t ctx;
+	struct ud___block_t *blocks;
+	long *diag_mem;
+	long i, j, i0, j0, blk_count, blk_max;
+	int is_binary, f;
+
+
+	status=0;
+	memset(files, 0, sizeof(files));
+	blocks=NULL;
+	diag_mem=NULL;
+	blk_count=blk_max=0;
+	if (changed) *changed=0;
+	if (context < 0) context=UD__DEFAULT_CONTEXT;
+
+	STOPIF( ud___load(files+0, file1), NULL);
+	STOPIF( ud___load(files+1, file2), NULL);
+
+	/* Shortcut for the common case. */
+	if (files[0].size == files[1].size &&
+			(!files[0].size ||
+			 memcmp(files[0].data, files[1].data, files[0].size) == 0))
+		goto ex;
+
+	if (changed) *changed=1;
+
+	is_binary=0;
+	for(f=0; f<2; f++)
+		if (files[f].size && memchr(files[f].data, 0,
+					files[f].size < UD___BINARY_CHECK ?
+					files[f].size : UD___BINARY_CHECK))
+			is_binary=1;
+
+	if (is_binary)
+	{
+		STOPIF_CODE_EPIPE( fprintf(output, "Binary files %s and %s differ\n",
+					label1, label2), NULL);
+		goto ex;
+	}
+
+
+	STOPIF( ud___classify(files), NULL);
+
+	/* The diagonals go from -(lines in file2)-1 to (lines in file1)+1. */
+	STOPIF( hlp__alloc( &diag_mem, sizeof(*diag_mem) * 2 *
+				(files[0].count + files[1].count + 3)), NULL);
+	ctx.fd=diag_mem + files[1].count + 1;
+	ctx.bd=ctx.fd + files[0].count + files[1].count + 3;
+	ctx.xv=files[0].id;
+	ctx.yv=files[1].id;
+	ctx.xchg=files[0].changed;
+	ctx.ychg=files[1].changed;
+
+	/* Roughly the square root of the total number of lines, like GNU diff
+	 * does it. */
+	ctx.too_expensive=1;
+	for(i=files[0].count + files[1].count + 3; i; i >>= 2)
+		ctx.too_expensive <<= 1;
+	if (ctx.too_expensive < UD___MIN_EXPENSIVE)
+		ctx.too_expensive=UD___MIN_EXPENSIVE;
+
+	ud___compare(&ctx, 0, files[0].count, 0, files[1].count);
+
+
+	/* Collect blocks of changes. */
+	i=j=0;
+	while (i < files[0].count || j < files[1].count)
+	{
+		if (i < files[0].count && j < files[1].count &&
+				!ctx.xchg[i] && !ctx.ychg[j])
+		{
+			i++, j++;
+			continue;
+		}
+
+		i0=i;
+		j0=j;
+		while (i < files[0].count && ctx.xchg[i]) i++;
+		while (j < files[1].count && ctx.ychg[j]) j++;
+		BUG_ON(i == i0 && j == j0, "No progress at %ld, %ld", i, j);
+
+		if (blk_count >= blk_max)
+		{
+			blk_max = blk_max*2 + 16;
+			STOPIF( hlp__realloc( &blocks, sizeof(*blocks) * blk_max), NULL);
+		}
+
+		blocks[blk_count].i0=i0;
+		blocks[blk_count].i1=i;
+		blocks[blk_count].j0=j0;
+		blocks[blk_count].j1=j;
+		blk_count++;
+	}
+	DEBUGP("%ld changed blocks", blk_count);
+
+	if (!blk_count) goto ex;
+
+
+	STOPIF_CODE_EPIPE( fprintf(output, "--- %s\n+++ %s\n",
+				label1, label2), NULL);
+	STOPIF( ud___print_hunks(output, files, blocks, blk_count, context),
+			NULL);
+
+ex:
+	ud___unload(files+0);
+	ud___unload(files+1);
+	IF_FREE(diag_mem);
+	IF_FREE(blocks);
+	return status;
+}
+
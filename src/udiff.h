@@ -0,0 +1,34 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __UDIFF_H__
+#define __UDIFF_H__
+
+#include <stdio.h>
+
+/** \file
+ * Internal unified diff engine header file. */
+
+
+/** Number of context lines printed around a change, if nothing else is
+ * given. */
+#define UD__DEFAULT_CONTEXT (3)
+
+
+/** Prints the differences between the files \a file1 and \a file2 in
+ * unified diff format to \a output, using \a label1 and \a label2 for the
+ * header lines.
+ *
+ * If \a changed is not \c NULL, it gets set to \c 1 if differences were
+ * found, \c 0 otherwise. */
+int ud__diff_files(FILE *output,
+		const char *file1, const char *label1,
+		const char *file2, const char *label2,
+		int context, int *changed);
+
+#endif
@@ -77,12 +77,14 @@
 #include "racallback.h"
 #include "props.h"
 #include "checksum.h"
+#include "awrite.h"
 #include "revert.h"
 #include "warnings.h"
 #include "est_ops.h"
 #include "waa.h"
 #include "commit.h"
 #include "racallback.h"
+#include "perf.h"
 
 
 
@@ -107,7 +109,7 @@ int up__fetch_decoder(struct estat *sts)
 	status=0;
 	/* Need it, but don't have it? */
 	if (!action->needs_decoder || 
-			sts->decoder) goto ex;
+			COLD(sts, decoder)) goto ex;
 
 	status=prp__open_byestat(sts, GDBM_READER, &db);
 	if (status == ENOENT)
@@ -120,7 +122,10 @@ int up__fetch_decoder(struct estat *sts)
 		 * know we'll need. */
 
 		if (prp__get(db, propval_updatepipe, &value) == 0)
-			STOPIF( hlp__strdup( &sts->decoder, value.dptr), NULL);
+		{
+			STOPIF( ops__make_cold(sts), NULL);
+			STOPIF( hlp__strdup( &sts->cold->decoder, value.dptr), NULL);
+		}
 	}
 
 	ex:
@@ -361,9 +366,10 @@ int up__parse_prop(struct estat *sts,
 				 * programs' names includes UTF-8.
 				 *
 				 * \todo utf8->local??  */
-				STOPIF( hlp__strdup( &sts->decoder, utf8_value->data), NULL);
+				STOPIF( ops__make_cold(sts), NULL);
+				STOPIF( hlp__strdup( &sts->cold->decoder, utf8_value->data), NULL);
 				sts->decoder_is_correct=1;
-				DEBUGP("got a decoder: %s", sts->decoder);
+				DEBUGP("got a decoder: %s", sts->cold->decoder);
 			}
 		}
 
@@ -424,6 +430,7 @@ int up__unlink(struct estat *sts, char *filename)
 	else
 	{
 		STOPIF( waa__delete_byext(filename, WAA__FILE_MD5s_EXT, 1), NULL);
+		STOPIF( waa__delete_byext(filename, WAA__FILE_FPRINT_EXT, 1), NULL);
 		STOPIF( waa__delete_byext(filename, WAA__PROP_EXT, 1), NULL);
 	}
 
@@ -854,11 +861,13 @@ svn_error_t *up__apply_textdelta(void *file_baton,
 	int status;
 	char *cp;
 	char* fn_utf8;
-	apr_file_t *source, *target;
+	apr_file_t *source;
 	struct encoder_t *encoder;
 	svn_stringbuf_t *stringbuf_src;
+	struct timespec started;
 
 
+	PRF__SPAN_START(started);
 	stringbuf_src=NULL;
 	encoder=NULL;
 	STOPIF( ops__build_path(&filename, sts), NULL);
@@ -960,14 +969,13 @@ into_stringbufs:
 				NULL);
 
 		/* Mode, owner etc. will be done at file_close.
-		 * We read if it's something special. */
-		STOPIF( apr_file_open(&target, filename_tmp, 
-					APR_WRITE | APR_CREATE | APR_TRUNCATE,
-					APR_UREAD | APR_UWRITE, sts->filehandle_pool),
+		 * The data is written by the writer threads; the stream gets closed 
+		 * by svn_txdelta_apply() after the last window, which waits for the 
+		 * writes to finish. */
+		STOPIF( aw__open(filename_tmp, sts->filehandle_pool, &svn_s_tgt), 
 				NULL);
 
 		svn_s_src=svn_stream_from_aprfile(source, sts->filehandle_pool);
-		svn_s_tgt=svn_stream_from_aprfile(target, sts->filehandle_pool);
 
 		/* How do we get the filesize here? */
 		if (!action->is_import_export)
@@ -975,9 +983,9 @@ into_stringbufs:
 						sts->filehandle_pool),
 					NULL);
 
-		if (sts->decoder)
+		if (COLD(sts, decoder))
 		{
-			STOPIF( hlp__encode_filter(svn_s_tgt, sts->decoder, 1, 
+			STOPIF( hlp__encode_filter(svn_s_tgt, sts->cold->decoder, 1, 
 						filename, &svn_s_tgt, &encoder, sts->filehandle_pool), NULL);
 			/* If the file gets decoded, use the original MD5 for comparison. */
 			encoder->output_md5= &(sts->md5);
@@ -992,6 +1000,7 @@ into_stringbufs:
 
 
 	sts->remote_status |= FS_CHANGED;
+	PRF__SPAN_END(started, "up__apply_textdelta", filename);
 
 ex:
 	RETURN_SVNERR(status);
@@ -1026,7 +1035,9 @@ svn_error_t *up__close_file(void *file_baton,
 {
 	struct estat *sts=file_baton;
 	int status;
+	struct timespec started;
 
+	PRF__SPAN_START(started);
 	if (action->is_compare && text_checksum)
 	{
 		if (memcmp(text_checksum, sts->md5, sizeof(sts->md5)) != 0)
@@ -1080,6 +1091,7 @@ svn_error_t *up__close_file(void *file_baton,
 	STOPIF( st__status(sts), NULL);
 
 ex:
+	PRF__SPAN_END(started, "up__close_file", sts->name);
 	RETURN_SVNERR(status);
 }
 
@@ -20,6 +20,7 @@
 #include "est_ops.h"
 #include "checksum.h"
 #include "racallback.h"
+#include "perf.h"
 
 
 /** \file
@@ -1103,12 +1104,13 @@ int url__open_session(svn_ra_session_t **session, char **missing_dirs)
 	BUG_ON(*cp);
 
 
-	STOPIF_SVNERR_TEXT( svn_ra_open,
+	PRF__COUNT(PRF__C_RA_CALLS, 1);
+	STOPIF_SVNERR_TEXT( svn_ra_open2,
 				(& current_url->session, buffer,
 				 &cb__cb_table, NULL,  /* cbtable, cbbaton, */
 				 cfg,	/* config hash */
 				 current_url->pool),
-				"svn_ra_open(\"%s\")", current_url->url);
+				"svn_ra_open2(\"%s\")", current_url->url);
 	head=SVN_INVALID_REVNUM;
 	STOPIF( url__canonical_rev( current_url, &head), NULL);
 
@@ -1144,6 +1146,7 @@ int url__open_session(svn_ra_session_t **session, char **missing_dirs)
 		*cp=0;
 
 		DEBUGP("Reparent to %s", buffer);
+		PRF__COUNT(PRF__C_RA_CALLS, 1);
 		STOPIF_SVNERR( svn_ra_reparent,
 				(current_url->session, buffer, current_url->pool));
 	}
@@ -1365,7 +1368,7 @@ int url__other_full_url(struct estat *sts, struct url_t *url, char **output)
 	if (url)
 	{
 		STOPIF( ops__build_path( &path, sts), NULL);
-		len=url->urllen + 1 + sts->path_len+1;
+		len=url->urllen + 1 + strlen(path)+1;
 		STOPIF( cch__new_cache(&cache, 4), NULL);
 
 		STOPIF( cch__add(cache, 0, NULL, len, &data), NULL);
@@ -1670,6 +1673,7 @@ int url__canonical_rev( struct url_t *url, svn_revnum_t *rev)
 			BUG_ON( !url->session );
 			/* As we ask at most once we just use the connection's pool - that 
 			 * has to exist if there's a session. */
+			PRF__COUNT(PRF__C_RA_CALLS, 1);
 			STOPIF_SVNERR( svn_ra_get_latest_revnum,
 					(url->session, & url->head_rev, url->pool));
 
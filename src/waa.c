@@ -17,6 +17,7 @@
 #include <strings.h>
 #include <time.h>
 #include <sys/mman.h>
+#include <stdint.h>
 
 
 #include "waa.h"
@@ -32,6 +33,8 @@
 #include "est_ops.h"
 #include "ignore.h"
 #include "actions.h"
+#include "watch.h"
+#include "perf.h"
 
 
 /** \file
@@ -1085,6 +1088,378 @@ int waa___find_position(struct estat **new,
 }
 
 
+/** \name Index of the entry list
+ *
+ * The \ref dir file is sorted by inode number, so the entries below some 
+ * directory are spread over the whole file. To load only some subtrees 
+ * we'd have to parse every line just to get the parent number; the \ref 
+ * dirx "index" gives us the parents, the names, and the line positions 
+ * directly.
+ *
+ * The index is only used if it was written together with the current \ref 
+ * dir file; older versions of FSVS don't know about it, and would leave a 
+ * stale index behind.
+ * @{ */
+/** The magic bytes at the start of the index. */
+#define WAA___DIR_INDEX_MAGIC "fsvsdx1\n"
+
+/** Header of the \ref dirx file. */
+struct waa___dir_index_hdr {
+	/** \c WAA___DIR_INDEX_MAGIC */
+	char magic[8];
+	/** Number of entries. */
+	uint32_t count;
+	/** For alignment. */
+	uint32_t unused;
+	/** Size, device, inode and modification time of the \ref dir file. */
+	uint64_t dir_size, dir_dev, dir_ino;
+	int64_t dir_mtime, dir_mtime_nsec;
+};
+
+/** One entry line. */
+struct waa___dir_index_entry {
+	/** Position of the line in the \ref dir file. */
+	uint64_t line;
+	/** Offset of the name in the line. */
+	uint32_t name;
+	/** Parent, as stored in the \ref dir file; \c 0 for the root. */
+	uint32_t parent;
+};
+
+/** Filehandle of the index being written, or \c -1. */
+static int waa___index_hdl=-1;
+/** Buffer for writing. */
+static struct waa___dir_index_entry waa___index_buffer[4096];
+/** Number of entries in the buffer. */
+static unsigned waa___index_used;
+
+/** The paths given to waa__read_or_build_tree() for a partial load, 
+ * or \c NULL; see waa___select_subtrees(). */
+static char **waa___subtree_paths=NULL;
+/** Number of paths in waa___subtree_paths. */
+static int waa___subtree_count=0;
+/** Set if only parts of the tree were loaded; then it must not be written 
+ * again. */
+static int waa___tree_is_partial=0;
+
+
+/** Writes the buffered index entries. */
+static int waa___index_flush(void)
+{
+	int status;
+	ssize_t len;
+
+
+	status=0;
+	len=sizeof(waa___index_buffer[0]) * waa___index_used;
+	STOPIF_CODE_ERR( write(waa___index_hdl, waa___index_buffer, len) != len, 
+			errno, "Writing the entry list index");
+	waa___index_used=0;
+
+ex:
+	return status;
+}
+
+
+/** Remembers that the line for \a sts started at \a line, and was \a len 
+ * bytes long. */
+static int waa___index_add(struct estat *sts, off_t line, unsigned len, 
+		unsigned parent)
+{
+	int status;
+	struct waa___dir_index_entry *entry;
+
+
+	status=0;
+	entry=waa___index_buffer + waa___index_used;
+	entry->line=line;
+	/* The name is followed by \0\n. */
+	entry->name=len - 2 - strlen(sts->name);
+	entry->parent=parent;
+
+	waa___index_used++;
+	if (waa___index_used >= sizeof(waa___index_buffer)/
+			sizeof(waa___index_buffer[0]))
+		STOPIF( waa___index_flush(), NULL);
+
+ex:
+	return status;
+}
+
+
+/** Finishes the index for the \ref dir file written to \a dir_hdl; 
+ * the header gets the \a count of entries and the file data. */
+static int waa___index_finish(int dir_hdl, unsigned count)
+{
+	int status;
+	struct waa___dir_index_hdr hdr;
+	struct stat st;
+
+
+	status=0;
+	STOPIF( waa___index_flush(), NULL);
+	STOPIF_CODE_ERR( fstat(dir_hdl, &st) == -1, errno,
+			"Cannot stat the entry list");
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, WAA___DIR_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.count=count;
+	hdr.dir_size=st.st_size;
+	hdr.dir_dev=st.st_dev;
+	hdr.dir_ino=st.st_ino;
+	hdr.dir_mtime=st.st_mtim.tv_sec;
+	hdr.dir_mtime_nsec=st.st_mtim.tv_nsec;
+
+	STOPIF_CODE_ERR( lseek(waa___index_hdl, 0, SEEK_SET) == -1, errno,
+			"seeking to start of the index");
+	STOPIF_CODE_ERR( write(waa___index_hdl, &hdr, sizeof(hdr)) != sizeof(hdr),
+			errno, "Writing the index header");
+
+ex:
+	return status;
+}
+
+
+/** One of the directories on the way to a given path. */
+struct waa___subtree_anc {
+	/** Number of the entry in the \ref dir file, starting with \c 0. */
+	unsigned nr;
+	/** Number of path components up to here. */
+	unsigned depth;
+	/** Which of the given paths run through here. */
+	unsigned long long args;
+	/** How many of its children get loaded. */
+	unsigned children;
+};
+
+
+/** Decides which entries of the \ref dir file get loaded.
+ *
+ * If only some paths are wanted, and the \ref dirx "index" matches the 
+ * \ref dir file described by \a dir_st, \a *remap gets an array with the 
+ * new line number (starting with \c 1) for each of the \a count entries, 
+ * or \c 0 if it's not needed; and \a *loaded is set to the number of 
+ * entries to load. The mapped index is returned in \a *index, and must be 
+ * unmapped with \a *index_len by the caller.
+ *
+ * The needed entries are
+ * - everything below the given paths, and
+ * - the directories on the way to them, with only the children on the 
+ *   path; their estat::entry_count gets fixed via \a *anc.
+ *
+ * If anything doesn't fit, \a *remap stays \c NULL and the whole tree is 
+ * loaded, as before. */
+static int waa___select_subtrees(char *dir_mmap, struct stat *dir_st,
+		unsigned count,
+		struct waa___dir_index_hdr **index, off_t *index_len, 
+		unsigned **remap, unsigned *loaded,
+		struct waa___subtree_anc **anc, unsigned *anc_count)
+{
+	int status, fh, i, j, depth;
+	unsigned nr, parent_nr, max_anc, comp_count;
+	struct stat st;
+	struct waa___dir_index_hdr *hdr;
+	struct waa___dir_index_entry *entries;
+	unsigned char *state;
+	unsigned *new_nr;
+	struct waa___subtree_anc *list, *parent;
+	char ***comps, *cp, *name;
+	unsigned *comp_len;
+	unsigned long long args;
+
+
+	status=0;
+	fh=-1;
+	hdr=NULL;
+	state=NULL;
+	new_nr=NULL;
+	list=NULL;
+	comps=NULL;
+	comp_len=NULL;
+	*remap=NULL;
+
+	/* More paths than bits, or all in one? */
+	if (waa___subtree_count > (int)sizeof(args)*8) goto ex;
+
+	/* Split the paths into their components. */
+	STOPIF( hlp__calloc( &comps, waa___subtree_count, sizeof(*comps)), NULL);
+	STOPIF( hlp__calloc( &comp_len, waa___subtree_count, sizeof(*comp_len)), 
+			NULL);
+	for(i=0; i<waa___subtree_count; i++)
+	{
+		cp=waa___subtree_paths[i];
+		STOPIF( hlp__calloc( comps+i, strlen(cp)/2+2, sizeof(*comps[i])), NULL);
+		while (*cp)
+		{
+			if (*cp == PATH_SEPARATOR) 
+			{
+				cp++;
+				continue;
+			}
+			if (cp[0] == '.' && (cp[1] == PATH_SEPARATOR || !cp[1]))
+			{
+				cp++;
+				continue;
+			}
+
+			comps[i][ comp_len[i]++ ]=cp;
+			cp=strchr(cp, PATH_SEPARATOR);
+			if (!cp) break;
+		}
+
+		/* The root itself is wanted, so everything is needed. */
+		if (!comp_len[i]) goto ex;
+	}
+
+
+	status=waa__open_byext(NULL, WAA__DIR_INDEX_EXT, WAA__READ, &fh);
+	if (status == ENOENT)
+	{
+		DEBUGP("no entry list index");
+		status=0;
+		goto ex;
+	}
+	STOPIF(status, NULL);
+
+	STOPIF_CODE_ERR( fstat(fh, &st) == -1, errno, 
+			"Cannot stat the entry list index");
+	if (st.st_size != sizeof(*hdr) + count*sizeof(*entries))
+	{
+		DEBUGP("index has wrong size");
+		goto ex;
+	}
+
+	hdr=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fh, 0);
+	STOPIF_CODE_ERR( hdr == MAP_FAILED, errno, "mmap of the index failed");
+	*index_len=st.st_size;
+
+	if (memcmp(hdr->magic, WAA___DIR_INDEX_MAGIC, sizeof(hdr->magic)) ||
+			hdr->count != count ||
+			hdr->dir_size != dir_st->st_size ||
+			hdr->dir_dev != dir_st->st_dev ||
+			hdr->dir_ino != dir_st->st_ino ||
+			hdr->dir_mtime != dir_st->st_mtim.tv_sec ||
+			hdr->dir_mtime_nsec != dir_st->st_mtim.tv_nsec)
+	{
+		DEBUGP("index doesn't match the entry list");
+		goto ex;
+	}
+
+	entries=(struct waa___dir_index_entry*)(hdr+1);
+
+
+	STOPIF( hlp__calloc( &state, count, sizeof(*state)), NULL);
+	max_anc=16;
+	STOPIF( hlp__alloc( &list, max_anc*sizeof(*list)), NULL);
+
+	/* The root is on the way to everything. */
+	list[0].nr=0;
+	list[0].depth=0;
+	list[0].args=~0ULL;
+	list[0].children=0;
+	*anc_count=1;
+	state[0]=1;
+	*loaded=1;
+
+	for(nr=1; nr<count; nr++)
+	{
+		parent_nr=entries[nr].parent;
+		/* Parents are always written before their children. */
+		if (!parent_nr || parent_nr > nr ||
+				entries[nr].line + entries[nr].name >= dir_st->st_size)
+		{
+			DEBUGP("index is invalid at %u", nr);
+			goto ex;
+		}
+		parent_nr--;
+
+		if (!state[parent_nr]) continue;
+
+		if (state[parent_nr] == 2)
+		{
+			state[nr]=2;
+			(*loaded)++;
+			continue;
+		}
+
+		/* The parent is on the way to some path; is this entry, too? */
+		for(j=*anc_count-1; list[j].nr != parent_nr; j--) ;
+		parent=list+j;
+		depth=parent->depth;
+		name=dir_mmap + entries[nr].line + entries[nr].name;
+
+		args=0;
+		for(i=0; i<waa___subtree_count; i++)
+		{
+			if (!(parent->args & (1ULL << i))) continue;
+
+			cp=comps[i][depth];
+			j=strchrnul(cp, PATH_SEPARATOR) - cp;
+			if (strncmp(name, cp, j) || name[j]) continue;
+
+			if (depth+1 == comp_len[i])
+			{
+				state[nr]=2;
+				break;
+			}
+
+			state[nr]=1;
+			args |= 1ULL << i;
+		}
+
+		if (!state[nr]) continue;
+
+		parent->children++;
+		(*loaded)++;
+
+		if (state[nr] == 1)
+		{
+			if (*anc_count >= max_anc)
+			{
+				max_anc*=2;
+				STOPIF( hlp__realloc( &list, max_anc*sizeof(*list)), NULL);
+			}
+			parent=list + *anc_count;
+			(*anc_count)++;
+			parent->nr=nr;
+			parent->depth=depth+1;
+			parent->args=args;
+			parent->children=0;
+		}
+	}
+
+
+	/* The new numbers. */
+	STOPIF( hlp__alloc( &new_nr, count*sizeof(*new_nr)), NULL);
+	comp_count=0;
+	for(nr=0; nr<count; nr++)
+		new_nr[nr] = state[nr] ? ++comp_count : 0;
+	BUG_ON(comp_count != *loaded);
+
+	DEBUGP("loading %u of %u entries", *loaded, count);
+	*remap=new_nr;
+	new_nr=NULL;
+	*index=hdr;
+	*anc=list;
+	list=NULL;
+	hdr=NULL;
+
+ex:
+	if (hdr) munmap(hdr, st.st_size);
+	if (fh != -1) close(fh);
+	if (comps)
+		for(i=0; i<waa___subtree_count; i++)
+			IF_FREE(comps[i]);
+	IF_FREE(comps);
+	IF_FREE(comp_len);
+	IF_FREE(state);
+	IF_FREE(new_nr);
+	IF_FREE(list);
+	return status;
+}
+/** @} */
+
+
 /** -.
  *
  * Here the complete entry tree gets written to a file, which is used on the
@@ -1201,15 +1576,22 @@ int waa__output_tree(struct estat *root)
 {
 	struct estat ***directory, *sts, **sts_pp;
 	int max_dir, i, alloc_dir;
-	unsigned this_len;
+	unsigned this_len, line_len;
+	off_t position;
 	int status, waa_info_hdl;
 	unsigned complete_count, string_space;
 	char header[HEADER_LEN] = "UNFINISHED";
+	struct timespec started;
 
 
+	PRF__START(started);
 	waa_info_hdl=-1;
 	directory=NULL;
+	BUG_ON(waa___tree_is_partial, "Only a part of the entries is loaded");
 	STOPIF( waa__open_dir(NULL, WAA__WRITE, &waa_info_hdl), NULL);
+	STOPIF( waa__open_byext(NULL, WAA__DIR_INDEX_EXT, WAA__WRITE, 
+				&waa___index_hdl), NULL);
+	waa___index_used=0;
 
 	/* allocate space for later use - entry count and similar. */
 	status=strlen(header);
@@ -1217,6 +1599,12 @@ int waa__output_tree(struct estat *root)
 	i=write(waa_info_hdl, header, sizeof(header));
 	STOPIF_CODE_ERR( i != sizeof(header), errno,
 			"header was not written");
+	position=sizeof(header);
+
+	/* The index header gets written at the end. */
+	STOPIF_CODE_ERR( lseek(waa___index_hdl, 
+				sizeof(struct waa___dir_index_hdr), SEEK_SET) == -1, errno,
+			"seeking in the index");
 
 
 	/* Take a page of pointers (on x86-32). Will be reallocated if
@@ -1228,7 +1616,9 @@ int waa__output_tree(struct estat *root)
 	/* The root entry is visible above all URLs. */
 	root->url=NULL;
 
-	STOPIF( ops__save_1entry(root, 0, waa_info_hdl), NULL);
+	STOPIF( ops__save_1entry(root, 0, waa_info_hdl, &line_len), NULL);
+	STOPIF( waa___index_add(root, position, line_len, 0), NULL);
+	position+=line_len;
 	root->file_index=complete_count=1;
 
 
@@ -1303,8 +1693,11 @@ int waa__output_tree(struct estat *root)
 
 
 		// do current entry
-		STOPIF( ops__save_1entry(sts, sts->parent->file_index, waa_info_hdl), 
-				NULL);
+		STOPIF( ops__save_1entry(sts, sts->parent->file_index, waa_info_hdl,
+					&line_len), NULL);
+		STOPIF( waa___index_add(sts, position, line_len, 
+					sts->parent->file_index), NULL);
+		position+=line_len;
 
 		complete_count++;
 		/* store position number for child -> parent relationship */
@@ -1388,6 +1781,7 @@ save_header:
 			"re-writing header failed");
 
 	status=0;
+	STOPIF( waa___index_finish(waa_info_hdl, complete_count), NULL);
 
 ex:
 	if (waa_info_hdl != -1)
@@ -1397,8 +1791,18 @@ ex:
 		STOPIF( i, "closing tree handle");
 	}
 
+	/* If the entry list couldn't be written, the new index is thrown away, 
+	 * too; the old one still belongs to the old entry list. */
+	if (waa___index_hdl != -1)
+	{
+		i=waa__close(waa___index_hdl, status);
+		waa___index_hdl=-1;
+		STOPIF( i, "closing tree index");
+	}
+
 	if (directory) IF_FREE(directory);
 
+	PRF__STOP(PRF__T_DIR_SAVE, started);
 	return status;
 }
 
@@ -1500,11 +1904,15 @@ int waa__update_dir(struct estat *_old)
 	status=nr_new=0;
 	dir_hdl=-1;
 
+	/* The copy below shares the path of old; so it never builds one of its 
+	 * own, which would not be given back. */
+	STOPIF( ops__build_path(&path, old), NULL);
+
 	current=*old;
 	current.by_inode=current.by_name=NULL;
 	current.entry_count=0;
-
-	STOPIF( ops__build_path(&path, old), NULL);
+	/* waa__dir_enum() stores the names in the cold data. */
+	current.cold=NULL;
 
 	/* To avoid storing arbitrarily long pathnames, we just open this
 	 * directory and do a fchdir() later. */
@@ -1553,7 +1961,7 @@ int waa__update_dir(struct estat *_old)
 	IF_FREE(current.by_name);
 	/* The strings are still used. We would have to copy them to a new area, 
 	 * like we're doing above in the by_name array. */
-	//	IF_FREE(current.strings);
+	//	IF_FREE(current.cold->strings);
 
 after_compare:
 	/* There's no doubt now.
@@ -1577,6 +1985,10 @@ ex:
 		STOPIF_CODE_ERR(i == -1 && !status, errno,
 				"cannot close dirhandle");
 	}
+	/* Only the structure; the strings are referenced by the new entries. */
+	IF_FREE(current.cold);
+	/* The path is that of old. */
+	current.path=NULL;
 	DEBUGP("update_dir reports %d new found, status %d", nr_new, status);
 	return status;
 }
@@ -1601,6 +2013,11 @@ ex:
  *
  * The \a callback is called for \b every entry read; but for performance 
  * reasons the \c path parameter will be \c NULL.
+ *
+ * If waa__read_or_build_tree() was given some paths for an action with 
+ * \ref actionlist_t::partial_load "partial_load" set, only these subtrees (and the directories leading to them) are 
+ * loaded, if the \ref dirx "index" allows that; see 
+ * waa___select_subtrees().
  * */
 int waa__input_tree(struct estat *root,
 		struct waa__entry_blocks_t **blocks,
@@ -1622,8 +2039,22 @@ int waa__input_tree(struct estat *root,
 	off_t length;
 	t_ul header_len;
 	struct estat *sts_tmp;
-
-
+	struct timespec started;
+	struct stat dir_st;
+	struct waa___dir_index_hdr *index;
+	struct waa___dir_index_entry *entries;
+	off_t index_len;
+	unsigned *remap, nr, file_count;
+	struct waa___subtree_anc *anc;
+	unsigned anc_count, anc_cur;
+
+
+	PRF__START(started);
+	index=NULL;
+	remap=NULL;
+	anc=NULL;
+	entries=NULL;
+	nr=anc_cur=0;
 	waa__entry_block.first=root;
 	waa__entry_block.count=1;
 	waa__entry_block.next=waa__entry_block.prev=NULL;
@@ -1638,9 +2069,9 @@ int waa__input_tree(struct estat *root,
 	}
 	STOPIF(status, "cannot open .dir file");
 
-	length=lseek(waa_info_hdl, 0, SEEK_END);
-	STOPIF_CODE_ERR( length == (off_t)-1, errno, 
-			"Cannot get length of .dir file");
+	STOPIF_CODE_ERR( fstat(waa_info_hdl, &dir_st) == -1, errno,
+			"Cannot stat .dir file");
+	length=dir_st.st_size;
 
 	DEBUGP("mmap()ping %llu bytes", (t_ull)length);
 	dir_mmap=mmap(NULL, length,
@@ -1700,8 +2131,22 @@ int waa__input_tree(struct estat *root,
 
 	DEBUGP("ok, found \\0 or \\0\\n at end");
 
+	if (waa___subtree_count)
+	{
+		file_count=count;
+		STOPIF( waa___select_subtrees(dir_mmap, &dir_st, file_count, 
+					&index, &index_len, &remap, &count, &anc, &anc_count), NULL);
+		if (remap)
+		{
+			entries=(struct waa___dir_index_entry*)(index+1);
+			approx_entry_count=count;
+			waa___tree_is_partial=1;
+		}
+	}
+
+	STOPIF( ops__make_cold(root), NULL);
 	STOPIF( hlp__alloc( &strings, string_space), NULL);
-	root->strings=strings;
+	root->cold->strings=strings;
 
 	/* read inodes */
 	cur=0;
@@ -1710,7 +2155,7 @@ int waa__input_tree(struct estat *root,
 	/* As long as there should be entries ... */
 	while ( count > 0)
 	{
-		DEBUGP("curr=%p, end=%p, count=%d",
+		DEBUGP_HOT("curr=%p, end=%p, count=%d",
 				dir_curr, dir_end, count);
 		TREE_DAMAGED( dir_curr>=dir_end, 
 				"An entry line has a wrong number of entries");
@@ -1730,9 +2175,33 @@ int waa__input_tree(struct estat *root,
 
 		sts=first ? root : stat_mem+cur;
 
-		DEBUGP("about to parse %p = '%-.40s...'", dir_curr, dir_curr);
+		/* Skip over the entries that are not needed. */
+		if (remap)
+		{
+			while (!remap[nr]) nr++;
+			dir_curr=dir_mmap + entries[nr].line;
+		}
+
+		DEBUGP_HOT("about to parse %p = '%-.40s...'", dir_curr, dir_curr);
 		STOPIF( ops__load_1entry(&dir_curr, sts, &filename, &parent), NULL);
 
+		if (remap)
+		{
+			/* The directories on the way get only some of their children. */
+			if (anc_cur < anc_count && anc[anc_cur].nr == nr)
+			{
+				if (S_ISDIR(sts->st.mode))
+					sts->entry_count=anc[anc_cur].children;
+				anc_cur++;
+			}
+
+			TREE_DAMAGED( parent != entries[nr].parent,
+					"the index doesn't match");
+			if (parent)
+				parent=remap[parent-1];
+			nr++;
+		}
+
 		/* Should this just be a BUG_ON? To not waste space in the release 
 		 * binary just for people messing with their dir-file?  */
 		TREE_DAMAGED( (parent && first) ||
@@ -1747,7 +2216,7 @@ int waa__input_tree(struct estat *root,
 		strcpy(strings, filename);
 		sts->name=strings;
 		strings += strlen(filename)+1;
-		BUG_ON(strings - root->strings > string_space);
+		BUG_ON(strings - root->cold->strings > string_space);
 
 		if (parent)
 		{
@@ -1764,8 +2233,10 @@ int waa__input_tree(struct estat *root,
 			BUG_ON(sts->parent->child_index > sts->parent->entry_count,
 					"too many children for parent");
 
-			/* Check the revision */
-			if (sts->repos_rev != sts->parent->repos_rev)
+			/* Check the revision; another URL may mean another revision, too.  
+			 * See \ref pathrevs. */
+			if (sts->repos_rev != sts->parent->repos_rev ||
+					sts->url != sts->parent->url)
 			{
 				sts_tmp=sts->parent;
 				while (sts_tmp && !sts_tmp->other_revs)
@@ -1806,8 +2277,225 @@ ex:
 			STOPIF_CODE_ERR(i, errno, "munmap() failed");
 	}
 
+	if (index)
+		munmap(index, index_len);
+	IF_FREE(remap);
+	IF_FREE(anc);
+
+	PRF__STOP(PRF__T_DIR_LOAD, started);
+	return status;
+}
+
+
+/** \name Incremental sorted output
+ *
+ * For \ref o_dir_sort "dir_sort" the entries are printed depth-first and 
+ * sorted by name; but a directory's status is only known when its whole 
+ * subtree has been checked.
+ *
+ * Instead of doing a second run through the whole tree afterwards, a 
+ * cursor walks the sorted tree while it is being checked, and stops at 
+ * the first entry that isn't done yet. Every time a directory gets 
+ * finished the cursor tries to advance.
+ *
+ * Directories get sorted only when the cursor enters them, and their 
+ * estat::by_name array is freed when the cursor leaves them; so only the 
+ * arrays along the current path are needed.
+ *
+ * As a directory is printed before its children, nothing can be shown 
+ * before the first printed directory is completely done; for a full 
+ * \ref status that's the working copy root. If only some paths are given, 
+ * the output for each of them is printed as soon as it's finished.
+ * @{ */
+/** One directory on the cursor's path. */
+struct waa___sorted_frame {
+	/** The directory. */
+	struct estat *dir;
+	/** The next entry in its estat::by_name list. */
+	struct estat **list;
+	/** Whether everything below is known to be done. */
+	int all_done;
+};
+
+/** The stack of directories. */
+static struct waa___sorted_frame *waa___sorted_stack=NULL;
+/** Number of used and allocated stack entries. */
+static int waa___sorted_depth=0, waa___sorted_max=0;
+/** The root; reset when the cursor has entered it. */
+static struct estat *waa___sorted_root=NULL;
+/** The callback to use for printing; \c NULL if the cursor is inactive. */
+static action_t *waa___sorted_callback=NULL;
+/** Set at the end; then all entries are done. */
+static int waa___sorted_final=0;
+
+
+/** Returns whether the sorted output has to go into this entry.
+ *
+ * If the entry was removed, sts->updated_mode is 0, so we have to take 
+ * a look at the old sts->st.mode to determine whether it was a 
+ * directory.
+ * The OPT__ALL_REMOVED check is duplicated from ac__dispatch, to avoid 
+ * recursing needlessly. */
+static inline int waa___sorted_descend(struct estat *sts)
+{
+	return (sts->do_child_wanted || sts->do_userselected) && 
+		sts->entry_count &&
+		(sts->local_mode_packed ? 
+		 TEST_PACKED(S_ISDIR, sts->local_mode_packed) :
+		 ((sts->entry_status & FS_REMOVED) && 					
+			S_ISDIR(sts->st.mode) &&
+			opt__get_int(OPT__ALL_REMOVED)==OPT__YES));
+}
+
+
+/** Returns whether the cursor may print or enter \a sts.
+ *
+ * Entries that are not printed don't get new children, so we needn't 
+ * wait for them. */
+static inline int waa___sorted_is_done(struct estat *sts, int all_done)
+{
+	return waa___sorted_final || all_done || 
+		!sts->do_this_entry || sts->subtree_done;
+}
+
+
+/** Puts \a dir on the cursor stack; sorts it, if necessary. */
+static int waa___sorted_push(struct estat *dir, int all_done)
+{
+	int status;
+	struct waa___sorted_frame *frame;
+
+
+	status=0;
+	if (waa___sorted_depth >= waa___sorted_max)
+	{
+		waa___sorted_max = waa___sorted_max*2 + 16;
+		STOPIF( hlp__realloc( &waa___sorted_stack, 
+					waa___sorted_max * sizeof(*waa___sorted_stack)), NULL);
+	}
+
+	if (!dir->by_name)
+		STOPIF( dir__sortbyname(dir), NULL);
+
+	frame=waa___sorted_stack + waa___sorted_depth;
+	frame->dir=dir;
+	frame->list=dir->by_name;
+	frame->all_done= all_done || (dir->do_this_entry && dir->subtree_done);
+	waa___sorted_depth++;
+
+ex:
+	return status;
+}
+
+
+/** Prints all entries that are done, up to the first one that isn't. */
+static int waa___sorted_advance(void)
+{
+	int status;
+	struct waa___sorted_frame *frame;
+	struct estat *sts;
+	action_t *saved;
+	int all_done, cleared;
+
+
+	status=0;
+	saved=action->local_callback;
+	action->local_callback=waa___sorted_callback;
+	/* While checking we might have a progress bar on the screen, which has 
+	 * to be removed before printing something. */
+	cleared=waa___sorted_final;
+
+	if (waa___sorted_root)
+	{
+		sts=waa___sorted_root;
+		if (!waa___sorted_is_done(sts, 0)) goto ex;
+
+		/* Do the root as first entry. */
+		if (!sts->parent && sts->do_this_entry)
+		{
+			if (!cleared && action->local_uninit)
+				STOPIF( action->local_uninit(), NULL);
+			cleared=1;
+			STOPIF( ac__dispatch(sts), NULL);
+		}
+
+		STOPIF( waa___sorted_push(sts, 0), NULL);
+		waa___sorted_root=NULL;
+	}
+
+	while (waa___sorted_depth)
+	{
+		frame=waa___sorted_stack + waa___sorted_depth-1;
+		sts=*frame->list;
+
+		if (!sts)
+		{
+			IF_FREE(frame->dir->by_name);
+			waa___sorted_depth--;
+			continue;
+		}
+
+		if (!waa___sorted_is_done(sts, frame->all_done)) break;
+
+		frame->list++;
+		all_done=frame->all_done;
+
+		if (sts->do_this_entry && ops__allowed_by_filter(sts))
+		{
+			if (!cleared && action->local_uninit)
+				STOPIF( action->local_uninit(), NULL);
+			cleared=1;
+			STOPIF( ac__dispatch(sts), NULL);
+		}
+
+		/* That might change the stack address, so "frame" is invalid 
+		 * afterwards. */
+		if (waa___sorted_descend(sts))
+			STOPIF( waa___sorted_push(sts, all_done), NULL);
+	}
+
+ex:
+	action->local_callback=saved;
+	return status;
+}
+
+
+/** -.
+ * The entries are given to ac__dispatch(), with \a callback as 
+ * \ref actionlist_t::local_callback "action->local_callback"; the 
+ * action's own callback can be used for eg. progress output meanwhile. */
+int waa__sorted_start(struct estat *root, action_t callback)
+{
+	waa___sorted_root=root;
+	waa___sorted_callback=callback;
+	waa___sorted_final=0;
+	waa___sorted_depth=0;
+	return 0;
+}
+
+
+/** -.
+ * */
+int waa__sorted_finish(void)
+{
+	int status;
+
+
+	status=0;
+	if (!waa___sorted_callback) goto ex;
+
+	waa___sorted_final=1;
+	STOPIF( waa___sorted_advance(), NULL);
+	BUG_ON(waa___sorted_depth || waa___sorted_root);
+
+ex:
+	IF_FREE(waa___sorted_stack);
+	waa___sorted_depth=waa___sorted_max=0;
+	waa___sorted_callback=NULL;
+	waa___sorted_root=NULL;
 	return status;
 }
+/** @} */
 
 
 /** Check whether the conditions for update and/or printing the directory
@@ -1925,6 +2613,7 @@ int waa___finish_directory(struct estat *sts)
 
 
 		/* This directory is done, tell the parent. */
+		walker->subtree_done=1;
 		walker=walker->parent;
 		if (!walker) break;
 
@@ -1941,6 +2630,9 @@ int waa___finish_directory(struct estat *sts)
 		DEBUGP("deferring parent %s/%s (%d unfinished)", 
 				walker->name, sts->name, walker->unfinished);
 
+	if (waa___sorted_callback)
+		STOPIF( waa___sorted_advance(), NULL);
+
 ex:
 	return status;
 }
@@ -2013,6 +2705,7 @@ int waa__update_tree(struct estat *root,
 {
 	int status;
 	struct estat *sts;
+	struct timespec started;
 
 
 	if (! (root->do_userselected || root->do_child_wanted) )
@@ -2026,6 +2719,8 @@ int waa__update_tree(struct estat *root,
 		DEBUGP("Full tree update");
 	}
 
+	PRF__START(started);
+
 	/* TODO: allow non-remembering behaviour */
 	action->keep_children=1;
 
@@ -2034,7 +2729,7 @@ int waa__update_tree(struct estat *root,
 	{
 		/* For convenience */
 		sts=cur_block->first;
-		DEBUGP("doing update for %s ... %d left in %p",
+		DEBUGP_HOT("doing update for %s ... %d left in %p",
 				sts->name, cur_block->count, cur_block);
 
 		/* For directories initialize the child counter.
@@ -2104,7 +2799,8 @@ int waa__update_tree(struct estat *root,
 			sts->entry_count=0;
 			sts->unfinished=0;
 			sts->by_inode=sts->by_name=NULL;
-			sts->strings=NULL;
+			if (sts->cold)
+				sts->cold->strings=NULL;
 			/* TODO: fill this members from the ignore list */
 			// sts->active_ign=sts->subdir_ign=NULL;
 		}
@@ -2116,7 +2812,7 @@ next:
 		if (TEST_PACKED(S_ISDIR, sts->local_mode_packed) && 
 				sts->entry_count==0)
 		{
-			DEBUGP("doing empty directory %s %d", sts->name, sts->do_this_entry);
+			DEBUGP_HOT("doing empty directory %s %d", sts->name, sts->do_this_entry);
 			/* Check this entry for added entries. There cannot be deleted 
 			 * entries, as this directory had no entries before. */
 			STOPIF( waa___finish_directory(sts), NULL);
@@ -2130,6 +2826,13 @@ next:
 				sts->do_this_entry) 
 			STOPIF( ac__dispatch(sts), NULL);
 
+		/* Directories are done in waa___finish_directory(); but removed ones 
+		 * only get there if they had children. */
+		if (!TEST_PACKED(S_ISDIR, sts->local_mode_packed) &&
+				(!TEST_PACKED(S_ISDIR, sts->old_rev_mode_packed) || 
+				 !sts->entry_count))
+			sts->subtree_done=1;
+
 
 		/* The parent must be done *after* the last child node ... at least 
 		 * that's what's documented above :-) */
@@ -2143,7 +2846,7 @@ next:
 			if (sts->parent->child_index >= sts->parent->entry_count 
 					&& sts->parent->do_this_entry)
 			{
-				DEBUGP("checking parent %s/%s", sts->parent->name, sts->name);
+				DEBUGP_HOT("checking parent %s/%s", sts->parent->name, sts->name);
 				/* Check the parent for added entries. 
 				 * Deleted entries have already been found missing while 
 				 * running through the list. */
@@ -2151,7 +2854,7 @@ next:
 				STOPIF( waa___finish_directory(sts->parent), NULL);
 			}
 			else
-				DEBUGP("deferring parent %s/%s%s: %d of %d, %d unfini", 
+				DEBUGP_HOT("deferring parent %s/%s%s: %d of %d, %d unfini", 
 						sts->parent->name, sts->name,
 						sts->parent->do_this_entry ? "" : " (no do_this_entry)",
 						sts->parent->child_index, sts->parent->entry_count, 
@@ -2173,6 +2876,7 @@ next:
 
 
 ex:
+	PRF__STOP(PRF__T_SCAN, started);
 	return status;
 }
 
@@ -2198,8 +2902,25 @@ int waa__read_or_build_tree(struct estat *root,
 
 
 	status=0;
+	/* Ask before reading the tree, so that a commit in between is seen 
+	 * as a changed stamp. */
+	STOPIF( wch__load_dirty(), NULL);
+
+	/* Status and info never write the tree, and only look at the given 
+	 * paths, so they can do with the entries they need. (Diff against a 
+	 * revision walks the repository, and may need more.)
+	 * A callback wants to see all entries.
+	 * If no path was given, waa__partial_update() uses the faked one. */
+	if (action->partial_load && !callback)
+	{
+		waa___subtree_paths=normalized;
+		waa___subtree_count= argc ? argc : (*normalized ? 1 : 0);
+	}
+
 	status=waa__input_tree(root, &blocks, callback);
 	DEBUGP("read tree = %d", status);
+	waa___subtree_count=0;
+	waa___subtree_paths=NULL;
 
 	if (status == -ENOENT)
 	{
@@ -2633,8 +3354,11 @@ int waa__partial_update(struct estat *root,
 			STOPIF(status, NULL);
 
 		/* Remember which argument relates to this entry. */
-		if (opt__get_int(OPT__PATH) == PATH_PARMRELATIVE && !sts->arg)
-			sts->arg= faked_arg0 ? "" : orig[i];
+		if (opt__get_int(OPT__PATH) == PATH_PARMRELATIVE && !COLD(sts, arg))
+		{
+			STOPIF( ops__make_cold(sts), NULL);
+			sts->cold->arg= faked_arg0 ? "" : orig[i];
+		}
 
 		/* This entry is marked as full, parents as "look below". */
 		sts->do_userselected = sts->do_this_entry = 1;
@@ -2711,13 +3435,14 @@ int waa__find_base(struct estat *root, int *argc, char ***args)
 	status=0;
 	/* Per default we use (shortened) per-wc paths, as there'll be no 
 	 * arguments. */
-	root->arg="";
+	STOPIF( ops__make_cold(root), NULL);
+	root->cold->arg="";
 
 	STOPIF( waa__find_common_base( *argc, *args, &normalized), NULL);
 	if (*argc > 0 && strcmp(normalized[0], ".") == 0)
 	{
 		/* Use it for display, but otherwise ignore it. */
-		root->arg = **args;
+		root->cold->arg = **args;
 
 		(*args) ++;
 		(*argc) --;
@@ -2747,23 +3472,7 @@ static inline int waa___recurse_tree(struct estat **list, action_t handler,
 		if (sts->do_this_entry && ops__allowed_by_filter(sts))
 			STOPIF( handler(sts), NULL);
 
-		/* If the entry was removed, sts->updated_mode is 0, so we have to take 
-		 * a look at the old sts->st.mode to determine whether it was a 
-		 * directory. */
-		/* The OPT__ALL_REMOVED check is duplicated from ac__dispatch, to avoid 
-		 * recursing needlessly. */
-		if ((sts->do_child_wanted || sts->do_userselected) && 
-				sts->entry_count &&
-				(sts->local_mode_packed ? 
-				 TEST_PACKED(S_ISDIR, sts->local_mode_packed) :
-				 ((sts->entry_status & FS_REMOVED) && 					
-					S_ISDIR(sts->st.mode) &&
-					opt__get_int(OPT__ALL_REMOVED)==OPT__YES)) )
-/*		if (TEST_PACKED( S_ISDIR, sts->local_mode_packed) &&
-				(sts->do_child_wanted || sts->do_userselected) && 
-				sts->entry_count &&
-				((opt__get_int(OPT__ALL_REMOVED)==OPT__YES) ||
-				 ((sts->entry_status & FS_REPLACED) != FS_REMOVED)) ) */
+		if (waa___sorted_descend(sts))
 			STOPIF( me(sts, handler), NULL);
 		list++;
 	}
@@ -109,6 +109,14 @@ extern struct waa__entry_blocks_t waa__entry_block;
  * See also \a waa__output_tree().
  * */
 #define WAA__DIR_EXT		"dir"
+/** \anchor dirx Index of the \ref dir file.
+ * Binary; a header, and for each entry line its position, the offset of 
+ * the name, and the parent number. It is written together with the \ref 
+ * dir file, and only used if it still matches that.
+ *
+ * With this, read-only commands that get some paths parse only the entries 
+ * they need; see waa__input_tree(). */
+#define WAA__DIR_INDEX_EXT		"dirx"
 /** \anchor ign List of groupings ("Identification Groups for New entries", 
  * formally "Ignore patterns").
  * They consist of a header with the number of patterns, followed by the 
@@ -124,6 +132,28 @@ extern struct waa__entry_blocks_t waa__entry_block;
  * These are split into a separate file, so that no data in \c /etc is 
  * changed after a commit. */
 #define WAA__URL_REVS		"revs"
+/** \anchor logc Log cache.
+ * Per URL an append-only cache of the revision log; the \c 
+ * url_t::internal_number is appended to the name. See log.c for the 
+ * format. */
+#define WAA__LOG_CACHE_EXT		"logc"
+/** Maximum length of the log cache name, including the URL number. */
+#define WAA__LOG_CACHE_EXT_LEN (strlen(WAA__LOG_CACHE_EXT) + 10)
+/** \anchor rstc Remote-status cache.
+ * Per URL the editor calls of the last \ref remote-status; the \c 
+ * url_t::internal_number is appended to the name. See racallback.c for 
+ * the format. */
+#define WAA__RS_CACHE_EXT		"rstc"
+/** Maximum length of the remote-status cache name, including the URL 
+ * number. */
+#define WAA__RS_CACHE_EXT_LEN (strlen(WAA__RS_CACHE_EXT) + 10)
+/** \anchor chnk Index of the manber blocks of all files.
+ * A hash table, keyed by the block MD5, with a key for the path of the 
+ * file; binary, and \c mmap()ed. See chunks.c. */
+#define WAA__CHUNK_INDEX_EXT		"chnk"
+/** \anchor watch_sock Socket of the \ref watch daemon.
+ * Clients ask the daemon for the list of changed entries here. */
+#define WAA__WATCH_EXT		"watch"
 /** \anchor copy Hash of copyfrom relations.
  * The key is the destination-, the value is the source-path; they are 
  * stored relative to the wc root, without the leading \c "./", ie. as \c 
@@ -152,6 +182,11 @@ extern struct waa__entry_blocks_t waa__entry_block;
  * Furthermore in the WAA directory of the working copy we store a 
  * (temporary) file as an index for all entries' MD5 checksums. */
 #define WAA__FILE_MD5s_EXT	"md5s"
+/** \anchor fprt Local fingerprint of a file.
+ * A single line with the algorithm, the MD5 and size of the file, and 
+ * the fingerprint; written next to the \ref md5s file if \ref 
+ * o_fingerprint is set. See fprint.c. */
+#define WAA__FILE_FPRINT_EXT	"fprt"
 /** \anchor prop List of other properties.
  * These are properties not converted to meta-data. */
 #define WAA__PROP_EXT		"prop"
@@ -180,6 +215,13 @@ extern struct waa__entry_blocks_t waa__entry_block;
 #define WAA__DIR_NAME_EXT		"dname"
 /** @} */
 
+/** \anchor fchk
+ * \name Temporary copy/move detection database
+ * Files are addressed by their key in the \ref chnk index.
+ * @{ */
+#define WAA__FILE_CHUNK_KEY_EXT		"fchk"
+/** @} */
+
 /** \name Short names for the open modes.
  * @{ */
 #define WAA__WRITE (O_WRONLY | O_CREAT | O_TRUNC)
@@ -195,7 +237,9 @@ extern struct waa__entry_blocks_t waa__entry_block;
 		max(                                             \
 			max(strlen(WAA__CONFLICT_EXT),                 \
 				strlen(WAA__COPYFROM_EXT)),                  \
-			strlen(WAA__IGNORE_EXT) ),										 \
+			max(strlen(WAA__IGNORE_EXT),                   \
+				max(WAA__LOG_CACHE_EXT_LEN,                  \
+					WAA__RS_CACHE_EXT_LEN)) ),                 \
 		max(                                             \
 			max(max(strlen(WAA__DIR_EXT),                  \
 					strlen(WAA__FILE_MD5s_EXT)),               \
@@ -335,6 +379,11 @@ int waa__partial_update(struct estat *root,
  * for the marked entries; directories before their children, and in order 
  * sorted by name.  */
 int waa__do_sorted_tree(struct estat *root, action_t handler);
+/** Prepares sorted output of the entries while the tree is being checked.  
+ * */
+int waa__sorted_start(struct estat *root, action_t callback);
+/** Prints the rest of the sorted output, and cleans up. */
+int waa__sorted_finish(void);
 
 /** A wrapper around dir__enumerator(), ignoring entries below \c 
  * $FSVS_WAA.  */
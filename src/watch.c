@@ -0,0 +1,997 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#include <apr_hash.h>
+#include <apr_strings.h>
+
+#include "global.h"
+#include "waa.h"
+#include "helper.h"
+#include "options.h"
+#include "est_ops.h"
+#include "ignore.h"
+#include "url.h"
+#include "watch.h"
+
+
+/** \file
+ * \ref watch action file.
+ *
+ * The daemon and the clients talk via an \c AF_UNIX socket in the WAA
+ * directory of the working copy (\c WAA__WATCH_EXT).
+ *
+ * A client sends a single line; the daemon answers with a header line
+ * <tt>fsvs-watch 1 </tt><i>stamp</i>, followed by the paths of all
+ * entries that might have changed, each terminated by a \c \\0.
+ *
+ * The stamp describes the \ref dir and \ref ignore files the daemon's
+ * baseline was taken from; if the client sees other files, or the daemon
+ * is still scanning (and sends \c rescan instead), the answer is not used.
+ * */
+
+/** \addtogroup cmds
+ *
+ * \section watch
+ *
+ * \code
+ * fsvs watch [path]
+ * \endcode
+ *
+ * This command runs in the foreground, and uses \c inotify to track
+ * which entries of the working copy get changed.
+ *
+ * While it's running, \ref status, \ref commit, \ref diff and the other
+ * commands that look for local changes ask it for the list of changed
+ * entries, and only \c lstat() these; all others are taken as unchanged,
+ * and their directories are not read.
+ *
+ * After a \ref commit or \ref update (ie. when the \ref dir list changes),
+ * after changes to the \ref ignore "ignore patterns", or if the kernel
+ * reports a queue overflow, the working copy is scanned again in the
+ * background; until that is finished, all commands do a full scan.
+ *
+ * Please note that \c inotify doesn't see changes made via a shared
+ * writeable \c mmap(), or by other machines on network filesystems; if
+ * that's a concern, use \ref o_watch "-o watch=no" or \c -C \c -C.
+ *
+ * On big working copies you might need to increase \c
+ * /proc/sys/fs/inotify/max_user_watches, as every directory needs a
+ * watch.
+ * */
+
+
+/** The protocol header line. */
+#define WCH___HEADER "fsvs-watch 1 "
+/** How long a client waits for an answer, in milliseconds. */
+#define WCH___TIMEOUT (5000)
+/** Buffer size for the baseline stamp. */
+#define WCH___STAMP_LEN (160)
+/** Output buffer size of the daemon. */
+#define WCH___BUFFER (64*1024)
+
+
+/** The dirty paths, as reported by the daemon; \c NULL if unknown. */
+static apr_hash_t *wch___dirty=NULL;
+
+
+/** Puts the socket address into \a addr.
+ * Returns \c ENAMETOOLONG if the path doesn't fit. */
+static int wch___address(struct sockaddr_un *addr)
+{
+	int status;
+	char *path, *eos;
+
+
+	STOPIF( waa__get_waa_directory(wc_path, &path, &eos, NULL,
+				waa__get_gwd_flag(WAA__WATCH_EXT)), NULL);
+	strcpy(eos, WAA__WATCH_EXT);
+
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return ENAMETOOLONG;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family=AF_UNIX;
+	strcpy(addr->sun_path, path);
+
+ex:
+	return status;
+}
+
+
+/** Describes the current \ref dir and \ref ignore files in \a buffer. */
+static int wch___stamp(char *buffer, int len)
+{
+	int status;
+	int i, l;
+	struct stat st;
+	char *filename, *eos;
+	static const char *const list[]= { WAA__DIR_EXT, WAA__IGNORE_EXT };
+
+
+	status=0;
+	for(i=0; i<sizeof(list)/sizeof(list[0]); i++)
+	{
+		STOPIF( waa__get_waa_directory(wc_path, &filename, &eos, NULL,
+					waa__get_gwd_flag(list[i])), NULL);
+		strcpy(eos, list[i]);
+
+		if (stat(filename, &st) == -1)
+		{
+			STOPIF_CODE_ERR( errno != ENOENT, errno,
+					"Cannot stat \"%s\"", filename);
+			memset(&st, 0, sizeof(st));
+		}
+
+		/* With only seconds two changes within the same second would give 
+		 * the same stamp. */
+		l=snprintf(buffer, len, "%s%llu:%llu:%llu.%09lu:%llu.%09lu",
+				i ? "," : "",
+				(t_ull)st.st_ino, (t_ull)st.st_size,
+				(t_ull)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec,
+				(t_ull)st.st_ctim.tv_sec, (unsigned long)st.st_ctim.tv_nsec);
+		BUG_ON(l >= len);
+		buffer+=l;
+		len-=l;
+	}
+
+ex:
+	return status;
+}
+
+
+/** -.
+ *
+ * Only done if there's no \c -C \c -C given; we don't want to make an
+ * explicit full check fast. */
+int wch__load_dirty(void)
+{
+	int status;
+	int fd, i, len, max, hdr_len;
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	char *buffer, *cp, *end;
+	char stamp[WCH___STAMP_LEN];
+	apr_hash_t *hash;
+
+
+	status=0;
+	fd=-1;
+	buffer=NULL;
+	wch___dirty=NULL;
+
+	if (!opt__get_int(OPT__WATCH) ||
+			(opt__get_int(OPT__CHANGECHECK) & (CHCHECK_DIRS | CHCHECK_ALLFILES)))
+		goto ex;
+
+	if (wch___address(&addr)) goto ex;
+
+	fd=socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1 ||
+			connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		DEBUGP("no watch daemon: %s", strerror(errno));
+		goto ex;
+	}
+
+	if (write(fd, "status\n", 7) != 7) goto ex;
+
+	len=max=0;
+	while (1)
+	{
+		if (len+1 >= max)
+		{
+			max=max*2 + 16384;
+			STOPIF( hlp__realloc(&buffer, max), NULL);
+		}
+
+		pfd.fd=fd;
+		pfd.events=POLLIN;
+		if (poll(&pfd, 1, WCH___TIMEOUT) != 1)
+		{
+			DEBUGP("watch daemon doesn't answer");
+			goto ex;
+		}
+
+		i=read(fd, buffer+len, max-len-1);
+		if (i == -1 && errno == EINTR) continue;
+		if (i == -1) goto ex;
+		if (i == 0) break;
+		len+=i;
+	}
+	buffer[len]=0;
+	end=buffer+len;
+
+	/* Only usable if the daemon has seen the same data as we do. */
+	STOPIF( wch___stamp(stamp, sizeof(stamp)), NULL);
+	hdr_len=strlen(WCH___HEADER);
+	cp=memchr(buffer, '\n', len);
+	if (!cp ||
+			strncmp(buffer, WCH___HEADER, hdr_len) != 0 ||
+			cp-buffer-hdr_len != strlen(stamp) ||
+			strncmp(buffer+hdr_len, stamp, cp-buffer-hdr_len) != 0)
+	{
+		DEBUGP("watch daemon not in sync: %.*s",
+				cp ? (int)(cp-buffer) : 0, buffer);
+		goto ex;
+	}
+
+	hash=apr_hash_make(global_pool);
+	for(cp++; cp<end; cp+=strlen(cp)+1)
+		apr_hash_set(hash, cp, APR_HASH_KEY_STRING, cp);
+
+	DEBUGP("watch daemon reports %u changed entries", apr_hash_count(hash));
+	wch___dirty=hash;
+	/* The hash references the strings. */
+	buffer=NULL;
+
+ex:
+	if (fd != -1) close(fd);
+	IF_FREE(buffer);
+	return status;
+}
+
+
+/** -. */
+int wch__is_clean(const char *path)
+{
+	return wch___dirty &&
+		!apr_hash_get(wch___dirty, path, APR_HASH_KEY_STRING);
+}
+
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/** Events that might change an entry in the working copy. */
+#define WCH___EVENTS (IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | \
+		IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+/** Events that might change the \ref dir or \ref ignore files. */
+#define WCH___WAA_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+
+/** The inotify descriptor. */
+static int wch___ino=-1;
+/** The paths of the watched directories, indexed by watch descriptor. */
+static char **wch___paths=NULL;
+/** Number of slots in \c wch___paths. */
+static int wch___paths_max=0;
+/** Watch descriptors of the directories of the \ref dir and \ref ignore
+ * files. */
+static int wch___waa_wd=-1, wch___conf_wd=-1;
+/** The set of dirty paths, and the pool it lives in. */
+static apr_hash_t *wch___set=NULL;
+static apr_pool_t *wch___pool=NULL;
+/** Whether a new baseline must be taken. */
+static int wch___rescan=1;
+/** Whether the baseline is complete. */
+static int wch___synced=0;
+/** The stamp the current baseline is based on. */
+static char wch___base_stamp[WCH___STAMP_LEN];
+
+/** The baseline child, and the pipes to talk to it. */
+static pid_t wch___child=0;
+static int wch___from_child=-1, wch___to_child=-1;
+/** Data read from the child, but not processed yet. */
+static char *wch___rbuf=NULL;
+static int wch___rbuf_len=0, wch___rbuf_max=0;
+/** Whether the child has sent its end marker. */
+static int wch___child_done=0;
+/** In the child, the stream to the daemon. */
+static FILE *wch___report=NULL;
+
+
+/** Remembers that \a path might have changed. */
+static int wch___mark(const char *path)
+{
+	int status;
+	char *copy;
+
+
+	status=0;
+	if (!apr_hash_get(wch___set, path, APR_HASH_KEY_STRING))
+	{
+		copy=apr_pstrdup(wch___pool, path);
+		STOPIF_ENOMEM(!copy);
+		apr_hash_set(wch___set, copy, APR_HASH_KEY_STRING, copy);
+	}
+
+ex:
+	return status;
+}
+
+
+/** Starts watching the directory \a path. */
+static int wch___add_watch(const char *path)
+{
+	int status;
+	int wd, new_max;
+
+
+	status=0;
+	wd=inotify_add_watch(wch___ino, path,
+			WCH___EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW | IN_MASK_ADD);
+	if (wd == -1)
+	{
+		/* Already removed again, or not a directory anymore; the parent has
+		 * been marked by that event. */
+		if (errno == ENOENT || errno == ENOTDIR || errno == EACCES)
+			goto ex;
+
+		STOPIF_CODE_ERR( errno == ENOSPC, ENOSPC,
+				"!The maximum number of inotify watches is reached;\n"
+				"please increase /proc/sys/fs/inotify/max_user_watches.");
+		STOPIF_CODE_ERR( 1, errno, "Cannot watch \"%s\"", path);
+	}
+
+	if (wd >= wch___paths_max)
+	{
+		new_max=wd*2 + 64;
+		STOPIF( hlp__realloc(&wch___paths,
+					new_max * sizeof(*wch___paths)), NULL);
+		memset(wch___paths + wch___paths_max, 0,
+				(new_max - wch___paths_max) * sizeof(*wch___paths));
+		wch___paths_max=new_max;
+	}
+
+	/* A moved directory keeps its descriptor. */
+	if (!wch___paths[wd] || strcmp(wch___paths[wd], path) != 0)
+	{
+		IF_FREE(wch___paths[wd]);
+		STOPIF( hlp__strdup(wch___paths+wd, path), NULL);
+	}
+
+ex:
+	return status;
+}
+
+
+/** Watches \a path and all directories below; used for directories that
+ * get created or moved into the working copy while we're running. */
+static int wch___add_tree(const char *path)
+{
+	int status;
+	DIR *dir;
+	struct dirent *de;
+	struct stat st;
+	char *sub;
+
+
+	sub=NULL;
+	STOPIF( wch___add_watch(path), NULL);
+
+	dir=opendir(path);
+	/* Maybe already removed again. */
+	if (!dir) goto ex;
+
+	while ( (de=readdir(dir)) )
+	{
+		if (de->d_name[0] == '.' &&
+				(de->d_name[1] == 0 ||
+				 (de->d_name[1] == '.' && de->d_name[2] == 0)))
+			continue;
+
+		STOPIF( hlp__strmnalloc(strlen(path) + 1 + strlen(de->d_name) + 1,
+					&sub, path, "/", de->d_name, NULL), NULL);
+
+		if (de->d_type == DT_DIR ||
+				(de->d_type == DT_UNKNOWN &&
+				 lstat(sub, &st) == 0 && S_ISDIR(st.st_mode)))
+			STOPIF( wch___add_tree(sub), NULL);
+
+		IF_FREE(sub);
+	}
+
+ex:
+	if (dir) closedir(dir);
+	IF_FREE(sub);
+	return status;
+}
+
+
+/** Processes a single inotify event. */
+static int wch___event(struct inotify_event *ev)
+{
+	int status;
+	const char *dir;
+	char *path;
+
+
+	status=0;
+	path=NULL;
+
+	if (ev->mask & IN_Q_OVERFLOW)
+	{
+		DEBUGP("event queue overflow");
+		wch___rescan=1;
+		goto ex;
+	}
+
+	if ((ev->wd == wch___waa_wd && ev->len &&
+				strcmp(ev->name, WAA__DIR_EXT) == 0) ||
+			(ev->wd == wch___conf_wd && ev->len &&
+			 strcmp(ev->name, WAA__IGNORE_EXT) == 0))
+	{
+		DEBUGP("%s changed", ev->name);
+		wch___rescan=1;
+	}
+
+	if (ev->wd < 0 || ev->wd >= wch___paths_max) goto ex;
+	dir=wch___paths[ev->wd];
+	if (!dir) goto ex;
+
+	if (ev->mask & IN_IGNORED)
+	{
+		IF_FREE(wch___paths[ev->wd]);
+		goto ex;
+	}
+
+	if (!ev->len)
+	{
+		STOPIF( wch___mark(dir), NULL);
+		goto ex;
+	}
+
+	STOPIF( hlp__strmnalloc(strlen(dir) + 1 + strlen(ev->name) + 1,
+				&path, dir, "/", ev->name, NULL), NULL);
+	DEBUGP("event 0x%X on %s", ev->mask, path);
+
+	STOPIF( wch___mark(path), NULL);
+	/* The directory listing changed, too. */
+	if (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+		STOPIF( wch___mark(dir), NULL);
+
+	if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+		STOPIF( wch___add_tree(path), NULL);
+
+ex:
+	IF_FREE(path);
+	return status;
+}
+
+
+/** Reads all pending inotify events. */
+static int wch___read_events(void)
+{
+	int status;
+	ssize_t len;
+	char *cp;
+	struct inotify_event *ev;
+	char buffer[16384]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+
+	status=0;
+	while (1)
+	{
+		len=read(wch___ino, buffer, sizeof(buffer));
+		if (len == -1)
+		{
+			if (errno == EAGAIN) break;
+			if (errno == EINTR) continue;
+			STOPIF_CODE_ERR(1, errno, "Cannot read inotify events");
+		}
+
+		for(cp=buffer; cp < buffer+len; cp += sizeof(*ev) + ev->len)
+		{
+			ev=(struct inotify_event*)cp;
+			STOPIF( wch___event(ev), NULL);
+		}
+	}
+
+ex:
+	return status;
+}
+
+
+/** Sends a record to the daemon. */
+static int wch___send(char type, const char *path)
+{
+	int status;
+
+
+	status=0;
+	STOPIF_CODE_ERR( fprintf(wch___report, "%c%s%c", type, path, 0) < 0,
+			errno, "Cannot report to the watch daemon");
+
+ex:
+	return status;
+}
+
+
+/** In the child: called for every entry read from the \ref dir file.
+ *
+ * Directories get watched, and entries with pending changes are always
+ * dirty. */
+static int wch___report_known(struct estat *sts)
+{
+	int status;
+	char *path;
+
+
+	status=0;
+	if (!S_ISDIR(sts->st.mode) && !(sts->flags & RF___SAVE_MASK))
+		goto ex;
+
+	STOPIF( ops__build_path(&path, sts), NULL);
+	if (S_ISDIR(sts->st.mode))
+		STOPIF( wch___send('d', path), NULL);
+	if (sts->flags & RF___SAVE_MASK)
+		STOPIF( wch___send('c', path), NULL);
+
+ex:
+	return status;
+}
+
+
+/** In the child: called for every entry after checking it. */
+static int wch___report_changed(struct estat *sts)
+{
+	int status;
+	char *path;
+
+
+	status=0;
+	if (!sts->entry_status && !(sts->flags & RF___SAVE_MASK))
+		goto ex;
+
+	STOPIF( ops__build_path(&path, sts), NULL);
+	if ((sts->entry_status & ~FS_CHILD_CHANGED) ||
+			(sts->flags & RF___SAVE_MASK))
+		STOPIF( wch___send('c', path), NULL);
+	/* New directories need a watch, too. */
+	if (TEST_PACKED(S_ISDIR, sts->local_mode_packed))
+		STOPIF( wch___send('d', path), NULL);
+
+ex:
+	return status;
+}
+
+
+/** In the child: takes the baseline.
+ *
+ * First all known directories are reported, so that they get watched;
+ * then, after the daemon acknowledged that, the entries are checked,
+ * and all changes are reported. So any change after our \c lstat() is
+ * seen by the daemon. */
+static int wch___baseline(struct estat *root, int ack)
+{
+	int status;
+	char c;
+	struct waa__entry_blocks_t *blocks;
+	static char *whole_wc[]= { ".", NULL };
+
+
+	status=url__load_list(NULL, 0);
+	if (status != ENOENT) STOPIF(status, NULL);
+
+	STOPIF( ign__load_list(NULL), NULL);
+
+	STOPIF( waa__input_tree(root, &blocks, wch___report_known),
+			"No working copy data could be found.");
+
+	STOPIF( wch___send('s', ""), NULL);
+	STOPIF_CODE_ERR( fflush(wch___report) != 0, errno,
+			"Cannot report to the watch daemon");
+	STOPIF_CODE_ERR( read(ack, &c, 1) != 1, EPIPE,
+			"The watch daemon went away");
+
+	/* We want to see every entry. */
+	opt__set_int(OPT__FILTER, PRIO_MUSTHAVE, FILTER__ALL);
+	action->local_callback=wch___report_changed;
+	STOPIF( waa__partial_update(root, 0, whole_wc, whole_wc, blocks), NULL);
+
+	STOPIF( wch___send('e', ""), NULL);
+	STOPIF_CODE_ERR( fflush(wch___report) != 0, errno,
+			"Cannot report to the watch daemon");
+
+ex:
+	return status;
+}
+
+
+/** Stops a running baseline child. */
+static void wch___stop_child(void)
+{
+	if (wch___child)
+	{
+		kill(wch___child, SIGTERM);
+		waitpid(wch___child, NULL, 0);
+		wch___child=0;
+	}
+
+	if (wch___from_child != -1) close(wch___from_child);
+	if (wch___to_child != -1) close(wch___to_child);
+	wch___from_child=wch___to_child=-1;
+	wch___rbuf_len=0;
+	wch___child_done=0;
+}
+
+
+/** Forgets the dirty set, and starts a new baseline.
+ *
+ * Returns with \a *is_child set in the forked process. */
+static int wch___start_baseline(struct estat *root, int *is_child)
+{
+	int status;
+	int to_parent[2], from_parent[2];
+	pid_t pid;
+
+
+	DEBUGP("starting a new baseline");
+	wch___stop_child();
+	wch___rescan=0;
+	wch___synced=0;
+
+	apr_pool_clear(wch___pool);
+	wch___set=apr_hash_make(wch___pool);
+
+	STOPIF( wch___stamp(wch___base_stamp, sizeof(wch___base_stamp)), NULL);
+
+	STOPIF_CODE_ERR( pipe(to_parent) == -1 || pipe(from_parent) == -1,
+			errno, "Cannot create pipes");
+
+	pid=fork();
+	STOPIF_CODE_ERR( pid == -1, errno, "Cannot fork");
+
+	if (pid == 0)
+	{
+		close(to_parent[0]);
+		close(from_parent[1]);
+		close(wch___ino);
+		*is_child=1;
+
+		wch___report=fdopen(to_parent[1], "w");
+		STOPIF_CODE_ERR( !wch___report, errno, "fdopen");
+		STOPIF( wch___baseline(root, from_parent[0]), NULL);
+		goto ex;
+	}
+
+	close(to_parent[1]);
+	close(from_parent[0]);
+	wch___child=pid;
+	wch___from_child=to_parent[0];
+	wch___to_child=from_parent[1];
+
+ex:
+	return status;
+}
+
+
+/** Processes data from the baseline child. */
+static int wch___child_input(void)
+{
+	int status;
+	int i, w;
+	char *cp, *end, *path;
+
+
+	status=0;
+	if (wch___rbuf_len+4096 > wch___rbuf_max)
+	{
+		wch___rbuf_max=wch___rbuf_max*2 + 65536;
+		STOPIF( hlp__realloc(&wch___rbuf, wch___rbuf_max), NULL);
+	}
+
+	i=read(wch___from_child, wch___rbuf+wch___rbuf_len,
+			wch___rbuf_max-wch___rbuf_len);
+	if (i == -1 && errno == EINTR) goto ex;
+	STOPIF_CODE_ERR( i == -1, errno, "Cannot read from the baseline child");
+
+	if (i == 0)
+	{
+		/* The child is finished. */
+		waitpid(wch___child, &w, 0);
+		wch___child=0;
+		STOPIF_CODE_ERR( !wch___child_done ||
+				!WIFEXITED(w) || WEXITSTATUS(w), ECHILD,
+				"!Scanning the working copy failed.");
+
+		wch___stop_child();
+		wch___synced=1;
+		DEBUGP("baseline done, %u entries dirty", apr_hash_count(wch___set));
+		goto ex;
+	}
+
+	wch___rbuf_len+=i;
+	end=wch___rbuf+wch___rbuf_len;
+	cp=wch___rbuf;
+	while (1)
+	{
+		path=memchr(cp, 0, end-cp);
+		if (!path) break;
+
+		switch (*cp)
+		{
+			case 'd':
+				STOPIF( wch___add_watch(cp+1), NULL);
+				break;
+			case 'c':
+				STOPIF( wch___mark(cp+1), NULL);
+				break;
+			case 's':
+				/* All known directories are watched now. */
+				STOPIF_CODE_ERR( write(wch___to_child, "", 1) != 1, errno,
+						"Cannot talk to the baseline child");
+				break;
+			case 'e':
+				wch___child_done=1;
+				break;
+			default:
+				BUG("unknown record %c", *cp);
+		}
+
+		cp=path+1;
+	}
+
+	wch___rbuf_len=end-cp;
+	memmove(wch___rbuf, cp, wch___rbuf_len);
+
+ex:
+	return status;
+}
+
+
+/** Writes \a len bytes to the non-blocking client socket \a fd, waiting 
+ * at most until \a deadline (in \c time() seconds).
+ * Returns \c -1 if the client is too slow or went away. */
+static int wch___write_client(int fd, const char *data, size_t len, 
+		time_t deadline)
+{
+	struct pollfd pfd;
+	ssize_t done;
+	int timeout;
+
+
+	while (len)
+	{
+		done=write(fd, data, len);
+		if (done > 0)
+		{
+			data+=done;
+			len-=done;
+			continue;
+		}
+
+		if (done == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)
+			return -1;
+
+		timeout=(deadline - time(NULL))*1000;
+		if (timeout <= 0) return -1;
+
+		pfd.fd=fd;
+		pfd.events=POLLOUT;
+		if (poll(&pfd, 1, timeout) == 0) return -1;
+	}
+
+	return 0;
+}
+
+
+/** Sends the list of dirty entries to a client.
+ * The socket is non-blocking; a client that doesn't read its answer 
+ * within \ref WCH___TIMEOUT is dropped, so that it can't stall the 
+ * daemon. */
+static int wch___answer(int fd)
+{
+	int status;
+	struct pollfd pfd;
+	char request[64];
+	apr_hash_index_t *hi;
+	const void *key;
+	apr_ssize_t klen;
+	static char buffer[WCH___BUFFER];
+	size_t used;
+	time_t deadline;
+
+
+	status=0;
+	deadline=time(NULL) + (WCH___TIMEOUT+999)/1000;
+
+	pfd.fd=fd;
+	pfd.events=POLLIN;
+	if (poll(&pfd, 1, WCH___TIMEOUT) != 1 ||
+			read(fd, request, sizeof(request)) <= 0)
+		goto ex;
+
+	used=snprintf(buffer, sizeof(buffer), "%s%s\n", WCH___HEADER,
+			wch___synced ? wch___base_stamp : "rescan");
+	if (wch___synced)
+		for(hi=apr_hash_first(NULL, wch___set); hi; hi=apr_hash_next(hi))
+		{
+			apr_hash_this(hi, &key, &klen, NULL);
+			if (used + klen+1 > sizeof(buffer))
+			{
+				if (wch___write_client(fd, buffer, used, deadline)) goto ex;
+				used=0;
+			}
+
+			if (klen+1 > sizeof(buffer))
+			{
+				if (wch___write_client(fd, key, klen+1, deadline)) goto ex;
+				continue;
+			}
+
+			memcpy(buffer+used, key, klen+1);
+			used+=klen+1;
+		}
+
+	/* Errors from a client that went away are not ours. */
+	wch___write_client(fd, buffer, used, deadline);
+
+ex:
+	close(fd);
+	return status;
+}
+
+
+/** Creates the listening socket. */
+static int wch___listen(int *fd)
+{
+	int status;
+	int sock;
+	struct sockaddr_un addr;
+	mode_t old_mask;
+
+
+	status=wch___address(&addr);
+	STOPIF( status, "!The socket path for this working copy is too long.");
+
+	sock=socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	STOPIF_CODE_ERR( sock == -1, errno, "Cannot create a socket");
+
+	/* Is there one running already? */
+	STOPIF_CODE_ERR( connect(sock, (struct sockaddr*)&addr,
+				sizeof(addr)) == 0, EBUSY,
+			"!There's already a watch daemon for \"%s\".", wc_path);
+	close(sock);
+
+	if (unlink(addr.sun_path) == -1)
+		STOPIF_CODE_ERR( errno != ENOENT, errno,
+				"Cannot remove \"%s\"", addr.sun_path);
+
+	sock=socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	STOPIF_CODE_ERR( sock == -1, errno, "Cannot create a socket");
+	/* The list of changed paths is for us only; the socket gets the 
+	 * permissions from the umask. */
+	old_mask=umask(0077);
+	status=bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 ? 
+		errno : 0;
+	umask(old_mask);
+	STOPIF( status, "Cannot bind to \"%s\"", addr.sun_path);
+	STOPIF_CODE_ERR( listen(sock, 16) == -1, errno, "listen");
+
+	*fd=sock;
+
+ex:
+	return status;
+}
+
+
+/** Watches the directory of the WAA file \a ext. */
+static int wch___watch_waa(const char *ext, int *wd)
+{
+	int status;
+	char *path, *eos;
+
+
+	STOPIF( waa__get_waa_directory(wc_path, &path, &eos, NULL,
+				waa__get_gwd_flag(ext)), NULL);
+	*eos=0;
+
+	*wd=inotify_add_watch(wch___ino, path, WCH___WAA_EVENTS | IN_MASK_ADD);
+	STOPIF_CODE_ERR( *wd == -1, errno, "Cannot watch \"%s\"", path);
+
+ex:
+	return status;
+}
+
+#endif
+
+
+/** -.
+ *
+ * Never returns in the daemon, except on errors. */
+int wch__work(struct estat *root, int argc, char *argv[])
+{
+	int status;
+#ifdef HAVE_SYS_INOTIFY_H
+	int listener, fd, i, n, is_child;
+	struct pollfd pfd[3];
+
+
+	listener=-1;
+	is_child=0;
+
+	STOPIF( waa__find_base(root, &argc, &argv), NULL);
+	if (opt__is_verbose() > 0)
+		printf("Watching WC root \"%s\"\n", wc_path);
+
+	STOPIF( apr_pool_create(&wch___pool, global_pool),
+			"Cannot create a pool");
+
+	wch___ino=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	STOPIF_CODE_ERR( wch___ino == -1, errno, "Cannot initialize inotify");
+
+	STOPIF( wch___watch_waa(WAA__DIR_EXT, &wch___waa_wd), NULL);
+	STOPIF( wch___watch_waa(WAA__IGNORE_EXT, &wch___conf_wd), NULL);
+
+	STOPIF( wch___listen(&listener), NULL);
+
+	/* A client that goes away shouldn't kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1)
+	{
+		if (wch___rescan)
+		{
+			STOPIF( wch___start_baseline(root, &is_child), NULL);
+			if (is_child) goto ex;
+		}
+
+		pfd[0].fd=wch___ino;
+		pfd[1].fd=listener;
+		pfd[2].fd=wch___from_child;
+		for(i=0; i<3; i++)
+		{
+			pfd[i].events=POLLIN;
+			pfd[i].revents=0;
+		}
+		n= wch___from_child == -1 ? 2 : 3;
+
+		i=poll(pfd, n, -1);
+		if (i == -1 && errno == EINTR) continue;
+		STOPIF_CODE_ERR( i == -1, errno, "poll");
+
+		if (pfd[0].revents)
+			STOPIF( wch___read_events(), NULL);
+
+		if (n == 3 && pfd[2].revents)
+			STOPIF( wch___child_input(), NULL);
+
+		if (pfd[1].revents)
+		{
+			fd=accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd == -1) continue;
+
+			/* Take everything that happened until now. */
+			STOPIF( wch___read_events(), NULL);
+			if (wch___rescan)
+			{
+				STOPIF( wch___start_baseline(root, &is_child), NULL);
+				if (is_child) goto ex;
+			}
+
+			STOPIF( wch___answer(fd), NULL);
+		}
+	}
+
+ex:
+	if (!is_child)
+		wch___stop_child();
+#else
+	STOPIF_CODE_ERR(1, ENOSYS,
+			"!The \"watch\" command needs inotify support.");
+
+ex:
+#endif
+	return status;
+}
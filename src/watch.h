@@ -0,0 +1,33 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include "actions.h"
+
+/** \file
+ * \ref watch action header file. */
+
+
+/** Runs the change tracking daemon. */
+work_t wch__work;
+
+/** Asks a running \ref watch daemon which entries might have changed.
+ *
+ * If there's no daemon, or its information is not usable, nothing
+ * happens; every entry is then checked as usual. */
+int wch__load_dirty(void);
+
+/** Returns whether the \ref watch daemon reported \a path as unchanged.
+ *
+ * \a path must be in the form that \c ops__build_path() returns, ie. \c
+ * "./dir/file". */
+int wch__is_clean(const char *path);
+
+#endif
@@ -0,0 +1,645 @@
+/************************************************************************
+ * Copyright (C) 2009 Philipp Marek.
+ *
+ * This program is free software;  you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ ************************************************************************/
+
+/** \file
+ * Micro-benchmarks for single fsvs functions.
+ *
+ * This is linked against all fsvs objects (with \c main() of \c fsvs.c
+ * renamed), so that the functions can be called directly; see the \c
+ * micro-bench target in \c src/Makefile.
+ *
+ * Usage:
+ * \code
+ *   micro-bench [-n entries] [-t seconds] [kernel ...]
+ * \endcode
+ * Every kernel is repeated until it ran for at least the given time (\c
+ * 0.5 seconds per default); the results are printed as nanoseconds per
+ * operation, and (where it makes sense) as bytes per second.
+ *
+ * A temporary directory is used for the WAA, the configuration and the
+ * data; it is removed afterwards.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <apr_pools.h>
+
+#include "global.h"
+#include "options.h"
+#include "actions.h"
+#include "helper.h"
+#include "est_ops.h"
+#include "checksum.h"
+#include "ignore.h"
+#include "direnum.h"
+#include "waa.h"
+
+
+extern char **environ;
+
+
+/** The number of entries to use for the tree based kernels. */
+static int mb___entries=100000;
+/** The minimum time per kernel, in nanoseconds. */
+static t_ull mb___min_ns=500000000ULL;
+/** The temporary base directory. */
+static char mb___base[PATH_MAX];
+/** The root of the synthetic entry tree. */
+static struct estat mb___root;
+/** All other entries of the tree; the first \c mb___dir_count are
+ * directories. */
+static struct estat *mb___tree;
+static int mb___dir_count;
+
+
+static t_ull mb___now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+
+static void mb___report(const char *name, t_ull ops, t_ull bytes,
+		t_ull ns)
+{
+	if (!ops) ops=1;
+	if (!ns) ns=1;
+
+	printf("%-24s %11llu ops %12.1f ns/op", name, ops, (double)ns/ops);
+	if (bytes)
+		printf(" %15.0f bytes/s", bytes*1e9/ns);
+	printf("\n");
+	fflush(stdout);
+}
+
+
+/** Pseudo-random data, so that the results are reproducible. */
+static void mb___fill(unsigned char *data, size_t len, uint32_t seed)
+{
+	size_t i;
+
+	for(i=0; i<len; i++)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		data[i]=seed;
+	}
+}
+
+
+static int mb___write_file(const char *name, size_t len, uint32_t seed)
+{
+	int status, fh;
+	unsigned char *data;
+
+	data=NULL;
+	fh=-1;
+	STOPIF( hlp__alloc( &data, len), NULL);
+	mb___fill(data, len, seed);
+
+	fh=open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	STOPIF_CODE_ERR( fh<0, errno, "creating %s", name);
+	STOPIF_CODE_ERR( write(fh, data, len) != len, errno, "writing %s", name);
+	status=0;
+
+ex:
+	if (fh>=0) close(fh);
+	IF_FREE(data);
+	return status;
+}
+
+
+/** Builds a tree of \c mb___entries entries below \c mb___root; names,
+ * extensions and depth are loosely modelled after a source tree. */
+static int mb___make_tree(void)
+{
+	static const char *ext[]= { ".c", ".h", ".o", ".txt", "~",
+		".swp", ".html", "" };
+	int status, i, fanout;
+	struct estat *sts;
+	char name[32];
+
+
+	status=0;
+	if (mb___tree) goto ex;
+
+	memset(&mb___root, 0, sizeof(mb___root));
+	mb___root.name=".";
+	mb___root.st.mode=S_IFDIR | 0755;
+
+	/* One directory per 20 entries; each directory has 8 subdirectories,
+	 * so the depth grows logarithmically. */
+	mb___dir_count=mb___entries/20;
+	fanout=8;
+	STOPIF( hlp__calloc( &mb___tree, mb___entries, sizeof(*mb___tree)),
+			NULL);
+
+	for(i=0; i<mb___entries; i++)
+	{
+		sts=mb___tree+i;
+		if (i<mb___dir_count)
+		{
+			sprintf(name, "dir%03d", i % 1000);
+			sts->st.mode=S_IFDIR | 0755;
+			sts->parent= i<fanout ? &mb___root : mb___tree + (i/fanout - 1);
+		}
+		else
+		{
+			sprintf(name, "file%05d%s", i, ext[i % (sizeof(ext)/sizeof(ext[0]))]);
+			sts->st.mode=S_IFREG | 0644;
+			sts->parent= mb___dir_count ?
+				mb___tree + (i % mb___dir_count) : &mb___root;
+		}
+
+		STOPIF( hlp__strdup( &sts->name, name), NULL);
+		sts->st.size=i*37;
+		sts->st.ino=i+100;
+		sts->st.dev=0x801;
+		sts->st.mtim.tv_sec=sts->st.ctim.tv_sec=1234567890+i;
+		sts->repos_rev=i % 1000 + 1;
+		mb___fill(sts->md5, sizeof(sts->md5), i+1);
+	}
+
+ex:
+	return status;
+}
+
+
+/** \c cs___end_of_block(), via cs__manber_blocks(), on a memory buffer. */
+static int mb___manber(void)
+{
+	int status;
+	size_t len;
+	unsigned char *data;
+	unsigned blocks;
+	t_ull start, ns, ops, bytes;
+
+
+	data=NULL;
+	len=64*1024*1024;
+	STOPIF( hlp__alloc( &data, len), NULL);
+	mb___fill(data, len, 1);
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		STOPIF( cs__manber_blocks(data, len, &blocks), NULL);
+		ops+=blocks;
+		bytes+=len;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("manber (per block)", ops, bytes, ns);
+
+ex:
+	IF_FREE(data);
+	return status;
+}
+
+
+/** Runs cs__compare_file() over \a count files named \a fmt, of \a size
+ * bytes each. */
+static int mb___compare_set(const char *title, const char *fmt,
+		int count, size_t size)
+{
+	int status, i, result;
+	struct estat *files;
+	char name[32];
+	t_ull start, ns, ops, bytes;
+
+
+	files=NULL;
+	STOPIF( hlp__calloc( &files, count, sizeof(*files)), NULL);
+
+	for(i=0; i<count; i++)
+	{
+		sprintf(name, fmt, i);
+		STOPIF( mb___write_file(name, size, i+1), NULL);
+
+		STOPIF( hlp__strdup( &files[i].name, name), NULL);
+		files[i].parent=&mb___root;
+		STOPIF( hlp__lstat(name, &files[i].st), NULL);
+	}
+
+	/* The first round gets the data into the page cache, and the MD5s
+	 * into the entries. */
+	for(i=0; i<count; i++)
+		STOPIF( cs__compare_file(files+i, NULL, &result), NULL);
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		for(i=0; i<count; i++)
+		{
+			files[i].change_flag=CF_UNKNOWN;
+			STOPIF( cs__compare_file(files+i, NULL, &result), NULL);
+			BUG_ON(result, "%s changed?", files[i].name);
+		}
+		ops+=count;
+		bytes+=count*size;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report(title, ops, bytes, ns);
+
+ex:
+	return status;
+}
+
+
+/** \c cs__compare_file() on small files, and on files that are large
+ * enough to be checked against (here not existing) manber hashes. */
+static int mb___compare(void)
+{
+	int status;
+
+	STOPIF( mb___compare_set("compare_file 4k", "small-%04d",
+				2000, 4096), NULL);
+	STOPIF( mb___compare_set("compare_file 4M", "large-%02d",
+				16, 4*1024*1024), NULL);
+
+ex:
+	return status;
+}
+
+
+/** \c ops__save_1entry() into a file, and \c ops__load_1entry() out of
+ * memory, like in \c waa__output_tree() and \c waa__input_tree(). */
+static int mb___dirfile(void)
+{
+	int status, fh, i, n;
+	char *data, *pos, *end, *filename;
+	struct estat sts;
+	ino_t parent;
+	off_t len;
+	t_ull start, ns, ops, bytes;
+
+
+	fh=-1;
+	data=NULL;
+	STOPIF( mb___make_tree(), NULL);
+
+	fh=open("dir-file", O_RDWR | O_CREAT | O_TRUNC, 0644);
+	STOPIF_CODE_ERR( fh<0, errno, "creating the dir-file");
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		STOPIF_CODE_ERR( lseek(fh, 0, SEEK_SET) == -1 ||
+				ftruncate(fh, 0) == -1, errno, "truncating the dir-file");
+
+		/* Only files; directories would count their children. */
+		for(i=mb___dir_count; i<mb___entries; i++)
+			STOPIF( ops__save_1entry(mb___tree+i, i/100+1, fh), NULL);
+
+		len=lseek(fh, 0, SEEK_CUR);
+		ops+=mb___entries-mb___dir_count;
+		bytes+=len;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("save_1entry", ops, bytes, ns);
+
+
+	data=mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fh, 0);
+	STOPIF_CODE_ERR( data == MAP_FAILED, errno, "mapping the dir-file");
+	end=data+len;
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		pos=data;
+		n=0;
+		while (pos < end)
+		{
+			memset(&sts, 0, sizeof(sts));
+			STOPIF( ops__load_1entry(&pos, &sts, &filename, &parent), NULL);
+			n++;
+		}
+		BUG_ON(n != mb___entries-mb___dir_count, "got %d entries", n);
+
+		ops+=n;
+		bytes+=len;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("load_1entry", ops, bytes, ns);
+
+ex:
+	if (data && data != MAP_FAILED) munmap(data, len);
+	if (fh>=0) close(fh);
+	return status;
+}
+
+
+/** \c ign__is_ignore() with a pattern set like found on a typical
+ * system; most entries match nothing, so they get tested against all
+ * patterns. */
+static int mb___ignore(void)
+{
+	static const char *patterns[]= {
+		"./**.o",
+		"./**~",
+		"./**/.*.swp",
+		"PCRE:./.*\\.(bak|orig|rej)$",
+		"dironly,./**/CVS",
+		"dironly,./**/.git",
+		"insens,./**.tmp",
+		"./dir001/dir00[0-9]/**.html",
+		"take,./dir002/**",
+		"./var/cache/**",
+		"./var/tmp/**",
+		"./proc",
+		"./sys",
+		"PCRE:.*/core(\\.[0-9]+)?$",
+		"mode:0111:0111,./**.sh",
+		"./**/*.pyc",
+	};
+	int status, i, count, ignored, is_ign;
+	char *copy[sizeof(patterns)/sizeof(patterns[0])];
+	char *path;
+	t_ull start, ns, ops, bytes, path_bytes;
+
+
+	STOPIF( mb___make_tree(), NULL);
+
+	count=sizeof(patterns)/sizeof(patterns[0]);
+	for(i=0; i<count; i++)
+		STOPIF( hlp__strdup( copy+i, patterns[i]), NULL);
+	STOPIF( ign__new_pattern(count, copy, NULL, 1, PATTERN_POSITION_END),
+			NULL);
+
+	/* The paths are cached, like during a normal run. */
+	path_bytes=0;
+	for(i=0; i<mb___entries; i++)
+	{
+		STOPIF( ops__build_path(&path, mb___tree+i), NULL);
+		path_bytes+=strlen(path);
+	}
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		ignored=0;
+		for(i=0; i<mb___entries; i++)
+		{
+			STOPIF( ign__is_ignore(mb___tree+i, &is_ign), NULL);
+			if (is_ign>0) ignored++;
+		}
+		ops+=mb___entries;
+		bytes+=path_bytes;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("is_ignore", ops, bytes, ns);
+	DEBUGP("%d of %d ignored", ignored, mb___entries);
+
+ex:
+	return status;
+}
+
+
+/** \c dir__enumerator() on a directory with \c mb___entries files. */
+static int mb___direnum(void)
+{
+	int status, i, fh;
+	char name[32];
+	struct estat *dir;
+	t_ull start, ns, ops;
+
+
+	dir=NULL;
+	STOPIF_CODE_ERR( mkdir("large-dir", 0755) == -1, errno,
+			"mkdir large-dir");
+	STOPIF_CODE_ERR( chdir("large-dir") == -1, errno, "chdir large-dir");
+
+	for(i=0; i<mb___entries; i++)
+	{
+		sprintf(name, "entry-%06d", i);
+		fh=open(name, O_WRONLY | O_CREAT, 0644);
+		STOPIF_CODE_ERR( fh<0, errno, "creating %s", name);
+		close(fh);
+	}
+
+	ops=0;
+	start=mb___now();
+	do
+	{
+		STOPIF( ops__allocate(1, &dir, NULL), NULL);
+		dir->name=".";
+		dir->st.mode=S_IFDIR | 0755;
+
+		STOPIF( dir__enumerator(dir, mb___entries, 1), NULL);
+		BUG_ON(dir->entry_count != mb___entries,
+				"got %d entries", dir->entry_count);
+
+		STOPIF( ops__free_entry(&dir), NULL);
+		ops+=mb___entries;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("dir__enumerator (entry)", ops, 0, ns);
+
+ex:
+	if (chdir("..") == -1 && !status) status=errno;
+	return status;
+}
+
+
+/** \c ops__build_path(), once with the cached paths thrown away, and
+ * once with the cache in place. */
+static int mb___build_path(void)
+{
+	int status, i;
+	char *path;
+	t_ull start, ns, ops, bytes;
+
+
+	STOPIF( mb___make_tree(), NULL);
+
+	/* The arena memory isn't freed; so don't loop as long as for the
+	 * other kernels. */
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		mb___root.path=NULL;
+		for(i=0; i<mb___entries; i++)
+			mb___tree[i].path=NULL;
+
+		for(i=0; i<mb___entries; i++)
+		{
+			STOPIF( ops__build_path(&path, mb___tree+i), NULL);
+			bytes+=strlen(path);
+		}
+		ops+=mb___entries;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns/4 && ops < 16*mb___entries);
+
+	mb___report("build_path (uncached)", ops, bytes, ns);
+
+
+	ops=bytes=0;
+	start=mb___now();
+	do
+	{
+		for(i=0; i<mb___entries; i++)
+		{
+			STOPIF( ops__build_path(&path, mb___tree+i), NULL);
+			bytes+=strlen(path);
+		}
+		ops+=mb___entries;
+		ns=mb___now()-start;
+	} while (ns < mb___min_ns);
+
+	mb___report("build_path (cached)", ops, bytes, ns);
+
+ex:
+	return status;
+}
+
+
+struct mb___kernel_t {
+	const char *name;
+	int (*run)(void);
+};
+
+static const struct mb___kernel_t mb___kernels[]= {
+	{ "manber", mb___manber },
+	{ "compare", mb___compare },
+	{ "dirfile", mb___dirfile },
+	{ "ignore", mb___ignore },
+	{ "direnum", mb___direnum },
+	{ "build_path", mb___build_path },
+};
+#define MB___KERNEL_COUNT (sizeof(mb___kernels)/sizeof(mb___kernels[0]))
+
+
+/** Creates the WAA, configuration and working copy directories, and
+ * initializes fsvs as for a \c status run in that working copy. */
+static int mb___setup(void)
+{
+	int status;
+	char *cp;
+	static const char *subdirs[]= { "waa", "conf", "wc" };
+	int i;
+
+
+	cp=getenv("TMPDIR");
+	snprintf(mb___base, sizeof(mb___base), "%s/fsvs-mb.XXXXXX",
+			cp ? cp : "/tmp");
+	STOPIF_CODE_ERR( !mkdtemp(mb___base), errno,
+			"creating a temporary directory");
+
+	for(i=0; i<3; i++)
+	{
+		STOPIF( hlp__strmnalloc(PATH_MAX, &cp,
+					mb___base, "/", subdirs[i], NULL), NULL);
+		STOPIF_CODE_ERR( mkdir(cp, 0700) == -1, errno, "mkdir %s", cp);
+		if (i == 0) setenv("FSVS_WAA", cp, 1);
+		if (i == 1) setenv("FSVS_CONF", cp, 1);
+		if (i == 2) wc_path=cp;
+	}
+	wc_path_len=strlen(wc_path);
+
+	STOPIF( apr_initialize(), "apr_initialize");
+	STOPIF( apr_pool_create_ex(&global_pool, NULL, NULL, NULL),
+			"create an apr_pool");
+
+	STOPIF( opt__load_env(environ), NULL);
+	STOPIF( act__find_action_by_name("status", &action), NULL);
+	STOPIF( waa__init(), NULL);
+
+	STOPIF_CODE_ERR( chdir(wc_path) == -1, errno, "chdir %s", wc_path);
+
+	memset(&mb___root, 0, sizeof(mb___root));
+	mb___root.name=".";
+	mb___root.st.mode=S_IFDIR | 0755;
+
+ex:
+	return status;
+}
+
+
+static void mb___cleanup(void)
+{
+	char cmd[PATH_MAX+20];
+
+	if (!mb___base[0]) return;
+
+	if (chdir("/") == 0)
+	{
+		snprintf(cmd, sizeof(cmd), "rm -rf '%s'", mb___base);
+		if (system(cmd))
+			fprintf(stderr, "Cannot remove %s\n", mb___base);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	int status, i, k, opt;
+
+
+	while ( (opt=getopt(argc, argv, "n:t:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				mb___entries=atoi(optarg);
+				break;
+			case 't':
+				mb___min_ns=strtod(optarg, NULL)*1e9;
+				break;
+			default:
+				fprintf(stderr,
+						"Usage: %s [-n entries] [-t seconds] [kernel ...]\n"
+						"Kernels:", argv[0]);
+				for(k=0; k<MB___KERNEL_COUNT; k++)
+					fprintf(stderr, " %s", mb___kernels[k].name);
+				fprintf(stderr, "\n");
+				return 1;
+		}
+	}
+
+	if (mb___entries < 100) mb___entries=100;
+
+	STOPIF( mb___setup(), NULL);
+
+	for(k=0; k<MB___KERNEL_COUNT; k++)
+	{
+		if (optind < argc)
+		{
+			for(i=optind; i<argc; i++)
+				if (strcmp(argv[i], mb___kernels[k].name) == 0) break;
+			if (i == argc) continue;
+		}
+
+		STOPIF( mb___kernels[k].run(),
+				"kernel %s failed", mb___kernels[k].name);
+	}
+
+ex:
+	mb___cleanup();
+	return status;
+}